@@ -8,6 +8,9 @@
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
+#include "iot/rule_engine.h"
+#include "audio_packet_pool.h"
+#include "assets.h"
 #include "assets/lang_config.h"
 
 #include <cstring>
@@ -16,6 +19,8 @@
 #include <driver/gpio.h>
 #include <arpa/inet.h>
 #include <esp_app_desc.h>
+#include <esp_random.h>
+#include <algorithm>
 
 #define TAG "Application"
 
@@ -49,6 +54,18 @@ Application::Application() {
         .skip_unhandled_events = true
     };
     esp_timer_create(&clock_timer_args, &clock_timer_handle_);
+
+    esp_timer_create_args_t iot_state_timer_args = {
+        .callback = [](void* arg) {
+            Application* app = (Application*)arg;
+            app->OnIotStateTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "iot_state_timer",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&iot_state_timer_args, &iot_state_timer_handle_);
 }
 
 Application::~Application() {
@@ -56,6 +73,10 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
+    if (iot_state_timer_handle_ != nullptr) {
+        esp_timer_stop(iot_state_timer_handle_);
+        esp_timer_delete(iot_state_timer_handle_);
+    }
     if (background_task_ != nullptr) {
         delete background_task_;
     }
@@ -68,22 +89,20 @@ void Application::CheckNewVersion() {
     // Check if there is a new firmware version available
     ota_.SetPostData(board.GetJson());
 
-    const int MAX_RETRY = 10;
-    int retry_count = 0;
-
+    // The device is already usable with the settings cached by the last check, so keep trying with backoff
+    int delay_ms = OTA_CHECK_MIN_DELAY_MS;
     while (true) {
         if (!ota_.CheckVersion()) {
-            retry_count++;
-            if (retry_count >= MAX_RETRY) {
-                ESP_LOGE(TAG, "Too many retries, exit version check");
-                return;
-            }
-            ESP_LOGW(TAG, "Check new version failed, retry in %d seconds (%d/%d)", 60, retry_count, MAX_RETRY);
-            vTaskDelay(pdMS_TO_TICKS(60000));
+            int jitter_ms = esp_random() % (delay_ms / 2 + 1);
+            ESP_LOGW(TAG, "Check new version failed, retry in %d ms", delay_ms + jitter_ms);
+            vTaskDelay(pdMS_TO_TICKS(delay_ms + jitter_ms));
+            delay_ms = std::min(delay_ms * 2, OTA_CHECK_MAX_DELAY_MS);
             continue;
         }
-        retry_count = 0;
+        delay_ms = OTA_CHECK_MIN_DELAY_MS;
+        ESP_LOGI(TAG, "Version checked %lld ms after boot", esp_timer_get_time() / 1000);
 
+#if !CONFIG_OTA_BACKGROUND_UPGRADE
         if (ota_.HasNewVersion()) {
             Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
             // Wait for the chat state to be idle
@@ -117,24 +136,28 @@ void Application::CheckNewVersion() {
                 background_task_ = nullptr;
                 vTaskDelay(pdMS_TO_TICKS(1000));
 
-                ota_.StartUpgrade([display](int progress, size_t speed) {
+                bool upgraded = ota_.StartUpgrade([display](int progress, size_t speed) {
                     char buffer[64];
                     snprintf(buffer, sizeof(buffer), "%d%% %zuKB/s", progress, speed / 1024);
                     // display->SetChatMessage("system", buffer);
                     display->ShowNotification(buffer);
                 });
 
-                // If upgrade success, the device will reboot and never reach here
-                display->ShowNotification(Lang::Strings::UPGRADE_FAILED);
-                ESP_LOGI(TAG, "Firmware upgrade failed...");
+                if (upgraded) {
+                    ESP_LOGI(TAG, "Firmware upgrade successful, rebooting in 3 seconds...");
+                } else {
+                    display->ShowNotification(Lang::Strings::UPGRADE_FAILED);
+                    ESP_LOGI(TAG, "Firmware upgrade failed...");
+                }
                 vTaskDelay(pdMS_TO_TICKS(3000));
                 Reboot();
             });
 
             return;
         }
+#endif
 
-        // No new version, mark the current version as valid
+        // No new version, or it is downloaded in the background while this one keeps running
         ota_.MarkCurrentVersionValid();
         std::string message = std::string(Lang::Strings::VERSION) + ota_.GetCurrentVersion();
         display->ShowNotification(message.c_str());
@@ -159,16 +182,112 @@ void Application::CheckNewVersion() {
             continue;
         }
 
-        SetDeviceState(kDeviceStateIdle);
-        display->SetQrHide(true,nullptr);
-        display->SetFaceHide(false);
-        display->SetChatMessage("system", "");
-        PlaySound(Lang::Sounds::P3_SUCCESS);
+        // Only leave the activation screen, a session started before the check finished is not interrupted
+        if (device_state_ == kDeviceStateActivating || device_state_ == kDeviceStateIdle) {
+            SetDeviceState(kDeviceStateIdle);
+            display->SetQrHide(true,nullptr);
+            display->SetFaceHide(false);
+            display->SetChatMessage("system", "");
+            PlaySound(Lang::Sounds::P3_SUCCESS);
+        }
         // Exit the loop if upgrade or idle
         break;
     }
+
+#if CONFIG_OTA_BACKGROUND_UPGRADE
+    if (ota_.HasNewVersion()) {
+        BackgroundUpgrade();
+    }
+#endif
+#if CONFIG_USE_ASSETS_PARTITION
+    // Both use the inactive partition, new firmware checks the resource pack again after the reboot
+    if (!ota_.HasNewVersion() && ota_.GetAssetsVersion() > (int)Assets::GetInstance().version()) {
+        UpgradeAssets();
+    }
+#endif
+#if CONFIG_USE_WAKE_WORD_DETECT
+    // One staged download at a time, the models are checked again after the next reboot
+    if (!ota_.HasNewVersion() && !upgrade_ready_ && !ota_.GetModelVersion().empty() &&
+        ota_.GetModelVersion() != ModelUpdate::GetVersion()) {
+        UpgradeModel();
+    }
+#endif
 }
 
+// Runs the download at low priority while the device keeps working,
+// throttled during voice sessions, see SetDeviceState
+bool Application::DownloadInBackground(std::function<bool()> download) {
+    vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+    int start_underruns = audio_underruns_;
+    ota_.SetBackground(true);
+    background_upgrading_ = true;
+    ota_.SetRateLimit(device_state_ == kDeviceStateIdle ? 0 : OTA_BACKGROUND_SESSION_RATE);
+    bool success = download();
+    background_upgrading_ = false;
+    ota_.SetRateLimit(0);
+    ESP_LOGI(TAG, "Background download %s, %d audio underruns during the download", success ? "finished" : "failed",
+        audio_underruns_ - start_underruns);
+    return success;
+}
+
+// Downloads the new version into the inactive partition while the device keeps working
+void Application::BackgroundUpgrade() {
+    ESP_LOGI(TAG, "Downloading version %s in the background", ota_.GetFirmwareVersion().c_str());
+    if (!DownloadInBackground([this]() { return ota_.StartUpgrade(nullptr); })) {
+        return;
+    }
+
+    // Reboot once the device has been idle for a while, see OnClockTimer
+    upgrade_ready_ = true;
+    Schedule([this]() {
+        std::string message = std::string(Lang::Strings::NEW_VERSION) + ota_.GetFirmwareVersion() + Lang::Strings::UPGRADE_READY;
+        Board::GetInstance().GetDisplay()->ShowNotification(message.c_str());
+    });
+}
+
+// The resource pack is staged like a firmware download and installed by Assets on the next boot
+void Application::UpgradeAssets() {
+    ESP_LOGI(TAG, "Downloading resource pack version %d, installed version %lu", ota_.GetAssetsVersion(),
+        Assets::GetInstance().version());
+    bool staged = DownloadInBackground([this]() {
+        const esp_partition_t* partition = nullptr;
+        size_t size = 0;
+        return ota_.DownloadAssets(partition, size) && Assets::Stage(partition, size);
+    });
+    if (!staged) {
+        return;
+    }
+
+    upgrade_ready_ = true;
+    Schedule([]() {
+        std::string message = std::string(Lang::Strings::OTA_UPGRADE) + Lang::Strings::UPGRADE_READY;
+        Board::GetInstance().GetDisplay()->ShowNotification(message.c_str());
+    });
+}
+
+#if CONFIG_USE_WAKE_WORD_DETECT
+// The models are staged like a resource pack and installed by ModelUpdate on the next boot
+void Application::UpgradeModel() {
+    ESP_LOGI(TAG, "Downloading models %s, installed version %s", ota_.GetModelVersion().c_str(),
+        ModelUpdate::GetVersion().c_str());
+    bool staged = DownloadInBackground([this]() {
+        const esp_partition_t* partition = nullptr;
+        size_t size = 0;
+        return ota_.DownloadModel(partition, size) &&
+            ModelUpdate::Stage(partition, size, ota_.GetModelSha256(), ota_.GetModelVersion());
+    });
+    if (!staged) {
+        return;
+    }
+
+    upgrade_ready_ = true;
+    Schedule([]() {
+        std::string message = std::string(Lang::Strings::OTA_UPGRADE) + Lang::Strings::UPGRADE_READY;
+        Board::GetInstance().GetDisplay()->ShowNotification(message.c_str());
+    });
+}
+#endif
+
 void Application::ShowActivationCode() {
     auto& message = ota_.GetActivationMessage();
     auto& code = ota_.GetActivationCode();
@@ -229,7 +348,7 @@ void Application::DismissAlert() {
 void Application::PlaySound(const std::string_view& sound) {
     auto codec = Board::GetInstance().GetAudioCodec();
     codec->EnableOutput(true);
-    SetDecodeSampleRate(16000);
+    SetDecodeSampleRate(16000, P3_FRAME_DURATION_MS);
     const char* data = sound.data();
     size_t size = sound.size();
     for (const char* p = data; p < data + size; ) {
@@ -237,9 +356,7 @@ void Application::PlaySound(const std::string_view& sound) {
         p += sizeof(BinaryProtocol3);
 
         auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
+        auto opus = AudioPacket::View(p3->payload, payload_size);
         p += payload_size;
 
         std::lock_guard<std::mutex> lock(mutex_);
@@ -359,17 +476,18 @@ void Application::Start() {
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
     opus_decode_sample_rate_ = codec->output_sample_rate();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1, opus_decode_frame_duration_);
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, opus_encode_frame_duration_);
     // For ML307 boards, we use complexity 5 to save bandwidth
     // For other boards, we use complexity 3 to save CPU
     if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        opus_encode_complexity_ = 5;
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
-        opus_encoder_->SetComplexity(3);
+        opus_encode_complexity_ = 3;
     }
+    opus_encoder_->SetComplexity(opus_encode_complexity_);
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -408,10 +526,10 @@ void Application::Start() {
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
+    protocol_->OnIncomingAudio([this](AudioPacket&& packet) {
         std::lock_guard<std::mutex> lock(mutex_);
         if (device_state_ == kDeviceStateSpeaking) {
-            audio_decode_queue_.emplace_back(std::move(data));
+            audio_decode_queue_.emplace_back(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -420,9 +538,14 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
-        SetDecodeSampleRate(protocol_->server_sample_rate());
+        SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->frame_duration());
+        SetEncodeFrameDuration(protocol_->frame_duration());
         auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
+        if (protocol_->iot_descriptors_unchanged()) {
+            ESP_LOGI(TAG, "Server has the IoT descriptors %s, skip upload", thing_manager.GetDescriptorsHash().c_str());
+        } else {
+            protocol_->SendIotDescriptors(thing_manager.GetDescriptors());
+        }
         std::string states;
         if (thing_manager.GetStatesJson(states, false)) {
             protocol_->SendIotStates(states);
@@ -436,66 +559,104 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        background_task_->WaitForCompletion();
-                        if (keep_listening_) {
-                            protocol_->SendStartListening(kListeningModeAutoStop);
-                            SetDeviceState(kDeviceStateListening);
-                        } else {
-                            SetDeviceState(kDeviceStateIdle);
-                        }
+    message_dispatcher_.Register("tts", [this, display](const IncomingMessage& message) {
+        auto state = message.GetRaw("state");
+        if (state == "start") {
+            Schedule([this]() {
+                aborted_ = false;
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                    SetDeviceState(kDeviceStateSpeaking);
+                }
+            });
+        } else if (state == "stop") {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    background_task_->WaitForCompletion();
+                    if (keep_listening_) {
+                        protocol_->SendStartListening(kListeningModeAutoStop);
+                        SetDeviceState(kDeviceStateListening);
+                    } else {
+                        SetDeviceState(kDeviceStateIdle);
                     }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
                 }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                    display->SetFace(emotion_str.c_str());
+            });
+        } else if (state == "sentence_start") {
+            if (message.Has("text")) {
+                auto text = message.GetString("text");
+                ESP_LOGI(TAG, "<< %s", text.c_str());
+                Schedule([this, display, message = std::move(text)]() {
+                    display->SetChatMessage("assistant", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (commands != NULL) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
-                }
-            }
         }
     });
+    message_dispatcher_.Register("stt", [this, display](const IncomingMessage& message) {
+        if (message.Has("text")) {
+            auto text = message.GetString("text");
+            ESP_LOGI(TAG, ">> %s", text.c_str());
+            Schedule([this, display, message = std::move(text)]() {
+                display->SetChatMessage("user", message.c_str());
+            });
+        }
+    });
+    message_dispatcher_.Register("llm", [this, display](const IncomingMessage& message) {
+        if (message.Has("emotion")) {
+            Schedule([this, display, emotion_str = message.GetString("emotion")]() {
+                display->SetEmotion(emotion_str.c_str());
+                display->SetFace(emotion_str.c_str());
+            });
+        }
+    });
+    message_dispatcher_.Register("iot", [this](const IncomingMessage& message) {
+        // Commands are handed to the things as cJSON, only these parts of the message are converted,
+        // from JSON or MessagePack alike
+        if (message.Has("rules")) {
+            // Rules are evaluated on the main loop, replace them there too. The server hears back how
+            // many were installed, a payload that is not an array leaves the current rules in place
+            Schedule([this, rules = message.GetCJson("rules")]() {
+                int total = cJSON_IsArray(rules) ? cJSON_GetArraySize(rules) : 0;
+                int installed = iot::RuleEngine::GetInstance().Install(rules);
+                cJSON_Delete(rules);
+                const char* result = installed < 0 ? "invalid_rules" : installed < total ? "partial" : "ok";
+                protocol_->SendIotRulesAck(result, installed < 0 ? 0 : installed, total);
+            });
+        }
+        if (!message.Has("commands")) {
+            return;
+        }
+        auto commands = message.GetCJson("commands");
+        if (commands == nullptr) {
+            ESP_LOGE(TAG, "Failed to parse IoT commands");
+            return;
+        }
+        auto& thing_manager = iot::ThingManager::GetInstance();
+        for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
+            auto command = cJSON_GetArrayItem(commands, i);
+            thing_manager.Invoke(command);
+        }
+        cJSON_Delete(commands);
+    });
+    // Commands run on the IoT worker, acks are sent from the main loop like every other message
+    iot::ThingManager::GetInstance().OnCommandAck([this](const iot::IotCommandAck& ack) {
+        Schedule([this, ack]() {
+            protocol_->SendIotAck(ack.id, iot::InvokeResultToString(ack.result), ack.queue_ms, ack.exec_ms);
+        });
+    });
+    iot::ThingManager::GetInstance().OnStateChanged([this]() {
+        NotifyIotStateChanged();
+    });
+    iot::ThingManager::GetInstance().OnMainLoop([this](std::function<void()> callback) {
+        Schedule(std::move(callback));
+    });
+    protocol_->OnIncomingJson([this](const IncomingMessage& message) {
+        if (!message_dispatcher_.Dispatch(message)) {
+            auto type = message.type();
+            ESP_LOGW(TAG, "Unhandled message type: %.*s", (int)type.size(), type.data());
+        }
+    });
+    iot::RuleEngine::GetInstance().Load();
+    // Let the server skip the descriptor upload when it already knows this set of things
+    protocol_->SetIotDescriptorsHash(iot::ThingManager::GetInstance().GetDescriptorsHash());
     protocol_->Start();
 
     // Check for new firmware version or get the MQTT broker address
@@ -517,16 +678,18 @@ void Application::Start() {
     audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
         background_task_->Schedule([this, data = std::move(data)]() mutable {
             opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+                QueueOutgoingAudio(opus);
             });
         });
     });
 #endif
 
 #if CONFIG_USE_WAKE_WORD_DETECT
-    wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
+    // Before the models are loaded, a staged update replaces them
+    bool models_ready = ModelUpdate::InstallStaged();
+    if (models_ready) {
+        wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
+    }
     wake_word_detect_.OnVadStateChange([this](bool speaking) {
         Schedule([this, speaking]() {
             if (device_state_ == kDeviceStateListening) {
@@ -545,17 +708,19 @@ void Application::Start() {
         Schedule([this, &wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
                 SetDeviceState(kDeviceStateConnecting);
-                wake_word_detect_.EncodeWakeWordData();
 
                 if (!protocol_->OpenAudioChannel()) {
                     wake_word_detect_.StartDetection();
                     return;
                 }
-                
+
+                // Encoded with the frame duration the server accepted in this session's hello,
+                // packets are sent as soon as they are encoded
+                wake_word_detect_.EncodeWakeWordData(protocol_->frame_duration());
                 std::vector<uint8_t> opus;
                 // Encode and send the wake word data to the server
                 while (wake_word_detect_.GetWakeWordOpus(opus)) {
-                    protocol_->SendAudio(opus);
+                    protocol_->SendAudio(opus.data(), opus.size());
                 }
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
@@ -574,22 +739,49 @@ void Application::Start() {
             wake_word_detect_.StartDetection();
         });
     });
-    wake_word_detect_.StartDetection();
+    if (models_ready) {
+        wake_word_detect_.StartDetection();
+    } else {
+        ESP_LOGW(TAG, "Wake word detection is disabled until the models are installed");
+    }
 #endif
 
     SetDeviceState(kDeviceStateIdle);
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    ESP_LOGI(TAG, "Ready %lld ms after boot, server time %s", esp_timer_get_time() / 1000,
+        ota_.HasServerTime() ? "available" : "pending");
 }
 
 void Application::OnClockTimer() {
     clock_ticks_++;
 
+    // Only a fallback for properties of board-specific things that never notify
+    if (clock_ticks_ % IOT_STATE_POLL_SECONDS == 0) {
+        NotifyIotStateChanged();
+    }
+
+    // clock_ticks_ restarts on every state change, so this is the time spent idle
+    if (upgrade_ready_ && device_state_ == kDeviceStateIdle && clock_ticks_ >= OTA_REBOOT_IDLE_SECONDS) {
+        upgrade_ready_ = false;
+        Schedule([this]() {
+            if (device_state_ != kDeviceStateIdle) {
+                upgrade_ready_ = true;
+                return;
+            }
+            ESP_LOGI(TAG, "Rebooting to apply the downloaded update");
+            Board::GetInstance().GetDisplay()->ShowNotification(Lang::Strings::UPGRADING);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            Reboot();
+        });
+    }
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintRealTimeStats(pdMS_TO_TICKS(1000));
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
         ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        AudioPacketPool::GetInstance().PrintStats();
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -644,6 +836,7 @@ void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
     opus_decoder_->ResetState();
     audio_decode_queue_.clear();
+    output_starved_ = false;
     last_output_time_ = std::chrono::steady_clock::now();
 }
 
@@ -654,6 +847,10 @@ void Application::OutputAudio() {
 
     std::unique_lock<std::mutex> lock(mutex_);
     if (audio_decode_queue_.empty()) {
+        // Running dry while speaking is only an underrun if more audio follows, counted when it arrives
+        if (device_state_ == kDeviceStateSpeaking) {
+            output_starved_ = true;
+        }
         // Disable the output if there is no audio data for a long time
         if (device_state_ == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
@@ -669,18 +866,34 @@ void Application::OutputAudio() {
         return;
     }
 
+    if (output_starved_) {
+        output_starved_ = false;
+        audio_underruns_++;
+        speaking_underruns_++;
+    }
     last_output_time_ = now;
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
     lock.unlock();
 
-    background_task_->Schedule([this, codec, opus = std::move(opus)]() mutable {
+    // The packet handle cannot be captured (std::function needs a copyable callable), so the
+    // task takes the front packet itself. A queue cleared meanwhile leaves it nothing to do.
+    background_task_->Schedule([this, codec]() {
+        AudioPacket opus;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (audio_decode_queue_.empty()) {
+                return;
+            }
+            opus = std::move(audio_decode_queue_.front());
+            audio_decode_queue_.pop_front();
+        }
         if (aborted_) {
             return;
         }
 
+        opus_decode_buffer_.assign(opus.data(), opus.data() + opus.size());
+        opus = AudioPacket();
         std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        if (!opus_decoder_->Decode(std::move(opus_decode_buffer_), pcm)) {
             return;
         }
 
@@ -696,6 +909,44 @@ void Application::OutputAudio() {
     });
 }
 
+// Called on the background task with the encoder output. The packet waits in a pool slot until
+// the main loop sends it, so a stalled network drops audio instead of growing the task list.
+void Application::QueueOutgoingAudio(const std::vector<uint8_t>& opus) {
+    auto packet = AudioPacketPool::GetInstance().Acquire(opus.size());
+    if (!packet) {
+        return;
+    }
+    memcpy(packet.data(), opus.data(), opus.size());
+
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        schedule = audio_send_queue_.empty();
+        audio_send_queue_.emplace_back(std::move(packet));
+    }
+    // One scheduled call sends every packet queued before it runs
+    if (schedule) {
+        Schedule([this]() {
+            SendQueuedAudio();
+        });
+    }
+}
+
+void Application::SendQueuedAudio() {
+    while (true) {
+        AudioPacket packet;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (audio_send_queue_.empty()) {
+                return;
+            }
+            packet = std::move(audio_send_queue_.front());
+            audio_send_queue_.pop_front();
+        }
+        protocol_->SendAudio(packet.data(), packet.size());
+    }
+}
+
 void Application::InputAudio() {
     auto codec = Board::GetInstance().GetAudioCodec();
     std::vector<int16_t> data;
@@ -740,9 +991,7 @@ void Application::InputAudio() {
     if (device_state_ == kDeviceStateListening) {
         background_task_->Schedule([this, data = std::move(data)]() mutable {
             opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+                QueueOutgoingAudio(opus);
             });
         });
     }
@@ -767,6 +1016,16 @@ void Application::SetDeviceState(DeviceState state) {
     // The state is changed, wait for all background tasks to finish
     background_task_->WaitForCompletion();
 
+    if (previous_state == kDeviceStateSpeaking) {
+        ESP_LOGI(TAG, "Speaking finished with %d audio underruns%s", speaking_underruns_,
+            background_upgrading_ ? " during background upgrade" : "");
+        speaking_underruns_ = 0;
+    }
+    // A background download only gets the bandwidth the session leaves over
+    if (background_upgrading_) {
+        ota_.SetRateLimit(state == kDeviceStateIdle ? 0 : OTA_BACKGROUND_SESSION_RATE);
+    }
+
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
     auto display = board.GetDisplay();
@@ -818,14 +1077,15 @@ void Application::SetDeviceState(DeviceState state) {
     }
 }
 
-void Application::SetDecodeSampleRate(int sample_rate) {
-    if (opus_decode_sample_rate_ == sample_rate) {
+void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
+    if (opus_decode_sample_rate_ == sample_rate && opus_decode_frame_duration_ == frame_duration) {
         return;
     }
 
     opus_decode_sample_rate_ = sample_rate;
+    opus_decode_frame_duration_ = frame_duration;
     opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1, opus_decode_frame_duration_);
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
@@ -834,12 +1094,65 @@ void Application::SetDecodeSampleRate(int sample_rate) {
     }
 }
 
+void Application::SetEncodeFrameDuration(int frame_duration) {
+    if (opus_encode_frame_duration_ == frame_duration) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Opus encode frame duration %d ms -> %d ms", opus_encode_frame_duration_, frame_duration);
+    opus_encode_frame_duration_ = frame_duration;
+    // Make sure no encoding is in progress before replacing the encoder
+    background_task_->WaitForCompletion();
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, opus_encode_frame_duration_);
+    opus_encoder_->SetComplexity(opus_encode_complexity_);
+}
+
 void Application::UpdateIotStates() {
     auto& thing_manager = iot::ThingManager::GetInstance();
     std::string states;
     if (thing_manager.GetStatesJson(states, true)) {
         protocol_->SendIotStates(states);
+        last_iot_states_time_ = esp_timer_get_time();
+        iot_states_pushed_++;
+    }
+}
+
+// May be called from any task, the push itself runs on the main loop
+void Application::NotifyIotStateChanged() {
+    int64_t expected = 0;
+    auto now = esp_timer_get_time();
+    if (!iot_state_changed_time_.compare_exchange_strong(expected, now)) {
+        // A push is already pending and will include this change
+        return;
     }
+    int64_t delay = IOT_STATE_COALESCE_MS * 1000;
+    int64_t next_allowed = last_iot_states_time_ + IOT_STATE_MIN_INTERVAL_MS * 1000;
+    if (now + delay < next_allowed) {
+        delay = next_allowed - now;
+    }
+    esp_timer_start_once(iot_state_timer_handle_, delay);
+}
+
+void Application::OnIotStateTimer() {
+    Schedule([this]() {
+        auto changed_time = iot_state_changed_time_.exchange(0);
+        // Local rules react to changes whether or not a channel is open
+        iot::RuleEngine::GetInstance().Evaluate();
+        if (protocol_ == nullptr || !protocol_->IsAudioChannelOpened()) {
+            // The full states are sent when the next channel opens
+            return;
+        }
+        int pushed = iot_states_pushed_;
+        UpdateIotStates();
+        if (iot_states_pushed_ != pushed) {
+            auto staleness = esp_timer_get_time() - changed_time;
+            if (staleness > max_iot_states_staleness_) {
+                max_iot_states_staleness_ = staleness;
+            }
+            ESP_LOGI(TAG, "IoT states pushed %d times, staleness %lld ms (max %lld ms)", iot_states_pushed_,
+                staleness / 1000, max_iot_states_staleness_ / 1000);
+        }
+    });
 }
 
 void Application::Reboot() {
@@ -9,17 +9,21 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <deque>
+#include <atomic>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "protocol.h"
+#include "message_dispatcher.h"
 #include "ota.h"
 #include "background_task.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
+#include "model_update.h"
 #endif
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "audio_processor.h"
@@ -42,7 +46,23 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
-#define OPUS_FRAME_DURATION_MS 60
+// State changes within the window are pushed together, and never more often than the minimum interval
+#define IOT_STATE_COALESCE_MS 200
+#define IOT_STATE_MIN_INTERVAL_MS 1000
+// Volume, backlight and battery notify when they change, other properties are checked this often
+#define IOT_STATE_POLL_SECONDS 5
+
+// The version check runs in the background and backs off exponentially while the server cannot be reached
+#define OTA_CHECK_MIN_DELAY_MS 5000
+#define OTA_CHECK_MAX_DELAY_MS (10 * 60 * 1000)
+
+// A background upgrade is limited to this rate in bytes per second while a voice session is active,
+// and the device reboots into the new version after being idle for this long
+#define OTA_BACKGROUND_SESSION_RATE (8 * 1024)
+#define OTA_REBOOT_IDLE_SECONDS 30
+
+// The built-in P3 sounds are always encoded with 60ms frames
+#define P3_FRAME_DURATION_MS 60
 
 class Application {
 public:
@@ -68,8 +88,10 @@ public:
     void VolUp();
     void VolDown();
     void UpdateIotStates();
+    void NotifyIotStateChanged();
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
+    // The packets point into the sound, which must stay mapped until it has played (the embedded sounds do)
     void PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
 
@@ -87,23 +109,43 @@ private:
     std::mutex mutex_;
     std::list<std::function<void()>> main_tasks_;
     std::unique_ptr<Protocol> protocol_;
+    MessageDispatcher message_dispatcher_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
+    esp_timer_handle_t iot_state_timer_handle_ = nullptr;
+    // Time of the first change since the last push, 0 if no push is pending
+    std::atomic<int64_t> iot_state_changed_time_{0};
+    std::atomic<int64_t> last_iot_states_time_{0};
+    int iot_states_pushed_ = 0;
+    int64_t max_iot_states_staleness_ = 0;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     bool keep_listening_ = false;
     bool aborted_ = false;
     bool voice_detected_ = false;
     int clock_ticks_ = 0;
+    std::atomic<bool> background_upgrading_{false};
+    std::atomic<bool> upgrade_ready_{false};
 
     // Audio encode / decode
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
+    // Both queues hold pool handles, so they are bounded by the packet pool
+    std::deque<AudioPacket> audio_decode_queue_;
+    std::deque<AudioPacket> audio_send_queue_;
+    // The decoder wrapper takes a vector, this one keeps its capacity between packets
+    std::vector<uint8_t> opus_decode_buffer_;
+    // Gaps in the playback because the next packet had not arrived yet
+    bool output_starved_ = false;
+    std::atomic<int> audio_underruns_{0};
+    int speaking_underruns_ = 0;
 
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
 
     int opus_decode_sample_rate_ = -1;
+    int opus_decode_frame_duration_ = P3_FRAME_DURATION_MS;
+    int opus_encode_frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
+    int opus_encode_complexity_ = 3;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
@@ -112,10 +154,18 @@ private:
     void InputAudio();
     void OutputAudio();
     void ResetDecoder();
-    void SetDecodeSampleRate(int sample_rate);
+    void QueueOutgoingAudio(const std::vector<uint8_t>& opus);
+    void SendQueuedAudio();
+    void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void SetEncodeFrameDuration(int frame_duration);
     void CheckNewVersion();
+    bool DownloadInBackground(std::function<bool()> download);
+    void BackgroundUpgrade();
+    void UpgradeAssets();
+    void UpgradeModel();
     void ShowActivationCode();
     void OnClockTimer();
+    void OnIotStateTimer();
 };
 
 #endif // _APPLICATION_H_
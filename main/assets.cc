@@ -0,0 +1,198 @@
+#include "assets.h"
+#include "settings.h"
+#include "partition_utils.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+
+#include <cstring>
+#include <algorithm>
+
+#define TAG "Assets"
+
+static uint32_t ReadUint32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+Assets::Assets() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSETS_PARTITION_LABEL);
+    if (partition_ == nullptr) {
+        ESP_LOGW(TAG, "No %s partition", ASSETS_PARTITION_LABEL);
+        return;
+    }
+
+    if (!InstallStaged()) {
+        ESP_LOGE(TAG, "The %s partition holds an incomplete resource pack, not mapped", ASSETS_PARTITION_LABEL);
+        return;
+    }
+    auto start_time = esp_timer_get_time();
+    if (Map()) {
+        ESP_LOGI(TAG, "Version %lu, %lu entries, mapped in %lld us", version(), count_, esp_timer_get_time() - start_time);
+    }
+}
+
+Assets::~Assets() {
+    if (header_ != nullptr) {
+        esp_partition_munmap(mmap_handle_);
+    }
+}
+
+uint32_t Assets::version() const {
+    return header_ != nullptr ? ReadUint32(header_ + 4) : 0;
+}
+
+// Only the header is checked at boot, the hash was verified when the pack was installed
+bool Assets::Map() {
+    uint8_t header[ASSETS_HEADER_SIZE];
+    if (esp_partition_read(partition_, 0, header, sizeof(header)) != ESP_OK || memcmp(header, ASSETS_MAGIC, 4) != 0) {
+        ESP_LOGW(TAG, "No resource pack installed");
+        return false;
+    }
+    uint32_t count = ReadUint32(header + 8);
+    uint32_t size = ReadUint32(header + 12);
+    if (size > partition_->size || ASSETS_HEADER_SIZE + (size_t)count * ASSETS_ENTRY_SIZE > size) {
+        ESP_LOGE(TAG, "Invalid resource pack, %lu entries in %lu bytes", count, size);
+        return false;
+    }
+
+    const void* data = nullptr;
+    auto err = esp_partition_mmap(partition_, 0, size, ESP_PARTITION_MMAP_DATA, &data, &mmap_handle_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %lu bytes: %s", size, esp_err_to_name(err));
+        return false;
+    }
+    header_ = (const uint8_t*)data;
+    entries_ = (const Entry*)(header_ + ASSETS_HEADER_SIZE);
+    count_ = count;
+    images_.resize(count_, lv_img_dsc_t{});
+    return true;
+}
+
+const Assets::Entry* Assets::Find(const char* name) const {
+    if (header_ == nullptr) {
+        return nullptr;
+    }
+    auto end = entries_ + count_;
+    auto entry = std::lower_bound(entries_, end, name, [](const Entry& entry, const char* name) {
+        return strncmp(entry.name, name, ASSETS_NAME_SIZE) < 0;
+    });
+    if (entry == end || strncmp(entry->name, name, ASSETS_NAME_SIZE) != 0) {
+        return nullptr;
+    }
+    if (entry->offset + entry->size > ReadUint32(header_ + 12)) {
+        ESP_LOGE(TAG, "Entry %s is out of range", name);
+        return nullptr;
+    }
+    return entry;
+}
+
+const lv_img_dsc_t* Assets::GetImage(const char* name) {
+    auto entry = Find(name);
+    if (entry == nullptr || entry->color_format == 0) {
+        ESP_LOGE(TAG, "Image %s not found", name);
+        return nullptr;
+    }
+    // The pixels stay in flash, only the descriptor lives in RAM
+    auto& image = images_[entry - entries_];
+    if (image.data == nullptr) {
+        image.header.magic = LV_IMAGE_HEADER_MAGIC;
+        image.header.cf = entry->color_format;
+        image.header.w = entry->width;
+        image.header.h = entry->height;
+        image.data_size = entry->size;
+        image.data = header_ + entry->offset;
+    }
+    return &image;
+}
+
+bool Assets::GetData(const char* name, const void*& data, size_t& size) {
+    auto entry = Find(name);
+    if (entry == nullptr) {
+        return false;
+    }
+    data = header_ + entry->offset;
+    size = entry->size;
+    return true;
+}
+
+bool Assets::Verify(const esp_partition_t* partition, size_t size) {
+    uint8_t header[ASSETS_HEADER_SIZE];
+    if (size < ASSETS_HEADER_SIZE || esp_partition_read(partition, 0, header, sizeof(header)) != ESP_OK ||
+        memcmp(header, ASSETS_MAGIC, 4) != 0 || ReadUint32(header + 12) != size) {
+        ESP_LOGE(TAG, "No resource pack of %zu bytes in %s", size, partition->label);
+        return false;
+    }
+
+    uint8_t digest[32];
+    if (!PartitionUtils::Sha256(partition, ASSETS_HEADER_SIZE, size - ASSETS_HEADER_SIZE, digest) ||
+        memcmp(digest, header + 16, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Resource pack in %s is corrupted", partition->label);
+        return false;
+    }
+    return true;
+}
+
+bool Assets::Stage(const esp_partition_t* partition, size_t size) {
+    auto assets = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSETS_PARTITION_LABEL);
+    if (assets == nullptr || size > assets->size) {
+        ESP_LOGE(TAG, "Resource pack of %zu bytes does not fit the %s partition", size, ASSETS_PARTITION_LABEL);
+        return false;
+    }
+    if (!Verify(partition, size)) {
+        return false;
+    }
+    Settings settings("assets", true);
+    settings.SetString("staged", partition->label);
+    settings.SetInt("size", size);
+    ESP_LOGI(TAG, "Resource pack staged in %s, installed on the next boot", partition->label);
+    return true;
+}
+
+// The marker stays until the copy is verified, a copy interrupted by a power loss is done again on the
+// next boot. The header is copied last, so a partial copy has no header for Map to accept either.
+bool Assets::InstallStaged() {
+    std::string label;
+    size_t size;
+    bool installing;
+    {
+        Settings settings("assets", false);
+        label = settings.GetString("staged");
+        size = settings.GetInt("size");
+        installing = settings.GetInt("installing") != 0;
+    }
+    if (label.empty()) {
+        return !installing;
+    }
+
+    auto assets = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSETS_PARTITION_LABEL);
+    // The staging slot may have been taken by a firmware upgrade in the meantime
+    auto staged = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if (assets == nullptr || staged == nullptr || staged == esp_ota_get_running_partition() || size > assets->size ||
+        !Verify(staged, size)) {
+        ESP_LOGW(TAG, "Staged resource pack is no longer valid, discarded");
+        Settings settings("assets", true);
+        settings.EraseKey("staged");
+        settings.EraseKey("size");
+        if (installing) {
+            ESP_LOGE(TAG, "The %s partition holds an incomplete copy until a new pack is installed", ASSETS_PARTITION_LABEL);
+        }
+        return !installing;
+    }
+
+    // Committed before the partition is touched
+    {
+        Settings settings("assets", true);
+        settings.SetInt("installing", 1);
+    }
+    auto start_time = esp_timer_get_time();
+    auto err = PartitionUtils::Copy(staged, assets, size, ASSETS_HEADER_SIZE);
+    if (err != ESP_OK || !Verify(assets, size)) {
+        ESP_LOGE(TAG, "Failed to install resource pack: %s", esp_err_to_name(err));
+        return false;
+    }
+    Settings settings("assets", true);
+    settings.EraseAll();
+    ESP_LOGI(TAG, "Installed resource pack of %zu bytes in %lld ms", size, (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
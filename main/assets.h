@@ -0,0 +1,84 @@
+#ifndef _ASSETS_H
+#define _ASSETS_H
+
+#include <esp_partition.h>
+#include <lvgl.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Resource pack produced by scripts/pack_assets.py, all integers are little endian:
+//   header: "AST1", version (u32), entry count (u32), pack size (u32),
+//           SHA-256 of everything after the header (32 bytes), reserved (16 bytes)
+//   entries sorted by name: name (32 bytes, NUL padded), offset (u32), size (u32),
+//           color format (u8, 0 for raw data), reserved (u8), width (u16), height (u16), reserved (u16)
+//   then the data of each entry, 4 byte aligned
+#define ASSETS_MAGIC "AST1"
+#define ASSETS_HEADER_SIZE 64
+#define ASSETS_ENTRY_SIZE 48
+#define ASSETS_NAME_SIZE 32
+#define ASSETS_PARTITION_LABEL "assets"
+
+// Images come from the assets partition when it is enabled, otherwise they are compiled into the app
+#if CONFIG_USE_ASSETS_PARTITION
+#define RESOURCE_IMAGE(name) Assets::GetInstance().GetImage(#name)
+#else
+#define RESOURCE_IMAGE(name) (&name)
+#endif
+
+// Read-only view of the resource pack in the assets partition, mapped into the address space once at boot.
+// A new pack is downloaded into a staging partition and copied over the old one on the next boot.
+class Assets {
+public:
+    static Assets& GetInstance() {
+        static Assets instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    Assets(const Assets&) = delete;
+    Assets& operator=(const Assets&) = delete;
+
+    bool available() const { return header_ != nullptr; }
+    // 0 when no valid pack is installed
+    uint32_t version() const;
+
+    const lv_img_dsc_t* GetImage(const char* name);
+    bool GetData(const char* name, const void*& data, size_t& size);
+
+    // Checks a pack downloaded into the staging partition and schedules it to be installed on the next boot
+    static bool Stage(const esp_partition_t* partition, size_t size);
+    // Copies a staged pack into the assets partition, runs at boot before the pack is mapped.
+    // Returns false while the assets partition holds an incomplete copy, it must not be mapped then
+    static bool InstallStaged();
+
+private:
+    Assets();
+    ~Assets();
+
+    struct Entry {
+        char name[ASSETS_NAME_SIZE];
+        uint32_t offset;
+        uint32_t size;
+        uint8_t color_format;
+        uint8_t reserved;
+        uint16_t width;
+        uint16_t height;
+        uint16_t reserved2;
+    };
+    static_assert(sizeof(Entry) == ASSETS_ENTRY_SIZE, "Unexpected assets entry size");
+
+    const esp_partition_t* partition_ = nullptr;
+    esp_partition_mmap_handle_t mmap_handle_ = 0;
+    const uint8_t* header_ = nullptr;
+    const Entry* entries_ = nullptr;
+    uint32_t count_ = 0;
+    // Descriptors for the mapped images, created on first use
+    std::vector<lv_img_dsc_t> images_;
+
+    bool Map();
+    const Entry* Find(const char* name) const;
+    static bool Verify(const esp_partition_t* partition, size_t size);
+};
+
+#endif // _ASSETS_H
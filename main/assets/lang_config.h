@@ -46,6 +46,7 @@ namespace Lang {
         constexpr const char* SPEAKING = "说话中...";
         constexpr const char* STANDBY = "待命";
         constexpr const char* UPGRADE_FAILED = "升级失败";
+        constexpr const char* UPGRADE_READY = "，空闲时重启";
         constexpr const char* UPGRADING = "正在升级系统...";
         constexpr const char* VERSION = "版本 ";
         constexpr const char* VOLUME = "音量 ";
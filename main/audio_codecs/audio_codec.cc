@@ -1,6 +1,7 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "iot/thing_manager.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -75,11 +76,17 @@ void AudioCodec::Start() {
 }
 
 void AudioCodec::SetOutputVolume(int volume) {
+    bool changed = volume != output_volume_;
     output_volume_ = volume;
     ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
     
     Settings settings("audio", true);
     settings.SetInt("output_volume", output_volume_);
+
+    // Every codec ends up here, whether the volume came from a board button, the server or a rule
+    if (changed) {
+        iot::ThingManager::GetInstance().NotifyStateChanged();
+    }
 }
 
 int AudioCodec::GetOutputVolume() {
@@ -0,0 +1,114 @@
+#include "audio_packet_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "AudioPacketPool"
+
+AudioPacket::AudioPacket(AudioPacket&& other) noexcept
+    : data_(other.data_), size_(other.size_), pooled_(other.pooled_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.pooled_ = false;
+}
+
+AudioPacket& AudioPacket::operator=(AudioPacket&& other) noexcept {
+    if (this != &other) {
+        Reset();
+        data_ = other.data_;
+        size_ = other.size_;
+        pooled_ = other.pooled_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.pooled_ = false;
+    }
+    return *this;
+}
+
+AudioPacket::~AudioPacket() {
+    Reset();
+}
+
+AudioPacket AudioPacket::View(const uint8_t* data, size_t size) {
+    AudioPacket packet;
+    packet.data_ = const_cast<uint8_t*>(data);
+    packet.size_ = size;
+    return packet;
+}
+
+void AudioPacket::Reset() {
+    if (pooled_) {
+        AudioPacketPool::GetInstance().Release(data_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    pooled_ = false;
+}
+
+AudioPacketPool::AudioPacketPool() {
+    slab_ = (uint8_t*)heap_caps_malloc(AUDIO_PACKET_POOL_SIZE_SPIRAM * AUDIO_PACKET_CAPACITY, MALLOC_CAP_SPIRAM);
+    if (slab_ != nullptr) {
+        in_spiram_ = true;
+        slot_count_ = AUDIO_PACKET_POOL_SIZE_SPIRAM;
+    } else {
+        slab_ = (uint8_t*)heap_caps_malloc(AUDIO_PACKET_POOL_SIZE * AUDIO_PACKET_CAPACITY, MALLOC_CAP_INTERNAL);
+        slot_count_ = slab_ != nullptr ? AUDIO_PACKET_POOL_SIZE : 0;
+    }
+    free_slots_ = (uint16_t*)heap_caps_malloc(slot_count_ * sizeof(uint16_t), MALLOC_CAP_INTERNAL);
+    if (free_slots_ == nullptr) {
+        slot_count_ = 0;
+    }
+    // Hand out the lowest slots first
+    for (size_t i = 0; i < slot_count_; i++) {
+        free_slots_[i] = slot_count_ - 1 - i;
+    }
+    free_count_ = slot_count_;
+    min_free_ = slot_count_;
+    ESP_LOGI(TAG, "%zu audio packets of %d bytes in %s", slot_count_, AUDIO_PACKET_CAPACITY,
+        in_spiram_ ? "PSRAM" : "internal RAM");
+}
+
+AudioPacketPool::~AudioPacketPool() {
+    heap_caps_free(free_slots_);
+    heap_caps_free(slab_);
+}
+
+AudioPacket AudioPacketPool::Acquire(size_t size) {
+    AudioPacket packet;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size > AUDIO_PACKET_CAPACITY) {
+        oversized_++;
+        return packet;
+    }
+    if (free_count_ == 0) {
+        exhausted_++;
+        return packet;
+    }
+
+    auto slot = free_slots_[--free_count_];
+    if (free_count_ < min_free_) {
+        min_free_ = free_count_;
+    }
+    acquired_++;
+    packet.data_ = slab_ + slot * AUDIO_PACKET_CAPACITY;
+    packet.size_ = size;
+    packet.pooled_ = true;
+    return packet;
+}
+
+void AudioPacketPool::Release(uint8_t* data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_[free_count_++] = (data - slab_) / AUDIO_PACKET_CAPACITY;
+}
+
+size_t AudioPacketPool::free_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_count_;
+}
+
+void AudioPacketPool::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "Audio packets free: %zu/%zu minimal free: %zu acquired: %zu dropped exhausted: %zu oversized: %zu",
+        free_count_, slot_count_, min_free_, acquired_, exhausted_, oversized_);
+    min_free_ = free_count_;
+}
@@ -0,0 +1,88 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Large enough for a 120 ms Opus frame at 64 kbps
+#define AUDIO_PACKET_CAPACITY 1024
+// Slots in PSRAM, about 7 seconds of 60 ms frames
+#define AUDIO_PACKET_POOL_SIZE_SPIRAM 128
+// Slots when there is no PSRAM, same internal RAM as the per-packet vectors used to peak at
+#define AUDIO_PACKET_POOL_SIZE 16
+
+class AudioPacketPool;
+
+// A move-only handle to an Opus packet. Packets acquired from the pool own a slot of the
+// slab and give it back when destroyed. Packets made with View() point at constant data
+// (the sounds embedded in flash) and own nothing.
+class AudioPacket {
+public:
+    AudioPacket() = default;
+    AudioPacket(AudioPacket&& other) noexcept;
+    AudioPacket& operator=(AudioPacket&& other) noexcept;
+    AudioPacket(const AudioPacket&) = delete;
+    AudioPacket& operator=(const AudioPacket&) = delete;
+    ~AudioPacket();
+
+    static AudioPacket View(const uint8_t* data, size_t size);
+
+    inline uint8_t* data() { return data_; }
+    inline const uint8_t* data() const { return data_; }
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+    inline explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    friend class AudioPacketPool;
+
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool pooled_ = false;
+
+    void Reset();
+};
+
+// Opus packets live in one slab allocated at startup, in PSRAM when the board has it.
+// A packet moves from the protocol (or the encoder) to the decoder (or the protocol) as a
+// handle, so no stage copies it or calls malloc/free for it. Every queued packet holds a
+// slot, so the audio queues can never use more memory than the slab: when it is exhausted
+// Acquire returns an empty handle and the caller drops the packet.
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    // Returns an empty handle when no slot is free or size exceeds AUDIO_PACKET_CAPACITY
+    AudioPacket Acquire(size_t size);
+    size_t capacity() const { return slot_count_; }
+    size_t free_count();
+    void PrintStats();
+
+private:
+    friend class AudioPacket;
+
+    AudioPacketPool();
+    ~AudioPacketPool();
+
+    void Release(uint8_t* data);
+
+    std::mutex mutex_;
+    uint8_t* slab_ = nullptr;
+    bool in_spiram_ = false;
+    size_t slot_count_ = 0;
+    // Stack of free slot indexes, the top is at free_count_ - 1
+    uint16_t* free_slots_ = nullptr;
+    size_t free_count_ = 0;
+    size_t min_free_ = 0;
+    size_t acquired_ = 0;
+    size_t exhausted_ = 0;
+    size_t oversized_ = 0;
+};
+
+#endif // AUDIO_PACKET_POOL_H
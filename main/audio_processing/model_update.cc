@@ -0,0 +1,99 @@
+#include "model_update.h"
+#include "settings.h"
+#include "partition_utils.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+
+#include <cstring>
+
+#define TAG "ModelUpdate"
+
+static bool Verify(const esp_partition_t* partition, size_t size, const std::string& sha256) {
+    uint8_t expected[32], digest[32];
+    if (!PartitionUtils::ParseSha256(sha256, expected) || !PartitionUtils::Sha256(partition, 0, size, digest)) {
+        return false;
+    }
+    return memcmp(expected, digest, sizeof(digest)) == 0;
+}
+
+std::string ModelUpdate::GetVersion() {
+    Settings settings("model", false);
+    return settings.GetString("version");
+}
+
+bool ModelUpdate::Stage(const esp_partition_t* partition, size_t size, const std::string& sha256, const std::string& version) {
+    auto model = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MODEL_PARTITION_LABEL);
+    if (model == nullptr || size > model->size) {
+        ESP_LOGE(TAG, "Models of %zu bytes do not fit the %s partition", size, MODEL_PARTITION_LABEL);
+        return false;
+    }
+    auto start_time = esp_timer_get_time();
+    if (!Verify(partition, size, sha256)) {
+        ESP_LOGE(TAG, "Downloaded models do not match SHA-256 %s", sha256.c_str());
+        return false;
+    }
+    Settings settings("model", true);
+    settings.SetString("staged", partition->label);
+    settings.SetInt("size", size);
+    settings.SetString("sha256", sha256);
+    settings.SetString("staged_version", version);
+    ESP_LOGI(TAG, "Models %s staged in %s, verified in %lld ms", version.c_str(), partition->label,
+        (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
+
+// The marker stays until the copy is verified, a copy interrupted by a power loss is done again on the
+// next boot, so esp_srmodel_init never sees a partially written partition
+bool ModelUpdate::InstallStaged() {
+    std::string label, sha256, version;
+    size_t size;
+    bool installing;
+    {
+        Settings settings("model", false);
+        label = settings.GetString("staged");
+        size = settings.GetInt("size");
+        sha256 = settings.GetString("sha256");
+        version = settings.GetString("staged_version");
+        installing = settings.GetInt("installing") != 0;
+    }
+    if (label.empty()) {
+        return !installing;
+    }
+
+    auto model = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MODEL_PARTITION_LABEL);
+    // The staging slot may have been taken by a firmware upgrade in the meantime
+    auto staged = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if (model == nullptr || staged == nullptr || staged == esp_ota_get_running_partition() || !Verify(staged, size, sha256)) {
+        ESP_LOGW(TAG, "Staged models are no longer valid, discarded");
+        Settings settings("model", true);
+        settings.EraseKey("staged");
+        if (installing) {
+            ESP_LOGE(TAG, "The %s partition holds an incomplete copy until new models are installed", MODEL_PARTITION_LABEL);
+        }
+        return !installing;
+    }
+
+    // Committed before the partition is touched, the installed version is gone from here on
+    {
+        Settings settings("model", true);
+        settings.SetInt("installing", 1);
+        settings.EraseKey("version");
+    }
+    auto start_time = esp_timer_get_time();
+    auto err = PartitionUtils::Copy(staged, model, size);
+    if (err != ESP_OK || !Verify(model, size, sha256)) {
+        ESP_LOGE(TAG, "Failed to install models: %s", esp_err_to_name(err));
+        return false;
+    }
+    Settings settings("model", true);
+    settings.EraseKey("staged");
+    settings.EraseKey("size");
+    settings.EraseKey("sha256");
+    settings.EraseKey("staged_version");
+    settings.EraseKey("installing");
+    settings.SetString("version", version);
+    ESP_LOGI(TAG, "Installed models %s, %zu bytes in %lld ms", version.c_str(), size, (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef _MODEL_UPDATE_H_
+#define _MODEL_UPDATE_H_
+
+#include <esp_partition.h>
+
+#include <string>
+
+#define MODEL_PARTITION_LABEL "model"
+
+// Keeps the ESP-SR models in the model partition up to date. A new model set is downloaded into the
+// inactive app partition, and copied over the model partition on the next boot before anything loads it.
+class ModelUpdate {
+public:
+    // Version installed over the air, empty for the models flashed with the firmware
+    static std::string GetVersion();
+    // Checks the downloaded models against the digest from the server and schedules them for the next boot
+    static bool Stage(const esp_partition_t* partition, size_t size, const std::string& sha256, const std::string& version);
+    // Must run before esp_srmodel_init. Returns false while the model partition holds an incomplete
+    // copy, the models must not be loaded then. A failed copy is retried on the next boot.
+    static bool InstallStaged();
+};
+
+#endif // _MODEL_UPDATE_H_
@@ -2,6 +2,7 @@
 #include "application.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <model_path.h>
 #include <arpa/inet.h>
 #include <sstream>
@@ -38,7 +39,13 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
     reference_ = reference;
     int ref_num = reference_ ? 1 : 0;
 
+    auto start_time = esp_timer_get_time();
     srmodel_list_t *models = esp_srmodel_init("model");
+    if (models == nullptr) {
+        ESP_LOGE(TAG, "No models found in the model partition");
+        return;
+    }
+    ESP_LOGI(TAG, "Loaded %d models in %lld ms", models->num, (esp_timer_get_time() - start_time) / 1000);
     for (int i = 0; i < models->num; i++) {
         ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
         if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
@@ -174,8 +181,9 @@ void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
     }
 }
 
-void WakeWordDetect::EncodeWakeWordData() {
+void WakeWordDetect::EncodeWakeWordData(int frame_duration) {
     wake_word_opus_.clear();
+    wake_word_frame_duration_ = frame_duration;
     if (wake_word_encode_task_stack_ == nullptr) {
         wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
     }
@@ -183,7 +191,7 @@ void WakeWordDetect::EncodeWakeWordData() {
         auto this_ = (WakeWordDetect*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, this_->wake_word_frame_duration_);
             encoder->SetComplexity(0); // 0 is the fastest
 
             for (auto& pcm: this_->wake_word_pcm_) {
@@ -28,7 +28,7 @@ public:
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
-    void EncodeWakeWordData();
+    void EncodeWakeWordData(int frame_duration);
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
@@ -52,6 +52,7 @@ private:
     std::list<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
+    int wake_word_frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
 
     void StoreWakeWordData(uint16_t* data, size_t size);
     void AudioDetectionTask();
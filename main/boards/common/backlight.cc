@@ -1,5 +1,6 @@
 #include "backlight.h"
 #include "settings.h"
+#include "iot/thing_manager.h"
 
 #include <esp_log.h>
 #include <driver/ledc.h>
@@ -70,6 +71,8 @@ void Backlight::OnTransitionTimer() {
 
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
+        // Reported once the transition is over, not for every step
+        iot::ThingManager::GetInstance().NotifyStateChanged();
     }
 }
 
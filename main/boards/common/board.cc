@@ -3,6 +3,7 @@
 #include "settings.h"
 #include "display/display.h"
 #include "assets/lang_config.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 #include <esp_ota_ops.h>
@@ -11,6 +12,9 @@
 
 #define TAG "Board"
 
+// Large enough for the partition table and board info, so the string is allocated once
+#define BOARD_JSON_RESERVE_SIZE 2048
+
 Board::Board() {
     Settings settings("board", true);
     uuid_ = settings.GetString("uuid");
@@ -98,62 +102,63 @@ std::string Board::GetJson() {
             }
         }
     */
-    std::string json = "{";
-    json += "\"version\":2,";
-    json += "\"language\":\"" + std::string(Lang::CODE) + "\",";
-    json += "\"flash_size\":" + std::to_string(SystemInfo::GetFlashSize()) + ",";
-    json += "\"minimum_free_heap_size\":" + std::to_string(SystemInfo::GetMinimumFreeHeapSize()) + ",";
-    json += "\"mac_address\":\"" + SystemInfo::GetMacAddress() + "\",";
-    json += "\"uuid\":\"" + uuid_ + "\",";
-    json += "\"chip_model_name\":\"" + SystemInfo::GetChipModelName() + "\",";
-    json += "\"chip_info\":{";
+    std::string json;
+    json.reserve(BOARD_JSON_RESERVE_SIZE);
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Key("version").Int(2);
+    writer.Key("language").String(Lang::CODE);
+    writer.Key("flash_size").Int(SystemInfo::GetFlashSize());
+    writer.Key("minimum_free_heap_size").Int(SystemInfo::GetMinimumFreeHeapSize());
+    writer.Key("mac_address").String(SystemInfo::GetMacAddress());
+    writer.Key("uuid").String(uuid_);
+    writer.Key("chip_model_name").String(SystemInfo::GetChipModelName());
 
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
-    json += "\"model\":" + std::to_string(chip_info.model) + ",";
-    json += "\"cores\":" + std::to_string(chip_info.cores) + ",";
-    json += "\"revision\":" + std::to_string(chip_info.revision) + ",";
-    json += "\"features\":" + std::to_string(chip_info.features);
-    json += "},";
+    writer.Key("chip_info").BeginObject();
+    writer.Key("model").Int(chip_info.model);
+    writer.Key("cores").Int(chip_info.cores);
+    writer.Key("revision").Int(chip_info.revision);
+    writer.Key("features").Int(chip_info.features);
+    writer.EndObject();
 
-    json += "\"application\":{";
     auto app_desc = esp_app_get_description();
-    json += "\"name\":\"" + std::string(app_desc->project_name) + "\",";
-    json += "\"version\":\"" + std::string(app_desc->version) + "\",";
-    json += "\"compile_time\":\"" + std::string(app_desc->date) + "T" + std::string(app_desc->time) + "Z\",";
-    json += "\"idf_version\":\"" + std::string(app_desc->idf_ver) + "\",";
+    writer.Key("application").BeginObject();
+    writer.Key("name").String(app_desc->project_name);
+    writer.Key("version").String(app_desc->version);
+    writer.Key("compile_time").String(std::string(app_desc->date) + "T" + app_desc->time + "Z");
+    writer.Key("idf_version").String(app_desc->idf_ver);
 
     char sha256_str[65];
     for (int i = 0; i < 32; i++) {
         snprintf(sha256_str + i * 2, sizeof(sha256_str) - i * 2, "%02x", app_desc->app_elf_sha256[i]);
     }
-    json += "\"elf_sha256\":\"" + std::string(sha256_str) + "\"";
-    json += "},";
+    writer.Key("elf_sha256").String(sha256_str);
+    writer.EndObject();
 
-    json += "\"partition_table\": [";
+    writer.Key("partition_table").BeginArray();
     esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, NULL);
     while (it) {
         const esp_partition_t *partition = esp_partition_get(it);
-        json += "{";
-        json += "\"label\":\"" + std::string(partition->label) + "\",";
-        json += "\"type\":" + std::to_string(partition->type) + ",";
-        json += "\"subtype\":" + std::to_string(partition->subtype) + ",";
-        json += "\"address\":" + std::to_string(partition->address) + ",";
-        json += "\"size\":" + std::to_string(partition->size);
-        json += "},";
+        writer.BeginObject();
+        writer.Key("label").String(partition->label);
+        writer.Key("type").Int(partition->type);
+        writer.Key("subtype").Int(partition->subtype);
+        writer.Key("address").Int(partition->address);
+        writer.Key("size").Int(partition->size);
+        writer.EndObject();
         it = esp_partition_next(it);
     }
-    json.pop_back(); // Remove the last comma
-    json += "],";
+    writer.EndArray();
 
-    json += "\"ota\":{";
     auto ota_partition = esp_ota_get_running_partition();
-    json += "\"label\":\"" + std::string(ota_partition->label) + "\"";
-    json += "},";
-
-    json += "\"board\":" + GetBoardJson();
+    writer.Key("ota").BeginObject();
+    writer.Key("label").String(ota_partition->label);
+    writer.EndObject();
 
-    // Close the JSON object
-    json += "}";
+    writer.Key("board");
+    GetBoardJson(writer);
+    writer.EndObject();
     return json;
 }
\ No newline at end of file
@@ -13,11 +13,12 @@
 void* create_board();
 class AudioCodec;
 class Display;
+class JsonWriter;
 class Board {
 private:
     Board(const Board&) = delete; // 禁用拷贝构造函数
     Board& operator=(const Board&) = delete; // 禁用赋值操作
-    virtual std::string GetBoardJson() = 0;
+    virtual void GetBoardJson(JsonWriter& writer) = 0;
 
 protected:
     Board();
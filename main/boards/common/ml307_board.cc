@@ -4,6 +4,7 @@
 #include "display.h"
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 #include <esp_timer.h>
@@ -104,16 +105,17 @@ const char* Ml307Board::GetNetworkStateIcon() {
     return FONT_AWESOME_SIGNAL_OFF;
 }
 
-std::string Ml307Board::GetBoardJson() {
+void Ml307Board::GetBoardJson(JsonWriter& writer) {
     // Set the board type for OTA
-    std::string board_json = std::string("{\"type\":\"" BOARD_TYPE "\",");
-    board_json += "\"name\":\"" BOARD_NAME "\",";
-    board_json += "\"revision\":\"" + modem_.GetModuleName() + "\",";
-    board_json += "\"carrier\":\"" + modem_.GetCarrierName() + "\",";
-    board_json += "\"csq\":\"" + std::to_string(modem_.GetCsq()) + "\",";
-    board_json += "\"imei\":\"" + modem_.GetImei() + "\",";
-    board_json += "\"iccid\":\"" + modem_.GetIccid() + "\"}";
-    return board_json;
+    writer.BeginObject();
+    writer.Key("type").String(BOARD_TYPE);
+    writer.Key("name").String(BOARD_NAME);
+    writer.Key("revision").String(modem_.GetModuleName());
+    writer.Key("carrier").String(modem_.GetCarrierName());
+    writer.Key("csq").String(std::to_string(modem_.GetCsq()));
+    writer.Key("imei").String(modem_.GetImei());
+    writer.Key("iccid").String(modem_.GetIccid());
+    writer.EndObject();
 }
 
 void Ml307Board::SetPowerSaveMode(bool enabled) {
@@ -0,0 +1,113 @@
+#include "tls_session_transport.h"
+
+#include <esp_log.h>
+#include <esp_crt_bundle.h>
+#include <sdkconfig.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#define TAG "TlsSessionTransport"
+
+// One cached session is enough, the device talks to a single WebSocket server.
+// The lock is held for the whole handshake, so the session is never freed while in use.
+static std::mutex session_mutex;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+static esp_tls_client_session_t* session = nullptr;
+static std::string session_server;
+#endif
+
+TlsSessionTransport::TlsSessionTransport() {
+}
+
+TlsSessionTransport::~TlsSessionTransport() {
+    Disconnect();
+}
+
+bool TlsSessionTransport::Connect(const char* host, int port) {
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    cfg.timeout_ms = TLS_SESSION_CONNECT_TIMEOUT_MS;
+
+    std::lock_guard<std::mutex> lock(session_mutex);
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    std::string server = std::string(host) + ":" + std::to_string(port);
+    if (session != nullptr && session_server == server) {
+        cfg.client_session = session;
+    }
+#endif
+
+    tls_ = esp_tls_init();
+    if (tls_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize TLS");
+        return false;
+    }
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tls_) != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        esp_tls_conn_destroy(tls_);
+        tls_ = nullptr;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // The ticket may be what the server did not like, the next attempt starts from scratch
+        if (cfg.client_session != nullptr) {
+            esp_tls_free_client_session(session);
+            session = nullptr;
+        }
+#endif
+        return false;
+    }
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // The server may have issued a new ticket, keep the latest one
+    auto new_session = esp_tls_get_client_session(tls_);
+    if (new_session != nullptr) {
+        if (session != nullptr) {
+            esp_tls_free_client_session(session);
+        }
+        session = new_session;
+        session_server = server;
+    }
+#endif
+    connected_ = true;
+    return true;
+}
+
+void TlsSessionTransport::Disconnect() {
+    if (tls_ != nullptr) {
+        esp_tls_conn_destroy(tls_);
+        tls_ = nullptr;
+    }
+    connected_ = false;
+}
+
+int TlsSessionTransport::Send(const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int ret = esp_tls_conn_write(tls_, data + sent, length - sent);
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Failed to send data: %d", ret);
+            connected_ = false;
+            return ret;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+int TlsSessionTransport::Receive(char* buffer, size_t buffer_size) {
+    int ret = esp_tls_conn_read(tls_, buffer, buffer_size);
+    if (ret <= 0) {
+        connected_ = false;
+    }
+    return ret;
+}
+
+void TlsSessionTransport::ClearSession() {
+    std::lock_guard<std::mutex> lock(session_mutex);
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (session != nullptr) {
+        esp_tls_free_client_session(session);
+        session = nullptr;
+    }
+#endif
+}
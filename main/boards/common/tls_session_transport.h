@@ -0,0 +1,30 @@
+#ifndef _TLS_SESSION_TRANSPORT_H_
+#define _TLS_SESSION_TRANSPORT_H_
+
+#include <transport.h>
+#include <esp_tls.h>
+
+#define TLS_SESSION_CONNECT_TIMEOUT_MS 10000
+
+// Like TlsTransport, but the session of the last connection is kept and offered to the
+// same server next time. A resumed handshake takes one round trip instead of two and
+// skips the certificate chain and the key exchange, which is most of the connect time.
+// Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS, without it every handshake is a full one.
+class TlsSessionTransport : public Transport {
+public:
+    TlsSessionTransport();
+    ~TlsSessionTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t buffer_size) override;
+
+    // Forgets the cached session, the next connection does a full handshake
+    static void ClearSession();
+
+private:
+    esp_tls_t* tls_ = nullptr;
+};
+
+#endif // _TLS_SESSION_TRANSPORT_H_
@@ -5,6 +5,8 @@
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
+#include "json_writer.h"
+#include "tls_session_transport.h"
 #include "assets/lang_config.h"
 
 #include <freertos/FreeRTOS.h>
@@ -13,7 +15,6 @@
 #include <esp_mqtt.h>
 #include <esp_udp.h>
 #include <tcp_transport.h>
-#include <tls_transport.h>
 #include <web_socket.h>
 #include <esp_log.h>
 
@@ -124,7 +125,8 @@ WebSocket* WifiBoard::CreateWebSocket() {
 #ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
     std::string url = CONFIG_WEBSOCKET_URL;
     if (url.find("wss://") == 0) {
-        return new WebSocket(new TlsTransport());
+        // Reconnects resume the TLS session instead of doing a full handshake
+        return new WebSocket(new TlsSessionTransport());
     } else {
         return new WebSocket(new TcpTransport());
     }
@@ -158,19 +160,20 @@ const char* WifiBoard::GetNetworkStateIcon() {
     }
 }
 
-std::string WifiBoard::GetBoardJson() {
+void WifiBoard::GetBoardJson(JsonWriter& writer) {
     // Set the board type for OTA
     auto& wifi_station = WifiStation::GetInstance();
-    std::string board_json = std::string("{\"type\":\"" BOARD_TYPE "\",");
-    board_json += "\"name\":\"" BOARD_NAME "\",";
+    writer.BeginObject();
+    writer.Key("type").String(BOARD_TYPE);
+    writer.Key("name").String(BOARD_NAME);
     if (!wifi_config_mode_) {
-        board_json += "\"ssid\":\"" + wifi_station.GetSsid() + "\",";
-        board_json += "\"rssi\":" + std::to_string(wifi_station.GetRssi()) + ",";
-        board_json += "\"channel\":" + std::to_string(wifi_station.GetChannel()) + ",";
-        board_json += "\"ip\":\"" + wifi_station.GetIpAddress() + "\",";
+        writer.Key("ssid").String(wifi_station.GetSsid());
+        writer.Key("rssi").Int(wifi_station.GetRssi());
+        writer.Key("channel").Int(wifi_station.GetChannel());
+        writer.Key("ip").String(wifi_station.GetIpAddress());
     }
-    board_json += "\"mac\":\"" + SystemInfo::GetMacAddress() + "\"}";
-    return board_json;
+    writer.Key("mac").String(SystemInfo::GetMacAddress());
+    writer.EndObject();
 }
 
 void WifiBoard::SetPowerSaveMode(bool enabled) {
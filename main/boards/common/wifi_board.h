@@ -9,7 +9,7 @@ protected:
 
     WifiBoard();
     void EnterWifiConfigMode();
-    virtual std::string GetBoardJson() override;
+    virtual void GetBoardJson(JsonWriter& writer) override;
 
 public:
     virtual std::string GetBoardType() override;
@@ -9,6 +9,7 @@
 
 #include "board.h"
 #include "resources.h"
+#include "assets.h"
 #include "audio_codec.h"
 
 #define TAG "LcdDisplay"
@@ -213,11 +214,11 @@ void LcdDisplay::SetLogoImg(int index)
         return;
     }
     static const lv_img_dsc_t *images[] = {
-        &bootlogo1, &bootlogo2, &bootlogo3, &bootlogo4, &bootlogo5,
-        &bootlogo6, &bootlogo7, &bootlogo8, &bootlogo9, &bootlogo10,
-        &bootlogo11, &bootlogo12, &bootlogo13, &bootlogo14, &bootlogo15,
-        &bootlogo16, &bootlogo17, &bootlogo18, &bootlogo19, &bootlogo20,
-        &bootlogo21
+        RESOURCE_IMAGE(bootlogo1), RESOURCE_IMAGE(bootlogo2), RESOURCE_IMAGE(bootlogo3), RESOURCE_IMAGE(bootlogo4), RESOURCE_IMAGE(bootlogo5),
+        RESOURCE_IMAGE(bootlogo6), RESOURCE_IMAGE(bootlogo7), RESOURCE_IMAGE(bootlogo8), RESOURCE_IMAGE(bootlogo9), RESOURCE_IMAGE(bootlogo10),
+        RESOURCE_IMAGE(bootlogo11), RESOURCE_IMAGE(bootlogo12), RESOURCE_IMAGE(bootlogo13), RESOURCE_IMAGE(bootlogo14), RESOURCE_IMAGE(bootlogo15),
+        RESOURCE_IMAGE(bootlogo16), RESOURCE_IMAGE(bootlogo17), RESOURCE_IMAGE(bootlogo18), RESOURCE_IMAGE(bootlogo19), RESOURCE_IMAGE(bootlogo20),
+        RESOURCE_IMAGE(bootlogo21)
     };
     lv_img_set_src(logo_img_, images[index]);
     
@@ -232,7 +233,7 @@ void LcdDisplay::ShowLogo()
     lv_obj_set_style_bg_opa(screen, 255, 0);
 
     logo_img_ = lv_img_create(screen);
-    lv_img_set_src(logo_img_, &bootlogo1);
+    lv_img_set_src(logo_img_, RESOURCE_IMAGE(bootlogo1));
     lv_obj_align(logo_img_, LV_ALIGN_CENTER, 0, 0);
 }
 
@@ -445,8 +446,8 @@ void LcdDisplay::SetNeutral(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &neutral1, &neutral2, &neutral3, &neutral4, 
-        &neutral5, &neutral6, &neutral7, &neutral8
+        RESOURCE_IMAGE(neutral1), RESOURCE_IMAGE(neutral2), RESOURCE_IMAGE(neutral3), RESOURCE_IMAGE(neutral4), 
+        RESOURCE_IMAGE(neutral5), RESOURCE_IMAGE(neutral6), RESOURCE_IMAGE(neutral7), RESOURCE_IMAGE(neutral8)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -461,8 +462,8 @@ void LcdDisplay::SetHappy(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &happy1, &happy2, &happy3, &happy4, 
-        &happy5, &happy6
+        RESOURCE_IMAGE(happy1), RESOURCE_IMAGE(happy2), RESOURCE_IMAGE(happy3), RESOURCE_IMAGE(happy4), 
+        RESOURCE_IMAGE(happy5), RESOURCE_IMAGE(happy6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -477,8 +478,8 @@ void LcdDisplay::SetSad(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &sad1, &sad2, &sad3, &sad4, 
-        &sad5, &sad6, &sad7, &sad8,
+        RESOURCE_IMAGE(sad1), RESOURCE_IMAGE(sad2), RESOURCE_IMAGE(sad3), RESOURCE_IMAGE(sad4), 
+        RESOURCE_IMAGE(sad5), RESOURCE_IMAGE(sad6), RESOURCE_IMAGE(sad7), RESOURCE_IMAGE(sad8),
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -493,8 +494,8 @@ void LcdDisplay::SetAngry(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &angry1, &angry2, &angry3, &angry4, 
-        &angry5, &angry6, &angry7
+        RESOURCE_IMAGE(angry1), RESOURCE_IMAGE(angry2), RESOURCE_IMAGE(angry3), RESOURCE_IMAGE(angry4), 
+        RESOURCE_IMAGE(angry5), RESOURCE_IMAGE(angry6), RESOURCE_IMAGE(angry7)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -509,8 +510,8 @@ void LcdDisplay::SetLoving(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &loving1, &loving2, &loving3, &loving4,
-        &loving5, &loving6
+        RESOURCE_IMAGE(loving1), RESOURCE_IMAGE(loving2), RESOURCE_IMAGE(loving3), RESOURCE_IMAGE(loving4),
+        RESOURCE_IMAGE(loving5), RESOURCE_IMAGE(loving6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -525,8 +526,8 @@ void LcdDisplay::SetEmbarrass(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &embarrassed1, &embarrassed2, &embarrassed3,
-        &embarrassed4
+        RESOURCE_IMAGE(embarrassed1), RESOURCE_IMAGE(embarrassed2), RESOURCE_IMAGE(embarrassed3),
+        RESOURCE_IMAGE(embarrassed4)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
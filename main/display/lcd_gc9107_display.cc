@@ -9,6 +9,7 @@
 #include <string.h>
 #include "board.h"
 #include "resources.h"
+#include "assets.h"
 #include "audio_codec.h"
 
 #define TAG "LcdGc9107Display"
@@ -150,11 +151,11 @@ void LcdGc9107Display::SetLogoImg(int index)
         return;
     }
     static const lv_img_dsc_t *images[] = {
-        &bootlogo1, &bootlogo2, &bootlogo3, &bootlogo4, &bootlogo5,
-        &bootlogo6, &bootlogo7, &bootlogo8, &bootlogo9, &bootlogo10,
-        &bootlogo11, &bootlogo12, &bootlogo13, &bootlogo14, &bootlogo15,
-        &bootlogo16, &bootlogo17, &bootlogo18, &bootlogo19, &bootlogo20,
-        &bootlogo21,
+        RESOURCE_IMAGE(bootlogo1), RESOURCE_IMAGE(bootlogo2), RESOURCE_IMAGE(bootlogo3), RESOURCE_IMAGE(bootlogo4), RESOURCE_IMAGE(bootlogo5),
+        RESOURCE_IMAGE(bootlogo6), RESOURCE_IMAGE(bootlogo7), RESOURCE_IMAGE(bootlogo8), RESOURCE_IMAGE(bootlogo9), RESOURCE_IMAGE(bootlogo10),
+        RESOURCE_IMAGE(bootlogo11), RESOURCE_IMAGE(bootlogo12), RESOURCE_IMAGE(bootlogo13), RESOURCE_IMAGE(bootlogo14), RESOURCE_IMAGE(bootlogo15),
+        RESOURCE_IMAGE(bootlogo16), RESOURCE_IMAGE(bootlogo17), RESOURCE_IMAGE(bootlogo18), RESOURCE_IMAGE(bootlogo19), RESOURCE_IMAGE(bootlogo20),
+        RESOURCE_IMAGE(bootlogo21),
     };
     lv_img_set_src(logo_img_, images[index]);
 }
@@ -169,7 +170,7 @@ void LcdGc9107Display::ShowLogo()
     lv_obj_set_style_bg_opa(screen, 255, 0);
 
     logo_img_ = lv_img_create(screen);
-    lv_img_set_src(logo_img_, &bootlogo1);
+    lv_img_set_src(logo_img_, RESOURCE_IMAGE(bootlogo1));
     lv_obj_align(logo_img_, LV_ALIGN_CENTER, 0, 0);
 
 }
@@ -226,7 +227,7 @@ void LcdGc9107Display::SetupUI() {
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
 
     face_img_ = lv_img_create(container_);
-    lv_img_set_src(face_img_, &neutral1);
+    lv_img_set_src(face_img_, RESOURCE_IMAGE(neutral1));
     lv_obj_set_width(face_img_, LV_SIZE_CONTENT);   /// 128
     lv_obj_set_height(face_img_, LV_SIZE_CONTENT);    /// 64
     lv_obj_set_align(face_img_, LV_ALIGN_CENTER);
@@ -361,8 +362,8 @@ void LcdGc9107Display::SetNeutral(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &neutral1, &neutral2, &neutral3, &neutral4, 
-        &neutral5, &neutral6, &neutral7, &neutral8, &neutral9, &neutral10
+        RESOURCE_IMAGE(neutral1), RESOURCE_IMAGE(neutral2), RESOURCE_IMAGE(neutral3), RESOURCE_IMAGE(neutral4), 
+        RESOURCE_IMAGE(neutral5), RESOURCE_IMAGE(neutral6), RESOURCE_IMAGE(neutral7), RESOURCE_IMAGE(neutral8), RESOURCE_IMAGE(neutral9), RESOURCE_IMAGE(neutral10)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -377,8 +378,8 @@ void LcdGc9107Display::SetHappy(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &happy1, &happy2, &happy3, &happy4, 
-        &happy5, &happy6
+        RESOURCE_IMAGE(happy1), RESOURCE_IMAGE(happy2), RESOURCE_IMAGE(happy3), RESOURCE_IMAGE(happy4), 
+        RESOURCE_IMAGE(happy5), RESOURCE_IMAGE(happy6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -393,8 +394,8 @@ void LcdGc9107Display::SetSad(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &sad1, &sad2, &sad3, &sad4, 
-        &sad5, &sad6, &sad7, &sad8,
+        RESOURCE_IMAGE(sad1), RESOURCE_IMAGE(sad2), RESOURCE_IMAGE(sad3), RESOURCE_IMAGE(sad4), 
+        RESOURCE_IMAGE(sad5), RESOURCE_IMAGE(sad6), RESOURCE_IMAGE(sad7), RESOURCE_IMAGE(sad8),
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -409,8 +410,8 @@ void LcdGc9107Display::SetAngry(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &angry1, &angry2, &angry3, &angry4, 
-        &angry5, &angry6, &angry7
+        RESOURCE_IMAGE(angry1), RESOURCE_IMAGE(angry2), RESOURCE_IMAGE(angry3), RESOURCE_IMAGE(angry4), 
+        RESOURCE_IMAGE(angry5), RESOURCE_IMAGE(angry6), RESOURCE_IMAGE(angry7)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -425,8 +426,8 @@ void LcdGc9107Display::SetLoving(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &loving1, &loving2, &loving3, &loving4,
-        &loving5, &loving6
+        RESOURCE_IMAGE(loving1), RESOURCE_IMAGE(loving2), RESOURCE_IMAGE(loving3), RESOURCE_IMAGE(loving4),
+        RESOURCE_IMAGE(loving5), RESOURCE_IMAGE(loving6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -441,8 +442,8 @@ void LcdGc9107Display::SetEmbarrass(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &embarrassed1, &embarrassed2, &embarrassed3,
-        &embarrassed4
+        RESOURCE_IMAGE(embarrassed1), RESOURCE_IMAGE(embarrassed2), RESOURCE_IMAGE(embarrassed3),
+        RESOURCE_IMAGE(embarrassed4)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -457,8 +458,8 @@ void LcdGc9107Display::SetIdle(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &idle1, &idle2, &idle3, &idle4, 
-        &idle5, &idle6, &idle7
+        RESOURCE_IMAGE(idle1), RESOURCE_IMAGE(idle2), RESOURCE_IMAGE(idle3), RESOURCE_IMAGE(idle4), 
+        RESOURCE_IMAGE(idle5), RESOURCE_IMAGE(idle6), RESOURCE_IMAGE(idle7)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -473,7 +474,7 @@ void LcdGc9107Display::SetCrying(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &crying1, &crying2, &crying3
+        RESOURCE_IMAGE(crying1), RESOURCE_IMAGE(crying2), RESOURCE_IMAGE(crying3)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -488,7 +489,7 @@ void LcdGc9107Display::SetShocked(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &shocked1, &shocked2, &shocked3, &shocked4, &shocked5
+        RESOURCE_IMAGE(shocked1), RESOURCE_IMAGE(shocked2), RESOURCE_IMAGE(shocked3), RESOURCE_IMAGE(shocked4), RESOURCE_IMAGE(shocked5)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -503,8 +504,8 @@ void LcdGc9107Display::SetRelaxed(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &relaxed1, &relaxed2, &relaxed3, 
-        &relaxed4, &relaxed5, &relaxed6
+        RESOURCE_IMAGE(relaxed1), RESOURCE_IMAGE(relaxed2), RESOURCE_IMAGE(relaxed3), 
+        RESOURCE_IMAGE(relaxed4), RESOURCE_IMAGE(relaxed5), RESOURCE_IMAGE(relaxed6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -519,8 +520,8 @@ void LcdGc9107Display::SetThinking(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &thinking1, &thinking2, &thinking3, 
-        &thinking4, &thinking5, &thinking6
+        RESOURCE_IMAGE(thinking1), RESOURCE_IMAGE(thinking2), RESOURCE_IMAGE(thinking3), 
+        RESOURCE_IMAGE(thinking4), RESOURCE_IMAGE(thinking5), RESOURCE_IMAGE(thinking6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -535,8 +536,8 @@ void LcdGc9107Display::SetSleepy(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &sleepy1, &sleepy2, &sleepy3, 
-        &sleepy4, &sleepy5
+        RESOURCE_IMAGE(sleepy1), RESOURCE_IMAGE(sleepy2), RESOURCE_IMAGE(sleepy3), 
+        RESOURCE_IMAGE(sleepy4), RESOURCE_IMAGE(sleepy5)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -551,8 +552,8 @@ void LcdGc9107Display::SetCool(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &cool1, &cool2, &cool3, 
-        &cool4, &cool5
+        RESOURCE_IMAGE(cool1), RESOURCE_IMAGE(cool2), RESOURCE_IMAGE(cool3), 
+        RESOURCE_IMAGE(cool4), RESOURCE_IMAGE(cool5)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -567,8 +568,8 @@ void LcdGc9107Display::SetSurprised(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &surprised1, &surprised2, &surprised3, 
-        &surprised4, &surprised5, &surprised6, &surprised7
+        RESOURCE_IMAGE(surprised1), RESOURCE_IMAGE(surprised2), RESOURCE_IMAGE(surprised3), 
+        RESOURCE_IMAGE(surprised4), RESOURCE_IMAGE(surprised5), RESOURCE_IMAGE(surprised6), RESOURCE_IMAGE(surprised7)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -583,8 +584,8 @@ void LcdGc9107Display::SetSilly(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &silly1, &silly2, &silly3, 
-        &silly4, &silly5, &silly6
+        RESOURCE_IMAGE(silly1), RESOURCE_IMAGE(silly2), RESOURCE_IMAGE(silly3), 
+        RESOURCE_IMAGE(silly4), RESOURCE_IMAGE(silly5), RESOURCE_IMAGE(silly6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -599,8 +600,8 @@ void LcdGc9107Display::SetLaughing(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &laughing1, &laughing2, &laughing3, 
-        &laughing4, &laughing5, &laughing6
+        RESOURCE_IMAGE(laughing1), RESOURCE_IMAGE(laughing2), RESOURCE_IMAGE(laughing3), 
+        RESOURCE_IMAGE(laughing4), RESOURCE_IMAGE(laughing5), RESOURCE_IMAGE(laughing6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -615,8 +616,8 @@ void LcdGc9107Display::SetConfused(int index)
         return;
     } 
     static const lv_img_dsc_t *images[] = {
-        &confused1, &confused2, &confused3, 
-        &confused4, &confused5, &confused6
+        RESOURCE_IMAGE(confused1), RESOURCE_IMAGE(confused2), RESOURCE_IMAGE(confused3), 
+        RESOURCE_IMAGE(confused4), RESOURCE_IMAGE(confused5), RESOURCE_IMAGE(confused6)
     };
     if(current_face_count_ != sizeof(images) / sizeof(images[0]))
         current_face_count_ = sizeof(images) / sizeof(images[0]);
@@ -0,0 +1,246 @@
+#include "rule_engine.h"
+#include "thing_manager.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <ctime>
+#include <cstring>
+
+#define TAG "RuleEngine"
+
+namespace iot {
+
+static bool ParseOperator(const char* str, RuleOperator& op) {
+    static const struct {
+        const char* str;
+        RuleOperator op;
+    } operators[] = {
+        {"<", kRuleOperatorLess},
+        {"<=", kRuleOperatorLessEqual},
+        {"==", kRuleOperatorEqual},
+        {"!=", kRuleOperatorNotEqual},
+        {">=", kRuleOperatorGreaterEqual},
+        {">", kRuleOperatorGreater},
+    };
+    for (auto& item : operators) {
+        if (strcmp(str, item.str) == 0) {
+            op = item.op;
+            return true;
+        }
+    }
+    return false;
+}
+
+void RuleEngine::Load() {
+    Settings settings("iot_rules", false);
+    auto json = settings.GetString("rules");
+    if (json.empty()) {
+        return;
+    }
+    auto rules = cJSON_Parse(json.c_str());
+    if (rules == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse saved rules");
+        return;
+    }
+
+    // Install never saves more than the limit, but the saved list may come from another build
+    rules_.clear();
+    for (int i = 0; i < cJSON_GetArraySize(rules); ++i) {
+        if (rules_.size() >= RULE_ENGINE_MAX_RULES) {
+            ESP_LOGW(TAG, "Too many saved rules, only the first %d are loaded", RULE_ENGINE_MAX_RULES);
+            break;
+        }
+        Rule rule;
+        if (ParseRule(cJSON_GetArrayItem(rules, i), rule)) {
+            rules_.push_back(std::move(rule));
+        }
+    }
+    cJSON_Delete(rules);
+    ESP_LOGI(TAG, "Loaded %zu rules", rules_.size());
+}
+
+int RuleEngine::Install(const cJSON* rules) {
+    if (!cJSON_IsArray(rules)) {
+        ESP_LOGE(TAG, "Rules must be an array, keeping the %zu installed rules", rules_.size());
+        return -1;
+    }
+
+    // Only the rules that parse are kept, so a bad rule from the server is not restored on every boot
+    rules_.clear();
+    auto saved = cJSON_CreateArray();
+    for (int i = 0; i < cJSON_GetArraySize(rules); ++i) {
+        auto item = cJSON_GetArrayItem(rules, i);
+        if (rules_.size() >= RULE_ENGINE_MAX_RULES) {
+            ESP_LOGW(TAG, "Too many rules, only the first %d are installed", RULE_ENGINE_MAX_RULES);
+            break;
+        }
+        Rule rule;
+        if (ParseRule(item, rule)) {
+            rules_.push_back(std::move(rule));
+            cJSON_AddItemToArray(saved, cJSON_Duplicate(item, 1));
+        }
+    }
+
+    Settings settings("iot_rules", true);
+    if (rules_.empty()) {
+        settings.EraseKey("rules");
+    } else {
+        auto json = cJSON_PrintUnformatted(saved);
+        settings.SetString("rules", json);
+        cJSON_free(json);
+    }
+    cJSON_Delete(saved);
+    ESP_LOGI(TAG, "Installed %zu of %d rules", rules_.size(), cJSON_GetArraySize(rules));
+
+    Evaluate();
+    return rules_.size();
+}
+
+bool RuleEngine::ParseRule(const cJSON* json, Rule& rule) {
+    auto id = cJSON_GetObjectItem(json, "id");
+    rule.id = cJSON_IsString(id) ? id->valuestring : "";
+
+    auto& thing_manager = ThingManager::GetInstance();
+    auto when = cJSON_GetObjectItem(json, "when");
+    auto name = cJSON_GetObjectItem(when, "name");
+    auto property = cJSON_GetObjectItem(when, "property");
+    auto op = cJSON_GetObjectItem(when, "op");
+    auto value = cJSON_GetObjectItem(when, "value");
+    if (!cJSON_IsString(name) || !cJSON_IsString(property) || !cJSON_IsString(op) || value == nullptr) {
+        ESP_LOGE(TAG, "Rule %s: invalid condition", rule.id.c_str());
+        return false;
+    }
+    auto thing = thing_manager.FindThing(name->valuestring);
+    rule.property = thing != nullptr ? thing->FindProperty(property->valuestring) : nullptr;
+    if (rule.property == nullptr) {
+        ESP_LOGE(TAG, "Rule %s: property %s.%s not found", rule.id.c_str(), name->valuestring, property->valuestring);
+        return false;
+    }
+    if (!ParseOperator(op->valuestring, rule.op)) {
+        ESP_LOGE(TAG, "Rule %s: unknown operator %s", rule.id.c_str(), op->valuestring);
+        return false;
+    }
+    if (rule.property->type() == kValueTypeString) {
+        if (!cJSON_IsString(value) || (rule.op != kRuleOperatorEqual && rule.op != kRuleOperatorNotEqual)) {
+            ESP_LOGE(TAG, "Rule %s: string properties only support == and !=", rule.id.c_str());
+            return false;
+        }
+        rule.string_value = value->valuestring;
+    } else if (cJSON_IsBool(value)) {
+        rule.value = cJSON_IsTrue(value) ? 1 : 0;
+    } else if (cJSON_IsNumber(value)) {
+        rule.value = value->valueint;
+    } else {
+        ESP_LOGE(TAG, "Rule %s: invalid value", rule.id.c_str());
+        return false;
+    }
+
+    auto hours = cJSON_GetObjectItem(json, "hours");
+    if (hours != nullptr) {
+        auto from = cJSON_GetArrayItem(hours, 0);
+        auto to = cJSON_GetArrayItem(hours, 1);
+        if (!cJSON_IsNumber(from) || !cJSON_IsNumber(to) || from->valueint < 0 || from->valueint > 23 ||
+            to->valueint < 0 || to->valueint > 24) {
+            ESP_LOGE(TAG, "Rule %s: hours must be [from, to]", rule.id.c_str());
+            return false;
+        }
+        rule.from_hour = from->valueint;
+        rule.to_hour = to->valueint;
+    }
+
+    // The action is checked like a server command now, so firing it later cannot fail on a typo
+    auto then = cJSON_GetObjectItem(json, "then");
+    auto action_name = cJSON_GetObjectItem(then, "name");
+    auto action_thing = cJSON_IsString(action_name) ? thing_manager.FindThing(action_name->valuestring) : nullptr;
+    if (action_thing == nullptr) {
+        ESP_LOGE(TAG, "Rule %s: action thing not found", rule.id.c_str());
+        return false;
+    }
+    const Method* method = nullptr;
+    ParameterList parameters;
+    auto result = action_thing->PrepareInvoke(then, method, parameters);
+    if (result != kInvokeOk) {
+        ESP_LOGE(TAG, "Rule %s: invalid action, %s", rule.id.c_str(), InvokeResultToString(result));
+        return false;
+    }
+    auto action = cJSON_PrintUnformatted(then);
+    rule.action = action;
+    cJSON_free(action);
+    return true;
+}
+
+bool RuleEngine::Match(const Rule& rule) const {
+    auto property = rule.property;
+    if (property->type() == kValueTypeString) {
+        bool equal = property->string() == rule.string_value;
+        return rule.op == kRuleOperatorEqual ? equal : !equal;
+    }
+    int value = property->type() == kValueTypeBoolean ? (property->boolean() ? 1 : 0) : property->number();
+    switch (rule.op) {
+        case kRuleOperatorLess:
+            return value < rule.value;
+        case kRuleOperatorLessEqual:
+            return value <= rule.value;
+        case kRuleOperatorEqual:
+            return value == rule.value;
+        case kRuleOperatorNotEqual:
+            return value != rule.value;
+        case kRuleOperatorGreaterEqual:
+            return value >= rule.value;
+        case kRuleOperatorGreater:
+            return value > rule.value;
+    }
+    return false;
+}
+
+bool RuleEngine::InHours(const Rule& rule) const {
+    if (rule.from_hour < 0) {
+        return true;
+    }
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    // Before the clock is synchronized the hour is meaningless
+    if (tm.tm_year < 2024 - 1900) {
+        return false;
+    }
+    if (rule.from_hour <= rule.to_hour) {
+        return tm.tm_hour >= rule.from_hour && tm.tm_hour < rule.to_hour;
+    }
+    return tm.tm_hour >= rule.from_hour || tm.tm_hour < rule.to_hour;
+}
+
+void RuleEngine::Evaluate() {
+    if (rules_.empty()) {
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    int fired = 0;
+    for (auto& rule : rules_) {
+        // Properties with a TTL are only read again when it has passed, so this stays cheap
+        rule.property->Refresh();
+        bool matched = InHours(rule) && Match(rule);
+        if (matched && !rule.matched) {
+            auto command = cJSON_Parse(rule.action.c_str());
+            if (command != nullptr) {
+                ThingManager::GetInstance().Invoke(command);
+                cJSON_Delete(command);
+            }
+            rule.fire_count++;
+            fired++;
+            ESP_LOGI(TAG, "Rule %s fired (%d times)", rule.id.c_str(), rule.fire_count);
+        }
+        rule.matched = matched;
+    }
+
+    auto evaluate_time = esp_timer_get_time() - start_time;
+    if (evaluate_time > max_evaluate_time_) {
+        max_evaluate_time_ = evaluate_time;
+    }
+    ESP_LOGD(TAG, "Evaluated %zu rules in %lld us (max %lld us), %d fired", rules_.size(), evaluate_time,
+        max_evaluate_time_, fired);
+}
+
+} // namespace iot
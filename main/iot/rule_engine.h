@@ -0,0 +1,76 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include "thing.h"
+
+#include <cJSON.h>
+
+#include <string>
+#include <vector>
+
+#define RULE_ENGINE_MAX_RULES 16
+
+namespace iot {
+
+enum RuleOperator {
+    kRuleOperatorLess,
+    kRuleOperatorLessEqual,
+    kRuleOperatorEqual,
+    kRuleOperatorNotEqual,
+    kRuleOperatorGreaterEqual,
+    kRuleOperatorGreater
+};
+
+// Runs a thing method when a property of another (or the same) thing meets a condition,
+// without a round trip to the server. A rule fires once each time its condition becomes true.
+// Example:
+// {"id":"night","when":{"name":"Speaker","property":"volume","op":">","value":40},
+//  "hours":[22,7],"then":{"name":"Speaker","method":"SetVolume","parameters":{"volume":40}}}
+class RuleEngine {
+public:
+    static RuleEngine& GetInstance() {
+        static RuleEngine instance;
+        return instance;
+    }
+    RuleEngine(const RuleEngine&) = delete;
+    RuleEngine& operator=(const RuleEngine&) = delete;
+
+    // Restores the rules saved in NVS, call after the things are added
+    void Load();
+    // Replaces all rules with the given array and saves the ones that are valid, returns how many were installed.
+    // Returns -1 and keeps the current rules if the payload is not an array
+    int Install(const cJSON* rules);
+    // Checks every rule against the current property values, called on the main loop when a state may have changed
+    void Evaluate();
+    int rule_count() const { return rules_.size(); }
+
+private:
+    struct Rule {
+        std::string id;
+        Property* property;
+        RuleOperator op;
+        int value;
+        std::string string_value;
+        // Local hours [from_hour, to_hour), wrapping past midnight, -1 for always
+        int from_hour = -1;
+        int to_hour = -1;
+        // The command passed to ThingManager::Invoke when the rule fires
+        std::string action;
+        bool matched = false;
+        int fire_count = 0;
+    };
+
+    RuleEngine() = default;
+    ~RuleEngine() = default;
+
+    std::vector<Rule> rules_;
+    int64_t max_evaluate_time_ = 0;
+
+    bool ParseRule(const cJSON* json, Rule& rule);
+    bool Match(const Rule& rule) const;
+    bool InHours(const Rule& rule) const;
+};
+
+} // namespace iot
+
+#endif // RULE_ENGINE_H
@@ -1,5 +1,4 @@
 #include "thing.h"
-#include "application.h"
 
 #include <esp_log.h>
 
@@ -36,41 +35,86 @@ std::string Thing::GetDescriptorJson() {
     return json_str;
 }
 
-std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+bool Thing::WriteStateJson(JsonWriter& writer, bool delta) {
+    if (!properties_.Refresh() && delta) {
+        return false;
+    }
+    writer.BeginObject();
+    writer.Key("name").String(name_);
+    writer.Key("state");
+    properties_.WriteState(writer, delta);
+    writer.EndObject();
+    return true;
 }
 
-void Thing::Invoke(const cJSON* command) {
+InvokeResult Thing::PrepareInvoke(const cJSON* command, const Method*& method, ParameterList& parameters) {
     auto method_name = cJSON_GetObjectItem(command, "method");
-    auto input_params = cJSON_GetObjectItem(command, "parameters");
+    if (!cJSON_IsString(method_name)) {
+        ESP_LOGE(TAG, "Missing method for %s", name_.c_str());
+        return kInvokeMethodNotFound;
+    }
+    method = methods_.Find(method_name->valuestring);
+    if (method == nullptr) {
+        ESP_LOGE(TAG, "Method not found: %s.%s", name_.c_str(), method_name->valuestring);
+        return kInvokeMethodNotFound;
+    }
 
-    try {
-        auto& method = methods_[method_name->valuestring];
-        for (auto& param : method.parameters()) {
-            auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
-            if (param.required() && input_param == nullptr) {
-                throw std::runtime_error("Parameter " + param.name() + " is required");
-            }
-            if (param.type() == kValueTypeNumber) {
-                param.set_number(input_param->valueint);
-            } else if (param.type() == kValueTypeString) {
-                param.set_string(input_param->valuestring);
-            } else if (param.type() == kValueTypeBoolean) {
-                param.set_boolean(input_param->valueint == 1);
+    // Fill a copy so a command arriving before the previous one ran does not overwrite its parameters
+    auto input_params = cJSON_GetObjectItem(command, "parameters");
+    parameters = method->parameters();
+    for (auto& param : parameters) {
+        auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
+        if (input_param == nullptr) {
+            if (param.required()) {
+                ESP_LOGE(TAG, "Parameter %s of %s.%s is required", param.name().c_str(), name_.c_str(), method->name().c_str());
+                return kInvokeMissingParameter;
             }
+            continue;
         }
+        if (param.type() == kValueTypeNumber && cJSON_IsNumber(input_param)) {
+            param.set_number(input_param->valueint);
+        } else if (param.type() == kValueTypeString && cJSON_IsString(input_param)) {
+            param.set_string(input_param->valuestring);
+        } else if (param.type() == kValueTypeBoolean && cJSON_IsBool(input_param)) {
+            param.set_boolean(cJSON_IsTrue(input_param));
+        } else if (param.type() == kValueTypeBoolean && cJSON_IsNumber(input_param)) {
+            param.set_boolean(input_param->valueint == 1);
+        } else {
+            ESP_LOGE(TAG, "Parameter %s of %s.%s has the wrong type", param.name().c_str(), name_.c_str(), method->name().c_str());
+            return kInvokeInvalidParameter;
+        }
+    }
+    return kInvokeOk;
+}
+
+const Parameter& ParameterList::operator[](std::string_view name) const {
+    auto parameter = Find(name);
+    if (parameter == nullptr) {
+        static const Parameter empty_parameter("", "", kValueTypeNumber, false);
+        ESP_LOGE(TAG, "Parameter not found: %.*s", (int)name.size(), name.data());
+        return empty_parameter;
+    }
+    return *parameter;
+}
 
-        Application::GetInstance().Schedule([&method]() {
-            method.Invoke();
-        });
-    } catch (const std::runtime_error& e) {
-        ESP_LOGE(TAG, "Method not found: %s", method_name->valuestring);
-        return;
+const char* InvokeResultToString(InvokeResult result) {
+    switch (result) {
+        case kInvokeOk:
+            return "ok";
+        case kInvokeThingNotFound:
+            return "thing_not_found";
+        case kInvokeMethodNotFound:
+            return "method_not_found";
+        case kInvokeMissingParameter:
+            return "missing_parameter";
+        case kInvokeInvalidParameter:
+            return "invalid_parameter";
+        case kInvokeQueueFull:
+            return "queue_full";
+        case kInvokeSuperseded:
+            return "superseded";
     }
+    return "unknown";
 }
 
 
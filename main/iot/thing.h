@@ -5,8 +5,11 @@
 #include <map>
 #include <functional>
 #include <vector>
-#include <stdexcept>
 #include <cJSON.h>
+#include <esp_timer.h>
+
+#include "json_writer.h"
+#include "string_hash.h"
 
 namespace iot {
 
@@ -16,30 +19,96 @@ enum ValueType {
     kValueTypeString
 };
 
+// Lookups by name never throw, a miss is reported with one of these
+enum InvokeResult {
+    kInvokeOk,
+    kInvokeThingNotFound,
+    kInvokeMethodNotFound,
+    kInvokeMissingParameter,
+    kInvokeInvalidParameter,
+    kInvokeQueueFull,
+    kInvokeSuperseded
+};
+
+const char* InvokeResultToString(InvokeResult result);
+
+// Property values are cached. Getters are called on Refresh(), at most once per TTL when one is given,
+// and every change of the cached value bumps the version. Whatever has a newer version than the
+// last report is dirty and goes into the next state delta.
 class Property {
 private:
     std::string name_;
+    uint32_t name_hash_;
     std::string description_;
     ValueType type_;
     std::function<bool()> boolean_getter_;
     std::function<int()> number_getter_;
     std::function<std::string()> string_getter_;
+    int ttl_ms_;
+
+    bool boolean_value_ = false;
+    int number_value_ = 0;
+    std::string string_value_;
+    int64_t refresh_time_ = 0;
+    bool expired_ = true;
+    uint32_t version_ = 0;
+    uint32_t sent_version_ = 0;
 
 public:
-    Property(const std::string& name, const std::string& description, std::function<bool()> getter) :
-        name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter) {}
-    Property(const std::string& name, const std::string& description, std::function<int()> getter) :
-        name_(name), description_(description), type_(kValueTypeNumber), number_getter_(getter) {}
-    Property(const std::string& name, const std::string& description, std::function<std::string()> getter) :
-        name_(name), description_(description), type_(kValueTypeString), string_getter_(getter) {}
+    Property(const std::string& name, const std::string& description, std::function<bool()> getter, int ttl_ms = 0) :
+        name_(name), name_hash_(StringHash(name)), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter), ttl_ms_(ttl_ms) {}
+    Property(const std::string& name, const std::string& description, std::function<int()> getter, int ttl_ms = 0) :
+        name_(name), name_hash_(StringHash(name)), description_(description), type_(kValueTypeNumber), number_getter_(getter), ttl_ms_(ttl_ms) {}
+    Property(const std::string& name, const std::string& description, std::function<std::string()> getter, int ttl_ms = 0) :
+        name_(name), name_hash_(StringHash(name)), description_(description), type_(kValueTypeString), string_getter_(getter), ttl_ms_(ttl_ms) {}
 
     const std::string& name() const { return name_; }
+    uint32_t name_hash() const { return name_hash_; }
     const std::string& description() const { return description_; }
     ValueType type() const { return type_; }
+    uint32_t version() const { return version_; }
+    bool dirty() const { return version_ != sent_version_; }
+
+    // The values seen by the last Refresh()
+    bool boolean() const { return boolean_value_; }
+    int number() const { return number_value_; }
+    const std::string& string() const { return string_value_; }
+
+    // Returns true if the value changed
+    bool Refresh() {
+        auto now = esp_timer_get_time();
+        if (!expired_ && ttl_ms_ > 0 && now - refresh_time_ < ttl_ms_ * 1000LL) {
+            return false;
+        }
+        refresh_time_ = now;
+        expired_ = false;
 
-    bool boolean() const { return boolean_getter_(); }
-    int number() const { return number_getter_(); }
-    std::string string() const { return string_getter_(); }
+        bool changed = version_ == 0;
+        if (type_ == kValueTypeBoolean) {
+            bool value = boolean_getter_();
+            changed |= value != boolean_value_;
+            boolean_value_ = value;
+        } else if (type_ == kValueTypeNumber) {
+            int value = number_getter_();
+            changed |= value != number_value_;
+            number_value_ = value;
+        } else if (type_ == kValueTypeString) {
+            auto value = string_getter_();
+            if (value != string_value_) {
+                changed = true;
+                string_value_ = std::move(value);
+            }
+        }
+        if (changed) {
+            version_++;
+        }
+        return changed;
+    }
+
+    // Call the getter on the next Refresh() even if the TTL has not passed.
+    // Like Refresh(), only called on the main loop, see ThingManager::WorkerTask
+    void Invalidate() { expired_ = true; }
+    void MarkSent() { sent_version_ = version_; }
 
     std::string GetDescriptorJson() {
         std::string json_str = "{";
@@ -55,15 +124,15 @@ public:
         return json_str;
     }
 
-    std::string GetStateJson() {
+    void WriteState(JsonWriter& writer) const {
+        writer.Key(name_);
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            writer.Bool(boolean_value_);
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
-        } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            writer.Int(number_value_);
+        } else {
+            writer.String(string_value_);
         }
-        return "null";
     }
 };
 
@@ -75,23 +144,45 @@ public:
     PropertyList() = default;
     PropertyList(const std::vector<Property>& properties) : properties_(properties) {}
 
-    void AddBooleanProperty(const std::string& name, const std::string& description, std::function<bool()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    void AddBooleanProperty(const std::string& name, const std::string& description, std::function<bool()> getter, int ttl_ms = 0) {
+        properties_.push_back(Property(name, description, getter, ttl_ms));
     }
-    void AddNumberProperty(const std::string& name, const std::string& description, std::function<int()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    void AddNumberProperty(const std::string& name, const std::string& description, std::function<int()> getter, int ttl_ms = 0) {
+        properties_.push_back(Property(name, description, getter, ttl_ms));
     }
-    void AddStringProperty(const std::string& name, const std::string& description, std::function<std::string()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    void AddStringProperty(const std::string& name, const std::string& description, std::function<std::string()> getter, int ttl_ms = 0) {
+        properties_.push_back(Property(name, description, getter, ttl_ms));
     }
 
-    const Property& operator[](const std::string& name) const {
+    // Entries carry the hash of their name, so a lookup compares integers before strings
+    Property* Find(std::string_view name) {
+        uint32_t hash = StringHash(name);
         for (auto& property : properties_) {
-            if (property.name() == name) {
-                return property;
+            if (property.name_hash() == hash && property.name() == name) {
+                return &property;
             }
         }
-        throw std::runtime_error("Property not found: " + name);
+        return nullptr;
+    }
+
+    // iterator
+    auto begin() { return properties_.begin(); }
+    auto end() { return properties_.end(); }
+
+    // Refreshes every property, returns true if any of them has not been reported yet
+    bool Refresh() {
+        bool dirty = false;
+        for (auto& property : properties_) {
+            property.Refresh();
+            dirty |= property.dirty();
+        }
+        return dirty;
+    }
+
+    void Invalidate() {
+        for (auto& property : properties_) {
+            property.Invalidate();
+        }
     }
 
     std::string GetDescriptorJson() {
@@ -106,45 +197,51 @@ public:
         return json_str;
     }
 
-    std::string GetStateJson() {
-        std::string json_str = "{";
+    // With delta only the dirty properties are written, everything written is marked as sent
+    void WriteState(JsonWriter& writer, bool delta) {
+        writer.BeginObject();
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            if (delta && !property.dirty()) {
+                continue;
+            }
+            property.WriteState(writer);
+            property.MarkSent();
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
 class Parameter {
 private:
     std::string name_;
+    uint32_t name_hash_;
     std::string description_;
     ValueType type_;
     bool required_;
-    bool boolean_;
-    int number_;
+    bool has_value_ = false;
+    bool boolean_ = false;
+    int number_ = 0;
     std::string string_;
 
 public:
     Parameter(const std::string& name, const std::string& description, ValueType type, bool required = true) :
-        name_(name), description_(description), type_(type), required_(required) {}
+        name_(name), name_hash_(StringHash(name)), description_(description), type_(type), required_(required) {}
 
     const std::string& name() const { return name_; }
+    uint32_t name_hash() const { return name_hash_; }
     const std::string& description() const { return description_; }
     ValueType type() const { return type_; }
     bool required() const { return required_; }
+    // False for an optional parameter the command left out, the value is then the zero default
+    bool has_value() const { return has_value_; }
 
     bool boolean() const { return boolean_; }
     int number() const { return number_; }
     const std::string& string() const { return string_; }
 
-    void set_boolean(bool value) { boolean_ = value; }
-    void set_number(int value) { number_ = value; }
-    void set_string(const std::string& value) { string_ = value; }
+    void set_boolean(bool value) { boolean_ = value; has_value_ = true; }
+    void set_number(int value) { number_ = value; has_value_ = true; }
+    void set_string(const std::string& value) { string_ = value; has_value_ = true; }
 
     std::string GetDescriptorJson() {
         std::string json_str = "{";
@@ -172,15 +269,19 @@ public:
         parameters_.push_back(parameter);
     }
 
-    const Parameter& operator[](const std::string& name) const {
+    const Parameter* Find(std::string_view name) const {
+        uint32_t hash = StringHash(name);
         for (auto& parameter : parameters_) {
-            if (parameter.name() == name) {
-                return parameter;
+            if (parameter.name_hash() == hash && parameter.name() == name) {
+                return &parameter;
             }
         }
-        throw std::runtime_error("Parameter not found: " + name);
+        return nullptr;
     }
 
+    // Method callbacks index parameters by name, a typo there gets an empty parameter and a log instead of an exception
+    const Parameter& operator[](std::string_view name) const;
+
     // iterator
     auto begin() { return parameters_.begin(); }
     auto end() { return parameters_.end(); }
@@ -201,17 +302,27 @@ public:
 class Method {
 private:
     std::string name_;
+    uint32_t name_hash_;
     std::string description_;
     ParameterList parameters_;
     std::function<void(const ParameterList&)> callback_;
+    bool coalesce_;
+    bool main_loop_;
 
 public:
-    Method(const std::string& name, const std::string& description, const ParameterList& parameters, std::function<void(const ParameterList&)> callback) :
-        name_(name), description_(description), parameters_(parameters), callback_(callback) {}
+    Method(const std::string& name, const std::string& description, const ParameterList& parameters, std::function<void(const ParameterList&)> callback, bool coalesce = false, bool main_loop = false) :
+        name_(name), name_hash_(StringHash(name)), description_(description), parameters_(parameters), callback_(callback), coalesce_(coalesce), main_loop_(main_loop) {}
 
     const std::string& name() const { return name_; }
+    uint32_t name_hash() const { return name_hash_; }
     const std::string& description() const { return description_; }
-    ParameterList& parameters() { return parameters_; }
+    // The declared parameters, each invocation works on its own copy
+    const ParameterList& parameters() const { return parameters_; }
+    // A queued call that has not started yet is replaced by a newer call of the same method
+    bool coalesce() const { return coalesce_; }
+    // Methods run on the IoT worker. Those that touch state the main loop also uses without a lock,
+    // like the audio codec, run on the main loop instead (the worker still waits for them)
+    bool main_loop() const { return main_loop_; }
 
     std::string GetDescriptorJson() {
         std::string json_str = "{";
@@ -221,8 +332,8 @@ public:
         return json_str;
     }
 
-    void Invoke() {
-        callback_(parameters_);
+    void Invoke(const ParameterList& parameters) const {
+        callback_(parameters);
     }
 };
 
@@ -234,17 +345,18 @@ public:
     MethodList() = default;
     MethodList(const std::vector<Method>& methods) : methods_(methods) {}
 
-    void AddMethod(const std::string& name, const std::string& description, const ParameterList& parameters, std::function<void(const ParameterList&)> callback) {
-        methods_.push_back(Method(name, description, parameters, callback));
+    void AddMethod(const std::string& name, const std::string& description, const ParameterList& parameters, std::function<void(const ParameterList&)> callback, bool coalesce = false, bool main_loop = false) {
+        methods_.push_back(Method(name, description, parameters, callback, coalesce, main_loop));
     }
 
-    Method& operator[](const std::string& name) {
+    const Method* Find(std::string_view name) const {
+        uint32_t hash = StringHash(name);
         for (auto& method : methods_) {
-            if (method.name() == name) {
-                return method;
+            if (method.name_hash() == hash && method.name() == name) {
+                return &method;
             }
         }
-        throw std::runtime_error("Method not found: " + name);
+        return nullptr;
     }
 
     std::string GetDescriptorJson() {
@@ -263,15 +375,21 @@ public:
 class Thing {
 public:
     Thing(const std::string& name, const std::string& description) :
-        name_(name), description_(description) {}
+        name_(name), name_hash_(StringHash(name)), description_(description) {}
     virtual ~Thing() = default;
 
     virtual std::string GetDescriptorJson();
-    virtual std::string GetStateJson();
-    virtual void Invoke(const cJSON* command);
+    // Returns false without writing anything if delta is set and no property changed since the last report
+    virtual bool WriteStateJson(JsonWriter& writer, bool delta = false);
+    // Looks up the method and fills a copy of its parameters from the command, the call itself is left to the caller
+    virtual InvokeResult PrepareInvoke(const cJSON* command, const Method*& method, ParameterList& parameters);
 
     const std::string& name() const { return name_; }
+    uint32_t name_hash() const { return name_hash_; }
     const std::string& description() const { return description_; }
+    // Properties with a TTL are read again on the next report
+    void InvalidateState() { properties_.Invalidate(); }
+    Property* FindProperty(std::string_view name) { return properties_.Find(name); }
 
 protected:
     PropertyList properties_;
@@ -279,6 +397,7 @@ protected:
 
 private:
     std::string name_;
+    uint32_t name_hash_;
     std::string description_;
 };
 
@@ -1,6 +1,8 @@
 #include "thing_manager.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
 
 #define TAG "ThingManager"
 
@@ -8,12 +10,53 @@ namespace iot {
 
 void ThingManager::AddThing(Thing* thing) {
     things_.push_back(thing);
+    descriptors_.clear();
+    descriptors_hash_.clear();
+}
+
+Thing* ThingManager::FindThing(std::string_view name) {
+    uint32_t hash = StringHash(name);
+    for (auto& thing : things_) {
+        if (thing->name_hash() == hash && thing->name() == name) {
+            return thing;
+        }
+    }
+    return nullptr;
+}
+
+const std::vector<std::string>& ThingManager::GetDescriptors() {
+    if (descriptors_.empty()) {
+        descriptors_.reserve(things_.size());
+        for (auto& thing : things_) {
+            descriptors_.push_back(thing->GetDescriptorJson());
+        }
+    }
+    return descriptors_;
+}
+
+const std::string& ThingManager::GetDescriptorsHash() {
+    if (descriptors_hash_.empty()) {
+        auto start_time = esp_timer_get_time();
+        auto json = GetDescriptorsJson();
+        uint8_t digest[32];
+        mbedtls_sha256((const unsigned char*)json.data(), json.size(), digest, 0);
+
+        static const char hex_chars[] = "0123456789abcdef";
+        descriptors_hash_.reserve(sizeof(digest) * 2);
+        for (auto byte : digest) {
+            descriptors_hash_.push_back(hex_chars[byte >> 4]);
+            descriptors_hash_.push_back(hex_chars[byte & 0xF]);
+        }
+        ESP_LOGI(TAG, "Descriptors of %zu things, %zu bytes, hashed in %lld us", things_.size(), json.size(),
+            esp_timer_get_time() - start_time);
+    }
+    return descriptors_hash_;
 }
 
 std::string ThingManager::GetDescriptorsJson() {
     std::string json_str = "[";
-    for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+    for (auto& descriptor : GetDescriptors()) {
+        json_str += descriptor + ",";
     }
     if (json_str.back() == ',') {
         json_str.pop_back();
@@ -23,40 +66,186 @@ std::string ThingManager::GetDescriptorsJson() {
 }
 
 bool ThingManager::GetStatesJson(std::string& json, bool delta) {
-    if (!delta) {
-        last_states_.clear();
-    }
+    auto start_time = esp_timer_get_time();
     bool changed = false;
-    json = "[";
-    // 枚举thing，获取每个thing的state，如果发生变化，则更新，保存到last_states_
-    // 如果delta为true，则只返回变化的部分
+    json.clear();
+    JsonWriter writer(json);
+    writer.BeginArray();
     for (auto& thing : things_) {
-        std::string state = thing->GetStateJson();
-        if (delta) {
-            // 如果delta为true，则只返回变化的部分
-            auto it = last_states_.find(thing->name());
-            if (it != last_states_.end() && it->second == state) {
-                continue;
-            }
+        if (thing->WriteStateJson(writer, delta)) {
             changed = true;
-            last_states_[thing->name()] = state;
         }
-        json += state + ",";
     }
-    if (json.back() == ',') {
-        json.pop_back();
-    }
-    json += "]";
+    writer.EndArray();
+    ESP_LOGD(TAG, "States of %zu things in %lld us, %zu bytes%s", things_.size(), esp_timer_get_time() - start_time,
+        json.size(), delta ? " (delta)" : "");
     return changed;
 }
 
-void ThingManager::Invoke(const cJSON* command) {
+void ThingManager::OnCommandAck(std::function<void(const IotCommandAck& ack)> callback) {
+    on_command_ack_ = callback;
+}
+
+void ThingManager::OnStateChanged(std::function<void()> callback) {
+    on_state_changed_ = callback;
+}
+
+void ThingManager::NotifyStateChanged() {
+    if (on_state_changed_ != nullptr) {
+        on_state_changed_();
+    }
+}
+
+void ThingManager::OnMainLoop(std::function<void(std::function<void()> callback)> schedule) {
+    schedule_main_loop_ = schedule;
+}
+
+// Called from the IoT worker, runs the callback in place when no main loop is set
+void ThingManager::RunOnMainLoop(std::function<void()> callback, bool wait) {
+    if (schedule_main_loop_ == nullptr) {
+        callback();
+        return;
+    }
+    if (!wait) {
+        schedule_main_loop_(callback);
+        return;
+    }
+
+    bool done = false;
+    schedule_main_loop_([this, &callback, &done]() {
+        callback();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done = true;
+        }
+        condition_variable_.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [&done]() { return done; });
+}
+
+void ThingManager::Ack(const std::string& id, InvokeResult result, int64_t queue_time, int64_t exec_time) {
+    if (id.empty() || on_command_ack_ == nullptr) {
+        return;
+    }
+    on_command_ack_(IotCommandAck{id, result, (int)(queue_time / 1000), (int)(exec_time / 1000)});
+}
+
+InvokeResult ThingManager::Invoke(const cJSON* command) {
+    // The server adds an id to the commands it wants to hear back about
+    std::string id;
+    auto id_item = cJSON_GetObjectItem(command, "id");
+    if (cJSON_IsString(id_item)) {
+        id = id_item->valuestring;
+    } else if (cJSON_IsNumber(id_item)) {
+        id = std::to_string(id_item->valueint);
+    }
+
     auto name = cJSON_GetObjectItem(command, "name");
-    for (auto& thing : things_) {
-        if (thing->name() == name->valuestring) {
-            thing->Invoke(command);
-            return;
+    if (!cJSON_IsString(name)) {
+        ESP_LOGE(TAG, "Command without thing name");
+        Ack(id, kInvokeThingNotFound);
+        return kInvokeThingNotFound;
+    }
+    auto thing = FindThing(name->valuestring);
+    if (thing == nullptr) {
+        ESP_LOGW(TAG, "Thing not found: %s", name->valuestring);
+        Ack(id, kInvokeThingNotFound);
+        return kInvokeThingNotFound;
+    }
+
+    const Method* method = nullptr;
+    ParameterList parameters;
+    auto result = thing->PrepareInvoke(command, method, parameters);
+    if (result != kInvokeOk) {
+        Ack(id, result);
+        return result;
+    }
+
+    std::string superseded_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (worker_task_handle_ == nullptr) {
+            xTaskCreate([](void* arg) {
+                auto manager = (ThingManager*)arg;
+                manager->WorkerTask();
+            }, "iot_worker", IOT_WORKER_STACK_SIZE, this, 2, &worker_task_handle_);
         }
+
+        // Only calls that have not started can be replaced, they keep their place in the queue
+        Command* pending = nullptr;
+        if (method->coalesce()) {
+            for (auto& queued : commands_) {
+                if (queued.thing == thing && queued.method == method) {
+                    pending = &queued;
+                    break;
+                }
+            }
+        }
+        if (pending != nullptr) {
+            superseded_id = std::move(pending->id);
+            pending->id = id;
+            pending->parameters = std::move(parameters);
+            pending->enqueue_time = esp_timer_get_time();
+            superseded_count_++;
+        } else if (commands_.size() >= IOT_COMMAND_QUEUE_SIZE) {
+            ESP_LOGW(TAG, "Command queue full, drop %s.%s", thing->name().c_str(), method->name().c_str());
+            result = kInvokeQueueFull;
+        } else {
+            commands_.push_back(Command{id, thing, method, std::move(parameters), esp_timer_get_time()});
+        }
+    }
+    condition_variable_.notify_one();
+
+    if (result != kInvokeOk) {
+        Ack(id, result);
+    } else if (!superseded_id.empty()) {
+        Ack(superseded_id, kInvokeSuperseded);
+    }
+    return result;
+}
+
+// One worker runs every call in arrival order, so calls on the same thing never overlap.
+// Main loop methods are handed to the main loop and waited for, so the order still holds.
+void ThingManager::WorkerTask() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_variable_.wait(lock, [this]() { return !commands_.empty(); });
+        Command command = std::move(commands_.front());
+        commands_.pop_front();
+        lock.unlock();
+
+        auto start_time = esp_timer_get_time();
+        if (command.method->main_loop()) {
+            RunOnMainLoop([&command]() { command.method->Invoke(command.parameters); }, true);
+        } else {
+            command.method->Invoke(command.parameters);
+        }
+        auto end_time = esp_timer_get_time();
+        auto queue_time = start_time - command.enqueue_time;
+        auto exec_time = end_time - start_time;
+
+        lock.lock();
+        executed_count_++;
+        if (exec_time > max_exec_time_) {
+            max_exec_time_ = exec_time;
+        }
+        int executed_count = executed_count_;
+        int superseded_count = superseded_count_;
+        int64_t max_exec_time = max_exec_time_;
+        lock.unlock();
+        ESP_LOGI(TAG, "%s.%s queued %lld ms, ran %lld ms (executed %d, superseded %d, max %lld ms)",
+            command.thing->name().c_str(), command.method->name().c_str(), queue_time / 1000, exec_time / 1000,
+            executed_count, superseded_count, max_exec_time / 1000);
+        Ack(command.id, kInvokeOk, queue_time, exec_time);
+
+        // A method almost always changes a property, report it without waiting for the next poll.
+        // Properties are refreshed on the main loop, so they are invalidated there too.
+        auto thing = command.thing;
+        RunOnMainLoop([this, thing]() {
+            thing->InvalidateState();
+            NotifyStateChanged();
+        }, false);
     }
 }
 
@@ -5,14 +5,30 @@
 #include "thing.h"
 
 #include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <vector>
 #include <memory>
 #include <functional>
-#include <map>
+#include <string>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+
+#define IOT_COMMAND_QUEUE_SIZE 8
+#define IOT_WORKER_STACK_SIZE 4096
 
 namespace iot {
 
+// Sent back to the server for every command that carries an id
+struct IotCommandAck {
+    std::string id;
+    InvokeResult result;
+    int queue_ms;
+    int exec_ms;
+};
+
 class ThingManager {
 public:
     static ThingManager& GetInstance() {
@@ -23,17 +39,56 @@ public:
     ThingManager& operator=(const ThingManager&) = delete;
 
     void AddThing(Thing* thing);
+    Thing* FindThing(std::string_view name);
 
+    // Descriptors do not change once the board has added its things, so they are built and hashed once
+    const std::vector<std::string>& GetDescriptors();
+    const std::string& GetDescriptorsHash();
     std::string GetDescriptorsJson();
+    // With delta only things and properties that changed since the last report are included
     bool GetStatesJson(std::string& json, bool delta = false);
-    void Invoke(const cJSON* command);
+    // Validates the command and queues it for the IoT worker, so slow things never block the caller
+    InvokeResult Invoke(const cJSON* command);
+    // Called from the IoT worker or the caller of Invoke
+    void OnCommandAck(std::function<void(const IotCommandAck& ack)> callback);
+    // Things call NotifyStateChanged when a property changes on its own, the reports are coalesced by the listener
+    void OnStateChanged(std::function<void()> callback);
+    void NotifyStateChanged();
+    // Runs a callback on the main loop. Main loop methods and property invalidation go through it,
+    // without one they run on the IoT worker
+    void OnMainLoop(std::function<void(std::function<void()> callback)> schedule);
 
 private:
+    struct Command {
+        std::string id;
+        Thing* thing;
+        const Method* method;
+        ParameterList parameters;
+        int64_t enqueue_time;
+    };
+
     ThingManager() = default;
     ~ThingManager() = default;
 
     std::vector<Thing*> things_;
-    std::map<std::string, std::string> last_states_;
+    std::vector<std::string> descriptors_;
+    std::string descriptors_hash_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    std::deque<Command> commands_;
+    TaskHandle_t worker_task_handle_ = nullptr;
+    std::function<void(const IotCommandAck& ack)> on_command_ack_;
+    std::function<void()> on_state_changed_;
+    std::function<void(std::function<void()> callback)> schedule_main_loop_;
+    // Guarded by mutex_
+    int64_t max_exec_time_ = 0;
+    int executed_count_ = 0;
+    int superseded_count_ = 0;
+
+    void WorkerTask();
+    void RunOnMainLoop(std::function<void()> callback, bool wait);
+    void Ack(const std::string& id, InvokeResult result, int64_t queue_time = 0, int64_t exec_time = 0);
 };
 
 
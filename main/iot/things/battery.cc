@@ -1,10 +1,15 @@
 #include "iot/thing.h"
+#include "iot/thing_manager.h"
 #include "board.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define TAG "Battery"
 
+// Reading the level goes through the ADC, the level does not move faster than this anyway
+#define BATTERY_LEVEL_TTL_MS 30000
+
 namespace iot {
 
 // 这里仅定义 Battery 的属性和方法，不包含具体的实现
@@ -13,9 +18,24 @@ private:
     int level_ = 0;
     bool charging_ = false;
     bool discharging_ = false;
+    esp_timer_handle_t check_timer_ = nullptr;
 
 public:
     Battery() : Thing("Battery", "电池管理") {
+        // The level changes on its own, a sync is asked for once the cached level expires.
+        // The sync reads the ADC on the main loop and sends the level only if it moved
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                ThingManager::GetInstance().NotifyStateChanged();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "battery_check",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &check_timer_));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(check_timer_, BATTERY_LEVEL_TTL_MS * 1000));
+
         // 定义设备的属性
         properties_.AddNumberProperty("level", "当前电量百分比", [this]() -> int {
             auto& board = Board::GetInstance();
@@ -23,7 +43,7 @@ public:
                 return level_;
             }
             return 0;
-        });
+        }, BATTERY_LEVEL_TTL_MS);
         properties_.AddBooleanProperty("charging", "是否充电中", [this]() -> int {
             return charging_;
         });
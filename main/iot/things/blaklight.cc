@@ -29,7 +29,7 @@ public:
             if (backlight) {
                 backlight->SetBrightness(brightness, true);
             }
-        });
+        }, true);
     }
 };
 
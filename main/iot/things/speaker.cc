@@ -19,12 +19,13 @@ public:
         });
 
         // 定义设备可以被远程执行的指令
+        // 音频编解码器也被主循环使用（按键调节音量），在主循环中执行
         methods_.AddMethod("SetVolume", "设置音量", ParameterList({
             Parameter("volume", "0到100之间的整数", kValueTypeNumber, true)
         }), [this](const ParameterList& parameters) {
             auto codec = Board::GetInstance().GetAudioCodec();
             codec->SetOutputVolume(static_cast<uint8_t>(parameters["volume"].number()));
-        });
+        }, true, true);
     }
 };
 
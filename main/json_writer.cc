@@ -0,0 +1,129 @@
+#include "json_writer.h"
+
+#include <esp_log.h>
+#include <charconv>
+
+#define TAG "JsonWriter"
+
+JsonWriter::JsonWriter(std::string& buffer) : buffer_(buffer) {
+}
+
+void JsonWriter::Separator() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0) {
+        return;
+    }
+    uint32_t bit = 1u << (depth_ - 1);
+    if (first_item_mask_ & bit) {
+        first_item_mask_ &= ~bit;
+    } else {
+        buffer_.push_back(',');
+    }
+}
+
+void JsonWriter::Begin(char c) {
+    Separator();
+    buffer_.push_back(c);
+    if (depth_ >= JSON_WRITER_MAX_DEPTH) {
+        ESP_LOGE(TAG, "JSON nesting too deep");
+        return;
+    }
+    depth_++;
+    first_item_mask_ |= 1u << (depth_ - 1);
+}
+
+void JsonWriter::End(char c) {
+    buffer_.push_back(c);
+    if (depth_ > 0) {
+        first_item_mask_ &= ~(1u << (depth_ - 1));
+        depth_--;
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Begin('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    End('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Begin('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    End(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    Separator();
+    AppendEscaped(key);
+    buffer_.push_back(':');
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    Separator();
+    AppendEscaped(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    Separator();
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr - digits);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    Separator();
+    buffer_.append(value ? "true" : "false");
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    Separator();
+    buffer_.append(json);
+    return *this;
+}
+
+void JsonWriter::AppendEscaped(std::string_view str) {
+    static const char hex_chars[] = "0123456789abcdef";
+    buffer_.push_back('"');
+    // Copy runs of plain characters in one go, UTF-8 bytes are passed through
+    size_t run_start = 0;
+    for (size_t i = 0; i < str.size(); i++) {
+        uint8_t c = str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        buffer_.append(str.data() + run_start, i - run_start);
+        run_start = i + 1;
+        switch (c) {
+            case '"': buffer_.append("\\\""); break;
+            case '\\': buffer_.append("\\\\"); break;
+            case '\b': buffer_.append("\\b"); break;
+            case '\f': buffer_.append("\\f"); break;
+            case '\n': buffer_.append("\\n"); break;
+            case '\r': buffer_.append("\\r"); break;
+            case '\t': buffer_.append("\\t"); break;
+            default:
+                buffer_.append("\\u00");
+                buffer_.push_back(hex_chars[c >> 4]);
+                buffer_.push_back(hex_chars[c & 0xF]);
+                break;
+        }
+    }
+    buffer_.append(str.data() + run_start, str.size() - run_start);
+    buffer_.push_back('"');
+}
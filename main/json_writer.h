@@ -0,0 +1,51 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#define JSON_WRITER_MAX_DEPTH 32
+
+// Serializes JSON straight into a caller supplied string, appending to what is already there.
+// Commas and string escaping are handled here, so call sites only describe the structure:
+//
+//     std::string message;
+//     message.reserve(128);
+//     JsonWriter writer(message);
+//     writer.BeginObject();
+//     writer.Key("type").String("listen");
+//     writer.Key("states").Raw(states);
+//     writer.EndObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& buffer);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    // Insert an already serialized JSON value
+    JsonWriter& Raw(std::string_view json);
+
+    inline std::string& buffer() {
+        return buffer_;
+    }
+
+private:
+    std::string& buffer_;
+    uint32_t first_item_mask_ = 0;
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void Separator();
+    void Begin(char c);
+    void End(char c);
+    void AppendEscaped(std::string_view str);
+};
+
+#endif // JSON_WRITER_H
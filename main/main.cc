@@ -7,6 +7,7 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "assets.h"
 
 #define TAG "main"
 
@@ -24,6 +25,11 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_USE_ASSETS_PARTITION
+    // Install a staged resource pack and map it before the display needs the images
+    Assets::GetInstance();
+#endif
+
     // Launch the application
     Application::GetInstance().Start();
     // The main thread will exit and release the stack memory
@@ -0,0 +1,143 @@
+#include "msgpack_writer.h"
+
+#include <esp_log.h>
+
+#define TAG "MsgPackWriter"
+
+MsgPackWriter::MsgPackWriter(std::string& buffer) : buffer_(buffer) {
+}
+
+void MsgPackWriter::AppendBigEndian(uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        buffer_.push_back((char)(value >> (i * 8)));
+    }
+}
+
+// Map entries are counted by their key, array entries by their value
+void MsgPackWriter::Item() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ > 0) {
+        counts_[depth_ - 1]++;
+    }
+}
+
+void MsgPackWriter::Begin(uint8_t header16) {
+    Item();
+    if (depth_ >= MSGPACK_WRITER_MAX_DEPTH) {
+        ESP_LOGE(TAG, "MessagePack nesting too deep");
+        return;
+    }
+    header_offsets_[depth_] = buffer_.size();
+    counts_[depth_] = 0;
+    depth_++;
+    buffer_.push_back(header16);
+    buffer_.append(2, '\0');
+}
+
+void MsgPackWriter::End(uint8_t fix_header) {
+    if (depth_ == 0) {
+        return;
+    }
+    depth_--;
+    size_t offset = header_offsets_[depth_];
+    uint16_t count = counts_[depth_];
+    if (count <= 15) {
+        buffer_[offset] = fix_header | count;
+        buffer_.erase(offset + 1, 2);
+    } else {
+        buffer_[offset + 1] = count >> 8;
+        buffer_[offset + 2] = count & 0xFF;
+    }
+}
+
+MsgPackWriter& MsgPackWriter::BeginObject() {
+    Begin(0xde);
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::EndObject() {
+    End(0x80);
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::BeginArray() {
+    Begin(0xdc);
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::EndArray() {
+    End(0x90);
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::Key(std::string_view key) {
+    String(key);
+    after_key_ = true;
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::String(std::string_view value) {
+    Item();
+    size_t size = value.size();
+    if (size < 32) {
+        buffer_.push_back(0xa0 | size);
+    } else if (size <= 0xFF) {
+        buffer_.push_back(0xd9);
+        AppendBigEndian(size, 1);
+    } else if (size <= 0xFFFF) {
+        buffer_.push_back(0xda);
+        AppendBigEndian(size, 2);
+    } else {
+        buffer_.push_back(0xdb);
+        AppendBigEndian(size, 4);
+    }
+    buffer_.append(value);
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::Int(int64_t value) {
+    Item();
+    if (value >= 0) {
+        if (value < 128) {
+            buffer_.push_back(value);
+        } else if (value <= 0xFF) {
+            buffer_.push_back(0xcc);
+            AppendBigEndian(value, 1);
+        } else if (value <= 0xFFFF) {
+            buffer_.push_back(0xcd);
+            AppendBigEndian(value, 2);
+        } else if (value <= 0xFFFFFFFFLL) {
+            buffer_.push_back(0xce);
+            AppendBigEndian(value, 4);
+        } else {
+            buffer_.push_back(0xcf);
+            AppendBigEndian(value, 8);
+        }
+    } else {
+        if (value >= -32) {
+            buffer_.push_back(0xe0 | (value & 0x1F));
+        } else if (value >= INT8_MIN) {
+            buffer_.push_back(0xd0);
+            AppendBigEndian(value, 1);
+        } else if (value >= INT16_MIN) {
+            buffer_.push_back(0xd1);
+            AppendBigEndian(value, 2);
+        } else if (value >= INT32_MIN) {
+            buffer_.push_back(0xd2);
+            AppendBigEndian(value, 4);
+        } else {
+            buffer_.push_back(0xd3);
+            AppendBigEndian(value, 8);
+        }
+    }
+    return *this;
+}
+
+MsgPackWriter& MsgPackWriter::Bool(bool value) {
+    Item();
+    buffer_.push_back(value ? 0xc3 : 0xc2);
+    return *this;
+}
@@ -0,0 +1,44 @@
+#ifndef MSGPACK_WRITER_H
+#define MSGPACK_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+#define MSGPACK_WRITER_MAX_DEPTH 8
+
+// Same interface as JsonWriter, but emits MessagePack, so one message builder serves both encodings.
+// Map and array sizes are not known up front: a 16-bit header is reserved when the container
+// starts and patched when it ends, shrinking to the one byte form for up to 15 entries.
+class MsgPackWriter {
+public:
+    explicit MsgPackWriter(std::string& buffer);
+
+    MsgPackWriter& BeginObject();
+    MsgPackWriter& EndObject();
+    MsgPackWriter& BeginArray();
+    MsgPackWriter& EndArray();
+    MsgPackWriter& Key(std::string_view key);
+    MsgPackWriter& String(std::string_view value);
+    MsgPackWriter& Int(int64_t value);
+    MsgPackWriter& Bool(bool value);
+
+    inline std::string& buffer() {
+        return buffer_;
+    }
+
+private:
+    std::string& buffer_;
+    size_t header_offsets_[MSGPACK_WRITER_MAX_DEPTH];
+    uint16_t counts_[MSGPACK_WRITER_MAX_DEPTH];
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void Item();
+    void Begin(uint8_t header16);
+    void End(uint8_t fix_header);
+    void AppendBigEndian(uint64_t value, int bytes);
+};
+
+#endif // MSGPACK_WRITER_H
@@ -2,25 +2,41 @@
 #include "system_info.h"
 #include "board.h"
 #include "settings.h"
+#include "ota_patch.h"
+#include "ota_inflate.h"
+#include "partition_utils.h"
 
 #include <cJSON.h>
 #include <esp_log.h>
 #include <esp_partition.h>
 #include <esp_ota_ops.h>
 #include <esp_app_format.h>
+#include <esp_heap_caps.h>
+#include <spi_flash_mmap.h>
+#include <esp_timer.h>
 
 #include <cstring>
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <memory>
 
 #define TAG "Ota"
 
 
 Ota::Ota() {
+    mbedtls_sha256_init(&image_sha256_);
+    mbedtls_sha256_init(&block_sha256_);
+    // The clock keeps running through a software reset, so the time set by an earlier check is still usable
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    has_server_time_ = tm.tm_year >= 2024 - 1900;
 }
 
 Ota::~Ota() {
+    mbedtls_sha256_free(&image_sha256_);
+    mbedtls_sha256_free(&block_sha256_);
 }
 
 void Ota::SetCheckVersionUrl(std::string check_version_url) {
@@ -50,6 +66,10 @@ bool Ota::CheckVersion() {
     }
 
     http->SetHeader("Content-Type", "application/json");
+    // Nothing needs to be parsed again if the server answers that the response did not change
+    if (!etag_.empty()) {
+        http->SetHeader("If-None-Match", etag_);
+    }
     std::string method = post_data_.length() > 0 ? "POST" : "GET";
     if (!http->Open(method, check_version_url_, post_data_)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
@@ -57,6 +77,13 @@ bool Ota::CheckVersion() {
         return false;
     }
 
+    if (http->GetStatusCode() == 304) {
+        ESP_LOGI(TAG, "Version info not modified");
+        http->Close();
+        delete http;
+        return true;
+    }
+    auto etag = http->GetResponseHeader("ETag");
     auto response = http->GetBody();
     http->Close();
     delete http;
@@ -70,6 +97,7 @@ bool Ota::CheckVersion() {
         ESP_LOGE(TAG, "Failed to parse JSON response");
         return false;
     }
+    etag_.clear();
 
     has_activation_code_ = false;
     cJSON *activation = cJSON_GetObjectItem(root, "activation");
@@ -100,7 +128,20 @@ bool Ota::CheckVersion() {
         has_mqtt_config_ = true;
     }
 
-    has_server_time_ = false;
+    // The last good connection settings are kept in NVS, the next boot connects without waiting for this check
+    cJSON *websocket = cJSON_GetObjectItem(root, "websocket");
+    if (websocket != NULL) {
+        Settings settings("websocket", true);
+        cJSON *item = NULL;
+        cJSON_ArrayForEach(item, websocket) {
+            if (item->type == cJSON_String) {
+                if (settings.GetString(item->string) != item->valuestring) {
+                    settings.SetString(item->string, item->valuestring);
+                }
+            }
+        }
+    }
+
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
     if (server_time != NULL) {
         cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
@@ -123,6 +164,34 @@ bool Ota::CheckVersion() {
         }
     }
 
+    assets_version_ = 0;
+    assets_url_.clear();
+    cJSON *assets = cJSON_GetObjectItem(root, "assets");
+    if (cJSON_IsObject(assets)) {
+        cJSON *assets_version = cJSON_GetObjectItem(assets, "version");
+        cJSON *assets_url = cJSON_GetObjectItem(assets, "url");
+        if (cJSON_IsNumber(assets_version) && cJSON_IsString(assets_url)) {
+            assets_version_ = assets_version->valueint;
+            assets_url_ = assets_url->valuestring;
+        }
+    }
+
+    model_version_.clear();
+    model_url_.clear();
+    model_sha256_.clear();
+    cJSON *model = cJSON_GetObjectItem(root, "model");
+    if (cJSON_IsObject(model)) {
+        cJSON *model_version = cJSON_GetObjectItem(model, "version");
+        cJSON *model_url = cJSON_GetObjectItem(model, "url");
+        cJSON *model_sha256 = cJSON_GetObjectItem(model, "sha256");
+        if (cJSON_IsString(model_version) && cJSON_IsString(model_url) && cJSON_IsString(model_sha256)) {
+            model_version_ = model_version->valuestring;
+            model_url_ = model_url->valuestring;
+            model_sha256_ = model_sha256->valuestring;
+        }
+    }
+    model_digest_ = ParseImageDigest(model);
+
     cJSON *firmware = cJSON_GetObjectItem(root, "firmware");
     if (firmware == NULL) {
         ESP_LOGE(TAG, "Failed to get firmware object");
@@ -144,7 +213,19 @@ bool Ota::CheckVersion() {
 
     firmware_version_ = version->valuestring;
     firmware_url_ = url->valuestring;
+    firmware_digest_ = ParseImageDigest(firmware);
+    firmware_patch_url_.clear();
+    cJSON *patch = cJSON_GetObjectItem(firmware, "patch");
+    if (cJSON_IsObject(patch)) {
+        cJSON *patch_url = cJSON_GetObjectItem(patch, "url");
+        cJSON *patch_from = cJSON_GetObjectItem(patch, "from");
+        if (cJSON_IsString(patch_url) && cJSON_IsString(patch_from) && current_version_ == patch_from->valuestring) {
+            firmware_patch_url_ = patch_url->valuestring;
+        }
+    }
     cJSON_Delete(root);
+    // Only a response that parsed completely may be confirmed as unchanged later
+    etag_ = etag;
 
     // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
     has_new_version_ = IsNewVersionAvailable(current_version_, firmware_version_);
@@ -156,6 +237,48 @@ bool Ota::CheckVersion() {
     return true;
 }
 
+// "sha256" and "size" of the image a download expands to, and optionally "block_sha256",
+// the digests of every "block_size" bytes, so a corrupted block is caught before the rest is downloaded
+Ota::ImageDigest Ota::ParseImageDigest(cJSON* object) {
+    ImageDigest digest;
+    if (!cJSON_IsObject(object)) {
+        return digest;
+    }
+    cJSON *size = cJSON_GetObjectItem(object, "size");
+    if (cJSON_IsNumber(size) && size->valuedouble > 0) {
+        digest.size = size->valuedouble;
+    }
+    cJSON *sha256 = cJSON_GetObjectItem(object, "sha256");
+    if (cJSON_IsString(sha256)) {
+        digest.has_sha256 = PartitionUtils::ParseSha256(sha256->valuestring, digest.sha256);
+        if (!digest.has_sha256) {
+            ESP_LOGW(TAG, "Invalid image SHA-256 %s", sha256->valuestring);
+        }
+    }
+
+    cJSON *block_size = cJSON_GetObjectItem(object, "block_size");
+    cJSON *blocks = cJSON_GetObjectItem(object, "block_sha256");
+    if (digest.size == 0 || !cJSON_IsNumber(block_size) || !cJSON_IsArray(blocks)) {
+        return digest;
+    }
+    size_t count = cJSON_GetArraySize(blocks);
+    if (block_size->valueint < OTA_MIN_DIGEST_BLOCK_SIZE || count != (digest.size + block_size->valueint - 1) / block_size->valueint) {
+        ESP_LOGW(TAG, "Ignoring %zu block digests of %d bytes for an image of %zu bytes", count, block_size->valueint, digest.size);
+        return digest;
+    }
+    digest.blocks.resize(count * 32);
+    for (size_t i = 0; i < count; i++) {
+        cJSON *block = cJSON_GetArrayItem(blocks, i);
+        if (!cJSON_IsString(block) || !PartitionUtils::ParseSha256(block->valuestring, &digest.blocks[i * 32])) {
+            ESP_LOGW(TAG, "Invalid digest for block %zu, block digests ignored", i);
+            digest.blocks.clear();
+            return digest;
+        }
+    }
+    digest.block_size = block_size->valueint;
+    return digest;
+}
+
 void Ota::MarkCurrentVersionValid() {
     auto partition = esp_ota_get_running_partition();
     if (strcmp(partition->label, "factory") == 0) {
@@ -176,120 +299,611 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-void Ota::Upgrade(const std::string& firmware_url) {
-    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
-    auto update_partition = esp_ota_get_next_update_partition(NULL);
-    if (update_partition == NULL) {
-        ESP_LOGE(TAG, "Failed to get update partition");
-        return;
+// The image a checkpoint belongs to: the target partition, the version and the digest when the server sends one
+std::string Ota::CheckpointKey() {
+    std::string key = std::string(update_partition_->label) + ":" + update_version_;
+    if (digest_->has_sha256) {
+        char hex[3];
+        key += ":";
+        for (auto byte : digest_->sha256) {
+            snprintf(hex, sizeof(hex), "%02x", byte);
+            key += hex;
+        }
     }
+    return key;
+}
 
-    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
+// The checkpoint belongs to one URL, image and size, anything else starts from the beginning
+size_t Ota::LoadCheckpoint(const std::string& url) {
+    Settings settings("ota", false);
+    if (settings.GetString("url") != url || settings.GetString("image") != CheckpointKey()) {
+        return 0;
+    }
+    size_t offset = settings.GetInt("offset");
+    update_size_ = settings.GetInt("size");
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || offset >= update_size_) {
+        return 0;
+    }
+    return offset;
+}
 
-    auto http = Board::GetInstance().CreateHttp();
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        delete http;
+// Called by the writer once the data up to offset is in flash
+void Ota::SaveCheckpoint(uint32_t epoch, size_t offset) {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+    if (!checkpoint_enabled_ || epoch != checkpoint_epoch_ || offset >= update_size_ ||
+        offset - checkpoint_offset_ < OTA_CHECKPOINT_INTERVAL) {
         return;
     }
+    Settings settings("ota", true);
+    if (checkpoint_offset_ == 0) {
+        settings.SetString("url", update_url_);
+        settings.SetString("image", CheckpointKey());
+        settings.SetInt("size", update_size_);
+    }
+    settings.SetInt("offset", offset);
+    checkpoint_offset_ = offset;
+}
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
-        delete http;
+void Ota::DisableCheckpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+    checkpoint_enabled_ = false;
+}
+
+void Ota::ClearCheckpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+    Settings settings("ota", true);
+    settings.EraseAll();
+    checkpoint_offset_ = 0;
+    checkpoint_epoch_++;
+}
+
+// Flushes the chunks filled by Upgrade() to the OTA partition, an empty chunk ends the image.
+// Sectors are erased right before they are written, the part written before a reboot is kept.
+void Ota::WriterTask() {
+    while (true) {
+        Chunk chunk;
+        auto wait_start = esp_timer_get_time();
+        xQueueReceive(full_chunks_, &chunk, portMAX_DELAY);
+        auto write_start = esp_timer_get_time();
+        writer_wait_time_ += write_start - wait_start;
+        if (chunk.size == 0) {
+            break;
+        }
+
+        if (!write_failed_) {
+            size_t erase_size = (chunk.size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+            auto err = esp_partition_erase_range(update_partition_, chunk.offset, erase_size);
+            if (err == ESP_OK) {
+                err = esp_partition_write(update_partition_, chunk.offset, chunk.data, chunk.size);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data at 0x%zx: %s", chunk.offset, esp_err_to_name(err));
+                write_failed_ = true;
+            }
+            flash_write_time_ += esp_timer_get_time() - write_start;
+
+            // Only whole sectors are checkpointed, the last partial chunk is never resumed from
+            size_t written = chunk.offset + chunk.size;
+            if (!write_failed_ && written % SPI_FLASH_SEC_SIZE == 0) {
+                SaveCheckpoint(chunk.epoch, written);
+            }
+        }
+        xQueueSend(free_chunks_, &chunk, portMAX_DELAY);
+    }
+    xSemaphoreGive(writer_done_);
+    vTaskDelete(NULL);
+}
+
+// The download after decompression, either the image itself or a patch that produces it
+bool Ota::ProcessPayload(const uint8_t* data, size_t size) {
+    if (payload_size_ == 0 && app_image_ && OtaPatch::IsPatch(data, size)) {
+        ESP_LOGI(TAG, "Applying patch against the running firmware");
+        patch_ = std::make_unique<OtaPatch>(esp_ota_get_running_partition(), [this](const uint8_t* data, size_t size) {
+            return OutputImage(data, size);
+        });
+        DisableCheckpoint();
+    }
+    payload_size_ += size;
+    return patch_ ? patch_->Write(data, size) : OutputImage(data, size);
+}
+
+// Compressed images carry the size and hash of the image they expand to, the server may send them as well
+bool Ota::VerifyImage() {
+    if (digest_->size > 0 && output_offset_ != digest_->size) {
+        ESP_LOGE(TAG, "Image is %zu bytes, the server expects %zu", output_offset_, digest_->size);
+        return false;
+    }
+    if (digest_->block_size > 0 && hashed_offset_ % digest_->block_size != 0 &&
+        !FinishBlock(hashed_offset_ / digest_->block_size)) {
+        return false;
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&image_sha256_, digest);
+    if (inflate_) {
+        if (output_offset_ != inflate_->image_size()) {
+            ESP_LOGE(TAG, "Image size %zu, expected %zu", output_offset_, inflate_->image_size());
+            return false;
+        }
+        if (memcmp(digest, inflate_->image_sha256(), sizeof(digest)) != 0) {
+            ESP_LOGE(TAG, "Image SHA-256 mismatch");
+            return false;
+        }
+        ESP_LOGI(TAG, "Image SHA-256 verified, %zu bytes compressed to %zu", output_offset_, update_size_);
+    }
+    if (digest_->has_sha256) {
+        if (memcmp(digest, digest_->sha256, sizeof(digest)) != 0) {
+            ESP_LOGE(TAG, "Image does not match the SHA-256 from the server");
+            return false;
+        }
+        ESP_LOGI(TAG, "Image SHA-256 matches the server, %zu blocks verified while downloading", verified_blocks_);
+    }
+    return true;
+}
+
+// Restarts the hashes at offset, the part already in flash is read back when a download resumes
+bool Ota::SyncHash(size_t offset) {
+    auto start_time = esp_timer_get_time();
+    mbedtls_sha256_free(&image_sha256_);
+    mbedtls_sha256_init(&image_sha256_);
+    mbedtls_sha256_starts(&image_sha256_, 0);
+    mbedtls_sha256_free(&block_sha256_);
+    mbedtls_sha256_init(&block_sha256_);
+    mbedtls_sha256_starts(&block_sha256_, 0);
+    hashed_offset_ = offset;
+    verified_blocks_ = 0;
+    if (offset == 0 || (!digest_->has_sha256 && digest_->block_size == 0)) {
+        return true;
+    }
+    // Blocks before the resumed one were verified when they were written
+    size_t block_start = digest_->block_size > 0 ? offset / digest_->block_size * digest_->block_size : offset;
+    verified_blocks_ = digest_->block_size > 0 ? offset / digest_->block_size : 0;
+    if (!PartitionUtils::Sha256Update(&image_sha256_, update_partition_, 0, offset) ||
+        !PartitionUtils::Sha256Update(&block_sha256_, update_partition_, block_start, offset - block_start)) {
+        ESP_LOGE(TAG, "Failed to read back the downloaded part");
+        return false;
+    }
+    ESP_LOGI(TAG, "Hashed %zu bytes written before in %lld ms", offset, (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
+
+bool Ota::FinishBlock(size_t index) {
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&block_sha256_, digest);
+    mbedtls_sha256_free(&block_sha256_);
+    mbedtls_sha256_init(&block_sha256_);
+    mbedtls_sha256_starts(&block_sha256_, 0);
+    if (index * 32 >= digest_->blocks.size() || memcmp(digest, &digest_->blocks[index * 32], sizeof(digest)) != 0) {
+        size_t end = std::min((index + 1) * digest_->block_size, hashed_offset_);
+        ESP_LOGE(TAG, "Block %zu (%zu-%zu) does not match its SHA-256, detected %lld ms into the download, %zu of %zu bytes not downloaded",
+            index, index * digest_->block_size, end, (esp_timer_get_time() - download_start_time_) / 1000, digest_->size - std::min(end, digest_->size),
+            digest_->size);
+        return false;
+    }
+    verified_blocks_++;
+    return true;
+}
+
+// Hashes each chunk before it is written, a block that does not match its digest stops the download
+// before it reaches the flash
+bool Ota::HashChunk(const Chunk& chunk) {
+    auto start_time = esp_timer_get_time();
+    if (chunk.offset != hashed_offset_ && !SyncHash(chunk.offset)) {
+        return false;
+    }
+    mbedtls_sha256_update(&image_sha256_, chunk.data, chunk.size);
+    bool matched = true;
+    size_t position = 0;
+    while (digest_->block_size > 0 && position < chunk.size && matched) {
+        size_t offset = chunk.offset + position;
+        size_t block_end = (offset / digest_->block_size + 1) * digest_->block_size;
+        size_t length = std::min(chunk.size - position, block_end - offset);
+        mbedtls_sha256_update(&block_sha256_, chunk.data + position, length);
+        position += length;
+        hashed_offset_ = offset + length;
+        if (hashed_offset_ == block_end) {
+            matched = FinishBlock(hashed_offset_ / digest_->block_size - 1);
+        }
+    }
+    hashed_offset_ = chunk.offset + chunk.size;
+    hash_time_ += esp_timer_get_time() - start_time;
+    return matched;
+}
+
+// Appends image bytes to the current chunk, full chunks go to the writer
+bool Ota::OutputImage(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (current_chunk_.data == nullptr) {
+            auto wait_start = esp_timer_get_time();
+            xQueueReceive(free_chunks_, &current_chunk_, portMAX_DELAY);
+            reader_wait_time_ += esp_timer_get_time() - wait_start;
+            current_chunk_.size = 0;
+            current_chunk_.offset = output_offset_;
+        }
+        size_t length = std::min(size, chunk_size_ - current_chunk_.size);
+        memcpy(current_chunk_.data + current_chunk_.size, data, length);
+        current_chunk_.size += length;
+        data += length;
+        size -= length;
+        if (current_chunk_.size == chunk_size_ && !FlushChunk()) {
+            return false;
+        }
+    }
+    return !write_failed_;
+}
+
+// The first chunk carries the app description, the writer only starts once it is accepted
+bool Ota::FlushChunk() {
+    if (current_chunk_.data == nullptr) {
+        return true;
+    }
+    if (current_chunk_.size == 0) {
+        DiscardChunk();
+        return true;
+    }
+
+    if (!writer_started_) {
+        // A download that cannot expand to the expected size is rejected before anything is written
+        size_t image_size = inflate_ ? inflate_->image_size() : patch_ ? patch_->target_size() : update_size_;
+        if (digest_->size > 0 && image_size != digest_->size) {
+            ESP_LOGE(TAG, "Download expands to %zu bytes, the server expects %zu", image_size, digest_->size);
+            return false;
+        }
+        if (current_chunk_.offset == 0 && app_image_) {
+            if (current_chunk_.size < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+                ESP_LOGE(TAG, "Firmware image is too small");
+                return false;
+            }
+            esp_app_desc_t new_app_info;
+            memcpy(&new_app_info, current_chunk_.data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+            ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+
+            auto current_version = esp_app_get_description()->version;
+            if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
+                ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
+                return false;
+            }
+        }
+
+        xTaskCreate([](void* arg) {
+            Ota* ota = (Ota*)arg;
+            ota->WriterTask();
+        }, "ota_writer", OTA_WRITER_STACK_SIZE, this, background_ ? OTA_WRITER_PRIORITY_BACKGROUND : OTA_WRITER_PRIORITY, nullptr);
+        writer_started_ = true;
+    }
+
+    if (current_chunk_.offset + current_chunk_.size > update_partition_->size) {
+        ESP_LOGE(TAG, "Image does not fit the partition");
+        return false;
+    }
+    if (!HashChunk(current_chunk_)) {
+        return false;
+    }
+    output_offset_ = current_chunk_.offset + current_chunk_.size;
+    current_chunk_.epoch = checkpoint_epoch_;
+    xQueueSend(full_chunks_, &current_chunk_, portMAX_DELAY);
+    current_chunk_ = {};
+    return !write_failed_;
+}
+
+void Ota::DiscardChunk() {
+    if (current_chunk_.data != nullptr) {
+        xQueueSend(free_chunks_, &current_chunk_, 0);
+        current_chunk_ = {};
+    }
+}
+
+// Sleeps until the bytes received since the limit was set fit in the allowed rate
+void Ota::Throttle(size_t size) {
+    size_t limit = rate_limit_;
+    if (limit != throttle_limit_) {
+        throttle_limit_ = limit;
+        throttle_bytes_ = 0;
+        throttle_start_time_ = esp_timer_get_time();
+    }
+    if (limit == 0) {
         return;
     }
+    throttle_bytes_ += size;
+    int64_t ahead = throttle_start_time_ + (int64_t)throttle_bytes_ * 1000000 / limit - esp_timer_get_time();
+    if (ahead > 0) {
+        vTaskDelay(pdMS_TO_TICKS(ahead / 1000));
+        throttled_time_ += ahead;
+    }
+}
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            delete http;
-            return;
+// Downloads an image into the partition. Only an app image is checked and set as the boot partition,
+// any other data is left for the caller to verify.
+bool Ota::Upgrade(const std::string& firmware_url, const esp_partition_t* partition, bool app_image, const std::string& version,
+    const ImageDigest& digest) {
+    ESP_LOGI(TAG, "Downloading %s from %s", app_image ? "firmware" : "data", firmware_url.c_str());
+    update_partition_ = partition;
+    app_image_ = app_image;
+    digest_ = &digest;
+    if (update_partition_ == NULL) {
+        ESP_LOGE(TAG, "Failed to get update partition");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition_->label, update_partition_->address);
+
+    // Large chunks in PSRAM when available, otherwise smaller ones in internal RAM
+    chunk_size_ = OTA_CHUNK_SIZE;
+    Chunk chunks[OTA_CHUNK_COUNT] = {};
+    for (auto& chunk : chunks) {
+        chunk.data = (uint8_t*)heap_caps_malloc(chunk_size_, MALLOC_CAP_SPIRAM);
+    }
+    if (std::any_of(std::begin(chunks), std::end(chunks), [](const Chunk& chunk) { return chunk.data == nullptr; })) {
+        chunk_size_ = OTA_CHUNK_SIZE_INTERNAL;
+        for (auto& chunk : chunks) {
+            heap_caps_free(chunk.data);
+            chunk.data = (uint8_t*)heap_caps_malloc(chunk_size_, MALLOC_CAP_INTERNAL);
+        }
+    }
+    auto buffer = (uint8_t*)heap_caps_malloc(OTA_RECEIVE_BUFFER_SIZE, MALLOC_CAP_INTERNAL);
+    if (chunks[0].data == nullptr || buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate OTA buffers");
+        for (auto& chunk : chunks) {
+            heap_caps_free(chunk.data);
+        }
+        heap_caps_free(buffer);
+        return false;
+    }
+    free_chunks_ = xQueueCreate(OTA_CHUNK_COUNT, sizeof(Chunk));
+    full_chunks_ = xQueueCreate(OTA_CHUNK_COUNT + 1, sizeof(Chunk));
+    writer_done_ = xSemaphoreCreateBinary();
+    for (auto& chunk : chunks) {
+        if (chunk.data != nullptr) {
+            xQueueSend(free_chunks_, &chunk, 0);
         }
+    }
+    current_chunk_ = {};
+    output_offset_ = 0;
+    writer_started_ = false;
+    write_failed_ = false;
+    reader_wait_time_ = 0;
+    writer_wait_time_ = 0;
+    flash_write_time_ = 0;
+    throttle_limit_ = 0;
+    throttle_bytes_ = 0;
+    throttle_start_time_ = esp_timer_get_time();
+    throttled_time_ = 0;
+    hash_time_ = 0;
+    SyncHash(0);
+
+    update_url_ = firmware_url;
+    update_version_ = version;
+    update_size_ = 0;
+    size_t offset = LoadCheckpoint(firmware_url);
+    size_t resumed_from = offset;
+    checkpoint_offset_ = offset;
+    checkpoint_enabled_ = true;
+    if (offset > 0) {
+        ESP_LOGI(TAG, "Resuming download at %zu/%zu", offset, update_size_);
+        output_offset_ = offset;
+    }
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+    bool success = false;
+    bool fatal = false;
+    int retries = 0;
+    size_t total_read = 0, recent_read = 0, wasted = 0;
+    auto start_time = esp_timer_get_time();
+    auto last_calc_time = start_time;
+    download_start_time_ = start_time;
+    // Every pass downloads from offset to the end, a dropped connection starts another pass
+    while (!success && !fatal) {
+        if (retries > 0) {
+            if (retries > OTA_MAX_RETRIES || write_failed_) {
+                break;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
+            ESP_LOGW(TAG, "Download interrupted at %zu, retry %d in %d ms", offset, retries, OTA_RETRY_DELAY_MS);
+            vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_DELAY_MS));
         }
 
-        if (ret == 0) {
-            break;
+        auto http = Board::GetInstance().CreateHttp();
+        if (offset > 0) {
+            http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+        }
+        if (!http->Open("GET", firmware_url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            delete http;
+            retries++;
+            continue;
+        }
+
+        size_t content_length = http->GetBodyLength();
+        if (offset > 0 && http->GetStatusCode() != 206) {
+            // The server ignored the range, take the whole image again
+            ESP_LOGW(TAG, "Server does not support range requests, restart download");
+            wasted += offset;
+            offset = 0;
+            output_offset_ = 0;
+            ClearCheckpoint();
+        }
+        if (content_length == 0 || (offset > 0 && offset + content_length != update_size_)) {
+            ESP_LOGE(TAG, "Unexpected content length %zu at offset %zu", content_length, offset);
+            delete http;
+            if (offset == 0) {
+                break;
+            }
+            // The file changed on the server
+            wasted += offset;
+            offset = 0;
+            output_offset_ = 0;
+            ClearCheckpoint();
+            retries++;
+            continue;
+        }
+        if (offset == 0) {
+            update_size_ = content_length;
+            inflate_.reset();
+            patch_.reset();
+            payload_size_ = 0;
         }
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+        bool read_failed = false;
+        while (true) {
+            int ret = http->Read((char*)buffer, OTA_RECEIVE_BUFFER_SIZE);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+                read_failed = true;
+                break;
+            }
 
-                auto current_version = esp_app_get_description()->version;
-                if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
-                    ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
-                    delete http;
-                    return;
+            // Calculate speed and progress every second
+            recent_read += ret;
+            total_read += ret;
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
+                size_t received = offset + ret;
+                size_t progress = received * 100 / update_size_;
+                ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, received, update_size_, recent_read);
+                if (upgrade_callback_) {
+                    upgrade_callback_(progress, recent_read);
                 }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
 
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    delete http;
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return;
+            if (ret == 0) {
+                if (offset < update_size_) {
+                    read_failed = true;
+                } else if ((inflate_ && !inflate_->finished()) || (patch_ && !patch_->finished())) {
+                    ESP_LOGE(TAG, "Download ended before the image was complete");
+                    fatal = true;
+                } else {
+                    success = FlushChunk() && VerifyImage();
+                    fatal = !success;
                 }
+                break;
+            }
 
-                image_header_checked = true;
-                std::string().swap(image_header);
+            if (offset == 0 && OtaInflate::IsCompressed(buffer, ret)) {
+                ESP_LOGI(TAG, "Decompressing the image while downloading");
+                inflate_ = std::make_unique<OtaInflate>([this](const uint8_t* data, size_t size) {
+                    return ProcessPayload(data, size);
+                });
+                DisableCheckpoint();
+            }
+            offset += ret;
+            bool written = inflate_ ? inflate_->Write(buffer, ret) : ProcessPayload(buffer, ret);
+            if (!written) {
+                fatal = true;
+                break;
             }
+            Throttle(ret);
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
-            delete http;
-            return;
+        delete http;
+
+        if (read_failed) {
+            // A raw image continues after the last chunk handed to the writer, a patch or compressed image starts over
+            bool restart = inflate_ || patch_;
+            wasted += restart ? offset : offset - output_offset_;
+            DiscardChunk();
+            offset = restart ? 0 : output_offset_;
+            output_offset_ = offset;
+            retries++;
         }
     }
-    delete http;
+    DiscardChunk();
+    inflate_.reset();
+    patch_.reset();
+    mbedtls_sha256_free(&image_sha256_);
+    mbedtls_sha256_free(&block_sha256_);
+
+    if (writer_started_) {
+        Chunk end = {nullptr, 0, 0, 0};
+        xQueueSend(full_chunks_, &end, portMAX_DELAY);
+        xSemaphoreTake(writer_done_, portMAX_DELAY);
+    }
+    for (auto& chunk : chunks) {
+        heap_caps_free(chunk.data);
+    }
+    heap_caps_free(buffer);
+    vQueueDelete(free_chunks_);
+    vQueueDelete(full_chunks_);
+    vSemaphoreDelete(writer_done_);
+    free_chunks_ = nullptr;
+    full_chunks_ = nullptr;
+    writer_done_ = nullptr;
+
+    auto elapsed = esp_timer_get_time() - start_time;
+    ESP_LOGI(TAG, "Downloaded %zu bytes, wrote %zu bytes in %lld ms (%lld KB/s), chunk %zu, reader waited %lld ms, writer waited %lld ms, flash %lld ms",
+        total_read, output_offset_, elapsed / 1000, elapsed > 0 ? (int64_t)total_read * 1000000 / elapsed / 1024 : 0, chunk_size_,
+        reader_wait_time_ / 1000, writer_wait_time_ / 1000, flash_write_time_ / 1000);
+    ESP_LOGI(TAG, "Resumed from %zu, %d retries, %zu bytes downloaded again, throttled %lld ms", resumed_from, retries, wasted,
+        throttled_time_ / 1000);
+    ESP_LOGI(TAG, "Hashing took %lld ms (%lld%% of the download), %zu/%zu blocks verified", hash_time_ / 1000,
+        elapsed > 0 ? hash_time_ * 100 / elapsed : 0, verified_blocks_,
+        digest.block_size > 0 ? digest.blocks.size() / 32 : 0);
+
+    if (!success || write_failed_) {
+        // A checkpoint is kept for the next attempt unless the written data is unusable
+        if (write_failed_ || fatal) {
+            ClearCheckpoint();
+        }
+        return false;
+    }
+    if (!app_image_) {
+        ClearCheckpoint();
+        return true;
+    }
 
-    esp_err_t err = esp_ota_end(update_handle);
+    // The image is verified here, esp_ota_begin/end are not used because they cannot continue a partial image
+    esp_err_t err = esp_ota_set_boot_partition(update_partition_);
+    ClearCheckpoint();
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
         } else {
-            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
         }
-        return;
+        return false;
     }
+    return true;
+}
 
-    err = esp_ota_set_boot_partition(update_partition);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
-        return;
+bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
+    upgrade_callback_ = callback;
+    bool upgraded = false;
+    if (!firmware_patch_url_.empty()) {
+        upgraded = Upgrade(firmware_patch_url_, esp_ota_get_next_update_partition(NULL), true, firmware_version_, firmware_digest_);
+        if (!upgraded) {
+            ESP_LOGW(TAG, "Patch upgrade failed, download the full image");
+        }
+    }
+    if (!upgraded) {
+        upgraded = Upgrade(firmware_url_, esp_ota_get_next_update_partition(NULL), true, firmware_version_, firmware_digest_);
     }
+    if (upgraded) {
+        ESP_LOGI(TAG, "Firmware upgrade successful, version %s boots on the next restart", firmware_version_.c_str());
+    }
+    return upgraded;
+}
 
-    ESP_LOGI(TAG, "Firmware upgrade successful, rebooting in 3 seconds...");
-    vTaskDelay(pdMS_TO_TICKS(3000));
-    esp_restart();
+// Resource packs and models are staged in the inactive app partition, see Assets::Stage and ModelUpdate::Stage.
+// That slot holds the previous firmware, which is lost as a rollback target once data is staged over it.
+// Until the running firmware is confirmed the bootloader may still need it, so nothing is staged then.
+bool Ota::DownloadData(const std::string& url, const esp_partition_t*& partition, size_t& size, const std::string& version,
+    const ImageDigest& digest) {
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGW(TAG, "Running firmware is not confirmed yet, keeping the rollback image");
+        return false;
+    }
+    partition = esp_ota_get_next_update_partition(NULL);
+    if (!Upgrade(url, partition, false, version, digest)) {
+        return false;
+    }
+    size = output_offset_;
+    return true;
 }
 
-void Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
-    upgrade_callback_ = callback;
-    Upgrade(firmware_url_);
+bool Ota::DownloadAssets(const esp_partition_t*& partition, size_t& size) {
+    // The pack carries its own hash, see Assets::Verify
+    return DownloadData(assets_url_, partition, size, std::to_string(assets_version_), ImageDigest());
+}
+
+bool Ota::DownloadModel(const esp_partition_t*& partition, size_t& size) {
+    return DownloadData(model_url_, partition, size, model_version_, model_digest_);
 }
 
 std::vector<int> Ota::ParseVersion(const std::string& version) {
@@ -4,6 +4,38 @@
 #include <functional>
 #include <string>
 #include <map>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+// The download is split into chunks that a writer task flushes to flash while the next chunk is received.
+// Chunks are whole flash sectors so every write erases and programs complete sectors.
+#define OTA_CHUNK_SIZE (16 * 1024)
+#define OTA_CHUNK_SIZE_INTERNAL (4 * 1024)
+#define OTA_CHUNK_COUNT 2
+#define OTA_WRITER_STACK_SIZE 4096
+// Progress is saved to NVS this often, an interrupted download resumes from there with an HTTP Range request
+#define OTA_CHECKPOINT_INTERVAL (64 * 1024)
+#define OTA_MAX_RETRIES 5
+#define OTA_RETRY_DELAY_MS 3000
+#define OTA_RECEIVE_BUFFER_SIZE 4096
+// The flash writer runs above the main loop for a blocking upgrade and below everything else in the background
+#define OTA_WRITER_PRIORITY 4
+#define OTA_WRITER_PRIORITY_BACKGROUND 1
+// Smallest block the server may send a digest for, bounds the memory used by the digest list
+#define OTA_MIN_DIGEST_BLOCK_SIZE (16 * 1024)
+
+class OtaPatch;
+class OtaInflate;
+struct cJSON;
 
 class Ota {
 public:
@@ -18,8 +50,19 @@ public:
     bool HasMqttConfig() { return has_mqtt_config_; }
     bool HasActivationCode() { return has_activation_code_; }
     bool HasServerTime() { return has_server_time_; }
-    void StartUpgrade(std::function<void(int progress, size_t speed)> callback);
+    // Returns true once the new image is verified and set as the boot partition, the caller decides when to reboot
+    bool StartUpgrade(std::function<void(int progress, size_t speed)> callback);
+    void SetBackground(bool background) { background_ = background; }
+    // Limits the download to the given bytes per second, 0 for unlimited, may be changed during the download
+    void SetRateLimit(size_t bytes_per_second) { rate_limit_ = bytes_per_second; }
     void MarkCurrentVersionValid();
+    // Version of the resource pack offered by the server, 0 if none
+    int GetAssetsVersion() const { return assets_version_; }
+    bool DownloadAssets(const esp_partition_t*& partition, size_t& size);
+    // Wake word models offered by the server, the version is empty if none
+    const std::string& GetModelVersion() const { return model_version_; }
+    const std::string& GetModelSha256() const { return model_sha256_; }
+    bool DownloadModel(const esp_partition_t*& partition, size_t& size);
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
     const std::string& GetCurrentVersion() const { return current_version_; }
@@ -37,10 +80,100 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    // A patch against the running version, preferred over the full image when the server offers one
+    std::string firmware_patch_url_;
+    int assets_version_ = 0;
+    std::string assets_url_;
+    std::string model_version_;
+    std::string model_url_;
+    std::string model_sha256_;
     std::string post_data_;
+    std::string etag_;
     std::map<std::string, std::string> headers_;
 
-    void Upgrade(const std::string& firmware_url);
+    // What the server says a download expands to, checked as the image is handed to the writer
+    struct ImageDigest {
+        size_t size = 0;
+        bool has_sha256 = false;
+        uint8_t sha256[32] = {};
+        // SHA-256 of every block_size bytes of the image, the last block may be shorter
+        size_t block_size = 0;
+        std::vector<uint8_t> blocks;
+    };
+    ImageDigest firmware_digest_;
+    ImageDigest model_digest_;
+
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+        size_t offset;
+        // The checkpoint epoch the chunk was filled in
+        uint32_t epoch;
+    };
+    // Empty chunks go from the reader to the writer through full_chunks_ and back through free_chunks_
+    QueueHandle_t free_chunks_ = nullptr;
+    QueueHandle_t full_chunks_ = nullptr;
+    SemaphoreHandle_t writer_done_ = nullptr;
+    const esp_partition_t* update_partition_ = nullptr;
+    bool app_image_ = true;
+    std::string update_url_;
+    std::string update_version_;
+    size_t update_size_ = 0;
+    // The writer saves checkpoints and the reader clears them, both under checkpoint_mutex_.
+    // A clear starts a new epoch, chunks queued before it can no longer save a checkpoint.
+    std::mutex checkpoint_mutex_;
+    uint32_t checkpoint_epoch_ = 0;
+    size_t checkpoint_offset_ = 0;
+    bool checkpoint_enabled_ = false;
+    std::atomic<bool> write_failed_{false};
+    int64_t writer_wait_time_ = 0;
+    int64_t flash_write_time_ = 0;
+
+    // The chunk being filled with image bytes, handed to the writer when full
+    Chunk current_chunk_ = {};
+    size_t chunk_size_ = 0;
+    size_t output_offset_ = 0;
+    bool writer_started_ = false;
+    int64_t reader_wait_time_ = 0;
+    // Compressed downloads and patches are transformed into the image on the fly, they cannot resume in the middle
+    std::unique_ptr<OtaInflate> inflate_;
+    std::unique_ptr<OtaPatch> patch_;
+    size_t payload_size_ = 0;
+    // Hashes of the image up to hashed_offset_, updated as chunks are flushed so a resumed download stays in step
+    const ImageDigest* digest_ = nullptr;
+    mbedtls_sha256_context image_sha256_;
+    mbedtls_sha256_context block_sha256_;
+    size_t hashed_offset_ = 0;
+    size_t verified_blocks_ = 0;
+    int64_t hash_time_ = 0;
+    int64_t download_start_time_ = 0;
+    bool background_ = false;
+    std::atomic<size_t> rate_limit_{0};
+    size_t throttle_limit_ = 0;
+    size_t throttle_bytes_ = 0;
+    int64_t throttle_start_time_ = 0;
+    int64_t throttled_time_ = 0;
+
+    bool Upgrade(const std::string& firmware_url, const esp_partition_t* partition, bool app_image, const std::string& version,
+        const ImageDigest& digest);
+    bool DownloadData(const std::string& url, const esp_partition_t*& partition, size_t& size, const std::string& version,
+        const ImageDigest& digest);
+    void WriterTask();
+    bool ProcessPayload(const uint8_t* data, size_t size);
+    bool OutputImage(const uint8_t* data, size_t size);
+    bool VerifyImage();
+    static ImageDigest ParseImageDigest(cJSON* object);
+    bool HashChunk(const Chunk& chunk);
+    bool SyncHash(size_t offset);
+    bool FinishBlock(size_t index);
+    bool FlushChunk();
+    void DiscardChunk();
+    void Throttle(size_t size);
+    std::string CheckpointKey();
+    size_t LoadCheckpoint(const std::string& url);
+    void SaveCheckpoint(uint32_t epoch, size_t offset);
+    void DisableCheckpoint();
+    void ClearCheckpoint();
     std::function<void(int progress, size_t speed)> upgrade_callback_;
     std::vector<int> ParseVersion(const std::string& version);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
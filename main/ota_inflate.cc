@@ -0,0 +1,92 @@
+#include "ota_inflate.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OtaInflate"
+
+OtaInflate::OtaInflate(std::function<bool(const uint8_t* data, size_t size)> output) : output_(output) {
+    // About 43 KB together, PSRAM is preferred but not required
+    decompressor_ = (tinfl_decompressor*)heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM);
+    if (decompressor_ == nullptr) {
+        decompressor_ = (tinfl_decompressor*)heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_INTERNAL);
+    }
+    dictionary_ = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM);
+    if (dictionary_ == nullptr) {
+        dictionary_ = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_INTERNAL);
+    }
+    if (decompressor_ != nullptr) {
+        tinfl_init(decompressor_);
+    }
+}
+
+OtaInflate::~OtaInflate() {
+    heap_caps_free(decompressor_);
+    heap_caps_free(dictionary_);
+}
+
+bool OtaInflate::IsCompressed(const uint8_t* data, size_t size) {
+    return size >= 4 && memcmp(data, OTA_INFLATE_MAGIC, 4) == 0;
+}
+
+bool OtaInflate::Write(const uint8_t* data, size_t size) {
+    if (failed_) {
+        return false;
+    }
+    if (decompressor_ == nullptr || dictionary_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate decompressor");
+        failed_ = true;
+        return false;
+    }
+
+    if (header_size_ < OTA_INFLATE_HEADER_SIZE) {
+        size_t length = std::min(size, OTA_INFLATE_HEADER_SIZE - header_size_);
+        memcpy(header_ + header_size_, data, length);
+        header_size_ += length;
+        data += length;
+        size -= length;
+        if (header_size_ < OTA_INFLATE_HEADER_SIZE) {
+            return true;
+        }
+        image_size_ = header_[4] | (header_[5] << 8) | (header_[6] << 16) | ((uint32_t)header_[7] << 24);
+        ESP_LOGI(TAG, "Compressed image of %zu bytes", image_size_);
+    }
+
+    while (size > 0 || !finished_) {
+        if (finished_) {
+            ESP_LOGE(TAG, "Data after the end of the compressed stream");
+            failed_ = true;
+            return false;
+        }
+        size_t in_bytes = size;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - dictionary_offset_;
+        auto status = tinfl_decompress(decompressor_, data, &in_bytes, dictionary_, dictionary_ + dictionary_offset_,
+            &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        size -= in_bytes;
+
+        if (out_bytes > 0) {
+            if (!output_(dictionary_ + dictionary_offset_, out_bytes)) {
+                ESP_LOGE(TAG, "Failed to output %zu bytes at %zu", out_bytes, output_size_);
+                failed_ = true;
+                return false;
+            }
+            output_size_ += out_bytes;
+            dictionary_offset_ = (dictionary_offset_ + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+
+        if (status == TINFL_STATUS_DONE) {
+            finished_ = true;
+        } else if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Failed to decompress: %d", status);
+            failed_ = true;
+            return false;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && size == 0) {
+            break;
+        }
+    }
+    return true;
+}
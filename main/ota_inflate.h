@@ -0,0 +1,44 @@
+#ifndef _OTA_INFLATE_H
+#define _OTA_INFLATE_H
+
+#include <rom/miniz.h>
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Compressed image produced by scripts/release.py, all integers are little endian:
+//   header: "ZIM1", image size (u32), SHA-256 of the image (32 bytes)
+//   then a zlib stream of the image, or of a patch that produces it (see ota_patch.h)
+#define OTA_INFLATE_MAGIC "ZIM1"
+#define OTA_INFLATE_HEADER_SIZE 40
+
+// Streams a compressed image through the inflater in ROM, using its 32 KB dictionary as the output window
+class OtaInflate {
+public:
+    OtaInflate(std::function<bool(const uint8_t* data, size_t size)> output);
+    ~OtaInflate();
+
+    static bool IsCompressed(const uint8_t* data, size_t size);
+
+    // Takes the next part of the compressed stream, returns false if it is invalid or the output callback failed
+    bool Write(const uint8_t* data, size_t size);
+    bool finished() const { return finished_; }
+    size_t image_size() const { return image_size_; }
+    const uint8_t* image_sha256() const { return header_ + 8; }
+    size_t output_size() const { return output_size_; }
+
+private:
+    std::function<bool(const uint8_t* data, size_t size)> output_;
+    tinfl_decompressor* decompressor_ = nullptr;
+    uint8_t* dictionary_ = nullptr;
+    size_t dictionary_offset_ = 0;
+    uint8_t header_[OTA_INFLATE_HEADER_SIZE];
+    size_t header_size_ = 0;
+    size_t image_size_ = 0;
+    size_t output_size_ = 0;
+    bool finished_ = false;
+    bool failed_ = false;
+};
+
+#endif // _OTA_INFLATE_H
@@ -0,0 +1,198 @@
+#include "ota_patch.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "OtaPatch"
+
+static uint32_t ReadUint32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+OtaPatch::OtaPatch(const esp_partition_t* source, std::function<bool(const uint8_t* data, size_t size)> output)
+    : source_(source), output_(output) {
+    copy_buffer_ = (uint8_t*)malloc(OTA_PATCH_COPY_BUFFER_SIZE);
+}
+
+OtaPatch::~OtaPatch() {
+    free(copy_buffer_);
+}
+
+bool OtaPatch::IsPatch(const uint8_t* data, size_t size) {
+    return size >= 4 && memcmp(data, OTA_PATCH_MAGIC, 4) == 0;
+}
+
+size_t OtaPatch::FieldLength() const {
+    switch (state_) {
+        case kStateHeader:
+            return OTA_PATCH_HEADER_SIZE;
+        case kStateOpcode:
+            return 1;
+        case kStateCopy:
+            return 8;
+        case kStateInsertLength:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+bool OtaPatch::Write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (state_ == kStateError) {
+            return false;
+        }
+        if (state_ == kStateDone) {
+            ESP_LOGE(TAG, "Data after the end of the patch");
+            state_ = kStateError;
+            return false;
+        }
+
+        // Insert data goes straight to the output
+        if (state_ == kStateInsertData) {
+            size_t length = std::min(size, insert_remaining_);
+            if (!Output(data, length)) {
+                return false;
+            }
+            data += length;
+            size -= length;
+            insert_remaining_ -= length;
+            if (insert_remaining_ == 0) {
+                state_ = output_size_ == target_size_ ? kStateDone : kStateOpcode;
+            }
+            continue;
+        }
+
+        // Fixed size fields may be split across writes, collect them first
+        size_t needed = FieldLength() - field_size_;
+        size_t length = std::min(size, needed);
+        memcpy(field_ + field_size_, data, length);
+        field_size_ += length;
+        data += length;
+        size -= length;
+        if (field_size_ == FieldLength()) {
+            field_size_ = 0;
+            if (!ParseField()) {
+                state_ = kStateError;
+                return false;
+            }
+        }
+    }
+    return state_ != kStateError;
+}
+
+bool OtaPatch::ParseField() {
+    switch (state_) {
+        case kStateHeader: {
+            if (memcmp(field_, OTA_PATCH_MAGIC, 4) != 0) {
+                ESP_LOGE(TAG, "Invalid patch magic");
+                return false;
+            }
+            source_size_ = ReadUint32(field_ + 4);
+            target_size_ = ReadUint32(field_ + 40);
+            ESP_LOGI(TAG, "Patch from %zu to %zu bytes", source_size_, target_size_);
+            if (source_size_ > source_->size || target_size_ == 0) {
+                ESP_LOGE(TAG, "Invalid patch sizes");
+                return false;
+            }
+            if (copy_buffer_ == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate copy buffer");
+                return false;
+            }
+            if (!VerifySource(field_ + 8)) {
+                source_matched_ = false;
+                return false;
+            }
+            state_ = kStateOpcode;
+            return true;
+        }
+        case kStateOpcode:
+            if (field_[0] == 'C') {
+                state_ = kStateCopy;
+            } else if (field_[0] == 'I') {
+                state_ = kStateInsertLength;
+            } else {
+                ESP_LOGE(TAG, "Unknown patch operation 0x%02x", field_[0]);
+                return false;
+            }
+            return true;
+        case kStateCopy: {
+            size_t offset = ReadUint32(field_);
+            size_t length = ReadUint32(field_ + 4);
+            if (!Copy(offset, length)) {
+                return false;
+            }
+            state_ = output_size_ == target_size_ ? kStateDone : kStateOpcode;
+            return true;
+        }
+        case kStateInsertLength:
+            insert_remaining_ = ReadUint32(field_);
+            if (insert_remaining_ == 0 || output_size_ + insert_remaining_ > target_size_) {
+                ESP_LOGE(TAG, "Invalid insert of %zu bytes", insert_remaining_);
+                return false;
+            }
+            state_ = kStateInsertData;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The patch only applies to the exact image it was made from, check it before writing anything
+bool OtaPatch::VerifySource(const uint8_t* sha256) {
+    auto start_time = esp_timer_get_time();
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    for (size_t offset = 0; offset < source_size_; offset += OTA_PATCH_COPY_BUFFER_SIZE) {
+        size_t length = std::min((size_t)OTA_PATCH_COPY_BUFFER_SIZE, source_size_ - offset);
+        if (esp_partition_read(source_, offset, copy_buffer_, length) != ESP_OK) {
+            mbedtls_sha256_free(&context);
+            ESP_LOGE(TAG, "Failed to read running partition");
+            return false;
+        }
+        mbedtls_sha256_update(&context, copy_buffer_, length);
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&context, digest);
+    mbedtls_sha256_free(&context);
+
+    bool matched = memcmp(digest, sha256, sizeof(digest)) == 0;
+    ESP_LOGI(TAG, "Source image %s, hashed in %lld ms", matched ? "matched" : "does not match",
+        (esp_timer_get_time() - start_time) / 1000);
+    return matched;
+}
+
+bool OtaPatch::Output(const uint8_t* data, size_t size) {
+    if (!output_(data, size)) {
+        state_ = kStateError;
+        return false;
+    }
+    output_size_ += size;
+    return true;
+}
+
+bool OtaPatch::Copy(size_t offset, size_t length) {
+    if (length == 0 || offset + length > source_size_ || output_size_ + length > target_size_) {
+        ESP_LOGE(TAG, "Invalid copy of %zu bytes at %zu", length, offset);
+        return false;
+    }
+    while (length > 0) {
+        size_t size = std::min(length, (size_t)OTA_PATCH_COPY_BUFFER_SIZE);
+        if (esp_partition_read(source_, offset, copy_buffer_, size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read running partition at %zu", offset);
+            return false;
+        }
+        if (!Output(copy_buffer_, size)) {
+            return false;
+        }
+        offset += size;
+        length -= size;
+    }
+    return true;
+}
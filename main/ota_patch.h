@@ -0,0 +1,64 @@
+#ifndef _OTA_PATCH_H
+#define _OTA_PATCH_H
+
+#include <esp_partition.h>
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Patch produced by scripts/ota_patch.py, all integers are little endian:
+//   header: "DPT1", source size (u32), SHA-256 of the source image (32 bytes), target size (u32)
+//   then operations until the target is complete:
+//     'C' source offset (u32), length (u32)  copy bytes of the running image
+//     'I' length (u32), data                 insert new bytes
+#define OTA_PATCH_MAGIC "DPT1"
+#define OTA_PATCH_HEADER_SIZE 44
+#define OTA_PATCH_COPY_BUFFER_SIZE 1024
+
+// Rebuilds the new image from a patch stream and the running partition, with a fixed amount of RAM
+class OtaPatch {
+public:
+    OtaPatch(const esp_partition_t* source, std::function<bool(const uint8_t* data, size_t size)> output);
+    ~OtaPatch();
+
+    static bool IsPatch(const uint8_t* data, size_t size);
+
+    // Takes the next part of the patch, returns false if it is invalid or the output callback failed
+    bool Write(const uint8_t* data, size_t size);
+    bool finished() const { return state_ == kStateDone; }
+    // False if the patch was made against a different image than the one running
+    bool source_matched() const { return source_matched_; }
+    size_t target_size() const { return target_size_; }
+
+private:
+    enum State {
+        kStateHeader,
+        kStateOpcode,
+        kStateCopy,
+        kStateInsertLength,
+        kStateInsertData,
+        kStateDone,
+        kStateError
+    };
+
+    const esp_partition_t* source_;
+    std::function<bool(const uint8_t* data, size_t size)> output_;
+    State state_ = kStateHeader;
+    uint8_t field_[OTA_PATCH_HEADER_SIZE];
+    size_t field_size_ = 0;
+    size_t source_size_ = 0;
+    size_t target_size_ = 0;
+    size_t output_size_ = 0;
+    size_t insert_remaining_ = 0;
+    bool source_matched_ = true;
+    uint8_t* copy_buffer_ = nullptr;
+
+    size_t FieldLength() const;
+    bool ParseField();
+    bool VerifySource(const uint8_t* sha256);
+    bool Output(const uint8_t* data, size_t size);
+    bool Copy(size_t offset, size_t length);
+};
+
+#endif // _OTA_PATCH_H
@@ -0,0 +1,82 @@
+#include "partition_utils.h"
+
+#include <spi_flash_mmap.h>
+
+#include <cstdlib>
+#include <algorithm>
+
+bool PartitionUtils::Sha256(const esp_partition_t* partition, size_t offset, size_t size, uint8_t digest[32]) {
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    bool success = Sha256Update(&context, partition, offset, size);
+    mbedtls_sha256_finish(&context, digest);
+    mbedtls_sha256_free(&context);
+    return success;
+}
+
+bool PartitionUtils::Sha256Update(mbedtls_sha256_context* context, const esp_partition_t* partition, size_t offset, size_t size) {
+    auto buffer = (uint8_t*)malloc(PARTITION_UTILS_BUFFER_SIZE);
+    if (buffer == nullptr) {
+        return false;
+    }
+    bool success = true;
+    for (size_t position = 0; position < size; position += PARTITION_UTILS_BUFFER_SIZE) {
+        size_t length = std::min((size_t)PARTITION_UTILS_BUFFER_SIZE, size - position);
+        if (esp_partition_read(partition, offset + position, buffer, length) != ESP_OK) {
+            success = false;
+            break;
+        }
+        mbedtls_sha256_update(context, buffer, length);
+    }
+    free(buffer);
+    return success;
+}
+
+bool PartitionUtils::ParseSha256(const std::string& hex, uint8_t digest[32]) {
+    if (hex.size() != 64) {
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        char byte[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+        char* end = nullptr;
+        digest[i] = strtoul(byte, &end, 16);
+        if (end != byte + 2) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t PartitionUtils::CopyRange(const esp_partition_t* source, const esp_partition_t* target, size_t offset,
+    size_t size, uint8_t* buffer) {
+    esp_err_t err = ESP_OK;
+    for (size_t position = offset; err == ESP_OK && position < offset + size; position += PARTITION_UTILS_BUFFER_SIZE) {
+        size_t length = std::min((size_t)PARTITION_UTILS_BUFFER_SIZE, offset + size - position);
+        err = esp_partition_read(source, position, buffer, length);
+        if (err == ESP_OK) {
+            err = esp_partition_write(target, position, buffer, length);
+        }
+    }
+    return err;
+}
+
+esp_err_t PartitionUtils::Copy(const esp_partition_t* source, const esp_partition_t* target, size_t size, size_t header_size) {
+    if (size > source->size || size > target->size || header_size > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    auto buffer = (uint8_t*)malloc(PARTITION_UTILS_BUFFER_SIZE);
+    if (buffer == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t erase_size = (size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    auto err = esp_partition_erase_range(target, 0, erase_size);
+    if (err == ESP_OK) {
+        err = CopyRange(source, target, header_size, size - header_size, buffer);
+    }
+    if (err == ESP_OK) {
+        err = CopyRange(source, target, 0, header_size, buffer);
+    }
+    free(buffer);
+    return err;
+}
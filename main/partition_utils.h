@@ -0,0 +1,32 @@
+#ifndef _PARTITION_UTILS_H_
+#define _PARTITION_UTILS_H_
+
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#define PARTITION_UTILS_BUFFER_SIZE 4096
+
+// Helpers for data that is downloaded into one partition and installed into another
+class PartitionUtils {
+public:
+    // Hashes size bytes of the partition starting at offset
+    static bool Sha256(const esp_partition_t* partition, size_t offset, size_t size, uint8_t digest[32]);
+    // Adds size bytes of the partition starting at offset to a running hash
+    static bool Sha256Update(mbedtls_sha256_context* context, const esp_partition_t* partition, size_t offset, size_t size);
+    // Digests from the server are 64 hex characters
+    static bool ParseSha256(const std::string& hex, uint8_t digest[32]);
+    // Erases the target and copies the first size bytes of the source into it. The first header_size
+    // bytes are written last, so data recognized by its header is never recognized half copied
+    static esp_err_t Copy(const esp_partition_t* source, const esp_partition_t* target, size_t size, size_t header_size = 0);
+
+private:
+    static esp_err_t CopyRange(const esp_partition_t* source, const esp_partition_t* target, size_t offset, size_t size,
+        uint8_t* buffer);
+};
+
+#endif // _PARTITION_UTILS_H_
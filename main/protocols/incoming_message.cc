@@ -0,0 +1,598 @@
+#include "incoming_message.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <cstdint>
+#include <cstring>
+
+#define TAG "IncomingMessage"
+
+static constexpr size_t npos = std::string_view::npos;
+
+static inline bool IsWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static size_t SkipWhitespace(std::string_view s, size_t pos) {
+    while (pos < s.size() && IsWhitespace(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+// pos points at the opening quote, returns the position after the closing quote
+static size_t SkipString(std::string_view s, size_t pos) {
+    for (pos++; pos < s.size(); pos++) {
+        if (s[pos] == '\\') {
+            pos++;
+        } else if (s[pos] == '"') {
+            return pos + 1;
+        }
+    }
+    return npos;
+}
+
+// Nested containers are only bracket matched, they are scanned again if someone asks for them
+static size_t SkipValue(std::string_view s, size_t pos) {
+    if (pos >= s.size()) {
+        return npos;
+    }
+    char c = s[pos];
+    if (c == '"') {
+        return SkipString(s, pos);
+    }
+    if (c == '{' || c == '[') {
+        int depth = 0;
+        while (pos < s.size()) {
+            c = s[pos];
+            if (c == '"') {
+                pos = SkipString(s, pos);
+                if (pos == npos) {
+                    return npos;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    return pos + 1;
+                }
+            }
+            pos++;
+        }
+        return npos;
+    }
+    // Numbers and literals run until the next delimiter
+    size_t start = pos;
+    while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']' && !IsWhitespace(s[pos])) {
+        pos++;
+    }
+    return pos == start ? npos : pos;
+}
+
+static IncomingMessage::ValueType GetValueType(char c) {
+    switch (c) {
+        case '"': return IncomingMessage::kValueTypeString;
+        case '{': return IncomingMessage::kValueTypeObject;
+        case '[': return IncomingMessage::kValueTypeArray;
+        case 't': return IncomingMessage::kValueTypeTrue;
+        case 'f': return IncomingMessage::kValueTypeFalse;
+        case 'n': return IncomingMessage::kValueTypeNull;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                return IncomingMessage::kValueTypeNumber;
+            }
+            return IncomingMessage::kValueTypeNone;
+    }
+}
+
+static inline bool IsMsgPackMap(uint8_t c) {
+    return (c & 0xF0) == 0x80 || c == 0xde || c == 0xdf;
+}
+
+IncomingMessage::IncomingMessage(const char* data, size_t length) : data_(data, length) {
+    if (length > 0 && IsMsgPackMap(data[0])) {
+        binary_ = true;
+        ScanMsgPack();
+    } else {
+        ScanJson();
+    }
+}
+
+bool IncomingMessage::AddField(std::string_view key, std::string_view value, ValueType type) {
+    // Dropping the rest would hand on a message that silently lacks fields
+    if (field_count_ >= INCOMING_MESSAGE_MAX_FIELDS) {
+        ESP_LOGE(TAG, "More than %d fields, reject the message at %.*s", INCOMING_MESSAGE_MAX_FIELDS, (int)key.size(), key.data());
+        return false;
+    }
+    auto& field = fields_[field_count_++];
+    field.key = key;
+    field.value = value;
+    field.type = type;
+    return true;
+}
+
+void IncomingMessage::ScanJson() {
+    size_t pos = SkipWhitespace(data_, 0);
+    if (pos >= data_.size() || data_[pos] != '{') {
+        return;
+    }
+    pos = SkipWhitespace(data_, pos + 1);
+    if (pos < data_.size() && data_[pos] == '}') {
+        valid_ = true;
+        return;
+    }
+
+    while (pos < data_.size()) {
+        if (data_[pos] != '"') {
+            return;
+        }
+        size_t key_end = SkipString(data_, pos);
+        if (key_end == npos) {
+            return;
+        }
+        auto key = data_.substr(pos + 1, key_end - pos - 2);
+
+        pos = SkipWhitespace(data_, key_end);
+        if (pos >= data_.size() || data_[pos] != ':') {
+            return;
+        }
+        pos = SkipWhitespace(data_, pos + 1);
+        size_t value_end = SkipValue(data_, pos);
+        if (value_end == npos) {
+            return;
+        }
+        auto type = GetValueType(data_[pos]);
+        if (type == kValueTypeNone) {
+            return;
+        }
+
+        bool added;
+        if (type == kValueTypeString) {
+            added = AddField(key, data_.substr(pos + 1, value_end - pos - 2), type);
+        } else {
+            added = AddField(key, data_.substr(pos, value_end - pos), type);
+        }
+        if (!added) {
+            return;
+        }
+
+        pos = SkipWhitespace(data_, value_end);
+        if (pos >= data_.size()) {
+            return;
+        }
+        if (data_[pos] == '}') {
+            valid_ = true;
+            return;
+        }
+        if (data_[pos] != ',') {
+            return;
+        }
+        pos = SkipWhitespace(data_, pos + 1);
+    }
+}
+
+static uint64_t ReadBigEndian(std::string_view s, size_t pos, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | (uint8_t)s[pos + i];
+    }
+    return value;
+}
+
+// Returns the size of the header and, for strings, maps and arrays, their length or entry count
+static bool ReadMsgPackHeader(std::string_view s, size_t pos, size_t& header_size, uint64_t& length,
+    IncomingMessage::ValueType& type) {
+    if (pos >= s.size()) {
+        return false;
+    }
+    uint8_t c = s[pos];
+    header_size = 1;
+    length = 0;
+    int length_bytes = 0;
+    size_t payload_size = 0;
+    if (c <= 0x7f || c >= 0xe0) {
+        type = IncomingMessage::kValueTypeNumber;
+    } else if (c <= 0x8f) {
+        type = IncomingMessage::kValueTypeObject;
+        length = c & 0x0F;
+    } else if (c <= 0x9f) {
+        type = IncomingMessage::kValueTypeArray;
+        length = c & 0x0F;
+    } else if (c <= 0xbf) {
+        type = IncomingMessage::kValueTypeString;
+        length = c & 0x1F;
+    } else {
+        switch (c) {
+            case 0xc0: type = IncomingMessage::kValueTypeNull; break;
+            case 0xc2: type = IncomingMessage::kValueTypeFalse; break;
+            case 0xc3: type = IncomingMessage::kValueTypeTrue; break;
+            case 0xc4: case 0xc5: case 0xc6:
+                type = IncomingMessage::kValueTypeNone;
+                length_bytes = 1 << (c - 0xc4);
+                break;
+            case 0xc7: case 0xc8: case 0xc9:
+                type = IncomingMessage::kValueTypeNone;
+                length_bytes = 1 << (c - 0xc7);
+                payload_size = 1;
+                break;
+            case 0xca: type = IncomingMessage::kValueTypeNumber; payload_size = 4; break;
+            case 0xcb: type = IncomingMessage::kValueTypeNumber; payload_size = 8; break;
+            case 0xcc: case 0xcd: case 0xce: case 0xcf:
+                type = IncomingMessage::kValueTypeNumber;
+                payload_size = 1 << (c - 0xcc);
+                break;
+            case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+                type = IncomingMessage::kValueTypeNumber;
+                payload_size = 1 << (c - 0xd0);
+                break;
+            case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+                type = IncomingMessage::kValueTypeNone;
+                payload_size = 1 + (1 << (c - 0xd4));
+                break;
+            case 0xd9: case 0xda: case 0xdb:
+                type = IncomingMessage::kValueTypeString;
+                length_bytes = 1 << (c - 0xd9);
+                break;
+            case 0xdc: case 0xdd:
+                type = IncomingMessage::kValueTypeArray;
+                length_bytes = c == 0xdc ? 2 : 4;
+                break;
+            case 0xde: case 0xdf:
+                type = IncomingMessage::kValueTypeObject;
+                length_bytes = c == 0xde ? 2 : 4;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (pos + 1 + length_bytes > s.size()) {
+        return false;
+    }
+    if (length_bytes > 0) {
+        length = ReadBigEndian(s, pos + 1, length_bytes);
+    }
+    header_size = 1 + length_bytes;
+    // Fixed size payloads are reported as part of the header
+    header_size += payload_size;
+    return pos + header_size <= s.size();
+}
+
+static size_t SkipMsgPack(std::string_view s, size_t pos, int depth) {
+    size_t header_size;
+    uint64_t length;
+    IncomingMessage::ValueType type;
+    if (depth > 16 || !ReadMsgPackHeader(s, pos, header_size, length, type)) {
+        return npos;
+    }
+    pos += header_size;
+    if (type == IncomingMessage::kValueTypeObject || type == IncomingMessage::kValueTypeArray) {
+        uint64_t items = type == IncomingMessage::kValueTypeObject ? length * 2 : length;
+        for (uint64_t i = 0; i < items; i++) {
+            pos = SkipMsgPack(s, pos, depth + 1);
+            if (pos == npos) {
+                return npos;
+            }
+        }
+        return pos;
+    }
+    // Strings, bin and ext carry a variable payload
+    if (length > s.size() - pos) {
+        return npos;
+    }
+    return pos + length;
+}
+
+void IncomingMessage::ScanMsgPack() {
+    size_t header_size;
+    uint64_t count;
+    ValueType type;
+    if (!ReadMsgPackHeader(data_, 0, header_size, count, type) || type != kValueTypeObject) {
+        return;
+    }
+    size_t pos = header_size;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t key_length;
+        ValueType key_type;
+        if (!ReadMsgPackHeader(data_, pos, header_size, key_length, key_type) || key_type != kValueTypeString
+            || key_length > data_.size() - pos - header_size) {
+            return;
+        }
+        auto key = data_.substr(pos + header_size, key_length);
+        pos += header_size + key_length;
+
+        uint64_t length;
+        if (!ReadMsgPackHeader(data_, pos, header_size, length, type)) {
+            return;
+        }
+        size_t value_end = SkipMsgPack(data_, pos, 0);
+        if (value_end == npos) {
+            return;
+        }
+        bool added;
+        if (type == kValueTypeString) {
+            added = AddField(key, data_.substr(pos + header_size, length), type);
+        } else {
+            added = AddField(key, data_.substr(pos, value_end - pos), type);
+        }
+        if (!added) {
+            return;
+        }
+        pos = value_end;
+    }
+    valid_ = true;
+}
+
+const IncomingMessage::Field* IncomingMessage::Find(std::string_view key) const {
+    for (int i = 0; i < field_count_; i++) {
+        if (fields_[i].key == key) {
+            return &fields_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool IncomingMessage::Has(std::string_view key) const {
+    return Find(key) != nullptr;
+}
+
+IncomingMessage::ValueType IncomingMessage::GetType(std::string_view key) const {
+    auto field = Find(key);
+    return field != nullptr ? field->type : kValueTypeNone;
+}
+
+std::string_view IncomingMessage::GetRaw(std::string_view key) const {
+    auto field = Find(key);
+    return field != nullptr ? field->value : std::string_view();
+}
+
+static int32_t ParseHex4(std::string_view s, size_t pos) {
+    if (pos + 4 > s.size()) {
+        return -1;
+    }
+    int32_t value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = s[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return -1;
+    }
+    return value;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out.push_back(code);
+    } else if (code < 0x800) {
+        out.push_back(0xC0 | (code >> 6));
+        out.push_back(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out.push_back(0xE0 | (code >> 12));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    } else {
+        out.push_back(0xF0 | (code >> 18));
+        out.push_back(0x80 | ((code >> 12) & 0x3F));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    }
+}
+
+std::string IncomingMessage::GetString(std::string_view key, const std::string& default_value) const {
+    auto field = Find(key);
+    if (field == nullptr || field->type != kValueTypeString) {
+        return default_value;
+    }
+    auto value = field->value;
+    if (binary_ || value.find('\\') == npos) {
+        return std::string(value);
+    }
+
+    std::string result;
+    result.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c != '\\' || i + 1 >= value.size()) {
+            result.push_back(c);
+            continue;
+        }
+        c = value[++i];
+        switch (c) {
+            case 'b': result.push_back('\b'); break;
+            case 'f': result.push_back('\f'); break;
+            case 'n': result.push_back('\n'); break;
+            case 'r': result.push_back('\r'); break;
+            case 't': result.push_back('\t'); break;
+            case 'u': {
+                int32_t code = ParseHex4(value, i + 1);
+                if (code < 0) {
+                    break;
+                }
+                i += 4;
+                // Characters outside the BMP come as a surrogate pair
+                if (code >= 0xD800 && code < 0xDC00 && i + 2 < value.size() && value[i + 1] == '\\' && value[i + 2] == 'u') {
+                    int32_t low = ParseHex4(value, i + 3);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                AppendUtf8(result, code);
+                break;
+            }
+            default:
+                result.push_back(c);
+                break;
+        }
+    }
+    return result;
+}
+
+static int GetMsgPackInt(std::string_view value) {
+    uint8_t c = value[0];
+    if (c <= 0x7f) {
+        return c;
+    } else if (c >= 0xe0) {
+        return (int8_t)c;
+    }
+    switch (c) {
+        case 0xcc: return (uint8_t)ReadBigEndian(value, 1, 1);
+        case 0xcd: return (uint16_t)ReadBigEndian(value, 1, 2);
+        case 0xce: return (uint32_t)ReadBigEndian(value, 1, 4);
+        case 0xcf: return ReadBigEndian(value, 1, 8);
+        case 0xd0: return (int8_t)ReadBigEndian(value, 1, 1);
+        case 0xd1: return (int16_t)ReadBigEndian(value, 1, 2);
+        case 0xd2: return (int32_t)ReadBigEndian(value, 1, 4);
+        case 0xd3: return (int64_t)ReadBigEndian(value, 1, 8);
+        case 0xca: {
+            uint32_t bits = ReadBigEndian(value, 1, 4);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            return (int)f;
+        }
+        case 0xcb: {
+            uint64_t bits = ReadBigEndian(value, 1, 8);
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return (int)d;
+        }
+        default: return 0;
+    }
+}
+
+int IncomingMessage::GetInt(std::string_view key, int default_value) const {
+    auto field = Find(key);
+    if (field == nullptr || field->type != kValueTypeNumber) {
+        return default_value;
+    }
+    auto value = field->value;
+    if (binary_) {
+        return GetMsgPackInt(value);
+    }
+    size_t i = 0;
+    bool negative = value[0] == '-';
+    if (negative) {
+        i++;
+    }
+    int result = 0;
+    for (; i < value.size() && value[i] >= '0' && value[i] <= '9'; i++) {
+        result = result * 10 + (value[i] - '0');
+    }
+    return negative ? -result : result;
+}
+
+bool IncomingMessage::GetBool(std::string_view key, bool default_value) const {
+    auto type = GetType(key);
+    if (type == kValueTypeTrue) {
+        return true;
+    } else if (type == kValueTypeFalse) {
+        return false;
+    }
+    return default_value;
+}
+
+IncomingMessage IncomingMessage::GetObject(std::string_view key) const {
+    auto field = Find(key);
+    if (field == nullptr || field->type != kValueTypeObject) {
+        return IncomingMessage();
+    }
+    return IncomingMessage(field->value.data(), field->value.size());
+}
+
+static double GetMsgPackDouble(std::string_view value) {
+    uint8_t c = value[0];
+    if (c == 0xca) {
+        uint32_t bits = ReadBigEndian(value, 1, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    } else if (c == 0xcb) {
+        uint64_t bits = ReadBigEndian(value, 1, 8);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    return GetMsgPackInt(value);
+}
+
+// Builds the value at pos, end is set past it
+static cJSON* MsgPackToCJson(std::string_view s, size_t pos, size_t& end, int depth) {
+    size_t header_size;
+    uint64_t length;
+    IncomingMessage::ValueType type;
+    if (!ReadMsgPackHeader(s, pos, header_size, length, type)) {
+        return nullptr;
+    }
+    end = SkipMsgPack(s, pos, depth);
+    if (end == npos) {
+        return nullptr;
+    }
+    switch (type) {
+        case IncomingMessage::kValueTypeNumber:
+            return cJSON_CreateNumber(GetMsgPackDouble(s.substr(pos, end - pos)));
+        case IncomingMessage::kValueTypeString:
+            return cJSON_CreateString(std::string(s.substr(pos + header_size, length)).c_str());
+        case IncomingMessage::kValueTypeTrue:
+            return cJSON_CreateTrue();
+        case IncomingMessage::kValueTypeFalse:
+            return cJSON_CreateFalse();
+        case IncomingMessage::kValueTypeNull:
+            return cJSON_CreateNull();
+        case IncomingMessage::kValueTypeObject:
+        case IncomingMessage::kValueTypeArray:
+            break;
+        default:
+            // Binary and extension types have no JSON form
+            return nullptr;
+    }
+
+    bool is_object = type == IncomingMessage::kValueTypeObject;
+    auto container = is_object ? cJSON_CreateObject() : cJSON_CreateArray();
+    size_t item_pos = pos + header_size;
+    for (uint64_t i = 0; i < length; i++) {
+        std::string key;
+        if (is_object) {
+            uint64_t key_length;
+            IncomingMessage::ValueType key_type;
+            if (!ReadMsgPackHeader(s, item_pos, header_size, key_length, key_type) || key_type != IncomingMessage::kValueTypeString) {
+                cJSON_Delete(container);
+                return nullptr;
+            }
+            // SkipMsgPack above checked that the whole container fits
+            key.assign(s.data() + item_pos + header_size, key_length);
+            item_pos += header_size + key_length;
+        }
+        size_t item_end;
+        auto item = MsgPackToCJson(s, item_pos, item_end, depth + 1);
+        if (item == nullptr) {
+            cJSON_Delete(container);
+            return nullptr;
+        }
+        if (is_object) {
+            cJSON_AddItemToObject(container, key.c_str(), item);
+        } else {
+            cJSON_AddItemToArray(container, item);
+        }
+        item_pos = item_end;
+    }
+    return container;
+}
+
+cJSON* IncomingMessage::GetCJson(std::string_view key) const {
+    auto field = Find(key);
+    if (field == nullptr) {
+        return nullptr;
+    }
+    // String spans hold only the characters, without quotes or a MessagePack header
+    if (field->type == kValueTypeString) {
+        return cJSON_CreateString(GetString(key).c_str());
+    }
+    if (binary_) {
+        size_t end;
+        return MsgPackToCJson(field->value, 0, end, 0);
+    }
+    return cJSON_ParseWithLength(field->value.data(), field->value.size());
+}
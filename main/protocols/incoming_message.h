@@ -0,0 +1,80 @@
+#ifndef INCOMING_MESSAGE_H
+#define INCOMING_MESSAGE_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// A message with more top-level fields is rejected as a whole rather than truncated
+#define INCOMING_MESSAGE_MAX_FIELDS 16
+
+struct cJSON;
+
+// A read-only view of one JSON object received from the server.
+// The top level is scanned once in the constructor, every field is kept as a span
+// into the original buffer, which does not need to be NUL terminated and is never copied.
+// Nested objects are scanned lazily with GetObject().
+// A MessagePack map is detected by its first byte and exposes the same fields.
+// Messages with more than INCOMING_MESSAGE_MAX_FIELDS fields are not valid.
+class IncomingMessage {
+public:
+    enum ValueType {
+        kValueTypeNone,
+        kValueTypeString,
+        kValueTypeNumber,
+        kValueTypeObject,
+        kValueTypeArray,
+        kValueTypeTrue,
+        kValueTypeFalse,
+        kValueTypeNull
+    };
+
+    IncomingMessage() = default;
+    IncomingMessage(const char* data, size_t length);
+
+    inline bool valid() const {
+        return valid_;
+    }
+    inline std::string_view data() const {
+        return data_;
+    }
+    inline bool binary() const {
+        return binary_;
+    }
+    // The raw "type" field, message types never contain escapes
+    inline std::string_view type() const {
+        return GetRaw("type");
+    }
+
+    bool Has(std::string_view key) const;
+    ValueType GetType(std::string_view key) const;
+    // Strings without quotes and escapes resolved as-is, other values in the encoding of the message
+    std::string_view GetRaw(std::string_view key) const;
+    std::string GetString(std::string_view key, const std::string& default_value = "") const;
+    int GetInt(std::string_view key, int default_value = 0) const;
+    bool GetBool(std::string_view key, bool default_value = false) const;
+    IncomingMessage GetObject(std::string_view key) const;
+    // The value as a cJSON tree for code that takes cJSON, from either encoding.
+    // nullptr if the field is missing or malformed, otherwise freed with cJSON_Delete.
+    cJSON* GetCJson(std::string_view key) const;
+
+private:
+    struct Field {
+        std::string_view key;
+        std::string_view value;
+        ValueType type;
+    };
+
+    std::string_view data_;
+    Field fields_[INCOMING_MESSAGE_MAX_FIELDS];
+    int field_count_ = 0;
+    bool valid_ = false;
+    bool binary_ = false;
+
+    void ScanJson();
+    void ScanMsgPack();
+    bool AddField(std::string_view key, std::string_view value, ValueType type);
+    const Field* Find(std::string_view key) const;
+};
+
+#endif // INCOMING_MESSAGE_H
@@ -0,0 +1,63 @@
+#include "message_dispatcher.h"
+#include "string_hash.h"
+
+#include <esp_log.h>
+
+#define TAG "MessageDispatcher"
+
+void MessageDispatcher::Register(const std::string& type, Handler handler) {
+    for (auto& entry : entries_) {
+        if (entry.type == type) {
+            entry.handler = handler;
+            return;
+        }
+    }
+    entries_.push_back({type, StringHash(type), handler});
+    Rebuild();
+}
+
+void MessageDispatcher::Rebuild() {
+    size_t size = 4;
+    while (size < entries_.size() * 2) {
+        size <<= 1;
+    }
+
+    // Grow until there is no collision, beyond the size limit fall back to linear probing
+    bool perfect = false;
+    while (true) {
+        table_.assign(size, -1);
+        mask_ = size - 1;
+        perfect = true;
+        for (size_t i = 0; i < entries_.size(); i++) {
+            uint32_t slot = entries_[i].hash & mask_;
+            while (table_[slot] != -1) {
+                perfect = false;
+                slot = (slot + 1) & mask_;
+            }
+            table_[slot] = i;
+        }
+        if (perfect || size >= MESSAGE_DISPATCHER_MAX_TABLE_SIZE) {
+            break;
+        }
+        size <<= 1;
+    }
+    if (!perfect) {
+        ESP_LOGW(TAG, "Hash collision among %zu message types, using probing", entries_.size());
+    }
+}
+
+bool MessageDispatcher::Dispatch(const IncomingMessage& message) const {
+    if (table_.empty()) {
+        return false;
+    }
+    auto type = message.type();
+    uint32_t hash = StringHash(type);
+    for (uint32_t slot = hash & mask_; table_[slot] != -1; slot = (slot + 1) & mask_) {
+        auto& entry = entries_[table_[slot]];
+        if (entry.hash == hash && entry.type == type) {
+            entry.handler(message);
+            return true;
+        }
+    }
+    return false;
+}
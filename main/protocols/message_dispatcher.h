@@ -0,0 +1,39 @@
+#ifndef MESSAGE_DISPATCHER_H
+#define MESSAGE_DISPATCHER_H
+
+#include "incoming_message.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#define MESSAGE_DISPATCHER_MAX_TABLE_SIZE 256
+
+// Routes incoming messages to handlers by their "type".
+// The handler set is fixed after startup, so on every Register() the table is
+// resized until each type lands in its own slot, and a dispatch is one hash,
+// one slot and one string compare.
+class MessageDispatcher {
+public:
+    using Handler = std::function<void(const IncomingMessage& message)>;
+
+    void Register(const std::string& type, Handler handler);
+    bool Dispatch(const IncomingMessage& message) const;
+
+private:
+    struct Entry {
+        std::string type;
+        uint32_t hash;
+        Handler handler;
+    };
+
+    std::vector<Entry> entries_;
+    std::vector<int16_t> table_;
+    uint32_t mask_ = 0;
+
+    void Rebuild();
+};
+
+#endif // MESSAGE_DISPATCHER_H
@@ -2,11 +2,15 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
 #include <ml307_mqtt.h>
 #include <ml307_udp.h>
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -14,127 +18,225 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    // The AES context is reused for every session, only the key changes.
+    // With CONFIG_MBEDTLS_HARDWARE_AES the hardware AES engine is used.
+    mbedtls_aes_init(&aes_ctx_);
+
+    esp_timer_create_args_t resume_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (MqttProtocol*)arg;
+            protocol->OnResumeTimeout();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mqtt_resume",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&resume_timer_args, &resume_timer_);
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    esp_timer_stop(resume_timer_);
+    esp_timer_delete(resume_timer_);
+    // Let the reconnect task finish what it is doing, it may be holding a lock or a new client
+    if (reconnect_task_handle_ != nullptr) {
+        xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_STOP_EVENT);
+        xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_STOPPED_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
     if (udp_ != nullptr) {
         delete udp_;
     }
-    if (mqtt_ != nullptr) {
-        delete mqtt_;
-    }
+    mqtt_.reset();
+    mbedtls_aes_free(&aes_ctx_);
     vEventGroupDelete(event_group_handle_);
 }
 
 void MqttProtocol::Start() {
-    StartMqttClient(false);
+    // The connection is kept in the background, so that opening a channel never waits for DNS, TLS and CONNECT
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_DISCONNECTED_EVENT);
+    xTaskCreate([](void* arg) {
+        auto protocol = (MqttProtocol*)arg;
+        protocol->ReconnectTask();
+    }, "mqtt_reconnect", 4096, this, 2, &reconnect_task_handle_);
 }
 
-bool MqttProtocol::StartMqttClient(bool report_error) {
-    if (mqtt_ != nullptr) {
-        ESP_LOGW(TAG, "Mqtt client already started");
-        delete mqtt_;
+void MqttProtocol::ReconnectTask() {
+    int delay_ms = MQTT_RECONNECT_MIN_DELAY_MS;
+    int reconnect_count = 0;
+    while (true) {
+        auto bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_DISCONNECTED_EVENT | MQTT_PROTOCOL_STOP_EVENT,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+        if (bits & MQTT_PROTOCOL_STOP_EVENT) {
+            break;
+        }
+        xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_DISCONNECTED_EVENT);
+
+        auto outage_start = esp_timer_get_time();
+        while (!(xEventGroupGetBits(event_group_handle_) & MQTT_PROTOCOL_STOP_EVENT)) {
+            auto mqtt = StartMqttClient();
+            if (mqtt != nullptr) {
+                Settings settings("mqtt", false);
+                auto publish_topic = settings.GetString("publish_topic");
+                std::shared_ptr<Mqtt> old_mqtt(mqtt);
+                {
+                    std::lock_guard<std::mutex> lock(mqtt_mutex_);
+                    mqtt_.swap(old_mqtt);
+                    publish_topic_ = publish_topic;
+                }
+                // Released outside the lock, the old client may still be running its disconnect callback.
+                // A sender still holding it deletes it once its publish returns.
+                old_mqtt.reset();
+                ESP_LOGI(TAG, "MQTT ready, reconnect count: %d, offline for %lld ms",
+                    reconnect_count++, (esp_timer_get_time() - outage_start) / 1000);
+                xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_CONNECTED_EVENT);
+                delay_ms = MQTT_RECONNECT_MIN_DELAY_MS;
+                break;
+            }
+
+            // Exponential backoff with jitter, cut short when a channel is waiting to be opened
+            int jitter_ms = esp_random() % (delay_ms / 2 + 1);
+            ESP_LOGW(TAG, "Failed to connect, retry in %d ms", delay_ms + jitter_ms);
+            xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_RECONNECT_NOW_EVENT | MQTT_PROTOCOL_STOP_EVENT, pdFALSE, pdFALSE,
+                pdMS_TO_TICKS(delay_ms + jitter_ms));
+            xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_RECONNECT_NOW_EVENT);
+            delay_ms = std::min(delay_ms * 2, MQTT_RECONNECT_MAX_DELAY_MS);
+        }
     }
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_STOPPED_EVENT);
+    vTaskDelete(NULL);
+}
 
+Mqtt* MqttProtocol::StartMqttClient() {
     Settings settings("mqtt", false);
     endpoint_ = settings.GetString("endpoint");
     client_id_ = settings.GetString("client_id");
     username_ = settings.GetString("username");
     password_ = settings.GetString("password");
-    publish_topic_ = settings.GetString("publish_topic");
 
     if (endpoint_.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
-        if (report_error) {
-            SetError(Lang::Strings::SERVER_NOT_FOUND);
-        }
-        return false;
+        return nullptr;
     }
 
-    mqtt_ = Board::GetInstance().CreateMqtt();
-    mqtt_->SetKeepAlive(90);
+    auto mqtt = Board::GetInstance().CreateMqtt();
+    mqtt->SetKeepAlive(MQTT_PING_INTERVAL_SECONDS);
 
-    mqtt_->OnDisconnected([this]() {
+    mqtt->OnDisconnected([this, mqtt]() {
+        {
+            // Runs under the esp-mqtt lock, so mqtt_mutex_ must never be held while calling into a client
+            std::lock_guard<std::mutex> lock(mqtt_mutex_);
+            if (mqtt != mqtt_.get()) {
+                return;
+            }
+        }
         ESP_LOGI(TAG, "Disconnected from endpoint");
+        xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_CONNECTED_EVENT);
+        xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_DISCONNECTED_EVENT);
     });
 
-    mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+    mqtt->OnMessage([this](const std::string& topic, const std::string& payload) {
+        IncomingMessage message(payload.data(), payload.size());
+        if (!message.valid()) {
+            ESP_LOGE(TAG, "Failed to parse message, size: %zu", payload.size());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (type == nullptr) {
+        auto type = message.type();
+        if (type.empty()) {
             ESP_LOGE(TAG, "Message type is not specified");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        if (type == "hello") {
+            ParseServerHello(message);
+        } else if (type == "goodbye") {
+            auto session_id = message.GetString("session_id");
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", message.Has("session_id") ? session_id.c_str() : "null");
+            if (!message.Has("session_id") || session_id_ == session_id) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     ESP_LOGI(TAG, "Connecting to endpoint %s", endpoint_.c_str());
-    if (!mqtt_->Connect(endpoint_, 8883, client_id_, username_, password_)) {
+    auto start_time = esp_timer_get_time();
+    if (!mqtt->Connect(endpoint_, 8883, client_id_, username_, password_)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
-        return false;
+        delete mqtt;
+        return nullptr;
     }
 
-    ESP_LOGI(TAG, "Connected to endpoint");
-    return true;
+    ESP_LOGI(TAG, "Connected to endpoint in %lld ms", (esp_timer_get_time() - start_time) / 1000);
+    return mqtt;
+}
+
+// The client is copied under the lock and used outside it, see mqtt_mutex_
+std::shared_ptr<Mqtt> MqttProtocol::GetMqtt(std::string& publish_topic) {
+    std::lock_guard<std::mutex> lock(mqtt_mutex_);
+    publish_topic = publish_topic_;
+    return publish_topic.empty() ? nullptr : mqtt_;
 }
 
 void MqttProtocol::SendText(const std::string& text) {
-    if (publish_topic_.empty()) {
+    std::string publish_topic;
+    auto mqtt = GetMqtt(publish_topic);
+    if (mqtt == nullptr) {
         return;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
+    if (!mqtt->Publish(publish_topic, text)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
     }
 }
 
-void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
+// MQTT payloads are binary safe, MessagePack goes to the same topic and is told apart by its first byte
+void MqttProtocol::SendMsgPack(const std::string& data) {
+    std::string publish_topic;
+    auto mqtt = GetMqtt(publish_topic);
+    if (mqtt == nullptr) {
+        return;
+    }
+    if (!mqtt->Publish(publish_topic, data)) {
+        ESP_LOGE(TAG, "Failed to publish MessagePack message");
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+}
+
+void MqttProtocol::SendAudio(const uint8_t* data, size_t size) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
+    // Build the packet in place: the nonce is the header, the payload is encrypted right after it.
+    // udp_packet_ keeps its capacity between packets, so no allocation happens here.
+    udp_packet_.resize(aes_nonce_.size() + size);
+    auto packet = (uint8_t*)udp_packet_.data();
+    memcpy(packet, aes_nonce_.data(), aes_nonce_.size());
+    *(uint16_t*)&packet[2] = htons(size);
+    *(uint32_t*)&packet[12] = htonl(++local_sequence_);
+
+    // mbedtls increments the counter block, so work on a copy of the header
+    uint8_t counter[16];
+    memcpy(counter, packet, sizeof(counter));
     size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    uint8_t stream_block[16];
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block,
+        data, packet + aes_nonce_.size()) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return;
     }
-    udp_->Send(encrypted);
+    udp_->Send(udp_packet_);
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    // An unanswered resume is dropped by the next OpenAudioChannel
+    esp_timer_stop(resume_timer_);
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         if (udp_ != nullptr) {
@@ -143,11 +245,12 @@ void MqttProtocol::CloseAudioChannel() {
         }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    SendMessage([this](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("goodbye");
+        writer.EndObject();
+    });
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -155,42 +258,127 @@ void MqttProtocol::CloseAudioChannel() {
 }
 
 bool MqttProtocol::OpenAudioChannel() {
-    if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
-        ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
-        if (!StartMqttClient(true)) {
+    // Only wait a bounded time for the reconnect task, the main loop must not hang on a broker outage
+    if (!(xEventGroupGetBits(event_group_handle_) & MQTT_PROTOCOL_CONNECTED_EVENT)) {
+        ESP_LOGI(TAG, "MQTT is not connected, waiting for the reconnect task");
+        auto wait_start = esp_timer_get_time();
+        xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_RECONNECT_NOW_EVENT);
+        EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_CONNECTED_EVENT, pdFALSE, pdFALSE, pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS));
+        xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_RECONNECT_NOW_EVENT);
+        ESP_LOGI(TAG, "Main loop blocked for %lld ms waiting for MQTT", (esp_timer_get_time() - wait_start) / 1000);
+        if (!(bits & MQTT_PROTOCOL_CONNECTED_EVENT)) {
+            Settings settings("mqtt", false);
+            SetError(settings.GetString("endpoint").empty() ? Lang::Strings::SERVER_NOT_FOUND : Lang::Strings::SERVER_NOT_CONNECTED);
             return false;
         }
     }
 
     error_occurred_ = false;
-    session_id_ = "";
-    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
+    auto start_time = esp_timer_get_time();
 
-    // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    SendText(message);
+    // With a resume token the server keeps the last session, its UDP parameters and the descriptors of this device,
+    // so UDP opens right away with the cached parameters. The answer is reconciled in ParseServerHello.
+    std::string resume_token;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (resume_state_ != kMqttResumeNone) {
+            // The last resume was never answered, do not try that token again
+            ESP_LOGW(TAG, "Last session resume was not answered, starting a new session");
+            resume_token_.clear();
+            resume_state_ = kMqttResumeNone;
+        }
+        if (!udp_server_.empty()) {
+            resume_token = resume_token_;
+        }
+        if (!resume_token.empty()) {
+            resume_state_ = kMqttResumeWaiting;
+            resume_start_time_ = start_time;
+            // local_sequence_ keeps counting up so that no AES-CTR counter block is reused with the cached key
+            remote_sequence_ = 0;
+        }
+    }
 
-    // 等待服务器响应
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & MQTT_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
+    bool resuming = !resume_token.empty();
+    if (resuming) {
+        // The resumed server session still has the descriptors of this device
+        iot_descriptors_unchanged_ = true;
+        SendHello(resume_token);
+        esp_timer_start_once(resume_timer_, MQTT_RESUME_TIMEOUT_MS * 1000);
+    } else {
+        session_id_ = "";
+        frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
+        msgpack_enabled_ = false;
+        iot_descriptors_unchanged_ = false;
+        SendHello("");
+        if (!WaitServerHello(MQTT_SERVER_HELLO_TIMEOUT_MS)) {
+            ESP_LOGE(TAG, "Failed to receive server hello");
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+            return false;
+        }
+    }
+
+    ConnectUdp();
+    // The MQTT task stamps the hello only after signalling it, and a resume has no answer yet
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    ESP_LOGI(TAG, "Audio channel opened in %lld ms%s", (esp_timer_get_time() - start_time) / 1000, resuming ? " (resuming)" : "");
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
     }
+    return true;
+}
 
+// Neither "resumed" nor fresh parameters arrived in time. The channel stays on the cached parameters
+// while a full hello asks for a new session, its answer is reconciled like a rejected resume.
+void MqttProtocol::OnResumeTimeout() {
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (resume_state_ != kMqttResumeWaiting) {
+            return;
+        }
+        resume_state_ = kMqttResumeAbandoned;
+        resume_token_.clear();
+    }
+    ESP_LOGW(TAG, "No answer to session resume in %d ms, asking for a new session", MQTT_RESUME_TIMEOUT_MS);
+    SendHello("");
+}
+
+// 发送 hello 消息申请 UDP 通道
+void MqttProtocol::SendHello(const std::string& resume_token) {
+    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
+    std::string message;
+    message.reserve(PROTOCOL_MESSAGE_RESERVE_SIZE * 2);
+    JsonWriter writer(message);
+    writer.BeginObject();
+    writer.Key("type").String("hello");
+    writer.Key("version").Int(3);
+    writer.Key("transport").String("udp");
+    WriteAudioParams(writer);
+    WriteFeatures(writer);
+    if (!resume_token.empty()) {
+        writer.Key("resume").BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("token").String(resume_token);
+        writer.EndObject();
+    }
+    writer.EndObject();
+    SendText(message);
+}
+
+bool MqttProtocol::WaitServerHello(int timeout_ms) {
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return bits & MQTT_PROTOCOL_SERVER_HELLO_EVENT;
+}
+
+void MqttProtocol::ConnectUdp() {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ != nullptr) {
         delete udp_;
     }
     udp_ = Board::GetInstance().CreateUdp();
+    udp_packet_.reserve(aes_nonce_.size() + 1024);
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < aes_nonce_.size()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -207,14 +395,20 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
-        std::vector<uint8_t> decrypted;
+        // Decrypt straight into a pooled buffer handed to the decoder, the counter block lives on the stack
         size_t decrypted_size = data.size() - aes_nonce_.size();
+        auto decrypted = AudioPacketPool::GetInstance().Acquire(decrypted_size);
+        if (!decrypted) {
+            // Dropped and counted by the pool, the sequence still moves on
+            remote_sequence_ = sequence;
+            return;
+        }
+        uint8_t counter[16];
+        memcpy(counter, data.data(), sizeof(counter));
         size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
+        uint8_t stream_block[16];
+        auto encrypted = (const uint8_t*)data.data() + aes_nonce_.size();
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, counter, stream_block, encrypted, decrypted.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
@@ -227,52 +421,83 @@ bool MqttProtocol::OpenAudioChannel() {
     });
 
     udp_->Connect(udp_server_, udp_port_);
+}
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+void MqttProtocol::ParseServerHello(const IncomingMessage& message) {
+    auto transport = message.GetRaw("transport");
+    if (transport != "udp") {
+        ESP_LOGE(TAG, "Unsupported transport: %.*s", (int)transport.size(), transport.data());
+        return;
     }
-    return true;
-}
 
-void MqttProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+    if (message.GetBool("resumed")) {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        // A late answer to a resume that already timed out is ignored, a new hello is on its way
+        if (resume_state_ == kMqttResumeWaiting) {
+            ESP_LOGI(TAG, "Server accepted session resume in %lld ms", (esp_timer_get_time() - resume_start_time_) / 1000);
+            resume_state_ = kMqttResumeNone;
+            esp_timer_stop(resume_timer_);
+        }
         return;
     }
 
-    auto session_id = cJSON_GetObjectItem(root, "session_id");
-    if (session_id != nullptr) {
-        session_id_ = session_id->valuestring;
+    if (message.Has("session_id")) {
+        session_id_ = message.GetString("session_id");
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-    }
+    // Get sample rate and frame duration from hello message
+    ParseAudioParams(message.GetObject("audio_params"));
+    ParseFeatures(message);
 
-    auto udp = cJSON_GetObjectItem(root, "udp");
-    if (udp == nullptr) {
+    auto udp = message.GetObject("udp");
+    if (!udp.valid()) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
-
-    // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
-    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
-    local_sequence_ = 0;
-    remote_sequence_ = 0;
+
+    bool reconcile;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        // The token lets the next session keep this one on the server
+        resume_token_ = message.GetString("resume_token");
+        udp_server_ = udp.GetString("server");
+        udp_port_ = udp.GetInt("port");
+        auto key = udp.GetString("key");
+        auto nonce = udp.GetString("nonce");
+
+        // auto encryption = udp.GetString("encryption");
+        // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption.c_str());
+        aes_nonce_ = DecodeHexString(nonce);
+        mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+        local_sequence_ = 0;
+        remote_sequence_ = 0;
+        reconcile = resume_state_ != kMqttResumeNone;
+        resume_state_ = kMqttResumeNone;
+    }
+
+    if (reconcile) {
+        // The channel is already open on the cached parameters of a session the server no longer has.
+        // Move UDP to the new ones and report the channel opened again, so that the new session gets the
+        // audio parameters, descriptors and states like any other.
+        esp_timer_stop(resume_timer_);
+        ESP_LOGW(TAG, "Session not resumed, switching UDP to the new session");
+        Application::GetInstance().Schedule([this]() {
+            {
+                std::lock_guard<std::mutex> lock(channel_mutex_);
+                if (udp_ == nullptr) {
+                    // Closed meanwhile, the next channel resumes the new session
+                    return;
+                }
+            }
+            ConnectUdp();
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            if (on_audio_channel_opened_ != nullptr) {
+                on_audio_channel_opened_();
+            }
+        });
+        return;
+    }
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -296,5 +521,16 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (udp_ == nullptr) {
+            return false;
+        }
+        // Neither the resume nor the full hello that followed it was answered
+        if (resume_state_ != kMqttResumeNone &&
+            esp_timer_get_time() - resume_start_time_ > MQTT_SERVER_HELLO_TIMEOUT_MS * 1000LL) {
+            return false;
+        }
+    }
+    return !error_occurred_ && !IsTimeout();
 }
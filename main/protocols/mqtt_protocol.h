@@ -5,20 +5,41 @@
 #include "protocol.h"
 #include <mqtt.h>
 #include <udp.h>
-#include <cJSON.h>
 #include <mbedtls/aes.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 
 #include <functional>
 #include <string>
 #include <map>
 #include <mutex>
+#include <memory>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
-#define MQTT_RECONNECT_INTERVAL_MS 10000
+#define MQTT_CONNECT_TIMEOUT_MS 3000
+#define MQTT_RECONNECT_MIN_DELAY_MS 1000
+#define MQTT_RECONNECT_MAX_DELAY_MS 60000
+#define MQTT_SERVER_HELLO_TIMEOUT_MS 10000
+// A server that does not answer a resume this fast is sent a full hello, the channel stays open meanwhile
+#define MQTT_RESUME_TIMEOUT_MS 2000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_CONNECTED_EVENT (1 << 1)
+#define MQTT_PROTOCOL_DISCONNECTED_EVENT (1 << 2)
+#define MQTT_PROTOCOL_RECONNECT_NOW_EVENT (1 << 3)
+#define MQTT_PROTOCOL_STOP_EVENT (1 << 4)
+#define MQTT_PROTOCOL_STOPPED_EVENT (1 << 5)
+
+// Where the answer to a resume hello stands. The channel opens with the cached parameters
+// without waiting for it, fresh parameters in the answer replace them afterwards.
+enum MqttResumeState {
+    kMqttResumeNone,
+    kMqttResumeWaiting,
+    // Not answered in time, a full hello was sent and only its answer counts
+    kMqttResumeAbandoned
+};
 
 class MqttProtocol : public Protocol {
 public:
@@ -26,7 +47,7 @@ public:
     ~MqttProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const uint8_t* data, size_t size) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -40,21 +61,38 @@ private:
     std::string password_;
     std::string publish_topic_;
 
-    std::mutex channel_mutex_;
-    Mqtt* mqtt_ = nullptr;
+    // Only held to copy or swap the client, never across a call into it: esp-mqtt runs the callbacks
+    // under its own lock, which Publish needs as well
+    std::mutex mqtt_mutex_;
+    mutable std::mutex channel_mutex_;
+    std::shared_ptr<Mqtt> mqtt_;
+    TaskHandle_t reconnect_task_handle_ = nullptr;
     Udp* udp_ = nullptr;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    std::string udp_packet_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    // Written by the server hello on the MQTT task, guarded by channel_mutex_
+    std::string resume_token_;
+    MqttResumeState resume_state_ = kMqttResumeNone;
+    int64_t resume_start_time_ = 0;
+    esp_timer_handle_t resume_timer_ = nullptr;
 
-    bool StartMqttClient(bool report_error=false);
-    void ParseServerHello(const cJSON* root);
+    std::shared_ptr<Mqtt> GetMqtt(std::string& publish_topic);
+    Mqtt* StartMqttClient();
+    void ReconnectTask();
+    void SendHello(const std::string& resume_token);
+    bool WaitServerHello(int timeout_ms);
+    void ConnectUdp();
+    void OnResumeTimeout();
+    void ParseServerHello(const IncomingMessage& message);
     std::string DecodeHexString(const std::string& hex_string);
 
     void SendText(const std::string& text) override;
+    void SendMsgPack(const std::string& data) override;
 };
 
 
@@ -1,14 +1,15 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const IncomingMessage& message)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(AudioPacket&& packet)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -31,90 +32,164 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
-void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
-    if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+void Protocol::ParseAudioParams(const IncomingMessage& audio_params) {
+    if (!audio_params.valid()) {
+        return;
     }
-    message += "}";
-    SendText(message);
-}
-
-void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
-}
-
-void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
-    if (mode == kListeningModeAlwaysOn) {
-        message += ",\"mode\":\"realtime\"";
-    } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
-    } else {
-        message += ",\"mode\":\"manual\"";
+    server_sample_rate_ = audio_params.GetInt("sample_rate", server_sample_rate_);
+    // The server may pick a different frame duration than the one we proposed in hello
+    if (audio_params.Has("frame_duration")) {
+        int duration = audio_params.GetInt("frame_duration");
+        if (duration == 20 || duration == 40 || duration == 60 || duration == 120) {
+            frame_duration_ = duration;
+        } else {
+            ESP_LOGW(TAG, "Unsupported frame duration %d, keep %d ms", duration, frame_duration_);
+        }
     }
-    message += "}";
-    SendText(message);
 }
 
-void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+void Protocol::WriteAudioParams(JsonWriter& writer) const {
+    writer.Key("audio_params").BeginObject();
+    writer.Key("format").String("opus");
+    writer.Key("sample_rate").Int(16000);
+    writer.Key("channels").Int(1);
+    writer.Key("frame_duration").Int(frame_duration_);
+    writer.EndObject();
 }
 
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
-        return;
+void Protocol::WriteFeatures(JsonWriter& writer) const {
+    writer.Key("features").BeginObject();
+    writer.Key("msgpack").Bool(true);
+    writer.EndObject();
+    if (!iot_descriptors_hash_.empty()) {
+        writer.Key("iot_descriptors_hash").String(iot_descriptors_hash_);
     }
+}
 
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
-        return;
+void Protocol::ParseFeatures(const IncomingMessage& message) {
+    auto features = message.GetObject("features");
+    msgpack_enabled_ = features.valid() && features.GetBool("msgpack");
+    if (msgpack_enabled_) {
+        ESP_LOGI(TAG, "Control messages are encoded with MessagePack");
     }
+    iot_descriptors_unchanged_ = message.GetBool("iot_descriptors_unchanged");
+}
 
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
+void Protocol::SendAbortSpeaking(AbortReason reason) {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("abort");
+        if (reason == kAbortReasonWakeWordDetected) {
+            writer.Key("reason").String("wake_word_detected");
         }
+        writer.EndObject();
+    });
+}
 
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
-
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
+void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("listen");
+        writer.Key("state").String("detect");
+        writer.Key("text").String(wake_word);
+        writer.EndObject();
+    });
+}
 
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
+void Protocol::SendStartListening(ListeningMode mode) {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("listen");
+        writer.Key("state").String("start");
+        if (mode == kListeningModeAlwaysOn) {
+            writer.Key("mode").String("realtime");
+        } else if (mode == kListeningModeAutoStop) {
+            writer.Key("mode").String("auto");
+        } else {
+            writer.Key("mode").String("manual");
         }
+        writer.EndObject();
+    });
+}
 
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
-    }
+void Protocol::SendStopListening() {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("listen");
+        writer.Key("state").String("stop");
+        writer.EndObject();
+    });
+}
 
-    cJSON_Delete(root);
+// One message per thing, the cached descriptors are inserted as they are
+void Protocol::SendIotDescriptors(const std::vector<std::string>& descriptors) {
+    auto start_time = esp_timer_get_time();
+    size_t total_size = 0;
+    std::string message;
+    for (auto& descriptor : descriptors) {
+        message.clear();
+        message.reserve(PROTOCOL_MESSAGE_RESERVE_SIZE + descriptor.size());
+        JsonWriter writer(message);
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("iot");
+        writer.Key("update").Bool(true);
+        writer.Key("descriptors").BeginArray().Raw(descriptor).EndArray();
+        writer.EndObject();
+        SendText(message);
+        total_size += message.size();
+    }
+    ESP_LOGI(TAG, "Sent %zu IoT descriptors, %zu bytes in %lld ms", descriptors.size(), total_size,
+        (esp_timer_get_time() - start_time) / 1000);
 }
 
+// IoT descriptors and states stay JSON in both encodings
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+    std::string message;
+    message.reserve(PROTOCOL_MESSAGE_RESERVE_SIZE + states.size());
+    JsonWriter writer(message);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("iot");
+    writer.Key("update").Bool(true);
+    writer.Key("states").Raw(states);
+    writer.EndObject();
     SendText(message);
 }
 
+void Protocol::SendIotAck(const std::string& id, const char* result, int queue_ms, int exec_ms) {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("iot");
+        writer.Key("ack").BeginObject();
+        writer.Key("id").String(id);
+        writer.Key("result").String(result);
+        writer.Key("queue_ms").Int(queue_ms);
+        writer.Key("exec_ms").Int(exec_ms);
+        writer.EndObject();
+        writer.EndObject();
+    });
+}
+
+void Protocol::SendIotRulesAck(const char* result, int installed, int total) {
+    SendMessage([&](auto& writer) {
+        writer.BeginObject();
+        writer.Key("session_id").String(session_id_);
+        writer.Key("type").String("iot");
+        writer.Key("rules_ack").BeginObject();
+        writer.Key("result").String(result);
+        writer.Key("installed").Int(installed);
+        writer.Key("total").Int(total);
+        writer.EndObject();
+        writer.EndObject();
+    });
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
@@ -1,10 +1,23 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
-#include <cJSON.h>
+#include "incoming_message.h"
+#include "json_writer.h"
+#include "msgpack_writer.h"
+#include "audio_packet_pool.h"
+
+#include <sdkconfig.h>
 #include <string>
 #include <functional>
 #include <chrono>
+#include <vector>
+
+// Outgoing control messages are built in a buffer of this size, so they fit without reallocation
+#define PROTOCOL_MESSAGE_RESERVE_SIZE 128
+
+// Payload types of BinaryProtocol3 frames
+#define BINARY_PROTOCOL3_TYPE_AUDIO 0
+#define BINARY_PROTOCOL3_TYPE_MSGPACK 1
 
 struct BinaryProtocol3 {
     uint8_t type;
@@ -31,12 +44,22 @@ public:
     inline int server_sample_rate() const {
         return server_sample_rate_;
     }
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // True when the server answered hello saying it already has the descriptors with our hash
+    inline bool iot_descriptors_unchanged() const {
+        return iot_descriptors_unchanged_;
+    }
+    inline void SetIotDescriptorsHash(const std::string& hash) {
+        iot_descriptors_hash_ = hash;
+    }
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingAudio(std::function<void(AudioPacket&& packet)> callback);
+    void OnIncomingJson(std::function<void(const IncomingMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -45,29 +68,57 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    virtual void SendAudio(const uint8_t* data, size_t size) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    virtual void SendIotDescriptors(const std::vector<std::string>& descriptors);
     virtual void SendIotStates(const std::string& states);
+    virtual void SendIotAck(const std::string& id, const char* result, int queue_ms, int exec_ms);
+    virtual void SendIotRulesAck(const char* result, int installed, int total);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<void(const IncomingMessage& message)> on_incoming_json_;
+    std::function<void(AudioPacket&& packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 16000;
+    int frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
     bool error_occurred_ = false;
+    // Set when the server accepts MessagePack control messages in its hello
+    bool msgpack_enabled_ = false;
+    std::string iot_descriptors_hash_;
+    bool iot_descriptors_unchanged_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual void SendText(const std::string& text) = 0;
+    virtual void SendMsgPack(const std::string& data) = 0;
     virtual void SetError(const std::string& message);
+    void ParseAudioParams(const IncomingMessage& audio_params);
+    void WriteAudioParams(JsonWriter& writer) const;
+    void WriteFeatures(JsonWriter& writer) const;
+    void ParseFeatures(const IncomingMessage& message);
     virtual bool IsTimeout() const;
+
+    // The builder is called with a JsonWriter or a MsgPackWriter, depending on the negotiated encoding
+    template <typename Builder>
+    void SendMessage(Builder&& build) {
+        std::string message;
+        message.reserve(PROTOCOL_MESSAGE_RESERVE_SIZE);
+        if (msgpack_enabled_) {
+            MsgPackWriter writer(message);
+            build(writer);
+            SendMsgPack(message);
+        } else {
+            JsonWriter writer(message);
+            build(writer);
+            SendText(message);
+        }
+    }
 };
 
 #endif // PROTOCOL_H
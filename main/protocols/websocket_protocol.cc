@@ -2,10 +2,14 @@
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
+#include "audio_packet_pool.h"
+#include "settings.h"
 
 #include <cstring>
-#include <cJSON.h>
+#include <algorithm>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -16,24 +20,114 @@ WebsocketProtocol::WebsocketProtocol() {
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
+    // Let the reconnect task finish a connection attempt instead of deleting it halfway
+    if (reconnect_task_handle_ != nullptr) {
+        xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_STOP_EVENT);
+        xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_STOPPED_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
     }
+    ReplaceWebSocket(nullptr);
     vEventGroupDelete(event_group_handle_);
 }
 
+// The old client is deleted outside the lock, its disconnect callback takes it
+void WebsocketProtocol::ReplaceWebSocket(WebSocket* websocket) {
+    {
+        std::lock_guard<std::mutex> lock(websocket_mutex_);
+        std::swap(websocket_, websocket);
+    }
+    if (websocket != nullptr) {
+        delete websocket;
+    }
+}
+
 void WebsocketProtocol::Start() {
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // Keep the connection open across sessions, a background task (re)connects it
+    // so that neither the main loop nor a wake up has to wait for the TLS handshake
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_DISCONNECTED_EVENT);
+    xTaskCreate([](void* arg) {
+        WebsocketProtocol* protocol = (WebsocketProtocol*)arg;
+        protocol->ReconnectTask();
+    }, "ws_reconnect", 4096, this, 2, &reconnect_task_handle_);
+#endif
+}
+
+void WebsocketProtocol::ReconnectTask() {
+    int delay_ms = WEBSOCKET_RECONNECT_MIN_DELAY_MS;
+    int reconnect_count = 0;
+    while (true) {
+        auto bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_DISCONNECTED_EVENT | WEBSOCKET_PROTOCOL_STOP_EVENT,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+        if (bits & WEBSOCKET_PROTOCOL_STOP_EVENT) {
+            break;
+        }
+        xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_DISCONNECTED_EVENT);
+
+        while (!(xEventGroupGetBits(event_group_handle_) & WEBSOCKET_PROTOCOL_STOP_EVENT)) {
+            auto websocket = Connect();
+            if (websocket != nullptr) {
+                ReplaceWebSocket(websocket);
+                if (!websocket->IsConnected()) {
+                    // Dropped before it was installed, its disconnect callback was ignored
+                    continue;
+                }
+                ESP_LOGI(TAG, "Websocket ready, reconnect count: %d", reconnect_count++);
+                xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_CONNECTED_EVENT);
+                delay_ms = WEBSOCKET_RECONNECT_MIN_DELAY_MS;
+                break;
+            }
+
+            // Exponential backoff with jitter, so that a fleet does not reconnect in lockstep
+            int jitter_ms = esp_random() % (delay_ms / 2 + 1);
+            ESP_LOGW(TAG, "Failed to connect, retry in %d ms", delay_ms + jitter_ms);
+            xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_STOP_EVENT, pdFALSE, pdFALSE,
+                pdMS_TO_TICKS(delay_ms + jitter_ms));
+            delay_ms = std::min(delay_ms * 2, WEBSOCKET_RECONNECT_MAX_DELAY_MS);
+        }
+    }
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_STOPPED_EVENT);
+    vTaskDelete(NULL);
+}
+
+void WebsocketProtocol::SendAudio(const uint8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(websocket_mutex_);
+    if (websocket_ == nullptr) {
+        return;
+    }
+
+    if (msgpack_enabled_) {
+        SendBinaryFrame(BINARY_PROTOCOL3_TYPE_AUDIO, data, size);
+    } else {
+        websocket_->Send(data, size, true);
+    }
 }
 
-void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void WebsocketProtocol::SendMsgPack(const std::string& data) {
+    std::lock_guard<std::mutex> lock(websocket_mutex_);
     if (websocket_ == nullptr) {
         return;
     }
 
-    websocket_->Send(data.data(), data.size(), true);
+    if (!SendBinaryFrame(BINARY_PROTOCOL3_TYPE_MSGPACK, data.data(), data.size())) {
+        ESP_LOGE(TAG, "Failed to send MessagePack message");
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+}
+
+// Once MessagePack is negotiated, binary frames carry a BinaryProtocol3 header to tell audio from control.
+// Must be called with websocket_mutex_ held, frame_buffer_ is reused between frames.
+bool WebsocketProtocol::SendBinaryFrame(uint8_t type, const void* data, size_t size) {
+    frame_buffer_.resize(sizeof(BinaryProtocol3) + size);
+    auto frame = (BinaryProtocol3*)frame_buffer_.data();
+    frame->type = type;
+    frame->reserved = 0;
+    frame->payload_size = htons(size);
+    memcpy(frame->payload, data, size);
+    return websocket_->Send(frame_buffer_.data(), frame_buffer_.size(), true);
 }
 
 void WebsocketProtocol::SendText(const std::string& text) {
+    std::lock_guard<std::mutex> lock(websocket_mutex_);
     if (websocket_ == nullptr) {
         return;
     }
@@ -45,78 +139,162 @@ void WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    {
+        // The reconnect task may replace the client at any time
+        std::lock_guard<std::mutex> lock(websocket_mutex_);
+        if (websocket_ == nullptr || !websocket_->IsConnected()) {
+            return false;
+        }
+    }
+    return audio_channel_opened_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-        websocket_ = nullptr;
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // End the session but keep the connection for the next one
+    if (audio_channel_opened_.exchange(false)) {
+        SendMessage([this](auto& writer) {
+            writer.BeginObject();
+            writer.Key("session_id").String(session_id_);
+            writer.Key("type").String("goodbye");
+            writer.EndObject();
+        });
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+    }
+#else
+    // Cleared before the client goes, its disconnect callback does not report the close again
+    bool opened = audio_channel_opened_.exchange(false);
+    ReplaceWebSocket(nullptr);
+    if (opened && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
     }
+#endif
 }
 
-bool WebsocketProtocol::OpenAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
+void WebsocketProtocol::OnMessage(const char* data, size_t len) {
+    // Scan the frame in place, it is not NUL terminated
+    IncomingMessage message(data, len);
+    if (!message.valid() || message.type().empty()) {
+        ESP_LOGE(TAG, "Invalid message, size: %zu", len);
+    } else if (message.type() == "hello") {
+        ParseServerHello(message);
+    } else if (on_incoming_json_ != nullptr) {
+        on_incoming_json_(message);
     }
+}
 
-    error_occurred_ = false;
-    std::string url = CONFIG_WEBSOCKET_URL;
-    std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
-    websocket_ = Board::GetInstance().CreateWebSocket();
-    websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
-
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
-        if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
+WebSocket* WebsocketProtocol::Connect() {
+    // Settings delivered by the version check take precedence over the build configuration
+    Settings settings("websocket", false);
+    std::string url = settings.GetString("url", CONFIG_WEBSOCKET_URL);
+    std::string token = "Bearer " + settings.GetString("token", CONFIG_WEBSOCKET_ACCESS_TOKEN);
+    auto websocket = Board::GetInstance().CreateWebSocket();
+    websocket->SetHeader("Authorization", token.c_str());
+    websocket->SetHeader("Protocol-Version", "1");
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
+        if (binary && msgpack_enabled_) {
+            auto frame = (const BinaryProtocol3*)data;
+            size_t payload_size = len >= sizeof(BinaryProtocol3) ? ntohs(frame->payload_size) : 0;
+            if (payload_size == 0 || sizeof(BinaryProtocol3) + payload_size > len) {
+                ESP_LOGE(TAG, "Invalid binary frame, size: %zu", len);
+            } else if (frame->type == BINARY_PROTOCOL3_TYPE_MSGPACK) {
+                OnMessage((const char*)frame->payload, payload_size);
+            } else if (on_incoming_audio_ != nullptr) {
+                auto packet = AudioPacketPool::GetInstance().Acquire(payload_size);
+                if (packet) {
+                    memcpy(packet.data(), frame->payload, payload_size);
+                    on_incoming_audio_(std::move(packet));
+                }
             }
-        } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
+        } else if (binary) {
+            if (on_incoming_audio_ != nullptr) {
+                // The pool counts the packets it cannot take, they are dropped
+                auto packet = AudioPacketPool::GetInstance().Acquire(len);
+                if (packet) {
+                    memcpy(packet.data(), data, len);
+                    on_incoming_audio_(std::move(packet));
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
             }
-            cJSON_Delete(root);
+        } else {
+            OnMessage(data, len);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this, websocket]() {
+        {
+            // A client that is being connected or replaced does not affect the current one
+            std::lock_guard<std::mutex> lock(websocket_mutex_);
+            if (websocket != websocket_) {
+                return;
+            }
+        }
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
-            on_audio_channel_closed_();
+        xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_CONNECTED_EVENT);
+        xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_DISCONNECTED_EVENT);
+        if (audio_channel_opened_.exchange(false)) {
+            if (on_audio_channel_closed_ != nullptr) {
+                on_audio_channel_closed_();
+            }
         }
     });
 
-    if (!websocket_->Connect(url.c_str())) {
+    auto start_time = esp_timer_get_time();
+    if (!websocket->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
+        delete websocket;
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "Connected to websocket server in %lld ms", (esp_timer_get_time() - start_time) / 1000);
+    return websocket;
+}
+
+bool WebsocketProtocol::OpenAudioChannel() {
+    error_occurred_ = false;
+    frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
+    msgpack_enabled_ = false;
+    iot_descriptors_unchanged_ = false;
+    auto start_time = esp_timer_get_time();
+
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // Only wait for the background connection, never connect on the main loop
+    EventBits_t connected = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_CONNECTED_EVENT, pdFALSE, pdFALSE,
+        pdMS_TO_TICKS(WEBSOCKET_CONNECT_TIMEOUT_MS));
+    if (!(connected & WEBSOCKET_PROTOCOL_CONNECTED_EVENT)) {
+        ESP_LOGE(TAG, "Websocket is not connected");
         SetError(Lang::Strings::SERVER_NOT_FOUND);
         return false;
     }
+#else
+    ReplaceWebSocket(nullptr);
+
+    auto websocket = Connect();
+    if (websocket == nullptr) {
+        SetError(Lang::Strings::SERVER_NOT_FOUND);
+        return false;
+    }
+    ReplaceWebSocket(websocket);
+#endif
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    websocket_->Send(message);
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    std::string message;
+    message.reserve(PROTOCOL_MESSAGE_RESERVE_SIZE);
+    JsonWriter writer(message);
+    writer.BeginObject();
+    writer.Key("type").String("hello");
+    writer.Key("version").Int(1);
+    writer.Key("transport").String("websocket");
+    WriteAudioParams(writer);
+    WriteFeatures(writer);
+    writer.EndObject();
+    SendText(message);
 
     // Wait for server hello
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -125,7 +303,11 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    ESP_LOGI(TAG, "Audio channel opened in %lld ms", (esp_timer_get_time() - start_time) / 1000);
 
+    // The receive task stamps the hello only after signalling it, do not let IsTimeout see the old time
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    audio_channel_opened_ = true;
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -133,19 +315,18 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
-void WebsocketProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void WebsocketProtocol::ParseServerHello(const IncomingMessage& message) {
+    auto transport = message.GetRaw("transport");
+    if (transport != "websocket") {
+        ESP_LOGE(TAG, "Unsupported transport: %.*s", (int)transport.size(), transport.data());
         return;
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
+    ParseAudioParams(message.GetObject("audio_params"));
+    ParseFeatures(message);
+
+    if (message.Has("session_id")) {
+        session_id_ = message.GetString("session_id");
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
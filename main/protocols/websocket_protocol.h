@@ -7,8 +7,21 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_CONNECTED_EVENT (1 << 1)
+#define WEBSOCKET_PROTOCOL_DISCONNECTED_EVENT (1 << 2)
+#define WEBSOCKET_PROTOCOL_STOP_EVENT (1 << 3)
+#define WEBSOCKET_PROTOCOL_STOPPED_EVENT (1 << 4)
+
+#define WEBSOCKET_CONNECT_TIMEOUT_MS 3000
+#define WEBSOCKET_RECONNECT_MIN_DELAY_MS 1000
+#define WEBSOCKET_RECONNECT_MAX_DELAY_MS 60000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -16,17 +29,31 @@ public:
     ~WebsocketProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const uint8_t* data, size_t size) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Only held to use or swap the client, a client is never deleted under it because its
+    // disconnect callback takes the lock. Whoever holds it may use websocket_, ReplaceWebSocket
+    // deletes the old client only after swapping it out.
+    mutable std::mutex websocket_mutex_;
     WebSocket* websocket_ = nullptr;
-
-    void ParseServerHello(const cJSON* root);
+    // Set on the main loop, cleared there or by the disconnect callback of the client task
+    std::atomic<bool> audio_channel_opened_{false};
+    TaskHandle_t reconnect_task_handle_ = nullptr;
+    std::vector<uint8_t> frame_buffer_;
+
+    WebSocket* Connect();
+    void ReplaceWebSocket(WebSocket* websocket);
+    void ReconnectTask();
+    void OnMessage(const char* data, size_t len);
+    void ParseServerHello(const IncomingMessage& message);
+    bool SendBinaryFrame(uint8_t type, const void* data, size_t size);
     void SendText(const std::string& text) override;
+    void SendMsgPack(const std::string& data) override;
 };
 
 #endif
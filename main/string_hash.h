@@ -0,0 +1,17 @@
+#ifndef STRING_HASH_H
+#define STRING_HASH_H
+
+#include <cstdint>
+#include <string_view>
+
+// 32-bit FNV-1a, cheap enough to run on every incoming message and usable at compile time
+constexpr uint32_t StringHash(std::string_view str) {
+    uint32_t hash = 2166136261u;
+    for (char c : str) {
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif // STRING_HASH_H
@@ -0,0 +1,93 @@
+#! /usr/bin/env python3
+# 由 main/resources/images/*.bin 生成图片描述符，替代原先编译进固件的巨大 C 数组
+#
+# 用法: python scripts/gen_images.py --input main/resources/images --output-dir build/images
+#   每个 .bin 为 LVGL 9 的二进制图片（12 字节图片头 + 像素数据），可用 LVGL 的图片转换工具导出
+#   生成 images.S（用 .incbin 直接嵌入像素数据，汇编器只做拷贝）和 images.c（每张图片一个 lv_image_dsc_t）
+#   图片名即文件名（不含扩展名），需在 main/resources/resources.h 中声明
+import os
+import glob
+import struct
+import argparse
+
+HEADER_SIZE = 12
+# LV_IMAGE_HEADER_MAGIC
+MAGIC = 0x19
+# LVGL 9 lv_color_format_t 的取值
+COLOR_FORMATS = {
+    0x12: "LV_COLOR_FORMAT_RGB565",
+    0x14: "LV_COLOR_FORMAT_RGB565A8",
+    0x0F: "LV_COLOR_FORMAT_RGB888",
+    0x10: "LV_COLOR_FORMAT_ARGB8888",
+}
+
+ASM_HEADER = """// Auto-generated by scripts/gen_images.py, do not edit
+    .section .rodata.images, "a"
+"""
+
+ASM_IMAGE = """
+    .balign 4
+    .global {name}_map
+{name}_map:
+    .incbin "{path}", {skip}
+"""
+
+SOURCE_HEADER = """// Auto-generated by scripts/gen_images.py, do not edit
+#include <lvgl.h>
+#include <stdint.h>
+"""
+
+SOURCE_IMAGE = """
+extern const uint8_t {name}_map[];
+const lv_image_dsc_t {name} = {{
+  .header.cf = {cf},
+  .header.magic = LV_IMAGE_HEADER_MAGIC,
+  .header.w = {width},
+  .header.h = {height},
+  .data_size = {size},
+  .data = {name}_map,
+}};
+"""
+
+
+# 返回 (名称, 颜色格式, 宽, 高, 像素数据)
+def read_image(path):
+    with open(path, "rb") as f:
+        content = f.read()
+    if len(content) < HEADER_SIZE:
+        raise ValueError(f"{path}: 文件过短")
+    flags, size, _ = struct.unpack("<III", content[:HEADER_SIZE])
+    if flags & 0xFF != MAGIC:
+        raise ValueError(f"{path}: 不是 LVGL 9 二进制图片")
+    cf = (flags >> 8) & 0xFF
+    if cf not in COLOR_FORMATS:
+        raise ValueError(f"{path}: 不支持的颜色格式 0x{cf:02x}")
+    name = os.path.splitext(os.path.basename(path))[0]
+    return name, cf, size & 0xFFFF, size >> 16, content[HEADER_SIZE:]
+
+
+def generate(input_dir, output_dir):
+    asm = [ASM_HEADER]
+    source = [SOURCE_HEADER]
+    for path in sorted(glob.glob(os.path.join(input_dir, "*.bin"))):
+        name, cf, width, height, data = read_image(path)
+        # 汇编器按字面解析路径，统一使用正斜杠
+        asm.append(ASM_IMAGE.format(name=name, path=os.path.abspath(path).replace("\\", "/"), skip=HEADER_SIZE))
+        source.append(SOURCE_IMAGE.format(name=name, cf=COLOR_FORMATS[cf], width=width, height=height, size=len(data)))
+
+    # 每次都重写输出，图片内容变化时 images.S 随之重新汇编
+    os.makedirs(output_dir, exist_ok=True)
+    with open(os.path.join(output_dir, "images.S"), "w") as f:
+        f.write("".join(asm))
+    with open(os.path.join(output_dir, "images.c"), "w") as f:
+        f.write("".join(source))
+    return len(asm) - 1
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--input", required=True)
+    parser.add_argument("--output-dir", required=True)
+    args = parser.parse_args()
+    count = generate(args.input, args.output_dir)
+    print(f"Generated {count} image descriptors in {args.output_dir}")
@@ -0,0 +1,36 @@
+#! /usr/bin/env python3
+# 生成版本检查响应中固件（或模型）的校验信息，设备边下载边校验，损坏的数据块在写入 flash 前即被发现
+#
+# 用法: python scripts/ota_digest.py [-b 块大小] image.bin
+#   image.bin 为设备最终写入的镜像（差分或压缩升级包还原后的固件），不是下载文件本身
+#
+# 输出的字段合并到 "firmware" 或 "model" 对象中:
+#   "size": 镜像大小, "sha256": 镜像摘要, "block_size": 块大小, "block_sha256": [每块摘要...]
+import sys
+import json
+import hashlib
+import argparse
+
+# 与 main/ota.h 中 OTA_MIN_DIGEST_BLOCK_SIZE 一致
+MIN_BLOCK_SIZE = 16 * 1024
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-b", "--block-size", type=int, default=64 * 1024)
+    parser.add_argument("image")
+    args = parser.parse_args()
+    if args.block_size < MIN_BLOCK_SIZE:
+        print(f"块大小不能小于 {MIN_BLOCK_SIZE}")
+        sys.exit(1)
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    blocks = [hashlib.sha256(image[offset:offset + args.block_size]).hexdigest()
+              for offset in range(0, len(image), args.block_size)]
+    print(json.dumps({
+        "size": len(image),
+        "sha256": hashlib.sha256(image).hexdigest(),
+        "block_size": args.block_size,
+        "block_sha256": blocks,
+    }, indent=2))
@@ -0,0 +1,111 @@
+#! /usr/bin/env python3
+# 生成差分升级包：设备用正在运行的固件和补丁还原出新固件（格式见 main/ota_patch.h）
+#
+# 用法: python scripts/ota_patch.py [-z] old.bin new.bin patch.bin
+#   -z  压缩补丁（格式见 main/ota_inflate.h）
+#
+# 服务器在版本检查的响应中返回:
+#   "firmware": {"version": "...", "url": "完整固件", "patch": {"from": "旧版本号", "url": "补丁"}}
+#   可附带新固件的校验信息，见 scripts/ota_digest.py
+import sys
+import struct
+import hashlib
+import zlib
+
+MAGIC = b"DPT1"
+# 以 BLOCK_SIZE 字节为单位在旧固件中查找相同内容，短于 MIN_COPY 的匹配直接插入新数据更省空间
+BLOCK_SIZE = 32
+MIN_COPY = 48
+
+
+def build_index(old):
+    index = {}
+    for offset in range(0, len(old) - BLOCK_SIZE + 1, 4):
+        index.setdefault(old[offset:offset + BLOCK_SIZE], offset)
+    return index
+
+
+def make_patch(old, new):
+    index = build_index(old)
+    ops = []
+    insert = bytearray()
+
+    def flush_insert():
+        if insert:
+            ops.append(b"I" + struct.pack("<I", len(insert)) + bytes(insert))
+            insert.clear()
+
+    pos = 0
+    while pos < len(new):
+        src = index.get(new[pos:pos + BLOCK_SIZE]) if pos + BLOCK_SIZE <= len(new) else None
+        if src is None:
+            insert.append(new[pos])
+            pos += 1
+            continue
+
+        # 向前扩展匹配，再把插入缓冲末尾与旧固件相同的部分并入
+        length = BLOCK_SIZE
+        while pos + length < len(new) and src + length < len(old) and new[pos + length] == old[src + length]:
+            length += 1
+        while insert and src > 0 and insert[-1] == old[src - 1]:
+            insert.pop()
+            src -= 1
+            pos -= 1
+            length += 1
+
+        if length < MIN_COPY:
+            insert.extend(new[pos:pos + length])
+        else:
+            flush_insert()
+            ops.append(b"C" + struct.pack("<II", src, length))
+        pos += length
+    flush_insert()
+
+    header = MAGIC + struct.pack("<I", len(old)) + hashlib.sha256(old).digest() + struct.pack("<I", len(new))
+    return header + b"".join(ops)
+
+
+def apply_patch(old, patch):
+    assert patch[:4] == MAGIC
+    source_size, = struct.unpack("<I", patch[4:8])
+    target_size, = struct.unpack("<I", patch[40:44])
+    assert hashlib.sha256(old[:source_size]).digest() == patch[8:40]
+    out = bytearray()
+    pos = 44
+    while len(out) < target_size:
+        op = patch[pos:pos + 1]
+        if op == b"C":
+            src, length = struct.unpack("<II", patch[pos + 1:pos + 9])
+            out += old[src:src + length]
+            pos += 9
+        elif op == b"I":
+            length, = struct.unpack("<I", patch[pos + 1:pos + 5])
+            out += patch[pos + 5:pos + 5 + length]
+            pos += 5 + length
+        else:
+            raise ValueError(f"unknown operation {op}")
+    return bytes(out)
+
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    compress = "-z" in args
+    if compress:
+        args.remove("-z")
+    if len(args) != 3:
+        print(f"用法: {sys.argv[0]} [-z] old.bin new.bin patch.bin")
+        sys.exit(1)
+    with open(args[0], "rb") as f:
+        old = f.read()
+    with open(args[1], "rb") as f:
+        new = f.read()
+    patch = make_patch(old, new)
+    # 生成后立即校验，确保设备还原出的固件与新固件一致
+    if apply_patch(old, patch) != new:
+        print("补丁校验失败")
+        sys.exit(1)
+    if compress:
+        patch = b"ZIM1" + struct.pack("<I", len(new)) + hashlib.sha256(new).digest() + zlib.compress(patch, 9)
+    with open(args[2], "wb") as f:
+        f.write(patch)
+    print(f"old: {len(old)} bytes, new: {len(new)} bytes, patch: {len(patch)} bytes ({len(patch) * 100 / len(new):.1f}%)")
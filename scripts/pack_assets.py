@@ -0,0 +1,68 @@
+#! /usr/bin/env python3
+# 生成 assets 分区的资源包（格式见 main/assets.h）
+#
+# 用法: python scripts/pack_assets.py [-v 版本号] [-o assets.bin] [-z] [附加文件...]
+#   图片读取 main/resources/images/*.bin（格式见 scripts/gen_images.py），附加文件（如 P3 音效）按文件名（不含扩展名）作为原始数据打包
+#   -z  另外生成压缩的 OTA 下载文件 assets.ota.bin（格式见 main/ota_inflate.h）
+#
+# 烧录: esptool.py write_flash 0xD00000 assets.bin（偏移见 partitions_assets.csv）
+# 服务器在版本检查的响应中返回: "assets": {"version": 版本号, "url": "资源包"}
+import os
+import glob
+import struct
+import hashlib
+import zlib
+import argparse
+
+from gen_images import read_image
+
+MAGIC = b"AST1"
+HEADER_SIZE = 64
+ENTRY_SIZE = 48
+NAME_SIZE = 32
+
+
+def pack(entries, version):
+    entries = sorted(entries, key=lambda entry: entry[0])
+    offset = HEADER_SIZE + len(entries) * ENTRY_SIZE
+    table = b""
+    body = b""
+    for name, cf, width, height, data in entries:
+        encoded = name.encode()
+        if len(encoded) >= NAME_SIZE:
+            raise ValueError(f"名称过长: {name}")
+        table += struct.pack("<32sIIBBHHH", encoded, offset + len(body), len(data), cf, 0, width, height, 0)
+        body += data + b"\0" * (-len(data) % 4)
+    content = table + body
+    header = MAGIC + struct.pack("<III", version, len(entries), HEADER_SIZE + len(content))
+    header += hashlib.sha256(content).digest() + b"\0" * 16
+    return header + content
+
+
+if __name__ == "__main__":
+    os.chdir(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-v", "--version", type=int, default=1)
+    parser.add_argument("-o", "--output", default="build/assets.bin")
+    parser.add_argument("-z", "--compress", action="store_true")
+    parser.add_argument("files", nargs="*")
+    args = parser.parse_args()
+
+    entries = [read_image(path) for path in sorted(glob.glob("main/resources/images/*.bin"))]
+    image_size = sum(len(entry[4]) for entry in entries)
+    for path in args.files:
+        with open(path, "rb") as f:
+            entries.append((os.path.splitext(os.path.basename(path))[0], 0, 0, 0, f.read()))
+
+    data = pack(entries, args.version)
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"{len(entries)} 个资源, 图片 {image_size} 字节（不再编译进固件）, 资源包 {len(data)} 字节 -> {args.output}")
+
+    if args.compress:
+        compressed = b"ZIM1" + struct.pack("<I", len(data)) + hashlib.sha256(data).digest() + zlib.compress(data, 9)
+        output = os.path.splitext(args.output)[0] + ".ota.bin"
+        with open(output, "wb") as f:
+            f.write(compressed)
+        print(f"压缩后 {len(compressed)} 字节 ({len(compressed) * 100 / len(data):.1f}%) -> {output}")
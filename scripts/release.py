@@ -2,6 +2,9 @@ import sys
 import os
 import json
 import zipfile
+import struct
+import hashlib
+import zlib
 
 # 切换到项目根目录
 os.chdir(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -25,6 +28,13 @@ def get_project_version():
                 return line.split("\"")[1].split("\"")[0].strip()
     return None
 
+def get_project_name():
+    with open("CMakeLists.txt") as f:
+        for line in f:
+            if line.startswith("project("):
+                return line.split("(")[1].split(")")[0].strip()
+    return None
+
 def merge_bin():
     if os.system("idf.py merge-bin") != 0:
         print("merge bin failed")
@@ -39,6 +49,17 @@ def zip_bin(board_type, project_version):
     print(f"zip bin to {output_path} done")
     
 
+# 压缩的 OTA 固件，设备边下载边解压（格式见 main/ota_inflate.h）
+def compress_bin(name, project_version):
+    with open(f"build/{get_project_name()}.bin", "rb") as f:
+        image = f.read()
+    header = b"ZIM1" + struct.pack("<I", len(image)) + hashlib.sha256(image).digest()
+    data = header + zlib.compress(image, 9)
+    output_path = f"releases/v{project_version}_{name}.ota.bin"
+    with open(output_path, "wb") as f:
+        f.write(data)
+    print(f"compress {len(image)} -> {len(data)} bytes ({len(data) * 100 / len(image):.1f}%) to {output_path} done")
+
 def release_current():
     merge_bin()
     board_type = get_board_type()
@@ -46,6 +67,7 @@ def release_current():
     project_version = get_project_version()
     print("project version:", project_version)
     zip_bin(board_type, project_version)
+    compress_bin(board_type, project_version)
 
 def get_all_board_types():
     board_configs = {}
@@ -114,6 +136,7 @@ def release(board_type, board_config):
             sys.exit(1)
         # Zip bin
         zip_bin(name, project_version)
+        compress_bin(name, project_version)
         print("-" * 80)
 
 if __name__ == "__main__":
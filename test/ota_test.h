@@ -0,0 +1,163 @@
+#ifndef OTA_TEST_H
+#define OTA_TEST_H
+
+// Firmware images, patches and compressed downloads for the OTA tests, in the formats of
+// scripts/ota_patch.py and scripts/release.py
+
+#include "test.h"
+#include "ota.h"
+#include "ota_patch.h"
+#include "ota_inflate.h"
+#include "settings.h"
+
+#include <esp_app_format.h>
+#include <esp_ota_ops.h>
+#include <http.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#define OTA_TEST_CHECK_URL "http://ota.test/check"
+#define OTA_TEST_PARTITION_SIZE (2 * 1024 * 1024)
+
+struct OtaTestPartitions {
+    const esp_partition_t* running;
+    const esp_partition_t* update;
+};
+
+inline std::string Sha256Hex(const std::string& data) {
+    uint8_t digest[32];
+    mbedtls_sha256((const unsigned char*)data.data(), data.size(), digest, 0);
+    std::string hex;
+    char byte[3];
+    for (auto value : digest) {
+        snprintf(byte, sizeof(byte), "%02x", value);
+        hex += byte;
+    }
+    return hex;
+}
+
+inline void AppendUint32(std::string& data, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        data += (char)(value >> (i * 8));
+    }
+}
+
+inline std::string Sha256Bytes(const std::string& data) {
+    std::string digest(32, '\0');
+    mbedtls_sha256((const unsigned char*)data.data(), data.size(), (unsigned char*)digest.data(), 0);
+    return digest;
+}
+
+// An app image of the given version, the contents only depend on the seed
+inline std::string MakeImage(const char* version, size_t size, uint32_t seed) {
+    std::string image(size, '\0');
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++) {
+        // Runs of repeated bytes keep the image compressible
+        if (i % 64 == 0) {
+            state = state * 1103515245u + 12345;
+        }
+        image[i] = (char)((state >> 16) + (i % 64 < 48 ? 0 : i));
+    }
+    image[0] = (char)ESP_IMAGE_HEADER_MAGIC;
+    esp_app_desc_t description = {};
+    strncpy(description.version, version, sizeof(description.version) - 1);
+    memcpy(&image[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], &description, sizeof(description));
+    return image;
+}
+
+// Copies every 4 KB block found at the same offset of the source and inserts the rest
+inline std::string MakePatch(const std::string& source, const std::string& target) {
+    const size_t block = 4096;
+    std::string patch = OTA_PATCH_MAGIC;
+    AppendUint32(patch, source.size());
+    patch += Sha256Bytes(source);
+    AppendUint32(patch, target.size());
+    for (size_t offset = 0; offset < target.size(); offset += block) {
+        size_t length = std::min(block, target.size() - offset);
+        if (offset + length <= source.size() && source.compare(offset, length, target, offset, length) == 0) {
+            patch += 'C';
+            AppendUint32(patch, offset);
+            AppendUint32(patch, length);
+        } else {
+            patch += 'I';
+            AppendUint32(patch, length);
+            patch.append(target, offset, length);
+        }
+    }
+    return patch;
+}
+
+// The payload is the image itself or a patch that produces it
+inline std::string Compress(const std::string& payload, const std::string& image) {
+    std::string compressed = OTA_INFLATE_MAGIC;
+    AppendUint32(compressed, image.size());
+    compressed += Sha256Bytes(image);
+    uLongf size = compressBound(payload.size());
+    std::string stream(size, '\0');
+    compress2((Bytef*)stream.data(), &size, (const Bytef*)payload.data(), payload.size(), Z_BEST_COMPRESSION);
+    stream.resize(size);
+    return compressed + stream;
+}
+
+// The firmware object of a version check response, the digest fields are left out when image is empty
+inline std::string FirmwareJson(const std::string& version, const std::string& url, const std::string& image,
+    const std::string& extra = "") {
+    std::string json = "{\"version\":\"" + version + "\",\"url\":\"" + url + "\"";
+    if (!image.empty()) {
+        json += ",\"size\":" + std::to_string(image.size()) + ",\"sha256\":\"" + Sha256Hex(image) + "\"";
+    }
+    return json + extra + "}";
+}
+
+inline bool CheckVersion(Ota& ota, const std::string& firmware_json, const std::string& extra = "") {
+    HttpServer::GetInstance().files[OTA_TEST_CHECK_URL] = "{\"firmware\":" + firmware_json + extra + "}";
+    ota.SetCheckVersionUrl(OTA_TEST_CHECK_URL);
+    return ota.CheckVersion();
+}
+
+// ota_0 runs version 1.0.0, ota_1 receives the upgrades
+inline OtaTestPartitions SetUpPartitions(const std::string& running_image) {
+    static OtaTestPartitions partitions = {
+        test_partition_add(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, "ota_0", OTA_TEST_PARTITION_SIZE),
+        test_partition_add(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, "ota_1", OTA_TEST_PARTITION_SIZE),
+    };
+    auto& data = test_partition_data(partitions.running);
+    std::fill(data.begin(), data.end(), 0xFF);
+    memcpy(data.data(), running_image.data(), running_image.size());
+    test_ota_set_running(partitions.running, ESP_OTA_IMG_VALID);
+    return partitions;
+}
+
+// Every test starts with an erased update partition, no checkpoint and an empty server
+inline void ResetOta(const OtaTestPartitions& partitions) {
+    auto& data = test_partition_data(partitions.update);
+    std::fill(data.begin(), data.end(), 0xFF);
+    test_ota_set_boot(partitions.running);
+    HttpServer::GetInstance().Reset();
+    Settings settings("ota", true);
+    settings.EraseAll();
+}
+
+inline bool PartitionHolds(const esp_partition_t* partition, const std::string& image) {
+    auto& data = test_partition_data(partition);
+    return image.size() <= data.size() && memcmp(data.data(), image.data(), image.size()) == 0;
+}
+
+inline bool PartitionErased(const esp_partition_t* partition) {
+    auto& data = test_partition_data(partition);
+    return std::all_of(data.begin(), data.end(), [](uint8_t byte) { return byte == 0xFF; });
+}
+
+inline int RequestCount(const std::string& url) {
+    int count = 0;
+    for (auto& request : HttpServer::GetInstance().requests) {
+        count += request.url == url ? 1 : 0;
+    }
+    return count;
+}
+
+#endif // OTA_TEST_H
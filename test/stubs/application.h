@@ -0,0 +1,40 @@
+#ifndef _APPLICATION_H_
+#define _APPLICATION_H_
+
+#include <functional>
+#include <list>
+#include <mutex>
+
+// The main loop of the tests: scheduled callbacks wait until the test runs them
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    void Schedule(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        main_tasks_.push_back(std::move(callback));
+    }
+
+    // Returns how many callbacks ran
+    int RunScheduled() {
+        std::list<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks = std::move(main_tasks_);
+            main_tasks_.clear();
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+        return tasks.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::list<std::function<void()>> main_tasks_;
+};
+
+#endif // _APPLICATION_H_
@@ -0,0 +1,19 @@
+#ifndef _AUDIO_CODEC_H
+#define _AUDIO_CODEC_H
+
+// Only the volume, which the Speaker thing reads and sets
+class AudioCodec {
+public:
+    virtual ~AudioCodec() = default;
+
+    virtual void SetOutputVolume(int volume) {
+        output_volume_ = volume;
+    }
+
+    inline int output_volume() const { return output_volume_; }
+
+protected:
+    int output_volume_ = 70;
+};
+
+#endif // _AUDIO_CODEC_H
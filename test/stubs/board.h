@@ -0,0 +1,61 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <http.h>
+#include <mqtt.h>
+#include <udp.h>
+#include <web_socket.h>
+#include <tls_session_transport.h>
+#include <audio_codec.h>
+
+#include <atomic>
+#include <string>
+
+// Only what the code under test needs from the board, the network is made of the fake servers
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board instance;
+        return instance;
+    }
+
+    Http* CreateHttp() {
+        return new Http();
+    }
+
+    Mqtt* CreateMqtt() {
+        return new Mqtt();
+    }
+
+    Udp* CreateUdp() {
+        return new Udp();
+    }
+
+    // As WifiBoard does for a wss:// url
+    WebSocket* CreateWebSocket() {
+        return new WebSocket(new TlsSessionTransport());
+    }
+
+    std::string GetUuid() {
+        return "00000000-0000-0000-0000-000000000001";
+    }
+
+    AudioCodec* GetAudioCodec() {
+        static AudioCodec codec;
+        return &codec;
+    }
+
+    // Set by the tests, every read stands for a trip through the ADC
+    std::atomic<int> battery_level{80};
+    std::atomic<int> battery_reads{0};
+
+    bool GetBatteryLevel(int& level, bool& charging, bool& discharging) {
+        battery_reads++;
+        level = battery_level;
+        charging = false;
+        discharging = true;
+        return true;
+    }
+};
+
+#endif // BOARD_H
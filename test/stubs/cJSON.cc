@@ -0,0 +1,399 @@
+#include "cJSON.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+cJSON* New(int type) {
+    auto item = (cJSON*)calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+char* Copy(const std::string& value) {
+    auto copy = (char*)malloc(value.size() + 1);
+    memcpy(copy, value.c_str(), value.size() + 1);
+    return copy;
+}
+
+void Append(cJSON* parent, cJSON* item) {
+    if (parent->child == nullptr) {
+        parent->child = item;
+        item->prev = item;
+        return;
+    }
+    // As in cJSON, the first child's prev points at the last one
+    auto last = parent->child->prev;
+    last->next = item;
+    item->prev = last;
+    parent->child->prev = item;
+}
+
+struct Parser {
+    const char* p;
+
+    void SkipSpace() {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            p++;
+        }
+    }
+
+    bool ParseString(std::string& out) {
+        if (*p != '"') {
+            return false;
+        }
+        p++;
+        while (*p != '"') {
+            if (*p == '\0') {
+                return false;
+            }
+            if (*p != '\\') {
+                out += *p++;
+                continue;
+            }
+            p++;
+            switch (*p) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    unsigned code = 0;
+                    if (sscanf(p + 1, "%4x", &code) != 1) {
+                        return false;
+                    }
+                    p += 4;
+                    // The tests only use the basic multilingual plane
+                    if (code < 0x80) {
+                        out += (char)code;
+                    } else if (code < 0x800) {
+                        out += (char)(0xC0 | (code >> 6));
+                        out += (char)(0x80 | (code & 0x3F));
+                    } else {
+                        out += (char)(0xE0 | (code >> 12));
+                        out += (char)(0x80 | ((code >> 6) & 0x3F));
+                        out += (char)(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                case '\0': return false;
+                default: out += *p; break;
+            }
+            p++;
+        }
+        p++;
+        return true;
+    }
+
+    cJSON* ParseValue() {
+        SkipSpace();
+        if (*p == '{' || *p == '[') {
+            bool object = *p == '{';
+            char end = object ? '}' : ']';
+            auto item = New(object ? cJSON_Object : cJSON_Array);
+            p++;
+            SkipSpace();
+            if (*p == end) {
+                p++;
+                return item;
+            }
+            while (true) {
+                std::string key;
+                if (object) {
+                    SkipSpace();
+                    if (!ParseString(key)) {
+                        break;
+                    }
+                    SkipSpace();
+                    if (*p++ != ':') {
+                        break;
+                    }
+                }
+                auto child = ParseValue();
+                if (child == nullptr) {
+                    break;
+                }
+                if (object) {
+                    child->string = Copy(key);
+                }
+                Append(item, child);
+                SkipSpace();
+                if (*p == ',') {
+                    p++;
+                    continue;
+                }
+                if (*p++ == end) {
+                    return item;
+                }
+                break;
+            }
+            cJSON_Delete(item);
+            return nullptr;
+        }
+        if (*p == '"') {
+            std::string value;
+            if (!ParseString(value)) {
+                return nullptr;
+            }
+            auto item = New(cJSON_String);
+            item->valuestring = Copy(value);
+            return item;
+        }
+        if (strncmp(p, "true", 4) == 0) {
+            p += 4;
+            return New(cJSON_True);
+        }
+        if (strncmp(p, "false", 5) == 0) {
+            p += 5;
+            return New(cJSON_False);
+        }
+        if (strncmp(p, "null", 4) == 0) {
+            p += 4;
+            return New(cJSON_NULL);
+        }
+        char* end = nullptr;
+        double number = strtod(p, &end);
+        if (end == p) {
+            return nullptr;
+        }
+        p = end;
+        auto item = New(cJSON_Number);
+        item->valuedouble = number;
+        item->valueint = (int)number;
+        return item;
+    }
+};
+
+void PrintString(const char* value, std::string& out) {
+    out += '"';
+    for (auto c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if ((unsigned char)*c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+                    out += escaped;
+                } else {
+                    out += *c;
+                }
+                break;
+        }
+    }
+    out += '"';
+}
+
+void Print(const cJSON* item, std::string& out) {
+    switch (item->type) {
+        case cJSON_False: out += "false"; break;
+        case cJSON_True: out += "true"; break;
+        case cJSON_NULL: out += "null"; break;
+        case cJSON_Number: {
+            char number[32];
+            if (item->valuedouble == (double)item->valueint) {
+                snprintf(number, sizeof(number), "%d", item->valueint);
+            } else {
+                snprintf(number, sizeof(number), "%.17g", item->valuedouble);
+            }
+            out += number;
+            break;
+        }
+        case cJSON_String: PrintString(item->valuestring, out); break;
+        case cJSON_Array:
+        case cJSON_Object: {
+            bool object = item->type == cJSON_Object;
+            out += object ? '{' : '[';
+            for (auto child = item->child; child != nullptr; child = child->next) {
+                if (child != item->child) {
+                    out += ',';
+                }
+                if (object) {
+                    PrintString(child->string, out);
+                    out += ':';
+                }
+                Print(child, out);
+            }
+            out += object ? '}' : ']';
+            break;
+        }
+    }
+}
+
+} // namespace
+
+cJSON* cJSON_Parse(const char* value) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    Parser parser{value};
+    auto item = parser.ParseValue();
+    if (item == nullptr) {
+        return nullptr;
+    }
+    parser.SkipSpace();
+    if (*parser.p != '\0') {
+        cJSON_Delete(item);
+        return nullptr;
+    }
+    return item;
+}
+
+cJSON* cJSON_ParseWithLength(const char* value, size_t buffer_length) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    std::string copy(value, buffer_length);
+    return cJSON_Parse(copy.c_str());
+}
+
+void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        auto next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+char* cJSON_PrintUnformatted(const cJSON* item) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    std::string out;
+    Print(item, out);
+    return Copy(out);
+}
+
+void cJSON_free(void* object) {
+    free(object);
+}
+
+int cJSON_GetArraySize(const cJSON* array) {
+    int size = 0;
+    for (auto child = array != nullptr ? array->child : nullptr; child != nullptr; child = child->next) {
+        size++;
+    }
+    return size;
+}
+
+cJSON* cJSON_GetArrayItem(const cJSON* array, int index) {
+    auto child = array != nullptr ? array->child : nullptr;
+    while (child != nullptr && index-- > 0) {
+        child = child->next;
+    }
+    return child;
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string) {
+    if (object == nullptr || string == nullptr) {
+        return nullptr;
+    }
+    for (auto child = object->child; child != nullptr; child = child->next) {
+        if (child->string != nullptr && strcasecmp(child->string, string) == 0) {
+            return child;
+        }
+    }
+    return nullptr;
+}
+
+cJSON_bool cJSON_IsBool(const cJSON* item) {
+    return item != nullptr && (item->type & (cJSON_True | cJSON_False)) != 0;
+}
+
+cJSON_bool cJSON_IsTrue(const cJSON* item) {
+    return item != nullptr && (item->type & 0xFF) == cJSON_True;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON* item) {
+    return item != nullptr && (item->type & 0xFF) == cJSON_Number;
+}
+
+cJSON_bool cJSON_IsString(const cJSON* item) {
+    return item != nullptr && (item->type & 0xFF) == cJSON_String;
+}
+
+cJSON_bool cJSON_IsArray(const cJSON* item) {
+    return item != nullptr && (item->type & 0xFF) == cJSON_Array;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON* item) {
+    return item != nullptr && (item->type & 0xFF) == cJSON_Object;
+}
+
+cJSON* cJSON_CreateNull(void) {
+    return New(cJSON_NULL);
+}
+
+cJSON* cJSON_CreateTrue(void) {
+    return New(cJSON_True);
+}
+
+cJSON* cJSON_CreateFalse(void) {
+    return New(cJSON_False);
+}
+
+cJSON* cJSON_CreateNumber(double num) {
+    auto item = New(cJSON_Number);
+    item->valuedouble = num;
+    item->valueint = (int)num;
+    return item;
+}
+
+cJSON* cJSON_CreateString(const char* string) {
+    auto item = New(cJSON_String);
+    item->valuestring = Copy(string);
+    return item;
+}
+
+cJSON* cJSON_CreateArray(void) {
+    return New(cJSON_Array);
+}
+
+cJSON* cJSON_CreateObject(void) {
+    return New(cJSON_Object);
+}
+
+cJSON* cJSON_Duplicate(const cJSON* item, cJSON_bool recurse) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    auto copy = New(item->type);
+    copy->valueint = item->valueint;
+    copy->valuedouble = item->valuedouble;
+    copy->valuestring = item->valuestring != nullptr ? Copy(item->valuestring) : nullptr;
+    copy->string = item->string != nullptr ? Copy(item->string) : nullptr;
+    if (recurse) {
+        for (auto child = item->child; child != nullptr; child = child->next) {
+            Append(copy, cJSON_Duplicate(child, true));
+        }
+    }
+    return copy;
+}
+
+cJSON_bool cJSON_AddItemToArray(cJSON* array, cJSON* item) {
+    if (array == nullptr || item == nullptr) {
+        return 0;
+    }
+    Append(array, item);
+    return 1;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON* object, const char* string, cJSON* item) {
+    if (object == nullptr || string == nullptr || item == nullptr) {
+        return 0;
+    }
+    free(item->string);
+    item->string = Copy(string);
+    Append(object, item);
+    return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef _DRIVER_GPIO_H_
+#define _DRIVER_GPIO_H_
+
+#include "esp_err.h"
+
+#include <cstdint>
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_18 = 18,
+} gpio_num_t;
+
+typedef enum {
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_DISABLE = 0,
+} gpio_pullup_t;
+
+typedef enum {
+    GPIO_PULLDOWN_DISABLE = 0,
+} gpio_pulldown_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE = 0,
+} gpio_int_type_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+// Output levels are kept per pin, so a test can read back what the code under test set
+inline int* gpio_levels() {
+    static int levels[64] = {};
+    return levels;
+}
+
+inline esp_err_t gpio_config(const gpio_config_t* config) {
+    return ESP_OK;
+}
+
+inline esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    gpio_levels()[gpio_num] = level;
+    return ESP_OK;
+}
+
+#endif // _DRIVER_GPIO_H_
@@ -0,0 +1,35 @@
+#ifndef _ESP_APP_FORMAT_H_
+#define _ESP_APP_FORMAT_H_
+
+#include <cstdint>
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+// Same sizes as in ESP-IDF, the app description follows the image header and the first segment header
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t rest[23];
+} esp_image_header_t;
+
+typedef struct {
+    uint32_t load_addr;
+    uint32_t data_len;
+} esp_image_segment_header_t;
+
+typedef struct {
+    uint32_t magic_word;
+    uint32_t secure_version;
+    uint32_t reserv1[2];
+    char version[32];
+    char project_name[32];
+    char time[16];
+    char date[16];
+    char idf_ver[32];
+    uint8_t app_elf_sha256[32];
+    uint32_t reserv2[20];
+} esp_app_desc_t;
+
+// The running firmware is version "1.0.0"
+const esp_app_desc_t* esp_app_get_description(void);
+
+#endif // _ESP_APP_FORMAT_H_
@@ -0,0 +1,30 @@
+#ifndef _ESP_LOG_H_
+#define _ESP_LOG_H_
+
+#include <cstdio>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+// One level for every tag, benchmarks turn the logs of the code they loop over off
+inline esp_log_level_t esp_log_level = ESP_LOG_INFO;
+
+inline void esp_log_level_set(const char* tag, esp_log_level_t level) {
+    esp_log_level = level;
+}
+
+#define ESP_LOG_AT(level, letter, tag, format, ...) \
+    do { if (esp_log_level >= level) printf(letter " (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_AT(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_AT(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_AT(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ((void)0)
+
+#endif // _ESP_LOG_H_
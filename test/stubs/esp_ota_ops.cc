@@ -0,0 +1,73 @@
+#include "esp_ota_ops.h"
+
+#include <cstring>
+
+namespace {
+
+const esp_partition_t* running_partition = nullptr;
+const esp_partition_t* boot_partition = nullptr;
+esp_ota_img_states_t running_state = ESP_OTA_IMG_VALID;
+
+} // namespace
+
+const esp_app_desc_t* esp_app_get_description(void) {
+    static esp_app_desc_t description = [] {
+        esp_app_desc_t description = {};
+        strcpy(description.version, "1.0.0");
+        strcpy(description.project_name, "xiaozhi");
+        return description;
+    }();
+    return &description;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void) {
+    return running_partition;
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+    for (int subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0; subtype <= ESP_PARTITION_SUBTYPE_APP_OTA_1; subtype++) {
+        auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, (esp_partition_subtype_t)subtype, nullptr);
+        if (partition != nullptr && partition != running_partition) {
+            return partition;
+        }
+    }
+    return nullptr;
+}
+
+const esp_partition_t* esp_ota_get_boot_partition(void) {
+    return boot_partition;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+    uint8_t magic = 0;
+    if (partition == nullptr || esp_partition_read(partition, 0, &magic, 1) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (magic != ESP_IMAGE_HEADER_MAGIC) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    boot_partition = partition;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state) {
+    if (partition == nullptr || partition != running_partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *ota_state = running_state;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void) {
+    running_state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+void test_ota_set_running(const esp_partition_t* partition, esp_ota_img_states_t state) {
+    running_partition = partition;
+    running_state = state;
+}
+
+void test_ota_set_boot(const esp_partition_t* partition) {
+    boot_partition = partition;
+}
@@ -0,0 +1,33 @@
+#ifndef _ESP_OTA_OPS_H_
+#define _ESP_OTA_OPS_H_
+
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <esp_app_format.h>
+
+#define ESP_ERR_OTA_BASE 0x1500
+#define ESP_ERR_OTA_VALIDATE_FAILED (ESP_ERR_OTA_BASE + 0x03)
+
+typedef enum {
+    ESP_OTA_IMG_NEW = 0x0,
+    ESP_OTA_IMG_PENDING_VERIFY = 0x1,
+    ESP_OTA_IMG_VALID = 0x2,
+    ESP_OTA_IMG_INVALID = 0x3,
+    ESP_OTA_IMG_ABORTED = 0x4,
+    ESP_OTA_IMG_UNDEFINED = 0xFFFFFFFF,
+} esp_ota_img_states_t;
+
+const esp_partition_t* esp_ota_get_running_partition(void);
+// The first OTA app partition that is not running
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from);
+const esp_partition_t* esp_ota_get_boot_partition(void);
+// Only checks the image magic, that is enough to tell a written image from an erased or corrupted one
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+
+// Host test helpers
+void test_ota_set_running(const esp_partition_t* partition, esp_ota_img_states_t state);
+void test_ota_set_boot(const esp_partition_t* partition);
+
+#endif // _ESP_OTA_OPS_H_
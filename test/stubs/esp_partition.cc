@@ -0,0 +1,139 @@
+#include "esp_partition.h"
+#include "spi_flash_mmap.h"
+#include "pacer.h"
+
+#include <cstring>
+#include <memory>
+
+namespace {
+
+struct Partition {
+    esp_partition_t partition;
+    std::vector<uint8_t> data;
+    long fail_after = -1;
+    int call_us = 0;
+    int erase_us = 0;
+    int write_us_per_kb = 0;
+    Pacer pacer;
+};
+
+std::vector<std::unique_ptr<Partition>> partitions;
+
+Partition* Find(const esp_partition_t* partition) {
+    for (auto& item : partitions) {
+        if (&item->partition == partition) {
+            return item.get();
+        }
+    }
+    return nullptr;
+}
+
+// Counts the bytes against the failure budget, true if the operation must fail
+bool Fail(Partition* item, size_t size) {
+    if (item->fail_after < 0) {
+        return false;
+    }
+    if ((long)size > item->fail_after) {
+        item->fail_after = 0;
+        return true;
+    }
+    item->fail_after -= size;
+    return false;
+}
+
+} // namespace
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    for (auto& item : partitions) {
+        auto& partition = item->partition;
+        if (partition.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.subtype == subtype) &&
+            (label == nullptr || strcmp(partition.label, label) == 0)) {
+            return &partition;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    auto item = Find(partition);
+    if (item == nullptr || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, item->data.data() + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    auto item = Find(partition);
+    if (item == nullptr || dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (Fail(item, size)) {
+        return ESP_FAIL;
+    }
+    item->pacer.Run(item->call_us + (int64_t)size * item->write_us_per_kb / 1024);
+    auto bytes = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        item->data[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    auto item = Find(partition);
+    if (item == nullptr || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 ||
+        offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (Fail(item, 0)) {
+        return ESP_FAIL;
+    }
+    item->pacer.Run(item->call_us + (int64_t)(size / SPI_FLASH_SEC_SIZE) * item->erase_us);
+    memset(item->data.data() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory,
+    const void** out_ptr, esp_partition_mmap_handle_t* out_handle) {
+    auto item = Find(partition);
+    if (item == nullptr || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_ptr = item->data.data() + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+}
+
+const esp_partition_t* test_partition_add(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label, uint32_t size) {
+    static uint32_t next_address = 0x10000;
+    auto item = std::make_unique<Partition>();
+    item->partition.type = type;
+    item->partition.subtype = subtype;
+    item->partition.address = next_address;
+    item->partition.size = size;
+    item->partition.erase_size = SPI_FLASH_SEC_SIZE;
+    strncpy(item->partition.label, label, sizeof(item->partition.label) - 1);
+    item->data.assign(size, 0xFF);
+    next_address += size;
+    partitions.push_back(std::move(item));
+    return &partitions.back()->partition;
+}
+
+std::vector<uint8_t>& test_partition_data(const esp_partition_t* partition) {
+    return Find(partition)->data;
+}
+
+void test_partition_fail_after(const esp_partition_t* partition, long bytes) {
+    Find(partition)->fail_after = bytes;
+}
+
+void test_partition_set_timing(const esp_partition_t* partition, int call_us, int erase_us, int write_us_per_kb) {
+    auto item = Find(partition);
+    item->call_us = call_us;
+    item->erase_us = erase_us;
+    item->write_us_per_kb = write_us_per_kb;
+    item->pacer.Reset();
+}
@@ -0,0 +1,59 @@
+#ifndef _ESP_PARTITION_H_
+#define _ESP_PARTITION_H_
+
+#include <esp_err.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+    ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11,
+    ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+    bool encrypted;
+    bool readonly;
+} esp_partition_t;
+
+typedef enum {
+    ESP_PARTITION_MMAP_DATA,
+    ESP_PARTITION_MMAP_INST,
+} esp_partition_mmap_memory_t;
+
+typedef uint32_t esp_partition_mmap_handle_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+// Like NOR flash, a write can only clear bits, the range must be erased first
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+// The mapping points straight at the RAM that holds the partition
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory,
+    const void** out_ptr, esp_partition_mmap_handle_t* out_handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+// Host test helpers, partitions live in RAM and start erased
+const esp_partition_t* test_partition_add(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label, uint32_t size);
+std::vector<uint8_t>& test_partition_data(const esp_partition_t* partition);
+// Writes and erases fail after the given number of bytes has been written, -1 to never fail
+void test_partition_fail_after(const esp_partition_t* partition, long bytes);
+// Makes erases and writes take as long as on a flash chip: call_us for every call, plus erase_us
+// per sector erased and write_us_per_kb for the bytes written. All zero, the default, for no delay
+void test_partition_set_timing(const esp_partition_t* partition, int call_us, int erase_us, int write_us_per_kb);
+
+#endif // _ESP_PARTITION_H_
@@ -0,0 +1,15 @@
+#ifndef _ESP_RANDOM_H_
+#define _ESP_RANDOM_H_
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+
+inline uint32_t esp_random() {
+    static std::mutex mutex;
+    static std::minstd_rand generator(1);
+    std::lock_guard<std::mutex> lock(mutex);
+    return generator();
+}
+
+#endif // _ESP_RANDOM_H_
@@ -0,0 +1,123 @@
+#ifndef _ESP_TIMER_H_
+#define _ESP_TIMER_H_
+
+#include "esp_err.h"
+
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+inline int64_t esp_timer_get_time() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+// Each start waits on its own thread. Stopping or starting again bumps the generation, which
+// wakes the waiting thread up and keeps it from calling back. The state outlives a deleted
+// timer until its last thread is gone.
+struct esp_timer {
+    struct State {
+        std::mutex mutex;
+        std::condition_variable condition_variable;
+        uint32_t generation = 0;
+        bool running = false;
+    };
+    esp_timer_cb_t callback;
+    void* arg;
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+typedef esp_timer* esp_timer_handle_t;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    *out_handle = new esp_timer{args->callback, args->arg};
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer->state->mutex);
+    if (!timer->state->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->state->running = false;
+    timer->state->generation++;
+    timer->state->condition_variable.notify_all();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    auto state = timer->state;
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        state->running = true;
+        generation = ++state->generation;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+    std::thread([state, generation, deadline, callback = timer->callback, arg = timer->arg]() {
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (state->condition_variable.wait_until(lock, deadline, [&]() { return state->generation != generation; })) {
+                return;
+            }
+            state->running = false;
+        }
+        callback(arg);
+    }).detach();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    auto state = timer->state;
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        state->running = true;
+        generation = ++state->generation;
+    }
+    std::thread([state, generation, period_us, callback = timer->callback, arg = timer->arg]() {
+        auto deadline = std::chrono::steady_clock::now();
+        while (true) {
+            deadline += std::chrono::microseconds(period_us);
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                if (state->condition_variable.wait_until(lock, deadline, [&]() { return state->generation != generation; })) {
+                    return;
+                }
+            }
+            callback(arg);
+        }
+    }).detach();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    esp_timer_stop(timer);
+    delete timer;
+    return ESP_OK;
+}
+
+#endif // _ESP_TIMER_H_
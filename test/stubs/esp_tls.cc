@@ -0,0 +1,140 @@
+#include "esp_tls.h"
+
+#include <openssl/ssl.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct esp_tls {
+    int fd = -1;
+    SSL* ssl = nullptr;
+    // OpenSSL does not allow a read and a write on the same connection at once
+    std::mutex mutex;
+    std::atomic<bool> closed{false};
+    std::atomic<int> readers{0};
+};
+
+struct esp_tls_client_session {
+    SSL_SESSION* session;
+};
+
+static SSL_CTX* ClientContext() {
+    static SSL_CTX* context = []() {
+        // lwIP reports a write to a closed socket as an error, not as a signal
+        signal(SIGPIPE, SIG_IGN);
+        auto context = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+        SSL_CTX_set_verify(context, SSL_VERIFY_NONE, nullptr);
+        return context;
+    }();
+    return context;
+}
+
+esp_tls_t* esp_tls_init(void) {
+    return new esp_tls();
+}
+
+int esp_tls_conn_new_sync(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls) {
+    std::string host(hostname, hostlen);
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* address = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &address) != 0) {
+        return -1;
+    }
+    tls->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int ret = connect(tls->fd, address->ai_addr, address->ai_addrlen);
+    freeaddrinfo(address);
+    if (ret != 0) {
+        return -1;
+    }
+
+    tls->ssl = SSL_new(ClientContext());
+    SSL_set_fd(tls->ssl, tls->fd);
+    SSL_set_tlsext_host_name(tls->ssl, host.c_str());
+    if (cfg->client_session != nullptr) {
+        SSL_set_session(tls->ssl, cfg->client_session->session);
+    }
+    return SSL_connect(tls->ssl) == 1 ? 1 : -1;
+}
+
+int esp_tls_conn_destroy(esp_tls_t* tls) {
+    // Wake up a reader blocked on the socket and let it leave before freeing the connection
+    tls->closed = true;
+    if (tls->fd >= 0) {
+        shutdown(tls->fd, SHUT_RDWR);
+    }
+    while (tls->readers > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (tls->ssl != nullptr) {
+        SSL_free(tls->ssl);
+    }
+    if (tls->fd >= 0) {
+        close(tls->fd);
+    }
+    delete tls;
+    return 0;
+}
+
+ssize_t esp_tls_conn_write(esp_tls_t* tls, const void* data, size_t datalen) {
+    if (tls == nullptr || tls->closed) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(tls->mutex);
+    return SSL_write(tls->ssl, data, datalen);
+}
+
+ssize_t esp_tls_conn_read(esp_tls_t* tls, void* data, size_t datalen) {
+    if (tls == nullptr) {
+        return -1;
+    }
+    tls->readers++;
+    ssize_t ret = 0;
+    while (!tls->closed) {
+        {
+            std::lock_guard<std::mutex> lock(tls->mutex);
+            if (SSL_pending(tls->ssl) > 0) {
+                ret = SSL_read(tls->ssl, data, datalen);
+                break;
+            }
+        }
+        // Wait outside the lock, so that writes go on while nothing arrives
+        pollfd poll_fd = { tls->fd, POLLIN, 0 };
+        if (poll(&poll_fd, 1, 20) > 0) {
+            std::lock_guard<std::mutex> lock(tls->mutex);
+            ret = SSL_read(tls->ssl, data, datalen);
+            break;
+        }
+    }
+    tls->readers--;
+    return ret;
+}
+
+esp_tls_client_session_t* esp_tls_get_client_session(esp_tls_t* tls) {
+    // A copy like mbedtls_ssl_get_session makes, OpenSSL marks the session of a connection
+    // freed without close_notify as not resumable
+    auto session = SSL_SESSION_dup(SSL_get_session(tls->ssl));
+    if (session == nullptr) {
+        return nullptr;
+    }
+    return new esp_tls_client_session_t{session};
+}
+
+void esp_tls_free_client_session(esp_tls_client_session_t* client_session) {
+    if (client_session != nullptr) {
+        SSL_SESSION_free(client_session->session);
+        delete client_session;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef _ESP_TLS_H_
+#define _ESP_TLS_H_
+
+#include <esp_err.h>
+
+#include <cstddef>
+#include <sys/types.h>
+
+// esp-tls on top of OpenSSL, limited to TLS 1.2 like the mbedtls build of the firmware.
+// The server certificate is not verified, the test servers use a throwaway one.
+typedef struct esp_tls esp_tls_t;
+typedef struct esp_tls_client_session esp_tls_client_session_t;
+
+typedef struct esp_tls_cfg {
+    esp_err_t (*crt_bundle_attach)(void* conf);
+    int timeout_ms;
+    esp_tls_client_session_t* client_session;
+} esp_tls_cfg_t;
+
+esp_tls_t* esp_tls_init(void);
+// Returns 1 once connected, -1 on failure
+int esp_tls_conn_new_sync(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls);
+int esp_tls_conn_destroy(esp_tls_t* tls);
+ssize_t esp_tls_conn_write(esp_tls_t* tls, const void* data, size_t datalen);
+ssize_t esp_tls_conn_read(esp_tls_t* tls, void* data, size_t datalen);
+esp_tls_client_session_t* esp_tls_get_client_session(esp_tls_t* tls);
+void esp_tls_free_client_session(esp_tls_client_session_t* client_session);
+
+#endif // _ESP_TLS_H_
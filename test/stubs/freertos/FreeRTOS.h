@@ -0,0 +1,18 @@
+#ifndef _FREERTOS_H_
+#define _FREERTOS_H_
+
+#include <cstdint>
+// The ESP-IDF port headers bring in the POSIX time functions
+#include <sys/time.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xffffffffUL
+// One tick per millisecond
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // _FREERTOS_H_
@@ -0,0 +1,67 @@
+#ifndef _FREERTOS_EVENT_GROUPS_H_
+#define _FREERTOS_EVENT_GROUPS_H_
+
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+typedef uint32_t EventBits_t;
+
+struct EventGroupDef_t {
+    EventBits_t bits = 0;
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+};
+typedef EventGroupDef_t* EventGroupHandle_t;
+
+inline EventGroupHandle_t xEventGroupCreate() {
+    return new EventGroupDef_t();
+}
+
+inline void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->condition_variable.notify_all();
+    return group->bits;
+}
+
+inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    auto previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+// Returns the bits as they were when the wait ended, before clear_on_exit, like FreeRTOS
+inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto ready = [&]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool satisfied;
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->condition_variable.wait(lock, ready);
+        satisfied = true;
+    } else {
+        satisfied = group->condition_variable.wait_for(lock, std::chrono::milliseconds(ticks_to_wait), ready);
+    }
+    auto result = group->bits;
+    if (satisfied && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+#endif // _FREERTOS_EVENT_GROUPS_H_
@@ -0,0 +1,68 @@
+#ifndef _FREERTOS_QUEUE_H_
+#define _FREERTOS_QUEUE_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Items are copied in and out like in FreeRTOS
+struct QueueDefinition {
+    size_t length;
+    size_t item_size;
+    std::deque<std::vector<uint8_t>> items;
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+
+    template <typename Predicate>
+    bool Wait(std::unique_lock<std::mutex>& lock, TickType_t ticks, Predicate predicate) {
+        if (ticks == portMAX_DELAY) {
+            condition_variable.wait(lock, predicate);
+            return true;
+        }
+        return condition_variable.wait_for(lock, std::chrono::milliseconds(ticks), predicate);
+    }
+};
+typedef QueueDefinition* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(size_t length, size_t item_size) {
+    auto queue = new QueueDefinition();
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+inline void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!queue->Wait(lock, ticks_to_wait, [queue]() { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+    auto bytes = (const uint8_t*)item;
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    queue->condition_variable.notify_all();
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!queue->Wait(lock, ticks_to_wait, [queue]() { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    if (queue->item_size > 0) {
+        memcpy(buffer, queue->items.front().data(), queue->item_size);
+    }
+    queue->items.pop_front();
+    queue->condition_variable.notify_all();
+    return pdTRUE;
+}
+
+#endif // _FREERTOS_QUEUE_H_
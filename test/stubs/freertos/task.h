@@ -0,0 +1,32 @@
+#ifndef _FREERTOS_TASK_H_
+#define _FREERTOS_TASK_H_
+
+#include "FreeRTOS.h"
+
+#include <thread>
+#include <chrono>
+
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+// Tasks run on detached threads, stack size and priority are ignored
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth,
+    void* parameters, int priority, TaskHandle_t* created_task) {
+    std::thread(function, parameters).detach();
+    if (created_task != nullptr) {
+        // Only compared against nullptr by the code under test
+        *created_task = (TaskHandle_t)function;
+    }
+    return pdPASS;
+}
+
+// A task ends when its function returns, which every caller does right after deleting itself
+inline void vTaskDelete(TaskHandle_t task) {
+}
+
+// Delays are 100 times shorter, so retry back-offs do not slow the tests down
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::microseconds(ticks * 10));
+}
+
+#endif // _FREERTOS_TASK_H_
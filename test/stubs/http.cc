@@ -0,0 +1,108 @@
+#include "http.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+void Http::SetHeader(const std::string& key, const std::string& value) {
+    headers_[key] = value;
+}
+
+bool Http::Open(const std::string& method, const std::string& url, const std::string& content) {
+    auto& server = HttpServer::GetInstance();
+    size_t range_start = 0;
+    auto range = headers_.find("Range");
+    if (range != headers_.end()) {
+        // Only "bytes=<start>-" is sent
+        range_start = std::stoul(range->second.substr(strlen("bytes=")));
+    }
+    server.requests.push_back(HttpRequest{url, range_start});
+
+    auto file = server.files.find(url);
+    if (file == server.files.end()) {
+        status_code_ = 404;
+        return true;
+    }
+    body_ = file->second;
+    status_code_ = 200;
+    received_ = 0;
+    receive_time_ = esp_timer_get_time();
+    if (range != headers_.end() && server.accept_ranges) {
+        status_code_ = 206;
+        position_ = std::min(range_start, body_.size());
+    }
+    return true;
+}
+
+void Http::Close() {
+}
+
+int Http::GetStatusCode() {
+    return status_code_;
+}
+
+std::string Http::GetResponseHeader(const std::string& key) const {
+    return "";
+}
+
+size_t Http::GetBodyLength() {
+    return body_.size() - position_;
+}
+
+std::string Http::GetBody() {
+    return body_.substr(position_);
+}
+
+int Http::Read(char* buffer, size_t buffer_size) {
+    auto& server = HttpServer::GetInstance();
+    if (dropped_) {
+        return -1;
+    }
+    size_t end = body_.size();
+    if (server.drops > 0 && position_ < server.drop_at) {
+        end = std::min(end, server.drop_at);
+    } else if (server.drops > 0 && position_ < body_.size()) {
+        server.drops--;
+        dropped_ = true;
+        if (server.on_drop) {
+            server.on_drop();
+        }
+        return -1;
+    }
+    size_t length = Receive(std::min(buffer_size, end - position_), end);
+    memcpy(buffer, body_.data() + position_, length);
+    position_ += length;
+    return length;
+}
+
+// Waits until some of the size bytes are in the receive window and takes them out of it
+size_t Http::Receive(size_t size, size_t end) {
+    auto& server = HttpServer::GetInstance();
+    if (server.bytes_per_second == 0 || size == 0) {
+        return size;
+    }
+    size_t wanted = std::min(size, server.receive_window);
+    while (true) {
+        auto now = esp_timer_get_time();
+        double sent = (double)(now - receive_time_) * server.bytes_per_second / 1000000;
+        double unsent = (double)(end - position_) - received_;
+        sent = std::min(sent, unsent);
+        double room = server.receive_window - received_;
+        if (sent > room) {
+            // The server had more to send than the window took
+            server.stalled_us += (int64_t)((sent - room) * 1000000 / server.bytes_per_second);
+            sent = room;
+        }
+        received_ += sent;
+        receive_time_ = now;
+        if (received_ >= wanted || unsent - sent <= 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(
+            (int64_t)((wanted - received_) * 1000000 / server.bytes_per_second) + 1));
+    }
+    size_t length = std::min(size, (size_t)received_);
+    received_ -= length;
+    server.read_pacer.Run((int64_t)length * server.read_us_per_kb / 1024);
+    return length;
+}
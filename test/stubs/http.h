@@ -0,0 +1,85 @@
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+#include "pacer.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Serves the files of the fake HTTP server below, keyed by URL
+class Http {
+public:
+    void SetHeader(const std::string& key, const std::string& value);
+    bool Open(const std::string& method, const std::string& url, const std::string& content = "");
+    void Close();
+    int GetStatusCode();
+    std::string GetResponseHeader(const std::string& key) const;
+    size_t GetBodyLength();
+    std::string GetBody();
+    int Read(char* buffer, size_t buffer_size);
+
+private:
+    std::map<std::string, std::string> headers_;
+    std::string body_;
+    int status_code_ = 0;
+    size_t position_ = 0;
+    bool dropped_ = false;
+    // Bytes the server has sent that wait in the receive window, and when that was last updated
+    double received_ = 0;
+    int64_t receive_time_ = 0;
+
+    size_t Receive(size_t size, size_t end);
+};
+
+struct HttpRequest {
+    std::string url;
+    // Where a Range header asked the download to start, 0 without one
+    size_t range_start;
+};
+
+class HttpServer {
+public:
+    static HttpServer& GetInstance() {
+        static HttpServer instance;
+        return instance;
+    }
+
+    std::map<std::string, std::string> files;
+    // Range requests are answered with 206 Partial Content, otherwise the whole file is sent with 200
+    bool accept_ranges = true;
+    // The next drops connections fail once they reach this offset of a file
+    size_t drop_at = 0;
+    int drops = 0;
+    // Called when a connection drops, before the client sees it
+    std::function<void()> on_drop;
+    std::vector<HttpRequest> requests;
+
+    // Without a bandwidth reads return at once. With one, the server sends at this many bytes per
+    // second until the receive window is full, like a TCP connection, and every read also costs
+    // the reader read_us_per_kb (TLS decryption) on top of waiting for the data
+    size_t bytes_per_second = 0;
+    size_t receive_window = 5760;
+    int read_us_per_kb = 0;
+    // Time the server could not send because the client left the receive window full
+    int64_t stalled_us = 0;
+    Pacer read_pacer;
+
+    void Reset() {
+        files.clear();
+        accept_ranges = true;
+        drop_at = 0;
+        drops = 0;
+        on_drop = nullptr;
+        requests.clear();
+        bytes_per_second = 0;
+        receive_window = 5760;
+        read_us_per_kb = 0;
+        stalled_us = 0;
+        read_pacer.Reset();
+    }
+};
+
+#endif // _HTTP_H_
@@ -0,0 +1,27 @@
+#ifndef _LVGL_H_
+#define _LVGL_H_
+
+#include <cstdint>
+
+// Only the image descriptor that Assets fills in
+#define LV_IMAGE_HEADER_MAGIC 0x19
+
+typedef struct {
+    uint32_t magic: 8;
+    uint32_t cf: 8;
+    uint32_t flags: 16;
+    uint32_t w: 16;
+    uint32_t h: 16;
+    uint32_t stride: 16;
+    uint32_t reserved_2: 16;
+} lv_image_header_t;
+
+typedef struct {
+    lv_image_header_t header;
+    uint32_t data_size;
+    const uint8_t* data;
+} lv_image_dsc_t;
+
+typedef lv_image_dsc_t lv_img_dsc_t;
+
+#endif // _LVGL_H_
@@ -0,0 +1,45 @@
+#include "rom/miniz.h"
+
+#include <zlib.h>
+#include <string_view>
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+    mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size, const mz_uint32 decomp_flags) {
+    if ((decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) == 0 || (decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) != 0) {
+        return TINFL_STATUS_BAD_PARAM;
+    }
+    auto stream = (z_stream*)r->stream;
+    if (stream == nullptr) {
+        stream = new z_stream();
+        if (inflateInit(stream) != Z_OK) {
+            delete stream;
+            return TINFL_STATUS_FAILED;
+        }
+        r->stream = stream;
+    }
+
+    // zlib keeps its own window, the output goes wherever the caller asks
+    stream->next_in = (Bytef*)pIn_buf_next;
+    stream->avail_in = *pIn_buf_size;
+    stream->next_out = pOut_buf_next;
+    stream->avail_out = *pOut_buf_size;
+    int ret = inflate(stream, Z_NO_FLUSH);
+    *pIn_buf_size -= stream->avail_in;
+    *pOut_buf_size -= stream->avail_out;
+
+    tinfl_status status;
+    if (ret == Z_STREAM_END) {
+        status = TINFL_STATUS_DONE;
+    } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+        status = stream->avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+    } else {
+        status = ret == Z_DATA_ERROR && stream->msg != nullptr && std::string_view(stream->msg) == "incorrect data check" ?
+            TINFL_STATUS_ADLER32_MISMATCH : TINFL_STATUS_FAILED;
+    }
+    if (status <= TINFL_STATUS_DONE) {
+        inflateEnd(stream);
+        delete stream;
+        r->stream = nullptr;
+    }
+    return status;
+}
@@ -0,0 +1,6 @@
+#ifndef _ML307_MQTT_H_
+#define _ML307_MQTT_H_
+
+#include "mqtt.h"
+
+#endif // _ML307_MQTT_H_
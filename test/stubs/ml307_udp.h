@@ -0,0 +1,6 @@
+#ifndef _ML307_UDP_H_
+#define _ML307_UDP_H_
+
+#include "udp.h"
+
+#endif // _ML307_UDP_H_
@@ -0,0 +1,109 @@
+#include "mqtt.h"
+
+Mqtt::~Mqtt() {
+    auto& broker = MqttBroker::GetInstance();
+    std::lock_guard<std::mutex> lock(broker.client_mutex_);
+    if (broker.client_ == this) {
+        broker.client_ = nullptr;
+    }
+}
+
+void Mqtt::SetKeepAlive(int keep_alive_seconds) {
+}
+
+bool Mqtt::Connect(const std::string broker_address, int broker_port, const std::string client_id,
+    const std::string username, const std::string password) {
+    auto& broker = MqttBroker::GetInstance();
+    if (!broker.reachable) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(broker.client_mutex_);
+    broker.client_ = this;
+    connected_ = true;
+    return true;
+}
+
+void Mqtt::Disconnect() {
+    connected_ = false;
+}
+
+bool Mqtt::Publish(const std::string topic, const std::string payload, int qos) {
+    auto& broker = MqttBroker::GetInstance();
+    if (!connected_) {
+        return false;
+    }
+    std::function<void(const std::string& payload)> on_publish;
+    {
+        std::lock_guard<std::mutex> lock(broker.mutex_);
+        broker.published_.push_back(payload);
+        on_publish = broker.on_publish;
+    }
+    if (on_publish) {
+        on_publish(payload);
+    }
+    return true;
+}
+
+bool Mqtt::IsConnected() {
+    return connected_;
+}
+
+void Mqtt::OnDisconnected(std::function<void()> callback) {
+    on_disconnected_ = callback;
+}
+
+void Mqtt::OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback) {
+    on_message_ = callback;
+}
+
+MqttBroker::MqttBroker() {
+    thread_ = std::thread([this]() {
+        Run();
+    });
+    thread_.detach();
+}
+
+void MqttBroker::Run() {
+    while (true) {
+        Delivery delivery;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_variable_.wait(lock, [this]() { return !deliveries_.empty(); });
+            delivery = std::move(deliveries_.front());
+            deliveries_.pop_front();
+        }
+        std::this_thread::sleep_until(delivery.due);
+        std::lock_guard<std::mutex> lock(client_mutex_);
+        if (client_ != nullptr && client_->connected_ && client_->on_message_) {
+            client_->on_message_("devices/test", delivery.payload);
+        }
+    }
+}
+
+void MqttBroker::Deliver(const std::string& payload, int delay_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deliveries_.push_back(Delivery{payload, std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms)});
+    condition_variable_.notify_all();
+}
+
+void MqttBroker::DropClient() {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    if (client_ != nullptr && client_->connected_) {
+        client_->connected_ = false;
+        if (client_->on_disconnected_) {
+            client_->on_disconnected_();
+        }
+    }
+}
+
+std::vector<std::string> MqttBroker::Published() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return published_;
+}
+
+void MqttBroker::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reachable = true;
+    on_publish = nullptr;
+    published_.clear();
+}
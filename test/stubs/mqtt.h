@@ -0,0 +1,71 @@
+#ifndef _MQTT_H_
+#define _MQTT_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A client of the fake broker below
+class Mqtt {
+public:
+    ~Mqtt();
+    void SetKeepAlive(int keep_alive_seconds);
+    bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+        const std::string username, const std::string password);
+    void Disconnect();
+    bool Publish(const std::string topic, const std::string payload, int qos = 0);
+    bool IsConnected();
+    void OnDisconnected(std::function<void()> callback);
+    void OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback);
+
+private:
+    friend class MqttBroker;
+    bool connected_ = false;
+    std::function<void()> on_disconnected_;
+    std::function<void(const std::string& topic, const std::string& payload)> on_message_;
+};
+
+// Messages for the client are delivered in order on the broker's own thread, like the esp-mqtt task
+class MqttBroker {
+public:
+    static MqttBroker& GetInstance() {
+        static MqttBroker instance;
+        return instance;
+    }
+
+    // Connect fails while the broker is down
+    bool reachable = true;
+    // Called with every published payload on the publishing thread, the server logic of a test lives here
+    std::function<void(const std::string& payload)> on_publish;
+
+    void Deliver(const std::string& payload, int delay_ms = 0);
+    // Drops the connected client, as when the network goes away
+    void DropClient();
+    std::vector<std::string> Published();
+    void Reset();
+
+private:
+    friend class Mqtt;
+    struct Delivery {
+        std::string payload;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    std::deque<Delivery> deliveries_;
+    std::vector<std::string> published_;
+    std::thread thread_;
+    // Held while a callback of the client runs, so the client is not deleted under it
+    std::mutex client_mutex_;
+    Mqtt* client_ = nullptr;
+
+    MqttBroker();
+    void Run();
+};
+
+#endif // _MQTT_H_
@@ -0,0 +1,122 @@
+#include "nvs.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+struct Entry {
+    bool is_string;
+    std::string string;
+    int32_t number;
+};
+
+std::mutex nvs_mutex;
+std::map<std::string, std::map<std::string, Entry>> namespaces;
+// Handle n refers to handle_names[n - 1], 0 is never handed out
+std::vector<std::string> handle_names;
+
+std::map<std::string, Entry>* Find(nvs_handle_t handle) {
+    if (handle == 0 || handle > handle_names.size()) {
+        return nullptr;
+    }
+    return &namespaces[handle_names[handle - 1]];
+}
+
+} // namespace
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    // Like the real NVS, a namespace that was never written cannot be opened read-only
+    if (open_mode == NVS_READONLY && namespaces.find(name) == namespaces.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    namespaces[name];
+    handle_names.push_back(name);
+    *out_handle = handle_names.size();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    auto it = entries->find(key);
+    if (it == entries->end() || !it->second.is_string) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    size_t size = it->second.string.size() + 1;
+    if (out_value != nullptr) {
+        if (*length < size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(out_value, it->second.string.c_str(), size);
+    }
+    *length = size;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    (*entries)[key] = Entry{true, value, 0};
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    auto it = entries->find(key);
+    if (it == entries->end() || it->second.is_string) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *out_value = it->second.number;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    (*entries)[key] = Entry{false, "", value};
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    return entries->erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto entries = Find(handle);
+    if (entries == nullptr) {
+        return ESP_FAIL;
+    }
+    entries->clear();
+    return ESP_OK;
+}
@@ -0,0 +1,6 @@
+#ifndef _NVS_FLASH_H_
+#define _NVS_FLASH_H_
+
+#include "nvs.h"
+
+#endif // _NVS_FLASH_H_
@@ -0,0 +1,40 @@
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Stands in for the time a device needs for an operation, such as a flash erase. Operations on a
+// device run one after another on a virtual clock and the caller sleeps until its operation is
+// done. Sleeps overshoot, so a thread that issues an operation right after its previous one, on
+// this or another device, continues from where that one ended rather than from the current time.
+// Otherwise thousands of small operations would add up the overshoot.
+class Pacer {
+public:
+    void Run(int64_t cost_us) {
+        if (cost_us <= 0) {
+            return;
+        }
+        auto now = esp_timer_get_time();
+        int64_t caller_time = now - thread_time_ <= PACER_SLACK_US ? thread_time_ : now;
+        busy_until_ = std::max(caller_time, busy_until_) + cost_us;
+        thread_time_ = busy_until_;
+        if (busy_until_ > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds(busy_until_ - now));
+        }
+    }
+
+    void Reset() {
+        busy_until_ = 0;
+    }
+
+private:
+    static constexpr int64_t PACER_SLACK_US = 300;
+    static inline thread_local int64_t thread_time_ = 0;
+    int64_t busy_until_ = 0;
+};
+
+#endif // _PACER_H_
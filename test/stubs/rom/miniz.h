@@ -0,0 +1,37 @@
+#ifndef _ROM_MINIZ_H_
+#define _ROM_MINIZ_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// The tinfl API of the inflater in ROM, backed by zlib on the host
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+#define TINFL_LZ_DICT_SIZE 32768
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+// Plain data like the real one, it is allocated with malloc and never destroyed.
+// The zlib state is released when the stream ends or fails.
+typedef struct {
+    void* stream;
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->stream = nullptr; } while (0)
+
+// Only zlib streams with a wrapping output buffer are supported
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+    mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size, const mz_uint32 decomp_flags);
+
+#endif // _ROM_MINIZ_H_
@@ -0,0 +1,11 @@
+#ifndef _SDKCONFIG_H_
+#define _SDKCONFIG_H_
+
+// Only the options read by the code under test, with the defaults of sdkconfig.defaults
+#define CONFIG_OPUS_FRAME_DURATION_MS 60
+#define CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS 1
+// The tests set the url in the "websocket" settings
+#define CONFIG_WEBSOCKET_URL ""
+#define CONFIG_WEBSOCKET_ACCESS_TOKEN "test-token"
+
+#endif // _SDKCONFIG_H_
@@ -0,0 +1,6 @@
+#ifndef _SPI_FLASH_MMAP_H_
+#define _SPI_FLASH_MMAP_H_
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif // _SPI_FLASH_MMAP_H_
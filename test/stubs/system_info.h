@@ -0,0 +1,13 @@
+#ifndef _SYSTEM_INFO_H_
+#define _SYSTEM_INFO_H_
+
+#include <string>
+
+class SystemInfo {
+public:
+    static std::string GetMacAddress() {
+        return "02:00:00:00:00:01";
+    }
+};
+
+#endif // _SYSTEM_INFO_H_
@@ -0,0 +1,81 @@
+#include "udp.h"
+
+#include <esp_timer.h>
+
+Udp::~Udp() {
+    auto& server = UdpServer::GetInstance();
+    std::lock_guard<std::mutex> lock(server.mutex_);
+    if (server.socket_ == this) {
+        server.socket_ = nullptr;
+    }
+}
+
+bool Udp::Connect(const std::string& host, int port) {
+    auto& server = UdpServer::GetInstance();
+    std::lock_guard<std::mutex> lock(server.mutex_);
+    server.socket_ = this;
+    server.host_ = host;
+    server.port_ = port;
+    return true;
+}
+
+void Udp::Disconnect() {
+}
+
+int Udp::Send(const std::string& data) {
+    auto& server = UdpServer::GetInstance();
+    std::function<void(const std::string& data)> on_packet;
+    {
+        std::lock_guard<std::mutex> lock(server.mutex_);
+        if (server.packets_++ == 0) {
+            server.first_packet_time_ = esp_timer_get_time();
+        }
+        on_packet = server.on_packet;
+    }
+    if (on_packet) {
+        on_packet(data);
+    }
+    if (server.echo && on_message_) {
+        on_message_(data);
+    }
+    return data.size();
+}
+
+void Udp::OnMessage(std::function<void(const std::string& data)> callback) {
+    on_message_ = callback;
+}
+
+std::string UdpServer::host() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return host_;
+}
+
+int UdpServer::port() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return port_;
+}
+
+int UdpServer::packets() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return packets_;
+}
+
+int64_t UdpServer::first_packet_time() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return first_packet_time_;
+}
+
+void UdpServer::Send(const std::string& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (socket_ != nullptr && socket_->on_message_) {
+        socket_->on_message_(data);
+    }
+}
+
+void UdpServer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    echo = false;
+    on_packet = nullptr;
+    packets_ = 0;
+    first_packet_time_ = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef _UDP_H_
+#define _UDP_H_
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// A socket of the fake UDP server below
+class Udp {
+public:
+    ~Udp();
+    bool Connect(const std::string& host, int port);
+    void Disconnect();
+    int Send(const std::string& data);
+    void OnMessage(std::function<void(const std::string& data)> callback);
+
+private:
+    friend class UdpServer;
+    std::function<void(const std::string& data)> on_message_;
+};
+
+// Packets are handled on the sending thread. Sent packets are not stored, so sending allocates nothing.
+class UdpServer {
+public:
+    static UdpServer& GetInstance() {
+        static UdpServer instance;
+        return instance;
+    }
+
+    // Every packet goes straight back to the socket, as from an echo server
+    bool echo = false;
+    // Called with every packet the device sends
+    std::function<void(const std::string& data)> on_packet;
+
+    std::string host();
+    int port();
+    int packets();
+    // When the first packet after Reset arrived, 0 before that
+    int64_t first_packet_time();
+    // Hands a packet to the connected socket on the calling thread
+    void Send(const std::string& data);
+    void Reset();
+
+private:
+    friend class Udp;
+    std::mutex mutex_;
+    Udp* socket_ = nullptr;
+    std::string host_;
+    int port_ = 0;
+    int packets_ = 0;
+    int64_t first_packet_time_ = 0;
+};
+
+#endif // _UDP_H_
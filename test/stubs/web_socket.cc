@@ -0,0 +1,343 @@
+#include "web_socket.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+
+#define FRAME_TYPE_TEXT 1
+#define FRAME_TYPE_BINARY 2
+#define FRAME_HEADER_SIZE 5
+
+static std::string FrameHeader(uint8_t type, size_t size) {
+    std::string header(FRAME_HEADER_SIZE, '\0');
+    header[0] = type;
+    uint32_t length = htonl(size);
+    memcpy(&header[1], &length, sizeof(length));
+    return header;
+}
+
+// Cuts the first complete frame off the buffer
+static bool TakeFrame(std::string& buffer, uint8_t& type, std::string& payload) {
+    if (buffer.size() < FRAME_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t length;
+    memcpy(&length, &buffer[1], sizeof(length));
+    length = ntohl(length);
+    if (buffer.size() < FRAME_HEADER_SIZE + length) {
+        return false;
+    }
+    type = buffer[0];
+    payload = buffer.substr(FRAME_HEADER_SIZE, length);
+    buffer.erase(0, FRAME_HEADER_SIZE + length);
+    return true;
+}
+
+WebSocket::WebSocket(Transport* transport) : transport_(transport) {
+}
+
+WebSocket::~WebSocket() {
+    closing_ = true;
+    transport_->Disconnect();
+    if (receive_thread_.joinable()) {
+        receive_thread_.join();
+    }
+    delete transport_;
+}
+
+void WebSocket::SetHeader(const char* key, const char* value) {
+    headers_[key] = value;
+}
+
+bool WebSocket::IsConnected() const {
+    return connected_;
+}
+
+bool WebSocket::Connect(const char* uri) {
+    std::string url(uri);
+    auto scheme_end = url.find("://");
+    std::string rest = scheme_end == std::string::npos ? url : url.substr(scheme_end + 3);
+    auto path_start = rest.find('/');
+    std::string authority = rest.substr(0, path_start);
+    std::string path = path_start == std::string::npos ? "/" : rest.substr(path_start);
+    auto colon = authority.find(':');
+    std::string host = authority.substr(0, colon);
+    int port = colon == std::string::npos ? 443 : std::stoi(authority.substr(colon + 1));
+    if (!transport_->Connect(host.c_str(), port)) {
+        return false;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n";
+    for (const auto& header : headers_) {
+        request += header.first + ": " + header.second + "\r\n";
+    }
+    request += "\r\n";
+    if (transport_->Send(request.data(), request.size()) != (int)request.size()) {
+        return false;
+    }
+
+    std::string response;
+    char buffer[512];
+    while (response.find("\r\n\r\n") == std::string::npos) {
+        int ret = transport_->Receive(buffer, sizeof(buffer));
+        if (ret <= 0) {
+            return false;
+        }
+        response.append(buffer, ret);
+    }
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0) {
+        return false;
+    }
+    received_ = response.substr(response.find("\r\n\r\n") + 4);
+    connected_ = true;
+    receive_thread_ = std::thread(&WebSocket::ReceiveLoop, this);
+    return true;
+}
+
+bool WebSocket::Send(const std::string& data) {
+    return Send(data.data(), data.size(), false);
+}
+
+bool WebSocket::Send(const void* data, size_t len, bool binary) {
+    if (!connected_) {
+        return false;
+    }
+    std::string frame = FrameHeader(binary ? FRAME_TYPE_BINARY : FRAME_TYPE_TEXT, len);
+    frame.append((const char*)data, len);
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    return transport_->Send(frame.data(), frame.size()) == (int)frame.size();
+}
+
+void WebSocket::OnDisconnected(std::function<void()> callback) {
+    on_disconnected_ = callback;
+}
+
+void WebSocket::OnData(std::function<void(const char* data, size_t len, bool binary)> callback) {
+    on_data_ = callback;
+}
+
+void WebSocket::ReceiveLoop() {
+    char buffer[1024];
+    uint8_t type;
+    std::string payload;
+    while (true) {
+        while (TakeFrame(received_, type, payload)) {
+            if (on_data_) {
+                on_data_(payload.data(), payload.size(), type == FRAME_TYPE_BINARY);
+            }
+        }
+        int ret = transport_->Receive(buffer, sizeof(buffer));
+        if (ret <= 0) {
+            break;
+        }
+        received_.append(buffer, ret);
+    }
+    connected_ = false;
+    // Closed by the server, not by the destructor
+    if (!closing_ && on_disconnected_) {
+        on_disconnected_();
+    }
+}
+
+// Copies src to dst, every chunk leaves delay_ms after it arrived. Chunks are queued, so
+// a burst is delayed once rather than once per chunk, like packets on a slow link.
+static void DelayedCopy(int src, int dst, int delay_ms) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> chunks;
+    bool done = false;
+
+    std::thread writer([&]() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return done || !chunks.empty(); });
+            if (chunks.empty()) {
+                break;
+            }
+            auto chunk = std::move(chunks.front());
+            chunks.pop_front();
+            lock.unlock();
+            std::this_thread::sleep_until(chunk.first);
+            if (write(dst, chunk.second.data(), chunk.second.size()) < 0) {
+                break;
+            }
+        }
+        shutdown(dst, SHUT_WR);
+    });
+
+    char buffer[4096];
+    while (true) {
+        ssize_t ret = read(src, buffer, sizeof(buffer));
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ret <= 0) {
+            done = true;
+            cv.notify_one();
+            break;
+        }
+        chunks.emplace_back(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms), std::string(buffer, ret));
+        cv.notify_one();
+    }
+    writer.join();
+}
+
+WebSocketServer::WebSocketServer() {
+    // A client that goes away must not kill the test with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    auto key = EVP_EC_gen("P-256");
+    auto certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_set_pubkey(certificate, key);
+    auto name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_sign(certificate, key, EVP_sha256());
+
+    auto context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_use_certificate(context, certificate);
+    SSL_CTX_use_PrivateKey(context, key);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    context_ = context;
+
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, (sockaddr*)&address, sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd_, (sockaddr*)&address, &length);
+    port_ = ntohs(address.sin_port);
+    listen(listen_fd_, 8);
+    std::thread(&WebSocketServer::AcceptLoop, this).detach();
+}
+
+int WebSocketServer::port() {
+    return port_;
+}
+
+int WebSocketServer::connections() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connections_;
+}
+
+int WebSocketServer::resumed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resumed_;
+}
+
+std::map<std::string, std::string> WebSocketServer::last_headers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_headers_;
+}
+
+void WebSocketServer::RotateTicketKeys() {
+    unsigned char keys[80];
+    RAND_bytes(keys, sizeof(keys));
+    SSL_CTX_set_tlsext_ticket_keys((SSL_CTX*)context_, keys, sizeof(keys));
+}
+
+void WebSocketServer::AcceptLoop() {
+    while (true) {
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        int delay_ms = rtt_ms / 2;
+        if (delay_ms == 0) {
+            std::thread(&WebSocketServer::Serve, this, fd).detach();
+            continue;
+        }
+
+        // The TLS server talks to one end of a socket pair, the relay links the other end to the client
+        int pair[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        std::thread([fd, relay = pair[1], delay_ms]() {
+            std::thread upstream(DelayedCopy, fd, relay, delay_ms);
+            DelayedCopy(relay, fd, delay_ms);
+            upstream.join();
+            close(relay);
+            close(fd);
+        }).detach();
+        std::thread(&WebSocketServer::Serve, this, pair[0]).detach();
+    }
+}
+
+void WebSocketServer::Serve(int fd) {
+    auto ssl = SSL_new((SSL_CTX*)context_);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) != 1) {
+        SSL_free(ssl);
+        close(fd);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_++;
+        if (SSL_session_reused(ssl)) {
+            resumed_++;
+        }
+    }
+
+    std::string received;
+    char buffer[1024];
+    int ret;
+    while (received.find("\r\n\r\n") == std::string::npos && (ret = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+        received.append(buffer, ret);
+    }
+    auto header_end = received.find("\r\n\r\n");
+    if (header_end != std::string::npos) {
+        std::map<std::string, std::string> headers;
+        size_t line_start = received.find("\r\n") + 2;
+        while (line_start < header_end) {
+            size_t line_end = received.find("\r\n", line_start);
+            auto line = received.substr(line_start, line_end - line_start);
+            auto colon = line.find(": ");
+            if (colon != std::string::npos) {
+                headers[line.substr(0, colon)] = line.substr(colon + 2);
+            }
+            line_start = line_end + 2;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last_headers_ = headers;
+        }
+        received.erase(0, header_end + 4);
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n";
+        SSL_write(ssl, response.data(), response.size());
+
+        uint8_t type;
+        std::string payload;
+        while (true) {
+            while (TakeFrame(received, type, payload)) {
+                if (type == FRAME_TYPE_TEXT && payload.find("\"type\":\"hello\"") != std::string::npos) {
+                    std::string hello = "{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"ws1\","
+                        "\"audio_params\":{\"sample_rate\":24000,\"frame_duration\":60}}";
+                    std::string frame = FrameHeader(FRAME_TYPE_TEXT, hello.size()) + hello;
+                    SSL_write(ssl, frame.data(), frame.size());
+                }
+            }
+            ret = SSL_read(ssl, buffer, sizeof(buffer));
+            if (ret <= 0) {
+                break;
+            }
+            received.append(buffer, ret);
+        }
+    }
+    SSL_free(ssl);
+    close(fd);
+}
@@ -0,0 +1,82 @@
+#ifndef _WEB_SOCKET_H_
+#define _WEB_SOCKET_H_
+
+#include <transport.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// The WebSocket client of esp-ml307 over any Transport. The opening request and its 101 answer
+// cost a round trip like the real upgrade, but frames are simplified to a type byte (1 text,
+// 2 binary) and a big endian 32 bit length, which is all the fake server below understands.
+class WebSocket {
+public:
+    WebSocket(Transport* transport);
+    ~WebSocket();
+
+    void SetHeader(const char* key, const char* value);
+    bool IsConnected() const;
+    bool Connect(const char* uri);
+    bool Send(const std::string& data);
+    bool Send(const void* data, size_t len, bool binary = false);
+    void OnDisconnected(std::function<void()> callback);
+    void OnData(std::function<void(const char* data, size_t len, bool binary)> callback);
+
+private:
+    Transport* transport_;
+    std::map<std::string, std::string> headers_;
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> closing_{false};
+    std::mutex send_mutex_;
+    std::thread receive_thread_;
+    // Bytes read after the 101 answer, before the receive thread started
+    std::string received_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const char* data, size_t len, bool binary)> on_data_;
+
+    void ReceiveLoop();
+};
+
+// A TLS WebSocket server on 127.0.0.1 with a self-signed certificate and TLS 1.2 session
+// tickets. Every client hello is answered with a server hello. With rtt_ms set, each new
+// connection goes through a relay that delays every chunk by half of it in each direction.
+class WebSocketServer {
+public:
+    static WebSocketServer& GetInstance() {
+        static WebSocketServer instance;
+        return instance;
+    }
+
+    // Applies to the connections accepted afterwards
+    std::atomic<int> rtt_ms{0};
+
+    int port();
+    // Accepted connections, and how many of them resumed a session
+    int connections();
+    int resumed();
+    // Headers of the last opening request
+    std::map<std::string, std::string> last_headers();
+    // Tickets issued before this are rejected, the next handshake is a full one
+    void RotateTicketKeys();
+
+private:
+    WebSocketServer();
+
+    void* context_ = nullptr;
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::mutex mutex_;
+    int connections_ = 0;
+    int resumed_ = 0;
+    std::map<std::string, std::string> last_headers_;
+
+    void AcceptLoop();
+    void Serve(int fd);
+};
+
+#endif // _WEB_SOCKET_H_
@@ -0,0 +1,47 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+// Minimal checks for the host tests: a failed check is reported and counted, the test keeps going
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            TestFailures()++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) do { \
+        printf("[ RUN ] %s\n", #test); \
+        test(); \
+    } while (0)
+
+// Polls for work handed to another task
+inline bool WaitUntil(std::function<bool()> condition, int timeout_ms = 1000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Tasks such as the IoT worker never exit, so leave without the static destructors that would wait for them
+[[noreturn]] inline void FinishTests() {
+    printf("%d check(s) failed\n", TestFailures());
+    fflush(stdout);
+    std::quick_exit(TestFailures() == 0 ? 0 : 1);
+}
+
+#endif // TEST_H
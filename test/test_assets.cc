@@ -0,0 +1,209 @@
+#include "ota_test.h"
+#include "assets.h"
+
+#include <utility>
+#include <vector>
+
+#define ASSETS_PARTITION_SIZE (256 * 1024)
+
+static OtaTestPartitions partitions;
+static const esp_partition_t* assets_partition;
+static std::string flashed_pack;
+static std::string new_pack;
+
+// A resource pack in the format of scripts/pack_assets.py, one image and one raw entry
+static std::string MakePack(uint32_t version, size_t data_size, uint32_t seed) {
+    std::vector<std::pair<std::string, std::string>> entries = {
+        {"boot_logo", MakeImage("image", data_size, seed)},
+        {"sound", MakeImage("sound", 1001, seed + 1)},
+    };
+    std::string table, body;
+    size_t offset = ASSETS_HEADER_SIZE + entries.size() * ASSETS_ENTRY_SIZE;
+    for (auto& [name, data] : entries) {
+        std::string entry(ASSETS_ENTRY_SIZE, '\0');
+        memcpy(&entry[0], name.data(), name.size());
+        std::string fields;
+        AppendUint32(fields, offset + body.size());
+        AppendUint32(fields, data.size());
+        memcpy(&entry[ASSETS_NAME_SIZE], fields.data(), fields.size());
+        // Color format, width and height for the image, 0 for raw data
+        if (name == "boot_logo") {
+            entry[ASSETS_NAME_SIZE + 8] = 0x12;
+            entry[ASSETS_NAME_SIZE + 10] = 64;
+            entry[ASSETS_NAME_SIZE + 12] = 32;
+        }
+        table += entry;
+        body += data + std::string(-data.size() % 4, '\0');
+    }
+    std::string content = table + body;
+    std::string pack = ASSETS_MAGIC;
+    AppendUint32(pack, version);
+    AppendUint32(pack, entries.size());
+    AppendUint32(pack, ASSETS_HEADER_SIZE + content.size());
+    pack += Sha256Bytes(content) + std::string(16, '\0');
+    return pack + content;
+}
+
+// The inactive app slot holds the download, as after Ota::DownloadAssets
+static void Download(const std::string& pack) {
+    auto& data = test_partition_data(partitions.update);
+    std::fill(data.begin(), data.end(), 0xFF);
+    memcpy(data.data(), pack.data(), pack.size());
+}
+
+static bool Stage(const std::string& pack) {
+    Download(pack);
+    return Assets::Stage(partitions.update, pack.size());
+}
+
+static bool Staged() {
+    Settings settings("assets", false);
+    return !settings.GetString("staged").empty();
+}
+
+static bool Installing() {
+    Settings settings("assets", false);
+    return settings.GetInt("installing") != 0;
+}
+
+static bool HasHeader(const esp_partition_t* partition) {
+    return memcmp(test_partition_data(partition).data(), ASSETS_MAGIC, 4) == 0;
+}
+
+// Every test starts from the pack flashed with the firmware and nothing staged
+static void Reset() {
+    ResetOta(partitions);
+    auto& data = test_partition_data(assets_partition);
+    std::fill(data.begin(), data.end(), 0xFF);
+    memcpy(data.data(), flashed_pack.data(), flashed_pack.size());
+    test_partition_fail_after(assets_partition, -1);
+    test_ota_set_running(partitions.running, ESP_OTA_IMG_VALID);
+    Settings settings("assets", true);
+    settings.EraseAll();
+}
+
+static void TestStageRejected() {
+    Reset();
+    auto corrupted = new_pack;
+    corrupted[5000] ^= 1;
+    CHECK(!Stage(corrupted));
+    // The size from the download does not match the header
+    Download(new_pack);
+    CHECK(!Assets::Stage(partitions.update, new_pack.size() - 1));
+    auto too_big = MakePack(3, ASSETS_PARTITION_SIZE, 3);
+    CHECK(!Stage(too_big));
+    CHECK(!Staged());
+
+    // Nothing to install, the flashed pack stays
+    CHECK(Assets::InstallStaged());
+    CHECK(PartitionHolds(assets_partition, flashed_pack));
+}
+
+static void TestInstall() {
+    Reset();
+    CHECK(Stage(new_pack));
+    CHECK(Staged());
+    // Only installed on the next boot
+    CHECK(PartitionHolds(assets_partition, flashed_pack));
+
+    CHECK(Assets::InstallStaged());
+    CHECK(PartitionHolds(assets_partition, new_pack));
+    CHECK(!Staged());
+    CHECK(!Installing());
+
+    // Done once
+    CHECK(Assets::InstallStaged());
+    CHECK(PartitionHolds(assets_partition, new_pack));
+}
+
+static void TestStagingSlotReused() {
+    Reset();
+    CHECK(Stage(new_pack));
+    // A firmware upgrade was downloaded over the staged pack before the reboot
+    Download(MakeImage("2.0.0", new_pack.size(), 5));
+    CHECK(Assets::InstallStaged());
+    CHECK(!Staged());
+    CHECK(PartitionHolds(assets_partition, flashed_pack));
+}
+
+static void TestCopyFailure() {
+    Reset();
+    CHECK(Stage(new_pack));
+
+    // Power lost or flash error halfway through the copy, the header is written last so there is none
+    test_partition_fail_after(assets_partition, new_pack.size() / 2);
+    CHECK(!Assets::InstallStaged());
+    CHECK(!HasHeader(assets_partition));
+    CHECK(Installing());
+    CHECK(Staged());
+
+    // Even the last write failing leaves no header behind
+    Reset();
+    CHECK(Stage(new_pack));
+    test_partition_fail_after(assets_partition, new_pack.size() - ASSETS_HEADER_SIZE);
+    CHECK(!Assets::InstallStaged());
+    CHECK(!HasHeader(assets_partition));
+
+    // Retried on the next boot
+    test_partition_fail_after(assets_partition, -1);
+    CHECK(Assets::InstallStaged());
+    CHECK(PartitionHolds(assets_partition, new_pack));
+    CHECK(!Installing());
+    CHECK(!Staged());
+}
+
+static void TestIncompleteCopyStaysMarked() {
+    Reset();
+    CHECK(Stage(new_pack));
+    test_partition_fail_after(assets_partition, new_pack.size() / 2);
+    CHECK(!Assets::InstallStaged());
+    test_partition_fail_after(assets_partition, -1);
+
+    // The staged copy is gone too, the partition must not be mapped until a new pack is installed
+    Download(MakeImage("2.0.0", new_pack.size(), 6));
+    CHECK(!Assets::InstallStaged());
+    CHECK(!Staged());
+    CHECK(Installing());
+    CHECK(!Assets::InstallStaged());
+
+    auto replacement = MakePack(4, 30000, 7);
+    CHECK(Stage(replacement));
+    CHECK(Assets::InstallStaged());
+    CHECK(!Installing());
+    CHECK(PartitionHolds(assets_partition, replacement));
+}
+
+// The first use of the instance is the boot: the staged pack is installed, then mapped
+static void TestBoot() {
+    Reset();
+    CHECK(Stage(new_pack));
+    auto& assets = Assets::GetInstance();
+    CHECK(assets.available());
+    CHECK(assets.version() == 2);
+    CHECK(!Staged());
+
+    auto image = assets.GetImage("boot_logo");
+    CHECK(image != nullptr);
+    CHECK(image != nullptr && image->header.w == 64 && image->header.h == 32 && image->data_size == 60000);
+    const void* data = nullptr;
+    size_t size = 0;
+    CHECK(assets.GetData("sound", data, size));
+    CHECK(size == 1001 && memcmp(data, MakeImage("sound", 1001, 12).data(), size) == 0);
+    CHECK(assets.GetImage("missing") == nullptr);
+}
+
+int main() {
+    partitions = SetUpPartitions(MakeImage("1.0.0", 512 * 1024, 1));
+    assets_partition = test_partition_add(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, ASSETS_PARTITION_LABEL,
+        ASSETS_PARTITION_SIZE);
+    flashed_pack = MakePack(1, 50000, 10);
+    new_pack = MakePack(2, 60000, 11);
+
+    RUN_TEST(TestStageRejected);
+    RUN_TEST(TestInstall);
+    RUN_TEST(TestStagingSlotReused);
+    RUN_TEST(TestCopyFailure);
+    RUN_TEST(TestIncompleteCopyStaysMarked);
+    RUN_TEST(TestBoot);
+    FinishTests();
+}
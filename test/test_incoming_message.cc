@@ -0,0 +1,313 @@
+#include "test.h"
+#include "protocols/incoming_message.h"
+#include "protocols/message_dispatcher.h"
+#include "msgpack_writer.h"
+
+#include <cJSON.h>
+#include <esp_timer.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BENCHMARK_ROUNDS 20000
+
+// Every heap allocation of the process is counted, cJSON allocates with malloc and calloc directly
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+
+static size_t heap_allocations = 0;
+static size_t heap_bytes = 0;
+
+extern "C" void* malloc(size_t size) {
+    heap_allocations++;
+    heap_bytes += size;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    heap_allocations++;
+    heap_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+    heap_allocations++;
+    heap_bytes += size;
+    return __libc_realloc(pointer, size);
+}
+
+// Text messages as the server sends them in one turn of a conversation
+static const std::vector<std::string> corpus = {
+    "{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"5f1c2a9e\","
+        "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"channels\":1,\"frame_duration\":60}}",
+    "{\"type\":\"stt\",\"text\":\"\\u628a\\u706f\\u6253\\u5f00\",\"session_id\":\"5f1c2a9e\"}",
+    "{\"type\":\"llm\",\"text\":\"\\ud83d\\ude0a\",\"emotion\":\"happy\",\"session_id\":\"5f1c2a9e\"}",
+    "{\"type\":\"tts\",\"state\":\"start\",\"sample_rate\":24000,\"session_id\":\"5f1c2a9e\"}",
+    "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"\\u597d\\u7684\\uff0c\\u706f\\u5df2\\u7ecf\\u6253\\u5f00\\u4e86\",\"session_id\":\"5f1c2a9e\"}",
+    "{\"type\":\"tts\",\"state\":\"sentence_end\",\"text\":\"\\u597d\\u7684\\uff0c\\u706f\\u5df2\\u7ecf\\u6253\\u5f00\\u4e86\",\"session_id\":\"5f1c2a9e\"}",
+    "{\"type\":\"tts\",\"state\":\"stop\",\"session_id\":\"5f1c2a9e\"}",
+};
+
+static std::string last_text;
+static std::string last_state;
+
+static void TestFields() {
+    const char* json = "{ \"type\" : \"tts\", \"state\":\"sentence_start\", \"count\": -12, \"ok\": true,"
+        " \"text\": \"a\\\"b\\\\c\\n\\u00e9\\ud83d\\ude0a\", \"nested\": {\"inner\": [1, {\"x\": \"}\"}]}, \"none\": null }";
+    IncomingMessage message(json, strlen(json));
+    CHECK(message.valid());
+    CHECK(!message.binary());
+    CHECK(message.type() == "tts");
+    CHECK(message.GetRaw("state") == "sentence_start");
+    CHECK(message.GetInt("count") == -12);
+    CHECK(message.GetBool("ok"));
+    CHECK(message.GetString("text") == "a\"b\\c\n\xc3\xa9\xf0\x9f\x98\x8a");
+    CHECK(message.GetType("none") == IncomingMessage::kValueTypeNull);
+    CHECK(!message.Has("missing"));
+    CHECK(message.GetString("missing", "default") == "default");
+    auto nested = message.GetObject("nested");
+    CHECK(nested.valid());
+    CHECK(nested.GetType("inner") == IncomingMessage::kValueTypeArray);
+    CHECK(!message.GetObject("state").valid());
+
+    const char* broken = "{\"type\":\"tts\",\"state\":";
+    CHECK(!IncomingMessage(broken, strlen(broken)).valid());
+    CHECK(!IncomingMessage("[1]", 3).valid());
+}
+
+// Frames are not NUL terminated, nothing past the given length may be read
+static void TestNotTerminated() {
+    std::string frame = "{\"type\":\"stt\",\"text\":\"hi\"}";
+    std::string buffer = frame + "\"garbage";
+    IncomingMessage message(buffer.data(), frame.size());
+    CHECK(message.valid());
+    CHECK(message.GetString("text") == "hi");
+    CHECK(!IncomingMessage(buffer.data(), frame.size() - 1).valid());
+}
+
+static void TestMsgPack() {
+    std::string buffer;
+    MsgPackWriter writer(buffer);
+    writer.BeginObject();
+    writer.Key("type").String("tts");
+    writer.Key("state").String("start");
+    writer.Key("sample_rate").Int(24000);
+    writer.Key("ok").Bool(true);
+    writer.Key("audio_params").BeginObject();
+    writer.Key("frame_duration").Int(60);
+    writer.EndObject();
+    writer.EndObject();
+
+    IncomingMessage message(buffer.data(), buffer.size());
+    CHECK(message.valid());
+    CHECK(message.binary());
+    CHECK(message.type() == "tts");
+    CHECK(message.GetRaw("state") == "start");
+    CHECK(message.GetInt("sample_rate") == 24000);
+    CHECK(message.GetBool("ok"));
+    CHECK(message.GetObject("audio_params").GetInt("frame_duration") == 60);
+}
+
+// Past the field table the message is rejected, not handed on without its last fields
+static void TestTooManyFields() {
+    for (int fields : {INCOMING_MESSAGE_MAX_FIELDS, INCOMING_MESSAGE_MAX_FIELDS + 1}) {
+        std::string json = "{\"type\":\"tts\"";
+        std::string msgpack;
+        MsgPackWriter writer(msgpack);
+        writer.BeginObject();
+        writer.Key("type").String("tts");
+        for (int i = 1; i < fields; i++) {
+            json += ",\"f" + std::to_string(i) + "\":" + std::to_string(i);
+            writer.Key("f" + std::to_string(i)).Int(i);
+        }
+        json += "}";
+        writer.EndObject();
+
+        bool fits = fields <= INCOMING_MESSAGE_MAX_FIELDS;
+        IncomingMessage from_json(json.data(), json.size());
+        IncomingMessage from_msgpack(msgpack.data(), msgpack.size());
+        CHECK(from_json.valid() == fits);
+        CHECK(from_msgpack.valid() == fits);
+        if (fits) {
+            CHECK(from_json.GetInt("f" + std::to_string(fields - 1)) == fields - 1);
+            CHECK(from_msgpack.GetInt("f" + std::to_string(fields - 1)) == fields - 1);
+        }
+    }
+}
+
+static std::string PrintCJson(std::string_view key, const IncomingMessage& message) {
+    auto item = message.GetCJson(key);
+    if (item == nullptr) {
+        return "";
+    }
+    auto printed = cJSON_PrintUnformatted(item);
+    std::string result(printed);
+    cJSON_free(printed);
+    cJSON_Delete(item);
+    return result;
+}
+
+// IoT commands reach the things as the same cJSON tree from either encoding
+static void TestCJson() {
+    std::string json = "{\"type\":\"iot\",\"commands\":[{\"id\":7,\"name\":\"Lamp\",\"method\":\"SetBrightness\","
+        "\"parameters\":{\"brightness\":-40,\"on\":true,\"off\":false,\"text\":\"\\u4eae\"}}],"
+        "\"name\":\"a\\nb\"}";
+    std::string msgpack;
+    MsgPackWriter writer(msgpack);
+    writer.BeginObject();
+    writer.Key("type").String("iot");
+    writer.Key("commands").BeginArray();
+    writer.BeginObject();
+    writer.Key("id").Int(7);
+    writer.Key("name").String("Lamp");
+    writer.Key("method").String("SetBrightness");
+    writer.Key("parameters").BeginObject();
+    writer.Key("brightness").Int(-40);
+    writer.Key("on").Bool(true);
+    writer.Key("off").Bool(false);
+    writer.Key("text").String("\xe4\xba\xae");
+    writer.EndObject();
+    writer.EndObject();
+    writer.EndArray();
+    writer.Key("name").String("a\nb");
+    writer.EndObject();
+
+    IncomingMessage from_json(json.data(), json.size());
+    IncomingMessage from_msgpack(msgpack.data(), msgpack.size());
+    CHECK(from_msgpack.valid() && from_msgpack.binary());
+    auto commands = PrintCJson("commands", from_json);
+    CHECK(!commands.empty());
+    CHECK(PrintCJson("commands", from_msgpack) == commands);
+    CHECK(PrintCJson("name", from_json) == "\"a\\nb\"");
+    CHECK(PrintCJson("name", from_msgpack) == "\"a\\nb\"");
+
+    auto tree = from_msgpack.GetCJson("commands");
+    auto parameters = cJSON_GetObjectItem(cJSON_GetArrayItem(tree, 0), "parameters");
+    CHECK(cJSON_GetObjectItem(parameters, "brightness")->valueint == -40);
+    CHECK(cJSON_IsTrue(cJSON_GetObjectItem(parameters, "on")));
+    cJSON_Delete(tree);
+
+    // MsgPackWriter writes neither floats nor nil: {"type": "iot", "p": [0.5, 1.5f, nil]}
+    const uint8_t values[] = { 0x82, 0xa4, 't', 'y', 'p', 'e', 0xa3, 'i', 'o', 't', 0xa1, 'p', 0x93,
+        0xcb, 0x3f, 0xe0, 0, 0, 0, 0, 0, 0, 0xca, 0x3f, 0xc0, 0, 0, 0xc0 };
+    IncomingMessage from_values((const char*)values, sizeof(values));
+    CHECK(PrintCJson("p", from_values) == "[0.5,1.5,null]");
+
+    CHECK(from_json.GetCJson("missing") == nullptr);
+    // A truncated nested value is caught by the scan, a malformed one by the conversion
+    std::string broken = "{\"type\":\"iot\",\"commands\":[{\"name\" \"Lamp\"}]}";
+    IncomingMessage from_broken(broken.data(), broken.size());
+    CHECK(from_broken.valid());
+    CHECK(from_broken.GetCJson("commands") == nullptr);
+}
+
+static void RegisterHandlers(MessageDispatcher& dispatcher) {
+    dispatcher.Register("tts", [](const IncomingMessage& message) {
+        auto state = message.GetRaw("state");
+        last_state.assign(state.data(), state.size());
+        if (state == "sentence_start") {
+            last_text = message.GetString("text");
+        }
+    });
+    dispatcher.Register("stt", [](const IncomingMessage& message) {
+        last_text = message.GetString("text");
+    });
+    dispatcher.Register("llm", [](const IncomingMessage& message) {
+        last_text = message.GetString("emotion");
+    });
+    dispatcher.Register("hello", [](const IncomingMessage& message) {
+        last_state = std::to_string(message.GetObject("audio_params").GetInt("sample_rate"));
+    });
+}
+
+static void TestDispatch() {
+    MessageDispatcher dispatcher;
+    RegisterHandlers(dispatcher);
+    CHECK(dispatcher.Dispatch(IncomingMessage(corpus[1].data(), corpus[1].size())));
+    CHECK(last_text == "\xe6\x8a\x8a\xe7\x81\xaf\xe6\x89\x93\xe5\xbc\x80");
+    CHECK(dispatcher.Dispatch(IncomingMessage(corpus[0].data(), corpus[0].size())));
+    CHECK(last_state == "24000");
+    std::string unknown = "{\"type\":\"mcp\"}";
+    CHECK(!dispatcher.Dispatch(IncomingMessage(unknown.data(), unknown.size())));
+}
+
+// What every message went through before: a cJSON tree, then a strcmp chain over "type"
+static void DispatchWithCJson(const std::string& json) {
+    // cJSON needs a NUL terminated copy of the frame
+    std::string copy(json);
+    auto root = cJSON_Parse(copy.c_str());
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (strcmp(type->valuestring, "hello") == 0) {
+        auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+        last_state = std::to_string(cJSON_GetObjectItem(audio_params, "sample_rate")->valueint);
+    } else if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        last_state = state->valuestring;
+        if (strcmp(state->valuestring, "sentence_start") == 0) {
+            last_text = cJSON_GetObjectItem(root, "text")->valuestring;
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0) {
+        last_text = cJSON_GetObjectItem(root, "text")->valuestring;
+    } else if (strcmp(type->valuestring, "llm") == 0) {
+        last_text = cJSON_GetObjectItem(root, "emotion")->valuestring;
+    }
+    cJSON_Delete(root);
+}
+
+// Reports messages per second and heap use per message of both paths over the corpus
+static void TestBenchmark() {
+    MessageDispatcher dispatcher;
+    RegisterHandlers(dispatcher);
+    // Leave the strings at their final capacity, so only the parsing is measured
+    last_text.reserve(256);
+    last_state.reserve(32);
+    size_t messages = BENCHMARK_ROUNDS * corpus.size();
+
+    size_t allocations = heap_allocations;
+    size_t bytes = heap_bytes;
+    auto start_time = esp_timer_get_time();
+    for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+        for (auto& json : corpus) {
+            DispatchWithCJson(json);
+        }
+    }
+    double cjson_seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    double cjson_allocations = (double)(heap_allocations - allocations) / messages;
+    double cjson_bytes = (double)(heap_bytes - bytes) / messages;
+
+    allocations = heap_allocations;
+    bytes = heap_bytes;
+    start_time = esp_timer_get_time();
+    for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+        for (auto& json : corpus) {
+            dispatcher.Dispatch(IncomingMessage(json.data(), json.size()));
+        }
+    }
+    double scan_seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    size_t scan_count = heap_allocations - allocations;
+    double scan_allocations = (double)scan_count / messages;
+    double scan_bytes = (double)(heap_bytes - bytes) / messages;
+
+    printf("cJSON tree:      %.0f messages/s, %.1f heap allocations, %.0f heap bytes per message\n",
+        messages / cjson_seconds, cjson_allocations, cjson_bytes);
+    printf("IncomingMessage: %.0f messages/s, %.1f heap allocations, %.0f heap bytes per message\n",
+        messages / scan_seconds, scan_allocations, scan_bytes);
+    // Only the two unescaped texts longer than the small string buffer are allocated, once per round
+    CHECK(scan_count == BENCHMARK_ROUNDS * 2);
+    CHECK(cjson_allocations > 10);
+    CHECK(scan_seconds < cjson_seconds);
+}
+
+int main() {
+    RUN_TEST(TestFields);
+    RUN_TEST(TestNotTerminated);
+    RUN_TEST(TestMsgPack);
+    RUN_TEST(TestTooManyFields);
+    RUN_TEST(TestCJson);
+    RUN_TEST(TestDispatch);
+    RUN_TEST(TestBenchmark);
+    FinishTests();
+}
@@ -0,0 +1,294 @@
+#include "test.h"
+#include "json_writer.h"
+
+#include <cJSON.h>
+#include <esp_timer.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#define BENCHMARK_ROUNDS 20000
+// As PROTOCOL_MESSAGE_RESERVE_SIZE and BOARD_JSON_RESERVE_SIZE
+#define MESSAGE_RESERVE_SIZE 128
+#define BOARD_JSON_RESERVE_SIZE 2048
+
+// Every C++ allocation of the process is counted, with its size
+static size_t heap_allocations = 0;
+static size_t heap_bytes = 0;
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    heap_bytes += size;
+    void* pointer = malloc(size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+    free(pointer);
+}
+
+struct Partition {
+    std::string label;
+    int type;
+    int subtype;
+    uint32_t address;
+    uint32_t size;
+};
+
+// What Board::GetJson reports, with the values of a 16 MB board
+struct DeviceInfo {
+    std::string session_id = "5f1c2a9e-51f2-4c3b-9d6e-0a7b8c9d0e1f";
+    std::string mac_address = "7c:df:a1:02:03:04";
+    std::string uuid = "3f2504e0-4f89-11d3-9a0c-0305e82c3301";
+    std::string project_name = "xiaozhi";
+    std::string version = "1.5.2";
+    std::string date = "Mar 12 2025";
+    std::string time = "10:20:30";
+    std::string idf_version = "v5.4-dirty";
+    std::string elf_sha256 = "d2a84f4b8b650937ec8f73cd8be2c74add5a911ba64df27458ed8229da804a26";
+    std::string ssid = "Home WiFi";
+    std::string ip = "192.168.1.23";
+    std::vector<Partition> partitions = {
+        {"nvs", 1, 2, 0x9000, 0x4000},
+        {"otadata", 1, 0, 0xd000, 0x2000},
+        {"phy_init", 1, 1, 0xf000, 0x1000},
+        {"model", 1, 130, 0x10000, 0xf0000},
+        {"ota_0", 0, 16, 0x100000, 0x600000},
+        {"ota_1", 0, 17, 0x700000, 0x600000},
+        {"assets", 1, 130, 0xd00000, 0x200000},
+        {"model_staging", 1, 130, 0xf00000, 0x100000},
+    };
+};
+
+static DeviceInfo info;
+
+// The board description as Board::GetJson and WifiBoard::GetBoardJson built it before the writer
+static std::string BoardJsonConcatenated() {
+    std::string json = "{";
+    json += "\"version\":2,";
+    json += "\"language\":\"" + std::string("zh-CN") + "\",";
+    json += "\"flash_size\":" + std::to_string(16777216) + ",";
+    json += "\"minimum_free_heap_size\":" + std::to_string(123456) + ",";
+    json += "\"mac_address\":\"" + info.mac_address + "\",";
+    json += "\"uuid\":\"" + info.uuid + "\",";
+    json += "\"chip_model_name\":\"" + std::string("esp32s3") + "\",";
+    json += "\"chip_info\":{";
+    json += "\"model\":" + std::to_string(9) + ",";
+    json += "\"cores\":" + std::to_string(2) + ",";
+    json += "\"revision\":" + std::to_string(2) + ",";
+    json += "\"features\":" + std::to_string(18);
+    json += "},";
+    json += "\"application\":{";
+    json += "\"name\":\"" + info.project_name + "\",";
+    json += "\"version\":\"" + info.version + "\",";
+    json += "\"compile_time\":\"" + info.date + "T" + info.time + "Z\",";
+    json += "\"idf_version\":\"" + info.idf_version + "\",";
+    json += "\"elf_sha256\":\"" + info.elf_sha256 + "\"";
+    json += "},";
+    json += "\"partition_table\": [";
+    for (auto& partition : info.partitions) {
+        json += "{";
+        json += "\"label\":\"" + partition.label + "\",";
+        json += "\"type\":" + std::to_string(partition.type) + ",";
+        json += "\"subtype\":" + std::to_string(partition.subtype) + ",";
+        json += "\"address\":" + std::to_string(partition.address) + ",";
+        json += "\"size\":" + std::to_string(partition.size);
+        json += "},";
+    }
+    json.pop_back();
+    json += "],";
+    json += "\"ota\":{";
+    json += "\"label\":\"" + std::string("ota_0") + "\"";
+    json += "},";
+    std::string board_json = std::string("{\"type\":\"" "bread-compact-wifi" "\",");
+    board_json += "\"name\":\"" "bread-compact-wifi" "\",";
+    board_json += "\"ssid\":\"" + info.ssid + "\",";
+    board_json += "\"rssi\":" + std::to_string(-52) + ",";
+    board_json += "\"channel\":" + std::to_string(6) + ",";
+    board_json += "\"ip\":\"" + info.ip + "\",";
+    board_json += "\"mac\":\"" + info.mac_address + "\"}";
+    json += "\"board\":" + board_json;
+    json += "}";
+    return json;
+}
+
+// The same description as Board::GetJson writes it now
+static void WriteBoardJson(std::string& json) {
+    json.reserve(BOARD_JSON_RESERVE_SIZE);
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Key("version").Int(2);
+    writer.Key("language").String("zh-CN");
+    writer.Key("flash_size").Int(16777216);
+    writer.Key("minimum_free_heap_size").Int(123456);
+    writer.Key("mac_address").String(info.mac_address);
+    writer.Key("uuid").String(info.uuid);
+    writer.Key("chip_model_name").String("esp32s3");
+    writer.Key("chip_info").BeginObject();
+    writer.Key("model").Int(9);
+    writer.Key("cores").Int(2);
+    writer.Key("revision").Int(2);
+    writer.Key("features").Int(18);
+    writer.EndObject();
+    writer.Key("application").BeginObject();
+    writer.Key("name").String(info.project_name);
+    writer.Key("version").String(info.version);
+    writer.Key("compile_time").String(info.date + "T" + info.time + "Z");
+    writer.Key("idf_version").String(info.idf_version);
+    writer.Key("elf_sha256").String(info.elf_sha256);
+    writer.EndObject();
+    writer.Key("partition_table").BeginArray();
+    for (auto& partition : info.partitions) {
+        writer.BeginObject();
+        writer.Key("label").String(partition.label);
+        writer.Key("type").Int(partition.type);
+        writer.Key("subtype").Int(partition.subtype);
+        writer.Key("address").Int(partition.address);
+        writer.Key("size").Int(partition.size);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("ota").BeginObject();
+    writer.Key("label").String("ota_0");
+    writer.EndObject();
+    writer.Key("board").BeginObject();
+    writer.Key("type").String("bread-compact-wifi");
+    writer.Key("name").String("bread-compact-wifi");
+    writer.Key("ssid").String(info.ssid);
+    writer.Key("rssi").Int(-52);
+    writer.Key("channel").Int(6);
+    writer.Key("ip").String(info.ip);
+    writer.Key("mac").String(info.mac_address);
+    writer.EndObject();
+    writer.EndObject();
+}
+
+// Protocol::SendStartListening before and after
+static std::string ListenConcatenated() {
+    std::string message = "{\"session_id\":\"" + info.session_id + "\"";
+    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    message += ",\"mode\":\"auto\"";
+    message += "}";
+    return message;
+}
+
+static void WriteListen(std::string& message) {
+    message.reserve(MESSAGE_RESERVE_SIZE);
+    JsonWriter writer(message);
+    writer.BeginObject();
+    writer.Key("session_id").String(info.session_id);
+    writer.Key("type").String("listen");
+    writer.Key("state").String("start");
+    writer.Key("mode").String("auto");
+    writer.EndObject();
+}
+
+static void TestStructure() {
+    std::string json = "prefix:";
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Key("a").Int(-1);
+    writer.Key("b").BeginArray();
+    writer.Int(1).Bool(true).String("x");
+    writer.BeginObject().EndObject();
+    writer.BeginArray().EndArray();
+    writer.EndArray();
+    writer.Key("c").Raw("{\"d\":null}");
+    writer.Key("e").Bool(false);
+    writer.EndObject();
+    CHECK(json == "prefix:{\"a\":-1,\"b\":[1,true,\"x\",{},[]],\"c\":{\"d\":null},\"e\":false}");
+}
+
+static void TestEscaping() {
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Key("k\"ey").String("q\" b\\ n\n t\t r\r \x01 \x1f \xe4\xbd\xa0\xe5\xa5\xbd");
+    writer.EndObject();
+    CHECK(json == "{\"k\\\"ey\":\"q\\\" b\\\\ n\\n t\\t r\\r \\u0001 \\u001f \xe4\xbd\xa0\xe5\xa5\xbd\"}");
+
+    // The output parses back to the same strings
+    auto root = cJSON_Parse(json.c_str());
+    CHECK(root != nullptr);
+    auto item = cJSON_GetObjectItem(root, "k\"ey");
+    CHECK(item != nullptr && strcmp(item->valuestring, "q\" b\\ n\n t\t r\r \x01 \x1f \xe4\xbd\xa0\xe5\xa5\xbd") == 0);
+    cJSON_Delete(root);
+}
+
+// Both builders produce the same document, apart from the space the old partition table had
+static void TestSameOutput() {
+    std::string expected = BoardJsonConcatenated();
+    expected.replace(expected.find("\"partition_table\": ["), 20, "\"partition_table\":[");
+    std::string json;
+    WriteBoardJson(json);
+    CHECK(json == expected);
+    CHECK(json.size() < BOARD_JSON_RESERVE_SIZE);
+
+    std::string message;
+    WriteListen(message);
+    CHECK(message == ListenConcatenated());
+}
+
+template <typename Build>
+static void Measure(const char* name, Build build, double& seconds, double& allocations, double& bytes) {
+    size_t start_allocations = heap_allocations;
+    size_t start_bytes = heap_bytes;
+    auto start_time = esp_timer_get_time();
+    size_t total_size = 0;
+    for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+        total_size += build();
+    }
+    seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    allocations = (double)(heap_allocations - start_allocations) / BENCHMARK_ROUNDS;
+    bytes = (double)(heap_bytes - start_bytes) / BENCHMARK_ROUNDS;
+    printf("%-28s %7.2f us, %5.1f heap allocations, %6.0f heap bytes per message of %zu bytes\n",
+        name, seconds * 1000000 / BENCHMARK_ROUNDS, allocations, bytes, total_size / BENCHMARK_ROUNDS);
+}
+
+// Serialization time and heap use per message of both builders
+static void TestBenchmark() {
+    double concat_seconds, concat_allocations, concat_bytes;
+    double writer_seconds, writer_allocations, writer_bytes;
+
+    Measure("Board JSON, concatenated", []() {
+        return BoardJsonConcatenated().size();
+    }, concat_seconds, concat_allocations, concat_bytes);
+    Measure("Board JSON, JsonWriter", []() {
+        std::string json;
+        WriteBoardJson(json);
+        return json.size();
+    }, writer_seconds, writer_allocations, writer_bytes);
+    // The reserved buffer, plus the compile time string that is joined before it is written
+    CHECK(writer_allocations <= 2);
+    CHECK(writer_allocations < concat_allocations / 10);
+    CHECK(writer_seconds < concat_seconds);
+
+    Measure("Listen, concatenated", []() {
+        return ListenConcatenated().size();
+    }, concat_seconds, concat_allocations, concat_bytes);
+    Measure("Listen, JsonWriter", []() {
+        std::string message;
+        WriteListen(message);
+        return message.size();
+    }, writer_seconds, writer_allocations, writer_bytes);
+    CHECK(writer_allocations == 1);
+    CHECK(writer_allocations < concat_allocations);
+}
+
+int main() {
+    RUN_TEST(TestStructure);
+    RUN_TEST(TestEscaping);
+    RUN_TEST(TestSameOutput);
+    RUN_TEST(TestBenchmark);
+    FinishTests();
+}
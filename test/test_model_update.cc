@@ -0,0 +1,187 @@
+#include "ota_test.h"
+#include "audio_processing/model_update.h"
+
+#define MODEL_URL "http://ota.test/srmodels.bin"
+#define MODEL_PARTITION_SIZE (512 * 1024)
+
+static OtaTestPartitions partitions;
+static const esp_partition_t* model_partition;
+static std::string flashed_models;
+static std::string new_models;
+
+// The inactive app slot holds the download, as after Ota::DownloadModel
+static void Download(const std::string& models) {
+    auto& data = test_partition_data(partitions.update);
+    std::fill(data.begin(), data.end(), 0xFF);
+    memcpy(data.data(), models.data(), models.size());
+}
+
+static bool Stage(const std::string& models, const std::string& sha256, const char* version = "2") {
+    Download(models);
+    return ModelUpdate::Stage(partitions.update, models.size(), sha256, version);
+}
+
+static bool Staged() {
+    Settings settings("model", false);
+    return !settings.GetString("staged").empty();
+}
+
+static bool Installing() {
+    Settings settings("model", false);
+    return settings.GetInt("installing") != 0;
+}
+
+// Every test starts from the models flashed with the firmware and nothing staged
+static void Reset() {
+    ResetOta(partitions);
+    auto& data = test_partition_data(model_partition);
+    std::fill(data.begin(), data.end(), 0xFF);
+    memcpy(data.data(), flashed_models.data(), flashed_models.size());
+    test_partition_fail_after(model_partition, -1);
+    test_ota_set_running(partitions.running, ESP_OTA_IMG_VALID);
+    Settings settings("model", true);
+    settings.EraseAll();
+}
+
+static void TestStageRejected() {
+    Reset();
+    auto sha256 = Sha256Hex(new_models);
+    auto corrupted = new_models;
+    corrupted[1000] ^= 1;
+    CHECK(!Stage(corrupted, sha256));
+    CHECK(!Stage(new_models, sha256.substr(0, 63) + "g"));
+    CHECK(!Stage(new_models, sha256.substr(0, 62)));
+    std::string too_big = MakeImage("2", MODEL_PARTITION_SIZE + 4096, 3);
+    CHECK(!Stage(too_big, Sha256Hex(too_big)));
+    CHECK(!Staged());
+
+    // Nothing to install, the flashed models stay
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(PartitionHolds(model_partition, flashed_models));
+    CHECK(ModelUpdate::GetVersion().empty());
+}
+
+static void TestInstall() {
+    Reset();
+    CHECK(Stage(new_models, Sha256Hex(new_models)));
+    CHECK(Staged());
+    // Only installed on the next boot
+    CHECK(PartitionHolds(model_partition, flashed_models));
+
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(PartitionHolds(model_partition, new_models));
+    CHECK(ModelUpdate::GetVersion() == "2");
+    CHECK(!Staged());
+    CHECK(!Installing());
+
+    // Done once
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(PartitionHolds(model_partition, new_models));
+}
+
+static void TestStagingSlotReused() {
+    Reset();
+    CHECK(Stage(new_models, Sha256Hex(new_models)));
+    // A firmware upgrade was downloaded over the staged models before the reboot
+    Download(MakeImage("2.0.0", new_models.size(), 5));
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(!Staged());
+    CHECK(PartitionHolds(model_partition, flashed_models));
+    CHECK(ModelUpdate::GetVersion().empty());
+}
+
+static void TestStagingSlotRunning() {
+    Reset();
+    CHECK(Stage(new_models, Sha256Hex(new_models)));
+    // The new firmware boots from the slot the models were staged in
+    test_ota_set_running(partitions.update, ESP_OTA_IMG_PENDING_VERIFY);
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(!Staged());
+    CHECK(PartitionHolds(model_partition, flashed_models));
+}
+
+static void TestCopyFailure() {
+    Reset();
+    CHECK(Stage(new_models, Sha256Hex(new_models), "3"));
+
+    // Power lost or flash error halfway through the copy
+    test_partition_fail_after(model_partition, new_models.size() / 2);
+    CHECK(!ModelUpdate::InstallStaged());
+    CHECK(Installing());
+    CHECK(Staged());
+    CHECK(ModelUpdate::GetVersion().empty());
+
+    // Retried on the next boot
+    test_partition_fail_after(model_partition, -1);
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(PartitionHolds(model_partition, new_models));
+    CHECK(ModelUpdate::GetVersion() == "3");
+    CHECK(!Installing());
+}
+
+static void TestIncompleteCopyStaysMarked() {
+    Reset();
+    CHECK(Stage(new_models, Sha256Hex(new_models)));
+    test_partition_fail_after(model_partition, new_models.size() / 2);
+    CHECK(!ModelUpdate::InstallStaged());
+    test_partition_fail_after(model_partition, -1);
+
+    // The staged copy is gone too, the partition must not be loaded until new models are installed
+    Download(MakeImage("2.0.0", new_models.size(), 6));
+    CHECK(!ModelUpdate::InstallStaged());
+    CHECK(!Staged());
+    CHECK(Installing());
+    CHECK(!ModelUpdate::InstallStaged());
+
+    auto replacement = MakeImage("4", new_models.size() - 5000, 7);
+    CHECK(Stage(replacement, Sha256Hex(replacement), "4"));
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(!Installing());
+    CHECK(PartitionHolds(model_partition, replacement));
+    CHECK(ModelUpdate::GetVersion() == "4");
+}
+
+// The download that feeds Stage, it must leave the rollback image alone until the firmware is confirmed
+static void TestDownloadModel() {
+    Reset();
+    HttpServer::GetInstance().files[MODEL_URL] = new_models;
+    auto model_json = ",\"model\":{\"version\":\"5\",\"url\":\"" MODEL_URL "\",\"sha256\":\"" + Sha256Hex(new_models) +
+        "\",\"size\":" + std::to_string(new_models.size()) + "}";
+    auto rollback_image = MakeImage("0.9.0", 300000, 8);
+    Download(rollback_image);
+
+    Ota ota;
+    CHECK(CheckVersion(ota, FirmwareJson("1.0.0", "http://ota.test/firmware.bin", ""), model_json));
+    CHECK(ota.GetModelVersion() == "5");
+    const esp_partition_t* partition = nullptr;
+    size_t size = 0;
+    test_ota_set_running(partitions.running, ESP_OTA_IMG_PENDING_VERIFY);
+    CHECK(!ota.DownloadModel(partition, size));
+    CHECK(RequestCount(MODEL_URL) == 0);
+    CHECK(PartitionHolds(partitions.update, rollback_image));
+
+    ota.MarkCurrentVersionValid();
+    CHECK(ota.DownloadModel(partition, size));
+    CHECK(partition == partitions.update && size == new_models.size());
+    CHECK(ModelUpdate::Stage(partition, size, ota.GetModelSha256(), ota.GetModelVersion()));
+    CHECK(ModelUpdate::InstallStaged());
+    CHECK(PartitionHolds(model_partition, new_models));
+    CHECK(ModelUpdate::GetVersion() == "5");
+}
+
+int main() {
+    partitions = SetUpPartitions(MakeImage("1.0.0", 1024 * 1024, 1));
+    model_partition = test_partition_add(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, MODEL_PARTITION_LABEL,
+        MODEL_PARTITION_SIZE);
+    flashed_models = MakeImage("1", 400000, 10);
+    new_models = MakeImage("2", 450000 + 123, 11);
+
+    RUN_TEST(TestStageRejected);
+    RUN_TEST(TestInstall);
+    RUN_TEST(TestStagingSlotReused);
+    RUN_TEST(TestStagingSlotRunning);
+    RUN_TEST(TestCopyFailure);
+    RUN_TEST(TestIncompleteCopyStaysMarked);
+    RUN_TEST(TestDownloadModel);
+    FinishTests();
+}
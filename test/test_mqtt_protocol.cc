@@ -0,0 +1,338 @@
+#include "test.h"
+#include "protocols/mqtt_protocol.h"
+#include "audio_packet_pool.h"
+#include "application.h"
+#include "settings.h"
+
+#include <esp_timer.h>
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define UDP_KEY "00112233445566778899aabbccddeeff"
+// The first byte is the packet type, bytes 2-3 the payload size and 12-15 the sequence, filled in per packet
+#define UDP_NONCE "01000000a1b2c3d40000000000000000"
+#define AUDIO_PACKET_SIZE 120
+#define BENCHMARK_PACKETS 20000
+
+// Every C++ allocation of the process is counted, the audio paths must not add any
+static std::atomic<size_t> heap_allocations{0};
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* pointer = malloc(size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+    free(pointer);
+}
+
+static MqttProtocol* protocol;
+static std::mutex received_mutex;
+static std::vector<std::vector<uint8_t>> received;
+static bool keep_received = true;
+
+#define RESUME_ANSWER_DELAY_MS 300
+
+static std::string ServerHello(const std::string& udp_server = "udp.test") {
+    return "{\"type\":\"hello\",\"transport\":\"udp\",\"session_id\":\"s1\",\"resume_token\":\"t1\","
+        "\"audio_params\":{\"sample_rate\":24000,\"frame_duration\":60},"
+        "\"udp\":{\"server\":\"" + udp_server + "\",\"port\":8888,\"key\":\"" UDP_KEY "\",\"nonce\":\"" UDP_NONCE "\"}}";
+}
+
+static bool IsHello(const std::string& payload) {
+    return payload.find("\"type\":\"hello\"") != std::string::npos;
+}
+
+static bool IsResumeHello(const std::string& payload) {
+    return IsHello(payload) && payload.find("\"resume\":{") != std::string::npos;
+}
+
+// Answers every client hello with a new session
+static void AnswerHello(const std::string& payload) {
+    if (IsHello(payload)) {
+        MqttBroker::GetInstance().Deliver(ServerHello());
+    }
+}
+
+static std::vector<uint8_t> TestPacket(uint8_t seed) {
+    std::vector<uint8_t> packet(AUDIO_PACKET_SIZE);
+    for (size_t i = 0; i < packet.size(); i++) {
+        packet[i] = (uint8_t)(seed + i * 7);
+    }
+    return packet;
+}
+
+static double Seconds(int64_t start_time) {
+    return (esp_timer_get_time() - start_time) / 1000000.0;
+}
+
+static void SetUp() {
+    Settings settings("mqtt", true);
+    settings.SetString("endpoint", "mqtt.test");
+    settings.SetString("client_id", "test");
+    settings.SetString("publish_topic", "device-server");
+
+    protocol = new MqttProtocol();
+    protocol->OnIncomingAudio([](AudioPacket&& packet) {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        if (keep_received) {
+            received.emplace_back(packet.data(), packet.data() + packet.size());
+        }
+    });
+    protocol->Start();
+}
+
+static void TestOpenChannel() {
+    MqttBroker::GetInstance().on_publish = AnswerHello;
+    CHECK(protocol->OpenAudioChannel());
+    CHECK(protocol->server_sample_rate() == 24000);
+    CHECK(UdpServer::GetInstance().host() == "udp.test" && UdpServer::GetInstance().port() == 8888);
+}
+
+// Through an echo server every packet is decrypted back into what was sent
+static void TestRoundTrip() {
+    auto& server = UdpServer::GetInstance();
+    server.Reset();
+    server.echo = true;
+    std::string last_packet;
+    server.on_packet = [&last_packet](const std::string& data) {
+        last_packet = data;
+    };
+    {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        received.clear();
+    }
+
+    for (uint8_t i = 0; i < 10; i++) {
+        auto packet = TestPacket(i);
+        protocol->SendAudio(packet.data(), packet.size());
+        // The header is the nonce with the size and sequence, the payload is encrypted
+        CHECK(last_packet.size() == 16 + packet.size());
+        CHECK(last_packet[0] == 0x01);
+        CHECK((uint8_t)last_packet[3] == packet.size());
+        CHECK((uint8_t)last_packet[15] == i + 1);
+        CHECK(memcmp(last_packet.data() + 16, packet.data(), packet.size()) != 0);
+    }
+
+    std::lock_guard<std::mutex> lock(received_mutex);
+    CHECK(received.size() == 10);
+    for (uint8_t i = 0; i < received.size(); i++) {
+        CHECK(received[i] == TestPacket(i));
+    }
+    server.Reset();
+}
+
+// Reports packets per second and heap allocations per packet in both directions
+static void TestBenchmark() {
+    auto& server = UdpServer::GetInstance();
+    auto& pool = AudioPacketPool::GetInstance();
+    auto packet = TestPacket(1);
+    std::vector<std::string> sent;
+    sent.reserve(BENCHMARK_PACKETS);
+    server.on_packet = [&sent](const std::string& data) {
+        sent.push_back(data);
+    };
+    // Warm up the packet buffer, the captured packets are decrypted below
+    for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+        protocol->SendAudio(packet.data(), packet.size());
+    }
+    server.on_packet = nullptr;
+
+    auto allocations = heap_allocations.load();
+    auto start_time = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+        protocol->SendAudio(packet.data(), packet.size());
+    }
+    double seconds = Seconds(start_time);
+    double encrypt_allocations = (double)(heap_allocations - allocations) / BENCHMARK_PACKETS;
+    printf("Encrypt: %.0f packets/s, %.3f heap allocations per packet\n", BENCHMARK_PACKETS / seconds, encrypt_allocations);
+    CHECK(encrypt_allocations == 0);
+
+    {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        keep_received = false;
+    }
+    allocations = heap_allocations.load();
+    start_time = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+        server.Send(sent[i]);
+    }
+    seconds = Seconds(start_time);
+    double decrypt_allocations = (double)(heap_allocations - allocations) / BENCHMARK_PACKETS;
+    printf("Decrypt: %.0f packets/s, %.3f heap allocations per packet\n", BENCHMARK_PACKETS / seconds, decrypt_allocations);
+    CHECK(decrypt_allocations == 0);
+    CHECK(pool.free_count() == pool.capacity());
+}
+
+// While the receiver holds every slot, incoming packets are dropped instead of allocated,
+// and the pool serves again once the slots come back
+static void TestPoolExhausted() {
+    auto& pool = AudioPacketPool::GetInstance();
+    auto& server = UdpServer::GetInstance();
+    std::vector<std::string> sent;
+    server.on_packet = [&sent](const std::string& data) {
+        sent.push_back(data);
+    };
+    auto packet = TestPacket(3);
+    for (int i = 0; i < 3; i++) {
+        protocol->SendAudio(packet.data(), packet.size());
+    }
+    server.on_packet = nullptr;
+
+    std::vector<AudioPacket> held;
+    while (auto slot = pool.Acquire(AUDIO_PACKET_SIZE)) {
+        held.emplace_back(std::move(slot));
+    }
+    CHECK(held.size() == pool.capacity());
+    CHECK(!pool.Acquire(AUDIO_PACKET_CAPACITY + 1));
+
+    {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        keep_received = true;
+        received.clear();
+    }
+    auto allocations = heap_allocations.load();
+    server.Send(sent[0]);
+    CHECK(heap_allocations == allocations);
+    {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        CHECK(received.empty());
+    }
+
+    held.clear();
+    CHECK(pool.free_count() == pool.capacity());
+    server.Send(sent[1]);
+    server.Send(sent[2]);
+    std::lock_guard<std::mutex> lock(received_mutex);
+    CHECK(received.size() == 2 && received[0] == packet);
+}
+
+// Milliseconds OpenAudioChannel blocked the caller
+static double OpenChannel() {
+    auto start_time = esp_timer_get_time();
+    CHECK(protocol->OpenAudioChannel());
+    return (esp_timer_get_time() - start_time) / 1000.0;
+}
+
+// Closes the channel opened by the earlier tests, the next one resumes the session of its hello
+static void ReopenSetUp(std::function<void(const std::string& payload)> on_publish) {
+    MqttBroker::GetInstance().on_publish = AnswerHello;
+    if (!protocol->IsAudioChannelOpened()) {
+        CHECK(protocol->OpenAudioChannel());
+    }
+    protocol->CloseAudioChannel();
+    Application::GetInstance().RunScheduled();
+    MqttBroker::GetInstance().on_publish = on_publish;
+}
+
+// UDP opens with the cached parameters before the server confirms the resume
+static void TestResumeOpensImmediately() {
+    std::atomic<int> resumes{0};
+    ReopenSetUp([&resumes](const std::string& payload) {
+        if (IsResumeHello(payload)) {
+            resumes++;
+            MqttBroker::GetInstance().Deliver("{\"type\":\"hello\",\"transport\":\"udp\",\"resumed\":true}", RESUME_ANSWER_DELAY_MS);
+        }
+    });
+    int opened = 0;
+    protocol->OnAudioChannelOpened([&opened]() { opened++; });
+    auto& server = UdpServer::GetInstance();
+    server.Reset();
+
+    double open_ms = OpenChannel();
+    auto packet = TestPacket(5);
+    protocol->SendAudio(packet.data(), packet.size());
+    printf("Resumed channel opened in %.1f ms, the server answers in %d ms\n", open_ms, RESUME_ANSWER_DELAY_MS);
+    CHECK(open_ms < RESUME_ANSWER_DELAY_MS / 2);
+    CHECK(resumes == 1);
+    CHECK(server.host() == "udp.test");
+    CHECK(server.packets() == 1);
+
+    // The confirmation changes nothing
+    std::this_thread::sleep_for(std::chrono::milliseconds(RESUME_ANSWER_DELAY_MS * 2));
+    CHECK(Application::GetInstance().RunScheduled() == 0);
+    CHECK(protocol->IsAudioChannelOpened());
+    CHECK(opened == 1);
+    protocol->OnAudioChannelOpened(nullptr);
+}
+
+// A rejected resume moves the open channel to the parameters of the new session
+static void TestResumeRejected() {
+    ReopenSetUp([](const std::string& payload) {
+        if (IsResumeHello(payload)) {
+            MqttBroker::GetInstance().Deliver(ServerHello("udp2.test"), RESUME_ANSWER_DELAY_MS);
+        }
+    });
+    int opened = 0;
+    protocol->OnAudioChannelOpened([&opened]() { opened++; });
+    auto& server = UdpServer::GetInstance();
+
+    double open_ms = OpenChannel();
+    CHECK(open_ms < RESUME_ANSWER_DELAY_MS / 2);
+    CHECK(server.host() == "udp.test");
+    CHECK(opened == 1);
+
+    CHECK(WaitUntil([]() { return Application::GetInstance().RunScheduled() > 0; }, RESUME_ANSWER_DELAY_MS * 4));
+    CHECK(server.host() == "udp2.test");
+    CHECK(protocol->IsAudioChannelOpened());
+    CHECK(opened == 2);
+
+    // The new session encrypts from the first sequence again
+    std::string last_packet;
+    server.on_packet = [&last_packet](const std::string& data) {
+        last_packet = data;
+    };
+    auto packet = TestPacket(6);
+    protocol->SendAudio(packet.data(), packet.size());
+    CHECK(last_packet.size() == 16 + packet.size() && (uint8_t)last_packet[15] == 1);
+    server.on_packet = nullptr;
+    protocol->OnAudioChannelOpened(nullptr);
+}
+
+// A server that ignores the resume gets a full hello, the channel stays open meanwhile
+static void TestResumeNotAnswered() {
+    std::atomic<int> full_hellos{0};
+    ReopenSetUp([&full_hellos](const std::string& payload) {
+        if (IsHello(payload) && !IsResumeHello(payload)) {
+            full_hellos++;
+            MqttBroker::GetInstance().Deliver(ServerHello());
+        }
+    });
+
+    double open_ms = OpenChannel();
+    CHECK(open_ms < RESUME_ANSWER_DELAY_MS / 2);
+    CHECK(protocol->IsAudioChannelOpened());
+    CHECK(full_hellos == 0);
+
+    CHECK(WaitUntil([&full_hellos]() { return full_hellos > 0; }, MQTT_RESUME_TIMEOUT_MS * 2));
+    CHECK(WaitUntil([]() { return Application::GetInstance().RunScheduled() > 0; }));
+    CHECK(protocol->IsAudioChannelOpened());
+    CHECK(full_hellos == 1);
+    protocol->CloseAudioChannel();
+}
+
+int main() {
+    SetUp();
+    RUN_TEST(TestOpenChannel);
+    RUN_TEST(TestRoundTrip);
+    RUN_TEST(TestBenchmark);
+    RUN_TEST(TestPoolExhausted);
+    RUN_TEST(TestResumeOpensImmediately);
+    RUN_TEST(TestResumeRejected);
+    RUN_TEST(TestResumeNotAnswered);
+    FinishTests();
+}
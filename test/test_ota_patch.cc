@@ -0,0 +1,198 @@
+#include "ota_test.h"
+
+#define FULL_URL "http://ota.test/firmware.bin"
+#define PATCH_URL "http://ota.test/firmware.patch"
+
+static std::string running_image;
+static std::string new_image;
+static OtaTestPartitions partitions;
+
+static std::string PatchJson(const char* from) {
+    return std::string(",\"patch\":{\"url\":\"") + PATCH_URL + "\",\"from\":\"" + from + "\"}";
+}
+
+// Runs the version check and the upgrade the way the application does
+static bool Upgrade(const std::string& firmware_json) {
+    Ota ota;
+    CHECK(CheckVersion(ota, firmware_json));
+    CHECK(ota.HasNewVersion());
+    return ota.StartUpgrade([](int progress, size_t speed) {});
+}
+
+static void ExpectUpgraded() {
+    CHECK(PartitionHolds(partitions.update, new_image));
+    CHECK(esp_ota_get_boot_partition() == partitions.update);
+}
+
+static void ExpectNotUpgraded() {
+    CHECK(esp_ota_get_boot_partition() == partitions.running);
+    // Nothing is left to resume from, a transformed download always starts over
+    Settings settings("ota", false);
+    CHECK(settings.GetString("url").empty());
+}
+
+// The images, patches and their digests all go through the SHA-256 stand-in, check it against a known answer
+static void TestSha256() {
+    CHECK(Sha256Hex("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(Sha256Hex(std::string(1000, 'a')) == "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+}
+
+static void TestPatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    server.files[PATCH_URL] = MakePatch(running_image, new_image);
+    CHECK(server.files[PATCH_URL].size() < new_image.size() / 4);
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, PatchJson("1.0.0"))));
+    ExpectUpgraded();
+    CHECK(RequestCount(PATCH_URL) == 1);
+    CHECK(RequestCount(FULL_URL) == 0);
+}
+
+static void TestPatchFromAnotherVersion() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    server.files[PATCH_URL] = MakePatch(running_image, new_image);
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, PatchJson("0.9.0"))));
+    ExpectUpgraded();
+    CHECK(RequestCount(PATCH_URL) == 0);
+    CHECK(RequestCount(FULL_URL) == 1);
+}
+
+static void TestPatchSourceMismatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    // Claims the running version but was made from a different build of it
+    server.files[PATCH_URL] = MakePatch(MakeImage("1.0.0", running_image.size(), 99), new_image);
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, PatchJson("1.0.0"))));
+    ExpectUpgraded();
+    CHECK(RequestCount(PATCH_URL) == 1);
+    CHECK(RequestCount(FULL_URL) == 1);
+}
+
+static void TestInvalidPatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    auto patch = MakePatch(running_image, new_image);
+    // One more operation after the target is complete
+    patch += 'C';
+    AppendUint32(patch, running_image.size());
+    AppendUint32(patch, 4096);
+    server.files[PATCH_URL] = patch;
+
+    CHECK(!Upgrade(FirmwareJson("2.0.0", PATCH_URL, "")));
+    ExpectNotUpgraded();
+}
+
+static void TestCompressedImage() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = Compress(new_image, new_image);
+    CHECK(server.files[FULL_URL].size() < new_image.size() / 2);
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image)));
+    ExpectUpgraded();
+    CHECK(RequestCount(FULL_URL) == 1);
+}
+
+static void TestCompressedPatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    server.files[PATCH_URL] = Compress(MakePatch(running_image, new_image), new_image);
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, PatchJson("1.0.0"))));
+    ExpectUpgraded();
+    CHECK(RequestCount(PATCH_URL) == 1);
+    CHECK(RequestCount(FULL_URL) == 0);
+}
+
+static void TestCorruptCompressedStream() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    auto compressed = Compress(new_image, new_image);
+    compressed[compressed.size() / 2] ^= 0x55;
+    server.files[FULL_URL] = compressed;
+
+    CHECK(!Upgrade(FirmwareJson("2.0.0", FULL_URL, "")));
+    ExpectNotUpgraded();
+}
+
+static void TestCompressedImageHashMismatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    // The header describes another image than the one in the stream
+    server.files[FULL_URL] = Compress(new_image, MakeImage("2.0.0", new_image.size(), 7));
+
+    CHECK(!Upgrade(FirmwareJson("2.0.0", FULL_URL, "")));
+    ExpectNotUpgraded();
+}
+
+static void TestTruncatedCompressedImage() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    auto compressed = Compress(new_image, new_image);
+    server.files[FULL_URL] = compressed.substr(0, compressed.size() * 2 / 3);
+
+    CHECK(!Upgrade(FirmwareJson("2.0.0", FULL_URL, "")));
+    ExpectNotUpgraded();
+    CHECK(RequestCount(FULL_URL) == 1);
+}
+
+static void TestCompressedDownloadRestartsAfterDrop() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = Compress(new_image, new_image);
+    server.drop_at = server.files[FULL_URL].size() / 2;
+    server.drops = 1;
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image)));
+    ExpectUpgraded();
+    // The stream cannot continue in the middle, the second request starts from the beginning
+    CHECK(server.requests.size() == 3);
+    CHECK(server.requests.back().url == FULL_URL && server.requests.back().range_start == 0);
+}
+
+static void TestExpandedSizeMismatch() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = Compress(new_image, new_image);
+
+    // Rejected from the header before anything is written
+    auto json = "{\"version\":\"2.0.0\",\"url\":\"" FULL_URL "\",\"size\":" + std::to_string(new_image.size() + 4096) + "}";
+    CHECK(!Upgrade(json));
+    ExpectNotUpgraded();
+    CHECK(PartitionErased(partitions.update));
+}
+
+int main() {
+    running_image = MakeImage("1.0.0", 1024 * 1024 + 1000, 1);
+    // A few changed regions and a longer tail, the rest is shared with the running image
+    new_image = running_image;
+    new_image.append(std::string(MakeImage("2.0.0", 70000, 2), 1000));
+    for (size_t offset : {300000, 650000, 900000}) {
+        auto changed = MakeImage("2.0.0", 20000, offset);
+        new_image.replace(offset, 20000, changed, 0, 20000);
+    }
+    new_image.replace(0, 4096, MakeImage("2.0.0", 4096, 3));
+    partitions = SetUpPartitions(running_image);
+
+    RUN_TEST(TestSha256);
+    RUN_TEST(TestPatch);
+    RUN_TEST(TestPatchFromAnotherVersion);
+    RUN_TEST(TestPatchSourceMismatch);
+    RUN_TEST(TestInvalidPatch);
+    RUN_TEST(TestCompressedImage);
+    RUN_TEST(TestCompressedPatch);
+    RUN_TEST(TestCorruptCompressedStream);
+    RUN_TEST(TestCompressedImageHashMismatch);
+    RUN_TEST(TestTruncatedCompressedImage);
+    RUN_TEST(TestCompressedDownloadRestartsAfterDrop);
+    RUN_TEST(TestExpandedSizeMismatch);
+    FinishTests();
+}
@@ -0,0 +1,120 @@
+#include "ota_test.h"
+
+#include <board.h>
+#include <spi_flash_mmap.h>
+
+#define IMAGE_URL "http://ota.test/firmware.bin"
+#define IMAGE_SIZE (1024 * 1024)
+
+// A scaled down HTTPS download to a flash chip: the server sends 2 MB/s into the lwIP default
+// receive window, decrypting costs the reading task 250 us per KB, a flash call takes 50 us,
+// a sector erase 2 ms and programming 250 us per KB
+#define NETWORK_BYTES_PER_SECOND (2 * 1024 * 1024)
+#define RECEIVE_WINDOW 5760
+#define READ_US_PER_KB 250
+#define FLASH_CALL_US 50
+#define FLASH_ERASE_US 2000
+#define FLASH_WRITE_US_PER_KB 250
+
+static std::string image;
+static OtaTestPartitions partitions;
+
+struct DownloadStats {
+    double seconds;
+    double stalled_seconds;
+};
+
+static void SetUpServer() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[IMAGE_URL] = image;
+    server.bytes_per_second = NETWORK_BYTES_PER_SECOND;
+    server.receive_window = RECEIVE_WINDOW;
+    server.read_us_per_kb = READ_US_PER_KB;
+}
+
+// What Ota::Upgrade did before the writer task: 512 byte reads, each written right away with
+// esp_ota_write, which erases a sector when the write reaches it, and the image read back and
+// hashed by esp_ota_end
+static bool UpgradeInline(DownloadStats& stats) {
+    SetUpServer();
+    auto start_time = esp_timer_get_time();
+    auto http = Board::GetInstance().CreateHttp();
+    if (!http->Open("GET", IMAGE_URL)) {
+        delete http;
+        return false;
+    }
+    char buffer[512];
+    size_t offset = 0;
+    bool success = true;
+    while (true) {
+        int ret = http->Read(buffer, sizeof(buffer));
+        if (ret <= 0) {
+            success = ret == 0;
+            break;
+        }
+        size_t end = offset + ret;
+        size_t erased = (offset + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+        if (erased < end) {
+            esp_partition_erase_range(partitions.update, erased,
+                (end - erased + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE);
+        }
+        esp_partition_write(partitions.update, offset, buffer, ret);
+        offset = end;
+    }
+    delete http;
+
+    std::string written(offset, '\0');
+    esp_partition_read(partitions.update, 0, written.data(), written.size());
+    success = success && Sha256Hex(written) == Sha256Hex(image);
+    stats.seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    stats.stalled_seconds = HttpServer::GetInstance().stalled_us / 1000000.0;
+    return success;
+}
+
+static bool UpgradePipelined(DownloadStats& stats) {
+    SetUpServer();
+    Ota ota;
+    CHECK(CheckVersion(ota, FirmwareJson("2.0.0", IMAGE_URL, image)));
+    auto& server = HttpServer::GetInstance();
+    server.stalled_us = 0;
+    auto start_time = esp_timer_get_time();
+    bool success = ota.StartUpgrade([](int progress, size_t speed) {});
+    stats.seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    stats.stalled_seconds = server.stalled_us / 1000000.0;
+    return success;
+}
+
+static void Report(const char* name, const DownloadStats& stats) {
+    printf("%-10s %6.0f KB/s, %4.0f ms in total, the server stalled %4.0f ms on a full receive window\n", name,
+        IMAGE_SIZE / 1024 / stats.seconds, stats.seconds * 1000, stats.stalled_seconds * 1000);
+}
+
+// Download throughput and network stalls, with reads and flash writes in one loop and with the writer task
+static void TestThroughput() {
+    test_partition_set_timing(partitions.update, FLASH_CALL_US, FLASH_ERASE_US, FLASH_WRITE_US_PER_KB);
+
+    DownloadStats inline_stats, pipelined_stats;
+    CHECK(UpgradeInline(inline_stats));
+    CHECK(PartitionHolds(partitions.update, image));
+    CHECK(UpgradePipelined(pipelined_stats));
+    CHECK(PartitionHolds(partitions.update, image));
+    CHECK(esp_ota_get_boot_partition() == partitions.update);
+    Report("inline", inline_stats);
+    Report("pipelined", pipelined_stats);
+
+    // Decrypting overlaps the flash writes and a 16 KB chunk costs one erase and one write call
+    // instead of 32 writes, the network now stalls only while both chunks wait for the flash
+    CHECK(pipelined_stats.seconds * 1.25 < inline_stats.seconds);
+    CHECK(pipelined_stats.stalled_seconds < inline_stats.stalled_seconds / 2);
+
+    test_partition_set_timing(partitions.update, 0, 0, 0);
+}
+
+int main() {
+    image = MakeImage("2.0.0", IMAGE_SIZE, 11);
+    partitions = SetUpPartitions(MakeImage("1.0.0", 256 * 1024, 1));
+
+    RUN_TEST(TestThroughput);
+    FinishTests();
+}
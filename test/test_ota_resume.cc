@@ -0,0 +1,299 @@
+#include "ota_test.h"
+
+#include <spi_flash_mmap.h>
+
+#define FULL_URL "http://ota.test/firmware.bin"
+#define DIGEST_BLOCK_SIZE (64 * 1024)
+// Not a multiple of OTA_CHECKPOINT_INTERVAL, so checkpoints fall inside blocks
+#define UNALIGNED_DIGEST_BLOCK_SIZE (96 * 1024)
+
+static std::string new_image;
+static OtaTestPartitions partitions;
+
+// Per block digests, so a resumed download also has to pick up the block it stopped in
+static std::string BlockDigests(const std::string& image, size_t block_size = DIGEST_BLOCK_SIZE) {
+    std::string json = ",\"block_size\":" + std::to_string(block_size) + ",\"block_sha256\":[";
+    for (size_t offset = 0; offset < image.size(); offset += block_size) {
+        json += (offset > 0 ? ",\"" : "\"") + Sha256Hex(image.substr(offset, block_size)) + "\"";
+    }
+    return json + "]";
+}
+
+static bool Upgrade(const std::string& firmware_json) {
+    Ota ota;
+    CHECK(CheckVersion(ota, firmware_json));
+    return ota.StartUpgrade([](int progress, size_t speed) {});
+}
+
+struct Checkpoint {
+    std::string url;
+    std::string image;
+    size_t size;
+    size_t offset;
+};
+
+static Checkpoint LoadCheckpoint() {
+    Settings settings("ota", false);
+    return Checkpoint{settings.GetString("url"), settings.GetString("image"), (size_t)settings.GetInt("size"),
+        (size_t)settings.GetInt("offset")};
+}
+
+// A checkpoint may only point at data that is already in flash
+static void ExpectCheckpointValid(const std::string& image) {
+    auto checkpoint = LoadCheckpoint();
+    CHECK(checkpoint.url == FULL_URL);
+    CHECK(checkpoint.size == image.size());
+    CHECK(checkpoint.offset > 0 && checkpoint.offset % SPI_FLASH_SEC_SIZE == 0);
+    CHECK(PartitionHolds(partitions.update, image.substr(0, checkpoint.offset)));
+}
+
+// Gives up after every retry, as if the power went out halfway
+static size_t Interrupt(const std::string& firmware_json, size_t offset) {
+    auto& server = HttpServer::GetInstance();
+    server.drop_at = offset;
+    server.drops = OTA_MAX_RETRIES + 1;
+    CHECK(!Upgrade(firmware_json));
+    server.drops = 0;
+    server.requests.clear();
+    return LoadCheckpoint().offset;
+}
+
+// Drops the next connection that reaches offset, the flag tells whether one did
+static bool& ReachesOffset(size_t offset) {
+    auto& server = HttpServer::GetInstance();
+    static bool reached;
+    reached = false;
+    server.drop_at = offset;
+    server.drops = 1;
+    server.on_drop = []() {
+        reached = true;
+    };
+    return reached;
+}
+
+// The first request after the version check
+static const HttpRequest& FirstDownload() {
+    static const HttpRequest none = {"", 0};
+    auto& requests = HttpServer::GetInstance().requests;
+    return requests.size() > 1 ? requests[1] : none;
+}
+
+static void TestResumeAfterDrop() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    server.drop_at = 700000;
+    server.drops = 1;
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image))));
+    CHECK(PartitionHolds(partitions.update, new_image));
+    CHECK(esp_ota_get_boot_partition() == partitions.update);
+    // Continues after the last chunk handed to the writer
+    CHECK(server.requests.size() == 3);
+    CHECK(server.requests[2].range_start > 0 && server.requests[2].range_start <= 700000);
+    CHECK(server.requests[2].range_start % SPI_FLASH_SEC_SIZE == 0);
+    // Done, nothing left to resume
+    CHECK(LoadCheckpoint().url.empty());
+}
+
+static void TestResumeFromCheckpoint() {
+    ResetOta(partitions);
+    HttpServer::GetInstance().files[FULL_URL] = new_image;
+    auto json = FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image));
+    size_t offset = Interrupt(json, 700000);
+    CHECK(offset >= OTA_CHECKPOINT_INTERVAL && offset <= 700000);
+    ExpectCheckpointValid(new_image);
+
+    // A new attempt, as after a reboot, asks for the rest only
+    CHECK(Upgrade(json));
+    CHECK(FirstDownload().range_start == offset);
+    CHECK(PartitionHolds(partitions.update, new_image));
+    CHECK(esp_ota_get_boot_partition() == partitions.update);
+    CHECK(LoadCheckpoint().url.empty());
+}
+
+static void TestCheckpointForAnotherImage() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    CHECK(Interrupt(FirmwareJson("2.0.0", FULL_URL, new_image), 700000) > 0);
+
+    // Same URL and version, but the server now has a rebuilt image
+    auto rebuilt = MakeImage("2.0.0", new_image.size(), 5);
+    server.files[FULL_URL] = rebuilt;
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, rebuilt)));
+    CHECK(FirstDownload().range_start == 0);
+    CHECK(PartitionHolds(partitions.update, rebuilt));
+}
+
+static void TestCheckpointForAnotherVersion() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    // Without a digest the version tells the images apart
+    CHECK(Interrupt(FirmwareJson("2.0.0", FULL_URL, ""), 700000) > 0);
+
+    auto next = MakeImage("2.0.1", new_image.size(), 6);
+    server.files[FULL_URL] = next;
+    CHECK(Upgrade(FirmwareJson("2.0.1", FULL_URL, "")));
+    CHECK(FirstDownload().range_start == 0);
+    CHECK(PartitionHolds(partitions.update, next));
+}
+
+static void TestServerIgnoresRange() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    auto json = FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image));
+    size_t offset = Interrupt(json, 700000);
+    CHECK(offset > 0);
+
+    // Asked for the rest, got the whole file and started over
+    server.accept_ranges = false;
+    CHECK(Upgrade(json));
+    CHECK(FirstDownload().range_start == offset);
+    CHECK(PartitionHolds(partitions.update, new_image));
+    CHECK(LoadCheckpoint().url.empty());
+}
+
+static void TestFileChangedWhileRetrying() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    // A longer image replaces the file while the download waits to retry
+    auto replaced = MakeImage("2.0.0", new_image.size() + 100000, 8);
+    server.drop_at = 700000;
+    server.drops = 1;
+    server.on_drop = [&server, replaced]() {
+        server.files[FULL_URL] = replaced;
+    };
+
+    CHECK(Upgrade(FirmwareJson("2.0.0", FULL_URL, "")));
+    CHECK(PartitionHolds(partitions.update, replaced));
+    CHECK(server.requests.back().range_start == 0);
+}
+
+// After the file changes the checkpoint starts over, it must never point into data of the old file
+static void TestNoStaleCheckpoint() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image;
+    auto replaced = MakeImage("2.0.0", new_image.size() + 100000, 9);
+    server.drop_at = 700000;
+    server.drops = OTA_MAX_RETRIES + 1;
+    bool first = true;
+    server.on_drop = [&server, &first, replaced]() {
+        if (first) {
+            server.files[FULL_URL] = replaced;
+            first = false;
+        }
+    };
+    auto json = FirmwareJson("2.0.0", FULL_URL, "");
+    CHECK(!Upgrade(json));
+    ExpectCheckpointValid(replaced);
+
+    server.drops = 0;
+    server.on_drop = nullptr;
+    server.requests.clear();
+    CHECK(Upgrade(json));
+    CHECK(FirstDownload().range_start > 0);
+    CHECK(PartitionHolds(partitions.update, replaced));
+}
+
+static void TestCorruptBlockClearsCheckpoint() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    auto json = FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image));
+    server.files[FULL_URL] = new_image;
+    CHECK(Interrupt(json, 300000) > 0);
+
+    // The rest of the file is corrupted, the written part cannot be trusted to go with it
+    server.files[FULL_URL][500000] ^= 1;
+    CHECK(!Upgrade(json));
+    CHECK(LoadCheckpoint().url.empty());
+    CHECK(esp_ota_get_boot_partition() == partitions.running);
+
+    server.files[FULL_URL] = new_image;
+    server.requests.clear();
+    CHECK(Upgrade(json));
+    CHECK(FirstDownload().range_start == 0);
+    CHECK(PartitionHolds(partitions.update, new_image));
+}
+
+// The block the checkpoint falls in is hashed from the part read back from flash and the rest downloaded
+static void TestResumeMidBlock() {
+    ResetOta(partitions);
+    HttpServer::GetInstance().files[FULL_URL] = new_image;
+    auto json = FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image, UNALIGNED_DIGEST_BLOCK_SIZE));
+    size_t offset = Interrupt(json, 700000);
+    CHECK(offset > 0 && offset % UNALIGNED_DIGEST_BLOCK_SIZE != 0);
+
+    CHECK(Upgrade(json));
+    CHECK(FirstDownload().range_start == offset);
+    CHECK(PartitionHolds(partitions.update, new_image));
+    CHECK(esp_ota_get_boot_partition() == partitions.update);
+}
+
+// Flash corrupted before the checkpoint fails that block, not only the whole image digest at the end
+static void TestResumeMidBlockCorruptFlash() {
+    ResetOta(partitions);
+    HttpServer::GetInstance().files[FULL_URL] = new_image;
+    auto json = FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image, UNALIGNED_DIGEST_BLOCK_SIZE));
+    size_t offset = Interrupt(json, 700000);
+    size_t block_start = offset / UNALIGNED_DIGEST_BLOCK_SIZE * UNALIGNED_DIGEST_BLOCK_SIZE;
+    CHECK(offset > block_start);
+    test_partition_data(partitions.update)[block_start + 1000] ^= 1;
+
+    size_t block_end = block_start + UNALIGNED_DIGEST_BLOCK_SIZE;
+    auto& reached = ReachesOffset(block_end + 2 * OTA_CHUNK_SIZE);
+    CHECK(!Upgrade(json));
+    CHECK(!reached);
+    CHECK(FirstDownload().range_start == offset);
+    CHECK(LoadCheckpoint().url.empty());
+    CHECK(esp_ota_get_boot_partition() == partitions.running);
+    HttpServer::GetInstance().on_drop = nullptr;
+}
+
+// A file shorter than the size from the version check is rejected at the first chunk, before the writer starts
+static void TestTruncatedFile() {
+    ResetOta(partitions);
+    auto& server = HttpServer::GetInstance();
+    server.files[FULL_URL] = new_image.substr(0, 700000);
+    auto& reached = ReachesOffset(2 * OTA_CHUNK_SIZE);
+    CHECK(!Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image, BlockDigests(new_image))));
+    CHECK(!reached);
+    CHECK(server.requests.size() == 2);
+    CHECK(PartitionErased(partitions.update));
+    CHECK(LoadCheckpoint().url.empty());
+    CHECK(esp_ota_get_boot_partition() == partitions.running);
+    server.on_drop = nullptr;
+}
+
+static void TestWriteFailureClearsCheckpoint() {
+    ResetOta(partitions);
+    HttpServer::GetInstance().files[FULL_URL] = new_image;
+    test_partition_fail_after(partitions.update, 500000);
+    CHECK(!Upgrade(FirmwareJson("2.0.0", FULL_URL, new_image)));
+    test_partition_fail_after(partitions.update, -1);
+    CHECK(LoadCheckpoint().url.empty());
+    CHECK(esp_ota_get_boot_partition() == partitions.running);
+}
+
+int main() {
+    new_image = MakeImage("2.0.0", 1200000 + 333, 4);
+    partitions = SetUpPartitions(MakeImage("1.0.0", 1024 * 1024, 1));
+
+    RUN_TEST(TestResumeAfterDrop);
+    RUN_TEST(TestResumeFromCheckpoint);
+    RUN_TEST(TestCheckpointForAnotherImage);
+    RUN_TEST(TestCheckpointForAnotherVersion);
+    RUN_TEST(TestServerIgnoresRange);
+    RUN_TEST(TestFileChangedWhileRetrying);
+    RUN_TEST(TestNoStaleCheckpoint);
+    RUN_TEST(TestCorruptBlockClearsCheckpoint);
+    RUN_TEST(TestResumeMidBlock);
+    RUN_TEST(TestResumeMidBlockCorruptFlash);
+    RUN_TEST(TestTruncatedFile);
+    RUN_TEST(TestWriteFailureClearsCheckpoint);
+    FinishTests();
+}
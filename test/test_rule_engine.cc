@@ -0,0 +1,317 @@
+#include "test.h"
+#include "iot/rule_engine.h"
+#include "iot/thing_manager.h"
+#include "settings.h"
+
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace iot {
+
+// Mock things, the tests drive the properties directly and count the method calls
+class Thermometer : public Thing {
+public:
+    std::atomic<int> temperature{20};
+    std::atomic<bool> door_open{false};
+    std::string mode = "auto";
+
+    Thermometer() : Thing("Thermometer", "A thermometer for the tests") {
+        properties_.AddNumberProperty("temperature", "Temperature", [this]() -> int {
+            return temperature;
+        });
+        properties_.AddBooleanProperty("door", "Whether the door is open", [this]() -> bool {
+            return door_open;
+        });
+        properties_.AddStringProperty("mode", "Mode", [this]() -> std::string {
+            return mode;
+        });
+    }
+};
+
+class Fan : public Thing {
+public:
+    std::atomic<int> calls{0};
+    std::atomic<int> speed{0};
+
+    Fan() : Thing("Fan", "A fan for the tests") {
+        methods_.AddMethod("SetSpeed", "Set the speed", ParameterList({
+            Parameter("speed", "Speed", kValueTypeNumber, true)
+        }), [this](const ParameterList& parameters) {
+            speed = parameters["speed"].number();
+            calls++;
+        });
+    }
+};
+
+} // namespace iot
+
+using namespace iot;
+
+static Thermometer thermometer;
+static Fan fan;
+
+// The test thread stands in for the main loop, as Evaluate and property reads must stay on it
+static std::mutex main_loop_mutex;
+static std::deque<std::function<void()>> main_loop_tasks;
+
+static void RunMainLoop() {
+    std::unique_lock<std::mutex> lock(main_loop_mutex);
+    while (!main_loop_tasks.empty()) {
+        auto task = std::move(main_loop_tasks.front());
+        main_loop_tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+static int Install(const char* json) {
+    auto rules = cJSON_Parse(json);
+    CHECK(rules != nullptr);
+    int installed = RuleEngine::GetInstance().Install(rules);
+    cJSON_Delete(rules);
+    return installed;
+}
+
+static std::string SavedRules() {
+    Settings settings("iot_rules", false);
+    return settings.GetString("rules");
+}
+
+static std::string Rule(const std::string& id, const std::string& when, const std::string& extra = "") {
+    return "{\"id\":\"" + id + "\",\"when\":" + when + extra +
+        ",\"then\":{\"name\":\"Fan\",\"method\":\"SetSpeed\",\"parameters\":{\"speed\":3}}}";
+}
+
+// Commands run on the IoT worker, give it time before checking that nothing ran
+static void ExpectCalls(int calls) {
+    CHECK(WaitUntil([calls]() {
+        RunMainLoop();
+        return fan.calls >= calls;
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    RunMainLoop();
+    CHECK(fan.calls == calls);
+}
+
+static void TestRejectsInvalidRules() {
+    const char* when = "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}";
+    std::string rules = "[" +
+        Rule("valid", when) + "," +
+        // Condition
+        "{\"id\":\"no_when\",\"then\":{\"name\":\"Fan\",\"method\":\"SetSpeed\",\"parameters\":{\"speed\":3}}}," +
+        Rule("unknown_thing", "{\"name\":\"Oven\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}") + "," +
+        Rule("unknown_property", "{\"name\":\"Thermometer\",\"property\":\"humidity\",\"op\":\">\",\"value\":30}") + "," +
+        Rule("unknown_operator", "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\"=>\",\"value\":30}") + "," +
+        Rule("string_order", "{\"name\":\"Thermometer\",\"property\":\"mode\",\"op\":\">\",\"value\":\"auto\"}") + "," +
+        Rule("string_value", "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":\"30\"}") + "," +
+        // Hours
+        Rule("bad_hour", when, ",\"hours\":[25,3]") + "," +
+        Rule("missing_hour", when, ",\"hours\":[3]") + "," +
+        // Action
+        "{\"id\":\"unknown_action_thing\",\"when\":" + when + ",\"then\":{\"name\":\"Oven\",\"method\":\"SetSpeed\"}}," +
+        "{\"id\":\"unknown_method\",\"when\":" + when + ",\"then\":{\"name\":\"Fan\",\"method\":\"Spin\"}}," +
+        "{\"id\":\"missing_parameter\",\"when\":" + when + ",\"then\":{\"name\":\"Fan\",\"method\":\"SetSpeed\"}}," +
+        "{\"id\":\"wrong_parameter\",\"when\":" + when +
+            ",\"then\":{\"name\":\"Fan\",\"method\":\"SetSpeed\",\"parameters\":{\"speed\":\"fast\"}}}" +
+        "]";
+    CHECK(Install(rules.c_str()) == 1);
+    // A payload that is not an array is reported and leaves the installed rules alone
+    CHECK(Install("{\"id\":\"not_an_array\"}") == -1);
+    CHECK(RuleEngine::GetInstance().Install(nullptr) == -1);
+    CHECK(RuleEngine::GetInstance().rule_count() == 1);
+
+    // Only the valid rule is saved, so the rejected ones are not parsed again on every boot
+    Install(rules.c_str());
+    auto saved = cJSON_Parse(SavedRules().c_str());
+    CHECK(cJSON_GetArraySize(saved) == 1);
+    auto id = cJSON_GetObjectItem(cJSON_GetArrayItem(saved, 0), "id");
+    CHECK(cJSON_IsString(id) && std::string(id->valuestring) == "valid");
+    cJSON_Delete(saved);
+}
+
+static void TestFiresOnceWhenConditionBecomesTrue() {
+    thermometer.temperature = 20;
+    fan.calls = 0;
+    fan.speed = 0;
+    CHECK(Install(("[" + Rule("hot", "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}") +
+        "]").c_str()) == 1);
+    ExpectCalls(0);
+
+    auto& rule_engine = RuleEngine::GetInstance();
+    thermometer.temperature = 31;
+    rule_engine.Evaluate();
+    ExpectCalls(1);
+    CHECK(fan.speed == 3);
+
+    // Still true, nothing new to do
+    thermometer.temperature = 35;
+    rule_engine.Evaluate();
+    ExpectCalls(1);
+
+    // Fires again only after the condition has been false
+    thermometer.temperature = 25;
+    rule_engine.Evaluate();
+    thermometer.temperature = 32;
+    rule_engine.Evaluate();
+    ExpectCalls(2);
+}
+
+static void TestOperators() {
+    struct {
+        const char* op;
+        int value;
+        int temperature;
+        bool fires;
+    } cases[] = {
+        {"<", 10, 9, true}, {"<", 10, 10, false},
+        {"<=", 10, 10, true}, {"<=", 10, 11, false},
+        {"==", 10, 10, true}, {"==", 10, 11, false},
+        {"!=", 10, 11, true}, {"!=", 10, 10, false},
+        {">=", 10, 10, true}, {">=", 10, 9, false},
+        {">", 10, 11, true}, {">", 10, 10, false},
+    };
+    for (auto& item : cases) {
+        thermometer.temperature = item.temperature;
+        fan.calls = 0;
+        std::string when = std::string("{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\"") + item.op +
+            "\",\"value\":" + std::to_string(item.value) + "}";
+        // Install evaluates the new rules at once
+        CHECK(Install(("[" + Rule("op", when) + "]").c_str()) == 1);
+        ExpectCalls(item.fires ? 1 : 0);
+    }
+}
+
+static void TestBooleanAndStringProperties() {
+    thermometer.door_open = false;
+    thermometer.mode = "auto";
+    fan.calls = 0;
+    std::string rules = "[" +
+        Rule("door", "{\"name\":\"Thermometer\",\"property\":\"door\",\"op\":\"==\",\"value\":true}") + "," +
+        Rule("mode", "{\"name\":\"Thermometer\",\"property\":\"mode\",\"op\":\"!=\",\"value\":\"auto\"}") +
+        "]";
+    CHECK(Install(rules.c_str()) == 2);
+    ExpectCalls(0);
+
+    auto& rule_engine = RuleEngine::GetInstance();
+    thermometer.door_open = true;
+    rule_engine.Evaluate();
+    ExpectCalls(1);
+
+    // Only written between evaluations, the getter runs on this thread
+    thermometer.mode = "manual";
+    rule_engine.Evaluate();
+    ExpectCalls(2);
+}
+
+static void TestHours() {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    CHECK(tm.tm_year >= 2024 - 1900);
+    // Run close to the top of the hour and the hour could change between here and the evaluation
+    if (tm.tm_min == 59 && tm.tm_sec >= 58) {
+        std::this_thread::sleep_for(std::chrono::seconds(3));
+        now = time(NULL);
+        localtime_r(&now, &tm);
+    }
+    int hour = tm.tm_hour;
+
+    thermometer.temperature = 40;
+    const char* when = "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}";
+    // [hour, hour + 1) contains now, to may be 24
+    fan.calls = 0;
+    CHECK(Install(("[" + Rule("now", when, ",\"hours\":[" + std::to_string(hour) + "," + std::to_string(hour + 1) +
+        "]") + "]").c_str()) == 1);
+    ExpectCalls(1);
+
+    // [hour + 1, hour + 2) does not, also when it wraps past midnight
+    fan.calls = 0;
+    CHECK(Install(("[" + Rule("later", when, ",\"hours\":[" + std::to_string((hour + 1) % 24) + "," +
+        std::to_string((hour + 2) % 24) + "]") + "]").c_str()) == 1);
+    ExpectCalls(0);
+
+    // A window that wraps past midnight and ends at now excludes it as well
+    fan.calls = 0;
+    CHECK(Install(("[" + Rule("until_now", when, ",\"hours\":[" + std::to_string((hour + 1) % 24) + "," +
+        std::to_string(hour) + "]") + "]").c_str()) == 1);
+    ExpectCalls(0);
+}
+
+static void TestLimit() {
+    // The condition stays false, firing this many rules at once would overflow the command queue
+    thermometer.temperature = 20;
+    fan.calls = 0;
+    std::string rules = "[";
+    for (int i = 0; i < RULE_ENGINE_MAX_RULES + 4; i++) {
+        if (i > 0) {
+            rules += ",";
+        }
+        rules += Rule("rule" + std::to_string(i),
+            "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}");
+    }
+    rules += "]";
+    CHECK(Install(rules.c_str()) == RULE_ENGINE_MAX_RULES);
+    auto saved = cJSON_Parse(SavedRules().c_str());
+    CHECK(cJSON_GetArraySize(saved) == RULE_ENGINE_MAX_RULES);
+    auto last = cJSON_GetObjectItem(cJSON_GetArrayItem(saved, RULE_ENGINE_MAX_RULES - 1), "id");
+    CHECK(cJSON_IsString(last) && std::string(last->valuestring) == "rule" + std::to_string(RULE_ENGINE_MAX_RULES - 1));
+    cJSON_Delete(saved);
+    ExpectCalls(0);
+
+    // Rules saved by another build beyond the limit are not all loaded either
+    {
+        Settings settings("iot_rules", true);
+        settings.SetString("rules", rules);
+    }
+    RuleEngine::GetInstance().Load();
+    CHECK(RuleEngine::GetInstance().rule_count() == RULE_ENGINE_MAX_RULES);
+    RuleEngine::GetInstance().Evaluate();
+    ExpectCalls(0);
+}
+
+static void TestPersistence() {
+    thermometer.temperature = 31;
+    fan.calls = 0;
+    CHECK(Install(("[" + Rule("hot", "{\"name\":\"Thermometer\",\"property\":\"temperature\",\"op\":\">\",\"value\":30}") +
+        "]").c_str()) == 1);
+    ExpectCalls(1);
+
+    // Loaded rules start unmatched, as after a reboot
+    auto& rule_engine = RuleEngine::GetInstance();
+    rule_engine.Load();
+    rule_engine.Evaluate();
+    ExpectCalls(2);
+
+    // Installing no rules removes the saved ones, Load then keeps what it has
+    CHECK(Install("[]") == 0);
+    CHECK(SavedRules().empty());
+    rule_engine.Load();
+    thermometer.temperature = 20;
+    rule_engine.Evaluate();
+    thermometer.temperature = 31;
+    rule_engine.Evaluate();
+    ExpectCalls(2);
+}
+
+int main() {
+    auto& thing_manager = ThingManager::GetInstance();
+    thing_manager.AddThing(&thermometer);
+    thing_manager.AddThing(&fan);
+    thing_manager.OnMainLoop([](std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(main_loop_mutex);
+        main_loop_tasks.push_back(std::move(callback));
+    });
+
+    RUN_TEST(TestRejectsInvalidRules);
+    RUN_TEST(TestFiresOnceWhenConditionBecomesTrue);
+    RUN_TEST(TestOperators);
+    RUN_TEST(TestBooleanAndStringProperties);
+    RUN_TEST(TestHours);
+    RUN_TEST(TestLimit);
+    RUN_TEST(TestPersistence);
+    FinishTests();
+}
@@ -0,0 +1,325 @@
+#include "test.h"
+#include "iot/thing_manager.h"
+#include "board.h"
+
+#include <driver/gpio.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#define STATE_SYNCS 20000
+#define LOOKUPS 200000
+#define INVOKES 20000
+
+using namespace iot;
+
+static ThingManager& thing_manager = ThingManager::GetInstance();
+static AudioCodec* codec = Board::GetInstance().GetAudioCodec();
+
+// The things a board with a speaker, a lamp and a battery adds, the same ones the firmware builds
+static void SetUp() {
+    for (auto type : {"Speaker", "Lamp", "Battery"}) {
+        auto thing = CreateThing(type);
+        CHECK(thing != nullptr);
+        thing_manager.AddThing(thing);
+    }
+}
+
+static void TestStatesDelta() {
+    auto& board = Board::GetInstance();
+    std::string json;
+    codec->SetOutputVolume(70);
+    CHECK(thing_manager.GetStatesJson(json, false));
+    CHECK(json == "[{\"name\":\"Speaker\",\"state\":{\"volume\":70}},{\"name\":\"Lamp\",\"state\":{\"power\":false}},"
+        "{\"name\":\"Battery\",\"state\":{\"level\":80,\"charging\":false}}]");
+
+    // Nothing changed, nothing to send
+    CHECK(!thing_manager.GetStatesJson(json, true));
+    CHECK(json == "[]");
+
+    // Only the changed property of the changed thing
+    codec->SetOutputVolume(40);
+    CHECK(thing_manager.GetStatesJson(json, true));
+    CHECK(json == "[{\"name\":\"Speaker\",\"state\":{\"volume\":40}}]");
+    CHECK(!thing_manager.GetStatesJson(json, true));
+
+    // The battery is read through the ADC once per TTL, unless its state is invalidated
+    int reads = board.battery_reads;
+    board.battery_level = 75;
+    CHECK(!thing_manager.GetStatesJson(json, true));
+    CHECK(board.battery_reads == reads);
+    thing_manager.FindThing("Battery")->InvalidateState();
+    CHECK(thing_manager.GetStatesJson(json, true));
+    CHECK(json == "[{\"name\":\"Battery\",\"state\":{\"level\":75}}]");
+    CHECK(board.battery_reads == reads + 1);
+}
+
+// What a delta sync did before properties had versions: read every property, write every
+// thing's full state and compare it with the copy kept from the last sync
+static bool GetStatesJsonByStringDiff(std::string& json, std::map<std::string, std::string>& last_states) {
+    bool changed = false;
+    json = "[";
+    for (auto name : {"Speaker", "Lamp", "Battery"}) {
+        auto thing = thing_manager.FindThing(name);
+        thing->InvalidateState();
+        std::string state;
+        JsonWriter writer(state);
+        thing->WriteStateJson(writer, false);
+        auto& last_state = last_states[thing->name()];
+        if (state != last_state) {
+            json += state + ",";
+            last_state = std::move(state);
+            changed = true;
+        }
+    }
+    if (json.back() == ',') {
+        json.pop_back();
+    }
+    json += "]";
+    return changed;
+}
+
+struct SyncStats {
+    double us_per_sync;
+    double bytes_per_sync;
+    double battery_reads_per_sync;
+};
+
+// Syncs STATE_SYNCS times, changing the volume before every change_every-th sync
+template <typename Sync>
+static SyncStats MeasureSyncs(int change_every, Sync sync) {
+    auto& board = Board::GetInstance();
+    std::string json;
+    size_t bytes = 0;
+    int reads = board.battery_reads;
+    auto start_time = esp_timer_get_time();
+    for (int i = 0; i < STATE_SYNCS; i++) {
+        if (change_every > 0 && i % change_every == 0) {
+            codec->SetOutputVolume(codec->output_volume() == 50 ? 60 : 50);
+        }
+        if (sync(json)) {
+            bytes += json.size();
+        }
+    }
+    double seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    return SyncStats{seconds * 1000000 / STATE_SYNCS, (double)bytes / STATE_SYNCS,
+        (double)(board.battery_reads - reads) / STATE_SYNCS};
+}
+
+// CPU time, bytes sent and battery reads per delta sync, versions against string diffs
+static void TestStatesBenchmark() {
+    std::map<std::string, std::string> last_states;
+    auto string_diff = [&last_states](std::string& json) {
+        return GetStatesJsonByStringDiff(json, last_states);
+    };
+    auto versions = [](std::string& json) {
+        return thing_manager.GetStatesJson(json, true);
+    };
+
+    for (int change_every : {0, 10, 1}) {
+        std::string json;
+        GetStatesJsonByStringDiff(json, last_states);
+        auto before = MeasureSyncs(change_every, string_diff);
+        thing_manager.GetStatesJson(json, false);
+        auto after = MeasureSyncs(change_every, versions);
+        const char* load = change_every == 0 ? "idle" : change_every == 1 ? "volume every sync" : "volume every 10 syncs";
+        printf("%-22s string diff: %6.3f us, %5.1f bytes, %.2f battery reads per sync\n", load,
+            before.us_per_sync, before.bytes_per_sync, before.battery_reads_per_sync);
+        printf("%-22s versions:    %6.3f us, %5.1f bytes, %.2f battery reads per sync\n", load,
+            after.us_per_sync, after.bytes_per_sync, after.battery_reads_per_sync);
+        CHECK(after.us_per_sync < before.us_per_sync);
+        // Both send only the speaker, whose one property is the volume
+        CHECK(after.bytes_per_sync <= before.bytes_per_sync);
+        CHECK(after.battery_reads_per_sync < 0.01);
+    }
+}
+
+static cJSON* Command(const char* id, const char* name, const char* method, cJSON* parameters = nullptr) {
+    auto command = cJSON_CreateObject();
+    if (id != nullptr) {
+        cJSON_AddItemToObject(command, "id", cJSON_CreateString(id));
+    }
+    cJSON_AddItemToObject(command, "name", cJSON_CreateString(name));
+    cJSON_AddItemToObject(command, "method", cJSON_CreateString(method));
+    if (parameters != nullptr) {
+        cJSON_AddItemToObject(command, "parameters", parameters);
+    }
+    return command;
+}
+
+static cJSON* Volume(cJSON* volume) {
+    auto parameters = cJSON_CreateObject();
+    cJSON_AddItemToObject(parameters, "volume", volume);
+    return parameters;
+}
+
+static void TestInvokeResults() {
+    std::mutex mutex;
+    std::map<std::string, InvokeResult> acks;
+    thing_manager.OnCommandAck([&mutex, &acks](const IotCommandAck& ack) {
+        std::lock_guard<std::mutex> lock(mutex);
+        acks[ack.id] = ack.result;
+    });
+    auto ack_of = [&mutex, &acks](const char* id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = acks.find(id);
+        return it == acks.end() ? -1 : (int)it->second;
+    };
+
+    // Rejected before anything is queued, the ack is sent right away
+    struct {
+        cJSON* command;
+        InvokeResult result;
+    } rejected[] = {
+        {Command("1", "Fan", "TurnOn"), kInvokeThingNotFound},
+        {Command("2", "Lamp", "Blink"), kInvokeMethodNotFound},
+        {Command("3", "Speaker", "SetVolume"), kInvokeMissingParameter},
+        {Command("4", "Speaker", "SetVolume", Volume(cJSON_CreateString("loud"))), kInvokeInvalidParameter},
+    };
+    for (auto& item : rejected) {
+        CHECK(thing_manager.Invoke(item.command) == item.result);
+        cJSON_Delete(item.command);
+    }
+    for (int i = 0; i < 4; i++) {
+        CHECK(ack_of(std::to_string(i + 1).c_str()) == rejected[i].result);
+    }
+
+    // Without a main loop the worker runs the methods in place
+    auto command = Command("5", "Lamp", "TurnOn");
+    CHECK(thing_manager.Invoke(command) == kInvokeOk);
+    cJSON_Delete(command);
+    command = Command("6", "Speaker", "SetVolume", Volume(cJSON_CreateNumber(33)));
+    CHECK(thing_manager.Invoke(command) == kInvokeOk);
+    cJSON_Delete(command);
+    CHECK(WaitUntil([&]() { return ack_of("6") == kInvokeOk; }, 1000));
+    CHECK(ack_of("5") == kInvokeOk);
+    CHECK(gpio_levels()[GPIO_NUM_18] == 1);
+    CHECK(codec->output_volume() == 33);
+    thing_manager.OnCommandAck(nullptr);
+}
+
+// How a command was dispatched before lookups were hashed: names compared one by one, a miss
+// thrown and caught, the parameters filled into the list the method declared
+struct ThrowingMethodList {
+    struct Entry {
+        std::string name;
+        ParameterList parameters;
+    };
+    std::vector<Entry> methods = {
+        {"TurnOn", ParameterList()},
+        {"TurnOff", ParameterList()},
+        {"SetVolume", ParameterList({Parameter("volume", "", kValueTypeNumber, true)})},
+    };
+
+    Entry& operator[](const std::string& name) {
+        for (auto& method : methods) {
+            if (method.name == name) {
+                return method;
+            }
+        }
+        throw std::runtime_error("Method not found: " + name);
+    }
+
+    bool Prepare(const cJSON* command) {
+        auto method_name = cJSON_GetObjectItem(command, "method");
+        auto input_params = cJSON_GetObjectItem(command, "parameters");
+        try {
+            auto& method = (*this)[method_name->valuestring];
+            for (auto& param : method.parameters) {
+                auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
+                if (param.required() && input_param == nullptr) {
+                    throw std::runtime_error("Parameter " + param.name() + " is required");
+                }
+                param.set_number(input_param->valueint);
+            }
+            return true;
+        } catch (const std::runtime_error& e) {
+            return false;
+        }
+    }
+};
+
+template <typename Prepare>
+static double MeasureLookups(const cJSON* command, Prepare prepare) {
+    int prepared = 0;
+    auto start_time = esp_timer_get_time();
+    for (int i = 0; i < LOOKUPS; i++) {
+        prepared += prepare(command);
+    }
+    double seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    CHECK(prepared == 0 || prepared == LOOKUPS);
+    return seconds * 1000000000 / LOOKUPS;
+}
+
+// Lookup time per command, hashed lookups against scans that throw on a miss, and commands per
+// second from Invoke to the ack through the IoT worker
+static void TestInvokeBenchmark() {
+    auto speaker = thing_manager.FindThing("Speaker");
+    ThrowingMethodList throwing;
+    auto hashed = [speaker](const cJSON* command) {
+        const Method* method = nullptr;
+        ParameterList parameters;
+        return speaker->PrepareInvoke(command, method, parameters) == kInvokeOk;
+    };
+    auto scanned = [&throwing](const cJSON* command) {
+        return throwing.Prepare(command);
+    };
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    auto hit = Command(nullptr, "Speaker", "SetVolume", Volume(cJSON_CreateNumber(50)));
+    auto miss = Command(nullptr, "Speaker", "SetBass");
+    double scanned_hit = MeasureLookups(hit, scanned);
+    double hashed_hit = MeasureLookups(hit, hashed);
+    double scanned_miss = MeasureLookups(miss, scanned);
+    double hashed_miss = MeasureLookups(miss, hashed);
+    cJSON_Delete(hit);
+    cJSON_Delete(miss);
+
+    std::atomic<int> acked{0};
+    int queue_full = 0;
+    thing_manager.OnCommandAck([&acked](const IotCommandAck& ack) {
+        acked++;
+    });
+    auto on = Command("on", "Lamp", "TurnOn");
+    auto off = Command("off", "Lamp", "TurnOff");
+    auto start_time = esp_timer_get_time();
+    for (int i = 0; i < INVOKES; i++) {
+        while (thing_manager.Invoke(i % 2 == 0 ? on : off) == kInvokeQueueFull) {
+            acked--;
+            queue_full++;
+            std::this_thread::yield();
+        }
+    }
+    CHECK(WaitUntil([&]() { return acked == INVOKES; }, 5000));
+    double seconds = (esp_timer_get_time() - start_time) / 1000000.0;
+    cJSON_Delete(on);
+    cJSON_Delete(off);
+    thing_manager.OnCommandAck(nullptr);
+    esp_log_level_set("*", ESP_LOG_INFO);
+
+    printf("SetVolume, scanned:  %6.0f ns per lookup\n", scanned_hit);
+    printf("SetVolume, hashed:   %6.0f ns per lookup\n", hashed_hit);
+    printf("SetBass, thrown:     %6.0f ns per lookup\n", scanned_miss);
+    printf("SetBass, hashed:     %6.0f ns per lookup\n", hashed_miss);
+    printf("Lamp through worker: %6.0f commands per second (%d retried on a full queue)\n",
+        INVOKES / seconds, queue_full);
+    // A miss no longer unwinds the stack
+    CHECK(hashed_miss < scanned_miss / 2);
+    // A hit now pays for the copy of the parameters each call keeps, still far less than one thrown miss
+    CHECK(hashed_hit < scanned_miss / 4);
+    CHECK(gpio_levels()[GPIO_NUM_18] == 0);
+}
+
+int main() {
+    SetUp();
+    RUN_TEST(TestStatesDelta);
+    RUN_TEST(TestStatesBenchmark);
+    RUN_TEST(TestInvokeResults);
+    RUN_TEST(TestInvokeBenchmark);
+    FinishTests();
+}
@@ -0,0 +1,165 @@
+#include "test.h"
+#include "protocols/websocket_protocol.h"
+#include "settings.h"
+
+#include <tls_session_transport.h>
+#include <web_socket.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#define LATENCY_RTT_MS 40
+#define LATENCY_ROUNDS 5
+
+static WebsocketProtocol* protocol;
+
+static void SetUp() {
+    auto& server = WebSocketServer::GetInstance();
+    Settings settings("websocket", true);
+    settings.SetString("url", "wss://127.0.0.1:" + std::to_string(server.port()) + "/xiaozhi/v1/");
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // The kept alive connection is made by Start, so the link is slow from the beginning
+    server.rtt_ms = LATENCY_RTT_MS;
+#endif
+
+    protocol = new WebsocketProtocol();
+    protocol->Start();
+}
+
+// Milliseconds from the start of the connection to the server hello
+static double OpenChannel() {
+    auto start_time = esp_timer_get_time();
+    bool opened = protocol->OpenAudioChannel();
+    double elapsed_ms = (esp_timer_get_time() - start_time) / 1000.0;
+    CHECK(opened);
+    return elapsed_ms;
+}
+
+static void TestOpenChannel() {
+    auto& server = WebSocketServer::GetInstance();
+    OpenChannel();
+    CHECK(protocol->IsAudioChannelOpened());
+    CHECK(protocol->server_sample_rate() == 24000);
+    CHECK(protocol->session_id() == "ws1");
+    auto headers = server.last_headers();
+    CHECK(headers["Authorization"] == "Bearer test-token");
+    CHECK(headers["Device-Id"] == "02:00:00:00:00:01");
+
+    protocol->CloseAudioChannel();
+    CHECK(!protocol->IsAudioChannelOpened());
+}
+
+#if !CONFIG_WEBSOCKET_KEEP_ALIVE
+// Only the first connection to the server does a full handshake
+static void TestSessionResumed() {
+    auto& server = WebSocketServer::GetInstance();
+    TlsSessionTransport::ClearSession();
+    int connections = server.connections();
+    int resumed = server.resumed();
+
+    OpenChannel();
+    protocol->CloseAudioChannel();
+    CHECK(server.connections() == connections + 1);
+    CHECK(server.resumed() == resumed);
+
+    for (int i = 0; i < 3; i++) {
+        OpenChannel();
+        protocol->CloseAudioChannel();
+    }
+    CHECK(server.connections() == connections + 4);
+    CHECK(server.resumed() == resumed + 3);
+}
+
+// A ticket the server no longer accepts costs a full handshake, not a failed connection
+static void TestTicketRejected() {
+    auto& server = WebSocketServer::GetInstance();
+    OpenChannel();
+    protocol->CloseAudioChannel();
+
+    server.RotateTicketKeys();
+    int connections = server.connections();
+    int resumed = server.resumed();
+    OpenChannel();
+    protocol->CloseAudioChannel();
+    CHECK(server.connections() == connections + 1);
+    CHECK(server.resumed() == resumed);
+
+    // The new ticket is used again
+    OpenChannel();
+    protocol->CloseAudioChannel();
+    CHECK(server.resumed() == resumed + 1);
+}
+
+// The main loop asks whether the channel is open while the client is being deleted
+static void TestIsOpenedWhileReplaced() {
+    std::atomic<bool> done{false};
+    std::thread poller([&done]() {
+        while (!done) {
+            protocol->IsAudioChannelOpened();
+        }
+    });
+    for (int i = 0; i < 10; i++) {
+        OpenChannel();
+        protocol->CloseAudioChannel();
+    }
+    done = true;
+    poller.join();
+    CHECK(!protocol->IsAudioChannelOpened());
+}
+#endif
+
+// Connect to hello over a link with LATENCY_RTT_MS of round trip time
+static void TestConnectLatency() {
+    auto& server = WebSocketServer::GetInstance();
+    server.rtt_ms = LATENCY_RTT_MS;
+
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // The connection is made in the background, opening only waits for the hello
+    double hello_ms = 0;
+    for (int i = 0; i < LATENCY_ROUNDS; i++) {
+        hello_ms += OpenChannel();
+        protocol->CloseAudioChannel();
+    }
+    hello_ms /= LATENCY_ROUNDS;
+    printf("RTT %d ms, kept alive connection: %.1f ms to hello\n", LATENCY_RTT_MS, hello_ms);
+    CHECK(hello_ms < LATENCY_RTT_MS * 2);
+#else
+    double full_ms = 0;
+    int resumed = server.resumed();
+    for (int i = 0; i < LATENCY_ROUNDS; i++) {
+        TlsSessionTransport::ClearSession();
+        full_ms += OpenChannel();
+        protocol->CloseAudioChannel();
+    }
+    full_ms /= LATENCY_ROUNDS;
+    CHECK(server.resumed() == resumed);
+
+    double resumed_ms = 0;
+    for (int i = 0; i < LATENCY_ROUNDS; i++) {
+        resumed_ms += OpenChannel();
+        protocol->CloseAudioChannel();
+    }
+    resumed_ms /= LATENCY_ROUNDS;
+    CHECK(server.resumed() == resumed + LATENCY_ROUNDS);
+
+    printf("RTT %d ms, full handshake: %.1f ms to hello, resumed session: %.1f ms to hello\n",
+        LATENCY_RTT_MS, full_ms, resumed_ms);
+    // A resumed handshake saves one of the four round trips
+    CHECK(full_ms - resumed_ms > LATENCY_RTT_MS / 2);
+#endif
+    server.rtt_ms = 0;
+}
+
+int main() {
+    SetUp();
+    RUN_TEST(TestOpenChannel);
+#if !CONFIG_WEBSOCKET_KEEP_ALIVE
+    RUN_TEST(TestSessionResumed);
+    RUN_TEST(TestTicketRejected);
+    RUN_TEST(TestIsOpenedWhileReplaced);
+#endif
+    RUN_TEST(TestConnectLatency);
+    FinishTests();
+}